@@ -0,0 +1,82 @@
+#include "arena.h"
+#include <assert.h>
+#include <string.h>
+
+void Arena_init(Arena *a, void *buf, uint32_t cap) {
+  a->base = buf;
+  a->cap = cap;
+  a->len = 0;
+  a->high_water = 0;
+}
+
+// 8 byte aligned, the buffer has to be too
+void *Arena_alloc(Arena *a, uint32_t size) {
+  uint32_t start = (a->len + 7) & ~7u;
+  assert(start <= a->cap && size <= a->cap - start);
+  a->len = start + size;
+  a->high_water = MAX(a->high_water, a->len);
+  return &a->base[start];
+}
+
+void *Arena_alloc_zero(Arena *a, uint32_t size) {
+  void *ptr = Arena_alloc(a, size);
+  memset(ptr, 0, size);
+  return ptr;
+}
+
+ArenaMark Arena_mark(const Arena *a) {
+  return a->len;
+}
+
+void Arena_release(Arena *a, ArenaMark mark) {
+  assert(mark <= a->len);
+  a->len = mark;
+}
+
+Bitset Bitset_new(Arena *a, uint16_t len) {
+  uint32_t words = (len + 63) / 64;
+  return (Bitset){ Arena_alloc_zero(a, words * sizeof(uint64_t)), len };
+}
+
+bool Bitset_get(const Bitset *b, NodeId id) {
+  assert(id < b->len);
+  return b->word_arr[id / 64] >> (id % 64) & 1;
+}
+
+void Bitset_set(Bitset *b, NodeId id) {
+  assert(id < b->len);
+  b->word_arr[id / 64] |= (uint64_t)1 << (id % 64);
+}
+
+void Bitset_clear(Bitset *b, NodeId id) {
+  assert(id < b->len);
+  b->word_arr[id / 64] &= ~((uint64_t)1 << (id % 64));
+}
+
+bool Bitset_test_and_set(Bitset *b, NodeId id) {
+  bool was = Bitset_get(b, id);
+  Bitset_set(b, id);
+  return was;
+}
+
+Worklist Worklist_new(Arena *a, uint16_t node_len) {
+  return (Worklist){
+    .node_arr = Arena_alloc(a, node_len * sizeof(NodeId)),
+    .on = Bitset_new(a, node_len),
+    .len = 0,
+    .cap = node_len,
+  };
+}
+
+void Worklist_push(Worklist *w, NodeId id) {
+  if (Bitset_test_and_set(&w->on, id)) return;
+  assert(w->len < w->cap);
+  w->node_arr[w->len++] = id;
+}
+
+NodeId Worklist_pop(Worklist *w) {
+  assert(w->len);
+  NodeId id = w->node_arr[--w->len];
+  Bitset_clear(&w->on, id);
+  return id;
+}
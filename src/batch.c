@@ -0,0 +1,132 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "parser.h"
+
+typedef struct {
+  const char *filename;
+  // What the compile printed, emitted in input order
+  char *out;
+  size_t out_len;
+  char *err;
+  size_t err_len;
+  bool failed;
+  bool done;
+} CompileJob;
+
+// Reused for every job of one worker
+typedef struct {
+  Parser *p;
+  Token *tokens;
+  Diagnostics *diag;
+} BatchWorker;
+
+typedef struct {
+  CompileJob *job_arr;
+  BatchWorker *worker_arr;
+  pthread_mutex_t done_lock;
+  pthread_cond_t done_cond;
+} Batch;
+
+void compile_job(BatchWorker *w, CompileJob *job, uint32_t job_index) {
+  FILE *out = open_memstream(&job->out, &job->out_len);
+  FILE *err = open_memstream(&job->err, &job->err_len);
+  assert(out && err);
+  Diagnostics_reset(w->diag);
+
+  SourceFile file;
+  if (!load_source(job->filename, &file)) {
+    Diagnostics_error_message(w->diag, "Failed to read input file "
+      ANSI_BLUE "%s" ANSI_RESET ": %s", job->filename, strerror(errno));
+    Diagnostics_print(err, w->diag, NULL);
+    job->failed = true;
+    fclose(out);
+    fclose(err);
+    return;
+  }
+
+  tokenize(file.ptr, file.len, w->tokens, w->diag);
+  Parser_reset(w->p);
+  Parser_init(w->p, file.ptr, w->tokens, w->diag);
+  w->p->out = out;
+  snprintf(w->p->filename_buffer, sizeof(w->p->filename_buffer),
+    "out/graph-%u.dot", job_index);
+  w->p->graph_filename = w->p->filename_buffer;
+  Parser_parse_top_level(w->p);
+  graphviz_wait();
+
+  if (w->diag->error_count) {
+    LineIndex lines;
+    LineIndex_build(&lines, file.ptr, file.len);
+    fprintf(err, ANSI_BOLD "%s" ANSI_RESET ":\n", job->filename);
+    Diagnostics_print(err, w->diag, &lines);
+    fprintf(err, "\n%d errors\n", w->diag->error_count);
+    LineIndex_free(&lines);
+    job->failed = true;
+  }
+  unload_source(&file);
+  fclose(out);
+  fclose(err);
+}
+
+void Batch_run_job(void *ctx, uint32_t job, uint32_t worker) {
+  Batch *b = ctx;
+  compile_job(&b->worker_arr[worker], &b->job_arr[job], job);
+  pthread_mutex_lock(&b->done_lock);
+  b->job_arr[job].done = true;
+  pthread_cond_broadcast(&b->done_cond);
+  pthread_mutex_unlock(&b->done_lock);
+}
+
+// Compiles every file on `thread_count` threads, output
+// comes out in the order of the inputs. Returns the number of
+// files that failed to compile
+uint32_t compile_batch(const char **filename_arr, uint32_t file_count, uint32_t thread_count) {
+  uint32_t worker_count = Pool_worker_count(file_count, thread_count);
+  Batch b = {
+    .job_arr = calloc(file_count, sizeof(CompileJob)),
+    .worker_arr = calloc(worker_count, sizeof(BatchWorker)),
+  };
+  assert(b.job_arr && b.worker_arr);
+  pthread_mutex_init(&b.done_lock, NULL);
+  pthread_cond_init(&b.done_cond, NULL);
+  for (uint32_t i = 0; i < file_count; ++i) b.job_arr[i].filename = filename_arr[i];
+  for (uint32_t i = 0; i < worker_count; ++i) {
+    BatchWorker *w = &b.worker_arr[i];
+    w->p = calloc(1, sizeof(*w->p));
+    w->tokens = malloc(sizeof(*w->tokens) * MAX_TOKENS);
+    w->diag = malloc(sizeof(*w->diag));
+    assert(w->p && w->tokens && w->diag);
+  }
+  Pool *pool = Pool_start(file_count, worker_count, Batch_run_job, &b);
+
+  // Stream the results out as soon as the next one in order is done
+  uint32_t failed = 0;
+  for (uint32_t i = 0; i < file_count; ++i) {
+    CompileJob *job = &b.job_arr[i];
+    pthread_mutex_lock(&b.done_lock);
+    while (!job->done) pthread_cond_wait(&b.done_cond, &b.done_lock);
+    pthread_mutex_unlock(&b.done_lock);
+    fwrite(job->out, 1, job->out_len, stdout);
+    fwrite(job->err, 1, job->err_len, stderr);
+    free(job->out);
+    free(job->err);
+    if (job->failed) failed++;
+  }
+
+  Pool_join(pool);
+  for (uint32_t i = 0; i < worker_count; ++i) {
+    BatchWorker *w = &b.worker_arr[i];
+    Parser_free(w->p);
+    free(w->p);
+    free(w->tokens);
+    free(w->diag);
+  }
+  pthread_mutex_destroy(&b.done_lock);
+  pthread_cond_destroy(&b.done_cond);
+  free(b.worker_arr);
+  free(b.job_arr);
+  return failed;
+}
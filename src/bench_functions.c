@@ -0,0 +1,109 @@
+// Optimization time of a generated module of many small
+// functions, on one thread and on more. Parsing is not timed,
+// every run optimizes freshly parsed graphs.
+//
+// usage: bench_functions [runs] [max threads]
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "son.c"
+
+#define DEFAULT_RUNS 200
+// As many as fit in MAX_TOKENS
+#define BENCH_FUNCTIONS 150
+
+double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int compare_double(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+// Every function has a loop with invariants to hoist
+char *module_source(void) {
+  char *buf;
+  size_t len;
+  FILE *fp = open_memstream(&buf, &len);
+  assert(fp);
+  for (int i = 0; i < BENCH_FUNCTIONS; ++i) {
+    fprintf(fp,
+      "int f%d(int n, int m) {\n"
+      "  int s = %d;\n"
+      "  while (s < n) { s = s + n * m - %d; }\n"
+      "  return s;\n"
+      "}\n", i, i, i);
+  }
+  fprintf(fp, "return 0;\n");
+  fclose(fp);
+  return buf;
+}
+
+void parse_module(Parser *p, const char *source, const Token *tokens, Diagnostics *diag) {
+  Parser_reset(p);
+  Parser_init(p, source, tokens, diag);
+  Parser_open_top_level(p);
+  while (p->token_arr[p->pos].tag != TOK_NONE) Parser_parse_statement_or_recover(p);
+  Parser_close_top_level(p);
+}
+
+// Median of `runs`
+double optimize_ns(Parser *p, const char *source, const Token *tokens,
+    Diagnostics *diag, uint32_t threads, int runs) {
+  double *ns = malloc(runs * sizeof(double));
+  assert(ns);
+  OPTIMIZE_THREADS = threads;
+  for (int i = 0; i < runs; ++i) {
+    parse_module(p, source, tokens, diag);
+    double start = now_ns();
+    Parser_optimize_all(p);
+    ns[i] = now_ns() - start;
+  }
+  qsort(ns, runs, sizeof(double), compare_double);
+  double median = ns[runs / 2];
+  free(ns);
+  return median;
+}
+
+int main(int argc, char *argv[]) {
+  int runs = argc > 1 ? atoi(argv[1]) : DEFAULT_RUNS;
+  uint32_t max_threads = argc > 2 ? atoi(argv[2]) : 0;
+  if (runs < 1) runs = 1;
+  if (!max_threads) max_threads = MAX(sysconf(_SC_NPROCESSORS_ONLN), 1);
+
+  char *source = module_source();
+  Token *tokens = malloc(sizeof(*tokens) * MAX_TOKENS);
+  Diagnostics *diag = calloc(1, sizeof(*diag));
+  Parser *p = calloc(1, sizeof(*p));
+  assert(tokens && diag && p);
+  tokenize(source, strlen(source), tokens, diag);
+  parse_module(p, source, tokens, diag);
+  if (diag->error_count) {
+    LineIndex lines;
+    LineIndex_build(&lines, source, strlen(source));
+    Diagnostics_print(stderr, diag, &lines);
+    exit(1);
+  }
+
+  printf("%u functions, %u cpus\n", p->function_len, (unsigned)sysconf(_SC_NPROCESSORS_ONLN));
+  printf("%8s %12s %8s\n", "threads", "us/optimize", "speedup");
+  double base = 0;
+  for (uint32_t threads = 1; threads <= max_threads; threads *= 2) {
+    double ns = optimize_ns(p, source, tokens, diag, threads, runs);
+    if (threads == 1) base = ns;
+    printf("%8u %12.1f %7.2fx\n", threads, ns / 1e3, base / ns);
+  }
+  Parser_free(p);
+  free(p);
+  free(diag);
+  free(tokens);
+  free(source);
+  return 0;
+}
@@ -0,0 +1,121 @@
+// Cold vs warm page cache load times of the input layer.
+// Cold runs drop the file from the page cache with
+// POSIX_FADV_DONTNEED first, so no root is needed.
+//
+// usage: bench_input [file] [runs]
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "error_reporting.c"
+#include "fs.c"
+
+#define DEFAULT_RUNS 15
+#define GENERATED_SIZE (32 * 1024 * 1024)
+const char *GENERATED_FILENAME = "out/bench_input.son";
+
+double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+int compare_double(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+void generate_source(const char *filename) {
+  FILE *fp = fopen(filename, "w");
+  if (fp == NULL) {
+    print_error_message("Failed to create '%s': %s", filename, strerror(errno));
+    exit(1);
+  }
+  const char *line = "int value = (12 + 34) * 56; // some comment\n";
+  size_t line_len = strlen(line);
+  for (size_t written = 0; written < GENERATED_SIZE; written += line_len) fputs(line, fp);
+  fflush(fp);
+  fsync(fileno(fp));
+  fclose(fp);
+}
+
+void drop_page_cache(const char *filename) {
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) return;
+  posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  close(fd);
+}
+
+// Reads every page so lazily mapped files pay for their faults
+uint64_t touch_source(const SourceFile *file) {
+  uint64_t sum = 0;
+  for (uint32_t i = 0; i < file->len; i += 4096) sum += (uint8_t)file->ptr[i];
+  return sum;
+}
+
+typedef enum {
+  LOAD_INPUT_LAYER,
+  LOAD_READ,
+} LoadMode;
+
+double time_load(const char *filename, LoadMode mode, bool cold, uint64_t *sink) {
+  if (cold) drop_page_cache(filename);
+  double start = now_ms();
+  SourceFile file;
+  bool ok;
+  if (mode == LOAD_INPUT_LAYER) {
+    ok = load_source(filename, &file);
+  } else {
+    int fd = open(filename, O_RDONLY);
+    ok = fd >= 0 && read_whole_fd(fd, &file);
+    if (fd >= 0) close(fd);
+  }
+  if (!ok) {
+    print_error_message("Failed to load '%s': %s", filename, strerror(errno));
+    exit(1);
+  }
+  *sink += touch_source(&file);
+  unload_source(&file);
+  return now_ms() - start;
+}
+
+void report(const char *name, const char *filename, LoadMode mode, bool cold,
+    int runs, uint32_t size) {
+  double times[runs];
+  uint64_t sink = 0;
+  for (int i = 0; i < runs; ++i) times[i] = time_load(filename, mode, cold, &sink);
+  qsort(times, runs, sizeof(*times), compare_double);
+  double median = times[runs / 2];
+  printf("%-22s min %8.3f ms  median %8.3f ms  %8.1f MB/s  (%lu)\n",
+    name, times[0], median, size / 1e6 / (median / 1e3), (unsigned long)(sink & 0xff));
+}
+
+int main(int argc, char *argv[]) {
+  const char *filename = argc > 1 ? argv[1] : NULL;
+  int runs = argc > 2 ? atoi(argv[2]) : DEFAULT_RUNS;
+  if (runs < 1) runs = 1;
+  if (filename == NULL) {
+    filename = GENERATED_FILENAME;
+    generate_source(filename);
+  }
+
+  SourceFile file;
+  if (!load_source(filename, &file)) {
+    print_error_message("Failed to load '%s': %s", filename, strerror(errno));
+    exit(1);
+  }
+  uint32_t size = file.len;
+  unload_source(&file);
+  printf("%s: %u bytes, %d runs\n", filename, size, runs);
+
+  report("cold load_source", filename, LOAD_INPUT_LAYER, true, runs, size);
+  report("cold read()", filename, LOAD_READ, true, runs, size);
+  report("warm load_source", filename, LOAD_INPUT_LAYER, false, runs, size);
+  report("warm read()", filename, LOAD_READ, false, runs, size);
+  return 0;
+}
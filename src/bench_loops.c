@@ -0,0 +1,122 @@
+// Hot loops run by the graph evaluator, once as written and
+// once after loop invariant code motion. The evaluator caches
+// a node until the loop it's in goes around again, so the
+// work saved is the computations hoisted out of the body.
+//
+// usage: bench_loops [runs]
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "son.c"
+
+#define DEFAULT_RUNS 20
+#define BENCH_FUEL 100000000
+
+typedef struct {
+  const char *name;
+  const char *source;
+  // Read by `arg`, so `n` isn't folded to a constant
+  int64_t arg;
+} Kernel;
+
+const Kernel KERNELS[] = {
+  { "invariant",
+    "int n = arg;\n"
+    "int i = 0;\n"
+    "int s = 0;\n"
+    "while (i < 100000) {\n"
+    "  s = s + i * ((n * n + n * 3) / (n - 2) - (n * 5 + 1) / (n + 1) * n);\n"
+    "  i = i + 1;\n"
+    "}\n"
+    "return s;\n", 7 },
+  { "nested",
+    "int n = arg;\n"
+    "int i = 0;\n"
+    "int s = 0;\n"
+    "while (i < 300) {\n"
+    "  int j = 0;\n"
+    "  while (j < 300) {\n"
+    "    s = s + j * (i * n + (n * n - 1) / 3 - i / (n + 2));\n"
+    "    j = j + 1;\n"
+    "  }\n"
+    "  i = i + 1;\n"
+    "}\n"
+    "return s;\n", 5 },
+  // Nothing to hoist, the two should match
+  { "variant",
+    "int i = 0;\n"
+    "int s = 1;\n"
+    "while (i < 100000) {\n"
+    "  s = s * 3 + i / 7 - s / 5;\n"
+    "  i = i + 1;\n"
+    "}\n"
+    "return s;\n", 0 },
+};
+
+double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+typedef struct {
+  double ns;
+  uint64_t computed;
+  int64_t result;
+} LoopRun;
+
+LoopRun run_kernel(SonContext *ctx, Eval *e, const Kernel *k, bool hoist, int runs) {
+  HOIST_INVARIANTS = hoist;
+  if (son_compile(ctx, k->source, strlen(k->source))) {
+    son_print_diagnostics(ctx, stderr);
+    exit(1);
+  }
+  const Parser *p = SonGraph_parser(son_graph(ctx));
+  LoopRun run = { .ns = 1e18 };
+  // Fastest run, the others only add scheduling noise
+  for (int i = 0; i < runs; ++i) {
+    double start = now_ns();
+    if (Parser_eval(p, e, BENCH_FUEL, k->arg, &run.result) != EVAL_OK) {
+      print_error_message("Kernel %s failed to run", k->name);
+      exit(1);
+    }
+    run.ns = MIN(run.ns, now_ns() - start);
+  }
+  run.computed = e->computed;
+  return run;
+}
+
+int main(int argc, char *argv[]) {
+  int runs = argc > 1 ? atoi(argv[1]) : DEFAULT_RUNS;
+  if (runs < 1) runs = 1;
+  SonContext *ctx = son_context_new();
+  Eval *e = malloc(sizeof(*e));
+  assert(ctx && e);
+  // Debug prints of the compiler would drown the table
+  FILE *null = fopen("/dev/null", "w");
+  assert(null);
+  son_context_set_output(ctx, null);
+
+  printf("%-10s %14s %14s %12s %12s %8s\n",
+    "kernel", "evals before", "evals after", "us before", "us after", "speedup");
+  for (size_t i = 0; i < sizeof(KERNELS) / sizeof(KERNELS[0]); ++i) {
+    const Kernel *k = &KERNELS[i];
+    LoopRun before = run_kernel(ctx, e, k, false, runs);
+    LoopRun after = run_kernel(ctx, e, k, true, runs);
+    if (before.result != after.result) {
+      print_error_message("Kernel %s returned %lld before hoisting and %lld after",
+        k->name, (long long)before.result, (long long)after.result);
+      exit(1);
+    }
+    printf("%-10s %14llu %14llu %12.1f %12.1f %7.2fx\n", k->name,
+      (unsigned long long)before.computed, (unsigned long long)after.computed,
+      before.ns / 1e3, after.ns / 1e3, before.ns / after.ns);
+  }
+  free(e);
+  son_context_free(ctx);
+  fclose(null);
+  return 0;
+}
@@ -0,0 +1,372 @@
+// Cost of the IR primitives the parser hammers, one at a time.
+// Every sample builds its input untimed, then times the operation
+// on it. Reported per operation: the median and the median
+// absolute deviation over the samples, and the median in ticks.
+// A tick is a TSC cycle on x86, a nanosecond elsewhere.
+//
+// Given a baseline, which is an earlier output of this, every
+// row is compared against it and slower ones get flagged.
+//
+// usage: bench_micro [samples] [baseline]
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "son.c"
+
+#define DEFAULT_SAMPLES 101
+#define WARMUP_SAMPLES 10
+// Slower than the baseline by this much and by more
+// than three deviations is worth a look
+#define REGRESSION_RATIO 1.10
+
+double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+uint64_t now_ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return now_ns();
+#endif
+}
+
+int compare_double(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+// Sorts `arr`
+double median(double *arr, int len) {
+  qsort(arr, len, sizeof(double), compare_double);
+  return arr[len / 2];
+}
+
+typedef struct {
+  Parser *p;
+  Diagnostics *diag;
+  Token *tokens;
+  // Names of the vars, or the text to tokenize
+  char *source;
+  uint32_t source_len;
+  NodeId used;
+  uint32_t count;
+  // Writes to /dev/null, for the traced rows
+  Trace *trace;
+  // Checkpoint the undo rows close
+  UndoMark mark;
+} Bench;
+
+typedef struct {
+  const char *name;
+  uint32_t arg;
+  // Untimed, builds what `run` works on
+  void (*setup)(Bench *b, uint32_t arg);
+  // Returns how many operations it did
+  uint32_t (*run)(Bench *b, uint32_t arg);
+} MicroBench;
+
+// Parser with the vars `v0`, `v1`, ... in `depth` nested scopes,
+// one var each, all bound to the same constant
+void setup_scopes(Bench *b, uint32_t depth) {
+  Parser_init(b->p, b->source, b->tokens, b->diag);
+  b->used = Parser_create_constant(b->p, 1);
+  uint32_t start = 0;
+  for (uint32_t i = 0; i < depth; ++i) {
+    Parser_push_scope(b->p);
+    uint16_t len = strchr(&b->source[start], ' ') - &b->source[start];
+    Parser_push_var(b->p, start, len, b->used);
+    start += len + 1;
+  }
+}
+
+void setup_empty(Bench *b, uint32_t arg) {
+  (void)arg;
+  Parser_init(b->p, b->source, b->tokens, b->diag);
+}
+
+// Edits recorded, flushes to the file included
+void setup_traced(Bench *b, uint32_t arg) {
+  setup_empty(b, arg);
+  b->p->trace = b->trace;
+}
+
+uint32_t run_create_node(Bench *b, uint32_t arg) {
+  (void)arg;
+  uint32_t count = 0;
+  while (b->p->node_len < MAX_NODES) {
+    Parser_create_node(b->p, (Node){ .tag = NODE_CONSTANT, .type = TYPE_INT, .value.i64 = count++ });
+  }
+  return count;
+}
+
+void setup_add_output(Bench *b, uint32_t arg) {
+  setup_empty(b, arg);
+  b->used = Parser_create_constant(b->p, 1);
+}
+
+void setup_add_output_traced(Bench *b, uint32_t arg) {
+  setup_add_output(b, arg);
+  b->p->trace = b->trace;
+}
+
+uint32_t run_add_output(Bench *b, uint32_t arg) {
+  (void)arg;
+  uint32_t count = 0;
+  while (b->p->link_len < MAX_LINKS) {
+    Parser_add_node_output(b->p, START_NODE, b->used);
+    count++;
+  }
+  return count;
+}
+
+// Edits logged for a checkpoint, committed at the end
+void setup_add_output_undo(Bench *b, uint32_t arg) {
+  setup_add_output(b, arg);
+  b->mark = Parser_checkpoint(b->p);
+}
+
+uint32_t run_add_output_undo(Bench *b, uint32_t arg) {
+  uint32_t count = run_add_output(b, arg);
+  Parser_commit(b->p, b->mark);
+  return count;
+}
+
+// As many edits as there are links, taken back per edit
+void setup_rollback(Bench *b, uint32_t arg) {
+  setup_add_output_undo(b, arg);
+  b->count = run_add_output(b, arg);
+}
+
+uint32_t run_rollback(Bench *b, uint32_t arg) {
+  (void)arg;
+  Parser_rollback(b->p, b->mark);
+  return b->count;
+}
+
+// One node used by `arg` others
+void setup_remove_output(Bench *b, uint32_t arg) {
+  setup_add_output(b, arg);
+  for (uint32_t i = 0; i < arg; ++i) {
+    NodeId user = Parser_create_constant(b->p, i);
+    Parser_add_node_output(b->p, user, b->used);
+  }
+}
+
+// Oldest user first, it's at the end of the list
+uint32_t run_remove_output(Bench *b, uint32_t arg) {
+  NodeId first = b->used + 1;
+  for (uint32_t i = 0; i < arg; ++i) Parser_remove_output_node(b->p, first + i, b->used);
+  return arg;
+}
+
+#define RESOLVE_COUNT 1000
+
+// The outermost var, every scope gets walked
+uint32_t run_resolve_var(Bench *b, uint32_t arg) {
+  (void)arg;
+  uint16_t len = strchr(b->source, ' ') - b->source;
+  for (uint32_t i = 0; i < RESOLVE_COUNT; ++i) Parser_resolve_var(b->p, 0, len);
+  return RESOLVE_COUNT;
+}
+
+// The vars copied up, as an `if` does
+void setup_duplicate(Bench *b, uint32_t arg) {
+  setup_scopes(b, arg);
+  Parser *p = b->p;
+  memcpy(&p->var_arr[p->var_len], p->var_arr, p->var_len * sizeof(Var));
+  p->var_len *= 2;
+}
+
+// As many copies as there are nodes for
+uint32_t run_duplicate(Bench *b, uint32_t arg) {
+  uint32_t count = 0;
+  while (b->p->node_len + arg <= MAX_NODES) {
+    Parser_duplicate_scopes(b->p, arg);
+    count++;
+  }
+  return count;
+}
+
+typedef enum {
+  CLASS_IDENT,
+  CLASS_DECIMAL,
+  CLASS_KEYWORD,
+  CLASS_PUNCT,
+} TokenClass;
+
+// As many tokens of one class as fit, apart by a space
+void setup_tokenize(Bench *b, uint32_t arg) {
+  static const char *const PUNCT[] = {
+    ";", ",", "+", "-", "*", "/", "{", "}", "=", "(", ")", "!", "<", ">", "==", "!=", "<=", ">=",
+  };
+  free(b->source);
+  size_t len;
+  FILE *fp = open_memstream(&b->source, &len);
+  assert(fp);
+  for (uint32_t i = 0; i < MAX_TOKENS - 1; ++i) {
+    switch ((TokenClass)arg) {
+      case CLASS_IDENT: fprintf(fp, "name_%u ", i); break;
+      case CLASS_DECIMAL: fprintf(fp, "%u ", i * 7919); break;
+      case CLASS_KEYWORD: fprintf(fp, "%s ", TOK_NAMES[KEYWORDS_START + i % KEYWORDS_COUNT]); break;
+      case CLASS_PUNCT: fprintf(fp, "%s ", PUNCT[i % (sizeof(PUNCT) / sizeof(*PUNCT))]); break;
+    }
+  }
+  fclose(fp);
+  b->source_len = len;
+  b->count = MAX_TOKENS - 1;
+  Diagnostics_reset(b->diag);
+}
+
+uint32_t run_tokenize(Bench *b, uint32_t arg) {
+  (void)arg;
+  tokenize(b->source, b->source_len, b->tokens, b->diag);
+  assert(!b->diag->error_count);
+  return b->count;
+}
+
+// Var names of the scope benches
+void setup_names(Bench *b) {
+  free(b->source);
+  size_t len;
+  FILE *fp = open_memstream(&b->source, &len);
+  assert(fp);
+  for (uint32_t i = 0; i < MAX_VAR_DEPTH; ++i) fprintf(fp, "v%u ", i);
+  fclose(fp);
+  b->source_len = len;
+}
+
+// Scope nodes and vars of the deepest runs stay under MAX_NODES
+// and MAX_VAR_DEPTH, copies take as many nodes again
+const MicroBench BENCHES[] = {
+  { "create_node", 0, setup_empty, run_create_node },
+  { "add_node_output", 0, setup_add_output, run_add_output },
+  { "create_node/traced", 0, setup_traced, run_create_node },
+  { "add_node_output/traced", 0, setup_add_output_traced, run_add_output },
+  { "add_node_output/undo", 0, setup_add_output_undo, run_add_output_undo },
+  { "rollback", 0, setup_rollback, run_rollback },
+  { "remove_output_node/8", 8, setup_remove_output, run_remove_output },
+  { "remove_output_node/64", 64, setup_remove_output, run_remove_output },
+  { "remove_output_node/240", 240, setup_remove_output, run_remove_output },
+  { "resolve_var/1", 1, setup_scopes, run_resolve_var },
+  { "resolve_var/16", 16, setup_scopes, run_resolve_var },
+  { "resolve_var/64", 64, setup_scopes, run_resolve_var },
+  { "resolve_var/200", 200, setup_scopes, run_resolve_var },
+  { "duplicate_scopes/1", 1, setup_duplicate, run_duplicate },
+  { "duplicate_scopes/16", 16, setup_duplicate, run_duplicate },
+  { "duplicate_scopes/64", 64, setup_duplicate, run_duplicate },
+  { "duplicate_scopes/120", 120, setup_duplicate, run_duplicate },
+  { "tokenize/ident", CLASS_IDENT, setup_tokenize, run_tokenize },
+  { "tokenize/decimal", CLASS_DECIMAL, setup_tokenize, run_tokenize },
+  { "tokenize/keyword", CLASS_KEYWORD, setup_tokenize, run_tokenize },
+  { "tokenize/punct", CLASS_PUNCT, setup_tokenize, run_tokenize },
+};
+#define BENCH_COUNT (sizeof(BENCHES) / sizeof(*BENCHES))
+
+typedef struct {
+  double ns;
+  double mad;
+  double ticks;
+} BenchResult;
+
+BenchResult run_bench(Bench *b, const MicroBench *m, int samples) {
+  double *ns = malloc(samples * sizeof(double));
+  double *ticks = malloc(samples * sizeof(double));
+  assert(ns && ticks);
+  for (int i = -WARMUP_SAMPLES; i < samples; ++i) {
+    m->setup(b, m->arg);
+    double start = now_ns();
+    uint64_t start_ticks = now_ticks();
+    uint32_t ops = m->run(b, m->arg);
+    uint64_t end_ticks = now_ticks();
+    double end = now_ns();
+    if (i < 0) continue;
+    ns[i] = (end - start) / ops;
+    ticks[i] = (double)(end_ticks - start_ticks) / ops;
+  }
+  BenchResult r = { .ns = median(ns, samples), .ticks = median(ticks, samples) };
+  for (int i = 0; i < samples; ++i) ns[i] = ns[i] > r.ns ? ns[i] - r.ns : r.ns - ns[i];
+  r.mad = median(ns, samples);
+  free(ns);
+  free(ticks);
+  return r;
+}
+
+// Rows of an earlier run, the header doesn't parse
+typedef struct {
+  char name[64];
+  double ns;
+} BaselineRow;
+
+uint32_t read_baseline(const char *filename, BaselineRow *row_arr, uint32_t cap) {
+  FILE *fp = fopen(filename, "r");
+  if (!fp) {
+    print_error_message("Failed to open baseline %s", filename);
+    exit(1);
+  }
+  char line[256];
+  uint32_t len = 0;
+  while (len < cap && fgets(line, sizeof(line), fp)) {
+    if (sscanf(line, "%63s %lf", row_arr[len].name, &row_arr[len].ns) == 2) len++;
+  }
+  fclose(fp);
+  return len;
+}
+
+int main(int argc, char *argv[]) {
+  int samples = argc > 1 ? atoi(argv[1]) : DEFAULT_SAMPLES;
+  const char *baseline = argc > 2 ? argv[2] : NULL;
+  if (samples < 1) samples = 1;
+
+  BaselineRow base_arr[BENCH_COUNT];
+  uint32_t base_len = baseline ? read_baseline(baseline, base_arr, BENCH_COUNT) : 0;
+
+  Bench b = {
+    .p = calloc(1, sizeof(Parser)),
+    .diag = calloc(1, sizeof(Diagnostics)),
+    .tokens = malloc(MAX_TOKENS * sizeof(Token)),
+  };
+  FILE *null = Trace_open("/dev/null");
+  assert(b.p && b.diag && b.tokens && null);
+  b.trace = Trace_new(null, 0);
+
+  printf("%-24s %10s %10s %10s", "benchmark", "ns/op", "mad", "ticks/op");
+  if (baseline) printf(" %10s %8s", "baseline", "change");
+  printf("\n");
+  uint32_t slower = 0;
+  for (uint32_t i = 0; i < BENCH_COUNT; ++i) {
+    const MicroBench *m = &BENCHES[i];
+    if (m->setup != setup_tokenize) setup_names(&b);
+    BenchResult r = run_bench(&b, m, samples);
+    printf("%-24s %10.2f %10.2f %10.1f", m->name, r.ns, r.mad, r.ticks);
+    for (uint32_t j = 0; j < base_len; ++j) {
+      if (strcmp(base_arr[j].name, m->name)) continue;
+      double base = base_arr[j].ns;
+      bool regressed = r.ns > base * REGRESSION_RATIO && r.ns - base > 3 * r.mad;
+      printf(" %10.2f %+7.1f%%%s", base, (r.ns / base - 1) * 100, regressed ? " slower" : "");
+      slower += regressed;
+      break;
+    }
+    printf("\n");
+  }
+  if (baseline) printf("%u slower than %s\n", slower, baseline);
+
+  // The parser only borrows it
+  b.p->trace = NULL;
+  Parser_free(b.p);
+  Trace_free(b.trace);
+  fclose(null);
+  free(b.p);
+  free(b.diag);
+  free(b.tokens);
+  free(b.source);
+  return 0;
+}
@@ -0,0 +1,179 @@
+// Stack usage and compile time on pathological nesting depths.
+// Every compile runs on a thread with a painted stack, the
+// deepest byte that got overwritten is the stack high water.
+//
+// usage: bench_nesting [runs]
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "son.c"
+
+#define DEFAULT_RUNS 20000
+#define BENCH_STACK_SIZE (1024 * 1024)
+#define STACK_PAINT 0xa5
+
+typedef struct {
+  SonContext *ctx;
+  const char *source;
+  uint32_t len;
+  uint32_t errors;
+} BenchCompile;
+
+double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+void *bench_compile(void *arg) {
+  BenchCompile *c = arg;
+  c->errors = son_compile(c->ctx, c->source, c->len);
+  return NULL;
+}
+
+void *bench_idle(void *arg) {
+  return arg;
+}
+
+// Stack bytes the thread touched, thread local
+// storage lives on the same mapping
+size_t run_on_painted_stack(void *(*fn)(void *), void *arg) {
+  char *stack;
+  if (posix_memalign((void **)&stack, 4096, BENCH_STACK_SIZE)) {
+    print_error_message("Failed to allocate the compile stack");
+    exit(1);
+  }
+  memset(stack, STACK_PAINT, BENCH_STACK_SIZE);
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setstack(&attr, stack, BENCH_STACK_SIZE);
+  pthread_t thread;
+  if (pthread_create(&thread, &attr, fn, arg)) {
+    print_error_message("Failed to start the compile thread");
+    exit(1);
+  }
+  pthread_join(thread, NULL);
+  pthread_attr_destroy(&attr);
+  // The stack grows down
+  size_t untouched = 0;
+  while (untouched < BENCH_STACK_SIZE && (uint8_t)stack[untouched] == STACK_PAINT) untouched++;
+  free(stack);
+  return BENCH_STACK_SIZE - untouched;
+}
+
+// Stack bytes one compile of `source` takes on top of an idle thread
+size_t stack_high_water(SonContext *ctx, const char *source) {
+  static size_t idle = 0;
+  if (!idle) idle = run_on_painted_stack(bench_idle, NULL);
+  BenchCompile c = { ctx, source, strlen(source), 0 };
+  size_t used = run_on_painted_stack(bench_compile, &c);
+  if (c.errors) {
+    son_print_diagnostics(ctx, stderr);
+    exit(1);
+  }
+  return used - idle;
+}
+
+double compile_ns(SonContext *ctx, const char *source, int runs) {
+  uint32_t len = strlen(source);
+  double start = now_ns();
+  for (int i = 0; i < runs; ++i) son_compile(ctx, source, len);
+  return (now_ns() - start) / runs;
+}
+
+typedef enum {
+  NEST_PARENS,
+  NEST_UNARY,
+  NEST_BLOCKS,
+  NEST_IFS,
+} NestKind;
+
+const char *NEST_NAME[] = {
+  [NEST_PARENS] = "parens",
+  [NEST_UNARY] = "unary",
+  [NEST_BLOCKS] = "blocks",
+  [NEST_IFS] = "ifs",
+};
+
+// Deepest input the parser takes. Expressions nest as deep
+// as MAX_TOKENS goes, every block adds a scope node though
+// and every nested `if` copies the whole scope chain,
+// MAX_NODES runs out first there
+const uint32_t NEST_MAX_DEPTH[] = {
+  [NEST_PARENS] = (MAX_TOKENS - 16) / 2,
+  [NEST_UNARY] = MAX_TOKENS - 16,
+  [NEST_BLOCKS] = MAX_NODES - 16,
+  [NEST_IFS] = 16,
+};
+
+char *nested_source(NestKind kind, uint32_t depth) {
+  char *buf;
+  size_t len;
+  FILE *fp = open_memstream(&buf, &len);
+  assert(fp);
+  fprintf(fp, "int a = 1;\n");
+  switch (kind) {
+    case NEST_PARENS:
+      fprintf(fp, "return ");
+      for (uint32_t i = 0; i < depth; ++i) fputc('(', fp);
+      fprintf(fp, "a");
+      for (uint32_t i = 0; i < depth; ++i) fputc(')', fp);
+      fprintf(fp, ";\n");
+      break;
+    case NEST_UNARY:
+      fprintf(fp, "return ");
+      for (uint32_t i = 0; i < depth; ++i) fputc('-', fp);
+      fprintf(fp, "a;\n");
+      break;
+    case NEST_BLOCKS:
+      for (uint32_t i = 0; i < depth; ++i) fputc('{', fp);
+      fprintf(fp, "a = 2;");
+      for (uint32_t i = 0; i < depth; ++i) fputc('}', fp);
+      fprintf(fp, "\nreturn a;\n");
+      break;
+    case NEST_IFS:
+      for (uint32_t i = 0; i < depth; ++i) fprintf(fp, "if (a) ");
+      fprintf(fp, "a = 2;\nreturn a;\n");
+      break;
+  }
+  fclose(fp);
+  return buf;
+}
+
+const char *TYPICAL_SOURCE =
+  "int a = 12;\n"
+  "int b = a * 3 + 2;\n"
+  "if (a < b) { a = b - 1; } else { b = a + 4; }\n"
+  "return a + b;\n";
+
+int main(int argc, char *argv[]) {
+  int runs = argc > 1 ? atoi(argv[1]) : DEFAULT_RUNS;
+  if (runs < 1) runs = 1;
+  SonContext *ctx = son_context_new();
+  assert(ctx);
+  // Debug prints of the compiler would drown the table
+  FILE *null = fopen("/dev/null", "w");
+  assert(null);
+  son_context_set_output(ctx, null);
+
+  printf("%-8s %6s %12s %12s\n", "input", "depth", "stack bytes", "ns/compile");
+  printf("%-8s %6s %12zu %12.0f\n", "typical", "-",
+    stack_high_water(ctx, TYPICAL_SOURCE), compile_ns(ctx, TYPICAL_SOURCE, runs));
+  for (NestKind kind = NEST_PARENS; kind <= NEST_IFS; ++kind) {
+    uint32_t max_depth = NEST_MAX_DEPTH[kind];
+    for (uint32_t depth = 1;; depth = MIN(depth * 2, max_depth)) {
+      char *source = nested_source(kind, depth);
+      printf("%-8s %6u %12zu %12.0f\n", NEST_NAME[kind], depth,
+        stack_high_water(ctx, source), compile_ns(ctx, source, runs));
+      free(source);
+      if (depth == max_depth) break;
+    }
+  }
+  son_context_free(ctx);
+  fclose(null);
+  return 0;
+}
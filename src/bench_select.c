@@ -0,0 +1,193 @@
+// Branches on data that follows no pattern, as ifs and after
+// if-conversion. First the graphs: how many ifs are left and
+// what the evaluator makes of them, the results have to agree.
+// The evaluator has no branch predictor to miss, so then the
+// two shapes the graphs lower to, a branch and a select, run
+// natively over random and sorted data. The random column is
+// where the mispredicts go, sorted data predicts perfectly.
+//
+// usage: bench_select [runs]
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "son.c"
+
+#define DEFAULT_RUNS 20
+#define BENCH_FUEL 100000000
+#define NATIVE_LEN (1 << 16)
+
+typedef struct {
+  const char *name;
+  const char *source;
+} Kernel;
+
+// A linear congruential generator picks the arm,
+// folding can't see through it
+const Kernel KERNELS[] = {
+  { "abs",
+    "int x = 1;\n"
+    "int i = 0;\n"
+    "int s = 0;\n"
+    "while (i < 100000) {\n"
+    "  x = x * 6364136223846793005 + 1442695040888963407;\n"
+    "  int v = x / 4294967296 / 1048576;\n"
+    "  if (v < 0) v = -v;\n"
+    "  s = s + v;\n"
+    "  i = i + 1;\n"
+    "}\n"
+    "return s;\n" },
+  { "clamp",
+    "int x = 7;\n"
+    "int i = 0;\n"
+    "int s = 0;\n"
+    "while (i < 100000) {\n"
+    "  x = x * 6364136223846793005 + 1442695040888963407;\n"
+    "  int v = x / 4294967296 / 1048576;\n"
+    "  if (v > 1000) v = 1000;\n"
+    "  else if (v < -1000) v = -1000;\n"
+    "  s = s + v;\n"
+    "  i = i + 1;\n"
+    "}\n"
+    "return s;\n" },
+  { "count",
+    "int x = 3;\n"
+    "int i = 0;\n"
+    "int lo = 0;\n"
+    "int hi = 0;\n"
+    "while (i < 100000) {\n"
+    "  x = x * 6364136223846793005 + 1442695040888963407;\n"
+    "  if (x < 0) lo = lo + 1; else hi = hi + 1;\n"
+    "  i = i + 1;\n"
+    "}\n"
+    "return hi - lo;\n" },
+};
+
+double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+typedef struct {
+  double ns;
+  uint16_t if_count;
+  int64_t result;
+} SelectRun;
+
+SelectRun run_kernel(SonContext *ctx, Eval *e, const Kernel *k, uint32_t budget, int runs) {
+  SELECT_BUDGET = budget;
+  if (son_compile(ctx, k->source, strlen(k->source))) {
+    son_print_diagnostics(ctx, stderr);
+    exit(1);
+  }
+  const Parser *p = SonGraph_parser(son_graph(ctx));
+  SelectRun run = { .ns = 1e18 };
+  for (NodeId i = START_NODE; i < p->node_len; ++i) run.if_count += p->node_arr[i].tag == NODE_IF;
+  for (int i = 0; i < runs; ++i) {
+    double start = now_ns();
+    if (Parser_eval(p, e, BENCH_FUEL, 0, &run.result) != EVAL_OK) {
+      print_error_message("Kernel %s failed to run", k->name);
+      exit(1);
+    }
+    run.ns = MIN(run.ns, now_ns() - start);
+  }
+  return run;
+}
+
+// The empty asm keeps the compiler from
+// turning the branch into a select itself
+int64_t sum_branch(const int64_t *arr, uint32_t len) {
+  int64_t s = 0;
+  for (uint32_t i = 0; i < len; ++i) {
+    int64_t v = arr[i];
+    if (v < 0) {
+      __asm__ volatile("");
+      v = -v;
+    }
+    s += v;
+  }
+  return s;
+}
+
+int64_t sum_select(const int64_t *arr, uint32_t len) {
+  int64_t s = 0;
+  for (uint32_t i = 0; i < len; ++i) {
+    int64_t v = arr[i];
+    int64_t mask = -(int64_t)(v < 0);
+    s += v ^ ((v ^ -v) & mask);
+  }
+  return s;
+}
+
+double time_native(int64_t (*sum)(const int64_t *, uint32_t), const int64_t *arr, int runs, int64_t *result) {
+  double best = 1e18;
+  for (int i = 0; i < runs; ++i) {
+    double start = now_ns();
+    *result = sum(arr, NATIVE_LEN);
+    best = MIN(best, now_ns() - start);
+  }
+  return best;
+}
+
+int compare_int64(const void *a, const void *b) {
+  int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+  return (x > y) - (x < y);
+}
+
+int main(int argc, char *argv[]) {
+  int runs = argc > 1 ? atoi(argv[1]) : DEFAULT_RUNS;
+  if (runs < 1) runs = 1;
+  SonContext *ctx = son_context_new();
+  Eval *e = malloc(sizeof(*e));
+  assert(ctx && e);
+  // Debug prints of the compiler would drown the table
+  FILE *null = fopen("/dev/null", "w");
+  assert(null);
+  son_context_set_output(ctx, null);
+
+  uint32_t budget = SELECT_BUDGET;
+  printf("%-8s %10s %10s %12s %12s %8s\n", "kernel", "ifs before", "ifs after", "us before", "us after", "speedup");
+  for (size_t i = 0; i < sizeof(KERNELS) / sizeof(KERNELS[0]); ++i) {
+    const Kernel *k = &KERNELS[i];
+    SelectRun before = run_kernel(ctx, e, k, 0, runs);
+    SelectRun after = run_kernel(ctx, e, k, budget, runs);
+    if (before.result != after.result) {
+      print_error_message("Kernel %s returned %lld with branches and %lld with selects",
+        k->name, (long long)before.result, (long long)after.result);
+      exit(1);
+    }
+    printf("%-8s %10u %10u %12.1f %12.1f %7.2fx\n", k->name, before.if_count, after.if_count,
+      before.ns / 1e3, after.ns / 1e3, before.ns / after.ns);
+  }
+  SELECT_BUDGET = budget;
+
+  // Half negative, in no order and then sorted
+  int64_t *arr = malloc(NATIVE_LEN * sizeof(int64_t));
+  assert(arr);
+  uint64_t x = 1;
+  for (uint32_t i = 0; i < NATIVE_LEN; ++i) {
+    x = x * 6364136223846793005u + 1442695040888963407u;
+    arr[i] = (int64_t)x >> 44;
+  }
+  printf("\n%-8s %12s %12s %8s\n", "native", "ns/branch", "ns/select", "speedup");
+  for (int sorted = 0; sorted < 2; ++sorted) {
+    if (sorted) qsort(arr, NATIVE_LEN, sizeof(int64_t), compare_int64);
+    int64_t branch_sum, select_sum;
+    double branch = time_native(sum_branch, arr, runs, &branch_sum);
+    double select = time_native(sum_select, arr, runs, &select_sum);
+    if (branch_sum != select_sum) {
+      print_error_message("Native sums differ, %lld and %lld", (long long)branch_sum, (long long)select_sum);
+      exit(1);
+    }
+    printf("%-8s %12.2f %12.2f %7.2fx\n", sorted ? "sorted" : "random",
+      branch / NATIVE_LEN, select / NATIVE_LEN, branch / select);
+  }
+  free(arr);
+  free(e);
+  son_context_free(ctx);
+  fclose(null);
+  return 0;
+}
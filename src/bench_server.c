@@ -0,0 +1,192 @@
+// Client side benchmark of the compile server. Keeps `depth`
+// requests in flight on one connection and reports the
+// latency percentiles and the request rate. Then checks a
+// client that sends everything and shuts down its side
+// before reading gets every response, and then the end.
+//
+// usage: bench_server <socket> [requests] [depth]
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "server.h"
+
+#define DEFAULT_REQUESTS 20000
+#define DEFAULT_DEPTH 16
+#define HALF_CLOSE_REQUESTS 64
+
+const char *BENCH_SOURCE =
+  "int a = 12;\n"
+  "int b = a * 3 + 2;\n"
+  "if (a < b) { a = b - 1; } else { b = a + 4; }\n"
+  "return a + b;\n";
+
+uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int compare_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+void write_all(int fd, const void *data, size_t len) {
+  const char *ptr = data;
+  while (len) {
+    ssize_t res = write(fd, ptr, len);
+    if (res < 0 && errno == EINTR) continue;
+    assert(res > 0);
+    ptr += res;
+    len -= res;
+  }
+}
+
+void read_all(int fd, void *data, size_t len) {
+  char *ptr = data;
+  while (len) {
+    ssize_t res = read(fd, ptr, len);
+    if (res < 0 && errno == EINTR) continue;
+    if (res <= 0) {
+      fprintf(stderr, "Server closed the connection\n");
+      exit(1);
+    }
+    ptr += res;
+    len -= res;
+  }
+}
+
+// The server may still be starting up
+int connect_retry(const char *path) {
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  assert(strlen(path) < sizeof(addr.sun_path));
+  strcpy(addr.sun_path, path);
+  for (int attempt = 0; attempt < 200; ++attempt) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    assert(fd >= 0);
+    if (!connect(fd, (struct sockaddr *)&addr, sizeof(addr))) return fd;
+    close(fd);
+    usleep(10 * 1000);
+  }
+  fprintf(stderr, "Failed to connect to %s: %s\n", path, strerror(errno));
+  exit(1);
+}
+
+void send_request(int fd, const char *source, uint32_t len) {
+  ServeRequest req = { len, SERVE_NODES };
+  write_all(fd, &req, sizeof(req));
+  write_all(fd, source, len);
+}
+
+// Every request in one go, the responses only after shutdown
+bool check_half_close(const char *path) {
+  uint32_t len = strlen(BENCH_SOURCE);
+  uint32_t size = sizeof(ServeRequest) + len;
+  // The requests and the start of one cut off by the end, which
+  // gets no response. Sent at once, so the server likely sees
+  // them together with the shutdown
+  char *batch = malloc(HALF_CLOSE_REQUESTS * size + sizeof(ServeRequest));
+  assert(batch);
+  ServeRequest req = { len, SERVE_NODES };
+  for (uint32_t i = 0; i <= HALF_CLOSE_REQUESTS; ++i) {
+    memcpy(&batch[i * size], &req, sizeof(req));
+    if (i < HALF_CLOSE_REQUESTS) memcpy(&batch[i * size + sizeof(req)], BENCH_SOURCE, len);
+  }
+  int fd = connect_retry(path);
+  write_all(fd, batch, HALF_CLOSE_REQUESTS * size + sizeof(req));
+  shutdown(fd, SHUT_WR);
+  free(batch);
+
+  char *payload = NULL;
+  uint32_t got = 0;
+  while (got < HALF_CLOSE_REQUESTS) {
+    ServeResponse res;
+    read_all(fd, &res, sizeof(res));
+    payload = realloc(payload, res.len ? res.len : 1);
+    assert(payload);
+    read_all(fd, payload, res.len);
+    if (res.error_count) {
+      fprintf(stderr, "Half-closed request %u failed:\n%.*s\n", got, res.len, payload);
+      return false;
+    }
+    got++;
+  }
+  free(payload);
+  char extra;
+  ssize_t res;
+  while ((res = read(fd, &extra, 1)) < 0 && errno == EINTR);
+  close(fd);
+  if (res) {
+    fprintf(stderr, "Half-closed connection wasn't closed after %u responses\n", got);
+    return false;
+  }
+  printf("half-close %u pipelined requests, every response, then the end\n", got);
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <socket> [requests] [depth]\n", argv[0]);
+    return 1;
+  }
+  uint32_t requests = argc > 2 ? atoi(argv[2]) : DEFAULT_REQUESTS;
+  uint32_t depth = argc > 3 ? atoi(argv[3]) : DEFAULT_DEPTH;
+  if (!requests) requests = 1;
+  if (!depth) depth = 1;
+
+  int fd = connect_retry(argv[1]);
+  uint32_t len = strlen(BENCH_SOURCE);
+  uint64_t *sent_at = malloc(requests * sizeof(uint64_t));
+  uint64_t *latency = malloc(requests * sizeof(uint64_t));
+  uint64_t *compile = malloc(requests * sizeof(uint64_t));
+  char *payload = NULL;
+  uint32_t payload_cap = 0;
+  assert(sent_at && latency && compile);
+
+  uint64_t start = now_ns();
+  uint32_t sent = 0;
+  for (uint32_t done = 0; done < requests; ++done) {
+    // Keep the pipeline full
+    while (sent < requests && sent - done < depth) {
+      sent_at[sent++] = now_ns();
+      send_request(fd, BENCH_SOURCE, len);
+    }
+    ServeResponse res;
+    read_all(fd, &res, sizeof(res));
+    if (res.len > payload_cap) {
+      payload_cap = res.len;
+      payload = realloc(payload, payload_cap);
+      assert(payload);
+    }
+    read_all(fd, payload, res.len);
+    latency[done] = now_ns() - sent_at[done];
+    compile[done] = res.compile_ns;
+    if (res.error_count) {
+      fprintf(stderr, "Request %u failed:\n%.*s\n", done, res.len, payload);
+      return 1;
+    }
+  }
+  double seconds = (now_ns() - start) / 1e9;
+  close(fd);
+
+  qsort(latency, requests, sizeof(*latency), compare_u64);
+  qsort(compile, requests, sizeof(*compile), compare_u64);
+  printf("%u requests, pipeline depth %u\n", requests, depth);
+  printf("latency   p50 %8.1f us  p99 %8.1f us  max %8.1f us\n",
+    latency[requests / 2] / 1e3,
+    latency[(uint64_t)requests * 99 / 100] / 1e3,
+    latency[requests - 1] / 1e3);
+  printf("compile   p50 %8.1f us  p99 %8.1f us\n",
+    compile[requests / 2] / 1e3,
+    compile[(uint64_t)requests * 99 / 100] / 1e3);
+  printf("throughput %.0f requests/s\n", requests / seconds);
+  return check_half_close(argv[1]) ? 0 : 1;
+}
@@ -0,0 +1,76 @@
+#include "parser.h"
+
+// Nodes STOP reaches backwards through the inputs, START
+// and STOP included. The graph is only read, `a` can belong
+// to another parser
+Bitset Parser_live_nodes(const Parser *p, Arena *a) {
+  Bitset live = Bitset_new(a, p->node_len);
+  ArenaMark mark = Arena_mark(a);
+  Worklist work = Worklist_new(a, p->node_len);
+
+  // STOP is an output of the nodes that end the program
+  Bitset_set(&live, START_NODE);
+  Bitset_set(&live, STOP_NODE);
+  for (NodeId i = START_NODE; i < p->node_len; ++i) {
+    for (LinkId link = p->node_arr[i].outputs; link; link = p->link_arr[link].next) {
+      if (p->link_arr[link].node != STOP_NODE) continue;
+      if (!Bitset_test_and_set(&live, i)) Worklist_push(&work, i);
+      break;
+    }
+  }
+  while (work.len) {
+    NodeId input_arr[MAX_INPUTS];
+    uint16_t input_len = Parser_node_inputs(p, Worklist_pop(&work), input_arr);
+    for (uint16_t i = 0; i < input_len; ++i) {
+      if (!Bitset_test_and_set(&live, input_arr[i])) Worklist_push(&work, input_arr[i]);
+    }
+  }
+  Arena_release(a, mark);
+  return live;
+}
+
+// Everything STOP doesn't reach backwards through the inputs
+// is dead: scopes left behind by branches and loops, phis and
+// computations nobody reads. Marked with a worklist and swept
+// in one pass over the nodes, the links get compacted
+DeadStats Parser_eliminate_dead(Parser *p) {
+  Profile_push(PHASE_DCE);
+  ArenaMark mark = Arena_mark(&p->scratch);
+  Bitset live = Parser_live_nodes(p, &p->scratch);
+
+  DeadStats stats = {0};
+  for (NodeId i = START_NODE; i < p->node_len; ++i) {
+    if (Bitset_get(&live, i) || !p->node_arr[i].tag) continue;
+    if (p->trace) Parser_trace(p, TRACE_REMOVE_NODE, i, 0);
+    if (p->undo) Parser_save_node(p, i);
+    p->node_arr[i].tag = NODE_NONE;
+    p->node_arr[i].outputs = 0;
+    stats.node_count++;
+  }
+  while (p->node_len > STOP_NODE + 1 && !p->node_arr[p->node_len - 1].tag) p->node_len--;
+
+  // Live users only, every list keeps its order
+  Link *old = Arena_alloc(&p->scratch, p->link_len * sizeof(Link));
+  memcpy(old, p->link_arr, p->link_len * sizeof(Link));
+  uint16_t link_len = 1;
+  for (NodeId i = START_NODE; i < p->node_len; ++i) {
+    LinkId head = 0, prev = 0;
+    for (LinkId link = p->node_arr[i].outputs; link; link = old[link].next) {
+      NodeId user = old[link].node;
+      if (user >= p->node_len || !Bitset_get(&live, user)) continue;
+      LinkId id = link_len++;
+      if (p->undo) Parser_save_link(p, id);
+      p->link_arr[id] = (Link){ 0, user };
+      if (prev) p->link_arr[prev].next = id;
+      else head = id;
+      prev = id;
+    }
+    if (p->undo && p->node_arr[i].outputs != head) Parser_save_node(p, i);
+    p->node_arr[i].outputs = head;
+  }
+  stats.link_count = p->link_len - link_len;
+  p->link_len = link_len;
+  Arena_release(&p->scratch, mark);
+  Profile_pop();
+  return stats;
+}
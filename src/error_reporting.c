@@ -1,20 +1,81 @@
 #include "common.h"
+#include <assert.h>
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
-void print_source_span(const char *source, uint32_t start, uint16_t len) {
-  uint32_t line_start;
-  uint32_t line_count = 1;
-  uint32_t i;
-
-  // Line count
-  for (i = 0; i < start; ++i) if (source[i] == '\n') line_count++;
-  // Line start
-  for (i = start; i > 0 && source[i - 1] != '\n'; --i);
-  line_start = i;
-  // Line end
-  for (i = start; source[i] != 0 && source[i] !=  '\n'; ++i);
+// Calls `LINE_FOUND(offset)` with the offset just past every newline
+#define FOR_EACH_NEWLINE(source, len, LINE_FOUND) do { \
+    uint32_t i_ = 0; \
+    FOR_EACH_NEWLINE_SIMD(source, len, i_, LINE_FOUND); \
+    for (; i_ < (len); ++i_) if ((source)[i_] == '\n') LINE_FOUND(i_ + 1); \
+  } while (0)
+
+#ifdef __SSE2__
+#define FOR_EACH_NEWLINE_SIMD(source, len, i, LINE_FOUND) \
+  for (; i + 16 <= (len); i += 16) { \
+    __m128i chunk = _mm_loadu_si128((const __m128i *)&(source)[i]); \
+    uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('\n'))); \
+    while (mask) { \
+      LINE_FOUND(i + __builtin_ctz(mask) + 1); \
+      mask &= mask - 1; \
+    } \
+  }
+#else
+#define FOR_EACH_NEWLINE_SIMD(source, len, i, LINE_FOUND)
+#endif
+
+void LineIndex_build(LineIndex *lines, const char *source, uint32_t len) {
+  uint32_t count = 1;
+#define COUNT_LINE(offset) count++
+  FOR_EACH_NEWLINE(source, len, COUNT_LINE);
+#undef COUNT_LINE
+
+  uint32_t *line_arr = malloc(count * sizeof(*line_arr));
+  assert(line_arr);
+  uint32_t line_len = 0;
+  line_arr[line_len++] = 0;
+#define PUSH_LINE(offset) line_arr[line_len++] = (offset)
+  FOR_EACH_NEWLINE(source, len, PUSH_LINE);
+#undef PUSH_LINE
+
+  *lines = (LineIndex){
+    .source = source,
+    .source_len = len,
+    .line_arr = line_arr,
+    .line_count = line_len,
+  };
+}
+
+void LineIndex_free(LineIndex *lines) {
+  free(lines->line_arr);
+  lines->line_arr = NULL;
+  lines->line_count = 0;
+}
+
+// Zero based line containing the offset
+uint32_t LineIndex_find_line(const LineIndex *lines, uint32_t offset) {
+  uint32_t low = 0, high = lines->line_count;
+  while (high - low > 1) {
+    uint32_t mid = low + (high - low) / 2;
+    if (lines->line_arr[mid] <= offset) low = mid;
+    else high = mid;
+  }
+  return low;
+}
+
+void print_source_span(FILE *out, const LineIndex *lines, uint32_t start, uint16_t len) {
+  const char *source = lines->source;
+  uint32_t line = LineIndex_find_line(lines, start);
+  uint32_t line_count = line + 1;
+  uint32_t line_start = lines->line_arr[line];
+  uint32_t i = line_count < lines->line_count
+    ? lines->line_arr[line_count] - 1
+    : lines->source_len;
   // Can't be multiline for now
   assert(i >= start + len);
 
@@ -22,24 +83,14 @@ void print_source_span(const char *source, uint32_t start, uint16_t len) {
   uint32_t value = line_count;
   while (value > 9) { number_len++; value /= 10; }
 
-  fprintf(stderr, ANSI_BLUE " %d" ANSI_RESET " | ", line_count);
-  fprintf(stderr, "%.*s", start - line_start, &source[line_start]);
-  fprintf(stderr, ANSI_RED "%.*s" ANSI_RESET, len, &source[start]);
-  fprintf(stderr, "%.*s\n    ", i - start - len, &source[start + len]);
-  for (i = 0; i < start - line_start + number_len; ++i) fputc(' ', stderr);
-  fprintf(stderr, ANSI_RED);
-  for (i = 0; i < len; ++i) fputc('^', stderr);
-  fprintf(stderr, ANSI_RESET "\n");
-}
-
-void print_note(const char *source, uint32_t start, uint16_t len, const char *fmt, ...) {
-  fprintf(stderr, ANSI_MAGENTA "NOTE: " ANSI_RESET);
-  va_list args;
-  va_start(args, fmt);
-  vfprintf(stderr, fmt, args);
-  va_end(args);
-  fprintf(stderr, "\n\n");
-  print_source_span(source, start, len);
+  fprintf(out, ANSI_BLUE " %d" ANSI_RESET " | ", line_count);
+  fprintf(out, "%.*s", start - line_start, &source[line_start]);
+  fprintf(out, ANSI_RED "%.*s" ANSI_RESET, len, &source[start]);
+  fprintf(out, "%.*s\n    ", i - start - len, &source[start + len]);
+  for (i = 0; i < start - line_start + number_len; ++i) fputc(' ', out);
+  fprintf(out, ANSI_RED);
+  for (i = 0; i < len; ++i) fputc('^', out);
+  fprintf(out, ANSI_RESET "\n");
 }
 
 void vprint_error_message(const char *fmt, va_list args) {
@@ -55,10 +106,64 @@ void print_error_message(const char *fmt, ...) {
   va_end(args);
 }
 
-void print_error(const char *source, uint32_t start, uint16_t len, const char *fmt, ...) {
+void Diagnostics_reset(Diagnostics *d) {
+  d->text_len = 0;
+  d->diag_len = 0;
+  d->error_count = 0;
+  d->dropped_count = 0;
+}
+
+void Diagnostics_vpush(Diagnostics *d, DiagKind kind,
+    uint32_t start, uint16_t len, bool has_span, const char *fmt, va_list args) {
+  if (kind == DIAG_ERROR) d->error_count++;
+  // Once full, keep counting errors but drop the text
+  if (d->diag_len >= MAX_DIAGNOSTICS) {
+    if (kind == DIAG_ERROR) d->dropped_count++;
+    return;
+  }
+  uint32_t space = DIAG_TEXT_SIZE - d->text_len;
+  int written = vsnprintf(&d->text[d->text_len], space, fmt, args);
+  if (written < 0) written = 0;
+  if ((uint32_t)written >= space) written = space ? space - 1 : 0;
+  d->diag_arr[d->diag_len++] = (Diagnostic){
+    .kind = kind,
+    .has_span = has_span,
+    .start = start,
+    .len = len,
+    .msg_start = d->text_len,
+    .msg_len = written,
+  };
+  d->text_len += written;
+}
+
+void Diagnostics_error(Diagnostics *d, uint32_t start, uint16_t len, const char *fmt, ...) {
   va_list args;
   va_start(args, fmt);
-  vprint_error_message(fmt, args);
-  print_source_span(source, start, len);
+  Diagnostics_vpush(d, DIAG_ERROR, start, len, true, fmt, args);
   va_end(args);
 }
+
+void Diagnostics_error_message(Diagnostics *d, const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  Diagnostics_vpush(d, DIAG_ERROR, 0, 0, false, fmt, args);
+  va_end(args);
+}
+
+void Diagnostics_note(Diagnostics *d, uint32_t start, uint16_t len, const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  Diagnostics_vpush(d, DIAG_NOTE, start, len, true, fmt, args);
+  va_end(args);
+}
+
+void Diagnostics_print(FILE *out, const Diagnostics *d, const LineIndex *lines) {
+  for (int i = 0; i < d->diag_len; ++i) {
+    Diagnostic diag = d->diag_arr[i];
+    if (diag.kind == DIAG_ERROR) fprintf(out, ANSI_RED "\nERROR: " ANSI_RESET);
+    else fprintf(out, ANSI_MAGENTA "NOTE: " ANSI_RESET);
+    fprintf(out, "%.*s\n\n", diag.msg_len, &d->text[diag.msg_start]);
+    if (diag.has_span) print_source_span(out, lines, diag.start, diag.len);
+  }
+  if (d->dropped_count) fprintf(out, "\n... and %d more errors\n", d->dropped_count);
+}
@@ -0,0 +1,211 @@
+#include "parser.h"
+
+// Runs the graph. A data node is computed once per trip of
+// the loop it's in and cached until that loop goes around
+// again, so hoisting shows up as work saved
+
+int64_t Eval_node(Eval *e, const Parser *p, NodeId id) {
+  Node node = p->node_arr[id];
+  if (e->stamp[id] == e->trip[node.loop] + 1) return e->value[id];
+  int64_t l, r, value = 0;
+  switch (node.tag) {
+    case NODE_CONSTANT:
+      value = node.value.i64;
+      break;
+    case NODE_MINUS:
+      value = (int64_t)(0 - (uint64_t)Eval_node(e, p, node.value.unary.node));
+      break;
+    case NODE_NOT:
+      value = !Eval_node(e, p, node.value.unary.node);
+      break;
+    // Only the side picked, like the branch it replaced
+    case NODE_SELECT:
+      value = Eval_node(e, p, node.value.select.cond) ?
+        Eval_node(e, p, node.value.select.left) : Eval_node(e, p, node.value.select.right);
+      break;
+    case NODE_ADD:
+    case NODE_SUB:
+    case NODE_MUL:
+    case NODE_DIV:
+    case NODE_SHL:
+    case NODE_SAR:
+    case NODE_SHR:
+    case NODE_MULHI:
+    case NODE_EQ:
+    case NODE_NE:
+    case NODE_LT:
+    case NODE_LE:
+    case NODE_GT:
+    case NODE_GE:
+      l = Eval_node(e, p, node.value.binary.left);
+      r = Eval_node(e, p, node.value.binary.right);
+      switch (node.tag) {
+        // Wrapping, like the machine would
+        case NODE_ADD: value = (int64_t)((uint64_t)l + (uint64_t)r); break;
+        case NODE_SUB: value = (int64_t)((uint64_t)l - (uint64_t)r); break;
+        case NODE_MUL: value = (int64_t)((uint64_t)l * (uint64_t)r); break;
+        case NODE_DIV:
+          if (!r) e->status = EVAL_DIV_BY_ZERO;
+          else if (r == -1) value = (int64_t)(0 - (uint64_t)l);
+          else value = l / r;
+          break;
+        case NODE_EQ: value = l == r; break;
+        case NODE_NE: value = l != r; break;
+        case NODE_LT: value = l < r; break;
+        case NODE_LE: value = l <= r; break;
+        case NODE_GT: value = l > r; break;
+        case NODE_GE: value = l >= r; break;
+        case NODE_SHL:
+        case NODE_SAR:
+        case NODE_SHR:
+        case NODE_MULHI:
+          Parser_fold_value(node.tag, l, r, &value);
+          break;
+        default: assert(0);
+      }
+      break;
+    // Parameters, the result of a call is set by the call
+    case NODE_PROJ:
+      assert(node.value.proj.ctrl == START_NODE && e->arg_arr);
+      value = e->arg_arr[node.value.proj.select - 1];
+      break;
+    // Set when its region is entered
+    case NODE_PHI:
+    default:
+      assert(0);
+  }
+  e->computed++;
+  e->value[id] = value;
+  e->stamp[id] = e->trip[node.loop] + 1;
+  return value;
+}
+
+// The control node following `ctrl`, ifs are handled by the caller
+NodeId Eval_next(const Parser *p, NodeId ctrl) {
+  for (LinkId link = p->node_arr[ctrl].outputs; link; link = p->link_arr[link].next) {
+    NodeId user = p->link_arr[link].node;
+    switch (p->node_arr[user].tag) {
+      case NODE_RETURN:
+      case NODE_REGION:
+      case NODE_LOOP:
+      case NODE_IF:
+      case NODE_CALL:
+        return user;
+      default: break;
+    }
+  }
+  return 0;
+}
+
+// Phis of a region all take their value from the same
+// side at once, they can read each other's old values
+void Eval_enter_region(Eval *e, const Parser *p, NodeId region, NodeId from) {
+  Node node = p->node_arr[region];
+  bool left = node.value.region.left_block == from;
+  NodeId phi_arr[MAX_NODES];
+  int64_t value_arr[MAX_NODES];
+  uint16_t phi_len = 0;
+  for (LinkId link = node.outputs; link; link = p->link_arr[link].next) {
+    NodeId user = p->link_arr[link].node;
+    Node phi = p->node_arr[user];
+    if (phi.tag != NODE_PHI || phi.value.phi.ctrl != region) continue;
+    phi_arr[phi_len] = user;
+    value_arr[phi_len++] = Eval_node(e, p, left ? phi.value.phi.left : phi.value.phi.right);
+  }
+  // Everything computed in the loop is stale now
+  if (node.tag == NODE_LOOP) e->trip[region]++;
+  for (uint16_t i = 0; i < phi_len; ++i) {
+    NodeId id = phi_arr[i];
+    e->value[id] = value_arr[i];
+    e->stamp[id] = e->trip[p->node_arr[id].loop] + 1;
+  }
+}
+
+// The projection of `ctrl` picked by `select`
+NodeId Eval_proj(const Parser *p, NodeId ctrl, uint16_t select) {
+  for (LinkId link = p->node_arr[ctrl].outputs; link; link = p->link_arr[link].next) {
+    NodeId user = p->link_arr[link].node;
+    if (p->node_arr[user].tag == NODE_PROJ &&
+        p->node_arr[user].value.proj.select == select) return user;
+  }
+  return 0;
+}
+
+EvalStatus Eval_run(const Parser *p, Eval *e, uint64_t *fuel, uint16_t depth, int64_t *result);
+
+// Runs the callee with a state of its own, the
+// result goes to the projection of the call's end
+EvalStatus Eval_call(Eval *e, const Parser *p, NodeId call, uint64_t *fuel, uint16_t depth, NodeId end) {
+  if (depth == MAX_CALL_DEPTH) return EVAL_TOO_DEEP;
+  struct NodeCall node = p->node_arr[call].value.call;
+  int64_t arg_arr[MAX_PARAMS];
+  for (uint16_t i = 0; i < node.arg_count; ++i) {
+    arg_arr[i] = Eval_node(e, p, p->arg_arr[node.arg_start + i]);
+  }
+  if (e->status != EVAL_OK) return e->status;
+  Eval *inner = malloc(sizeof(Eval));
+  assert(inner);
+  inner->arg_arr = arg_arr;
+  int64_t value = 0;
+  EvalStatus status = Eval_run(Parser_function(p, node.function)->graph, inner, fuel, depth + 1, &value);
+  free(inner);
+  NodeId proj = Eval_proj(p, end, 1);
+  // Nobody reads an unused result
+  if (proj) {
+    e->value[proj] = value;
+    e->stamp[proj] = e->trip[p->node_arr[proj].loop] + 1;
+  }
+  return status;
+}
+
+// Stops at the first return, or after
+// `fuel` control nodes for endless loops
+EvalStatus Eval_run(const Parser *p, Eval *e, uint64_t *fuel, uint16_t depth, int64_t *result) {
+  memset(e->stamp, 0, p->node_len * sizeof(e->stamp[0]));
+  memset(e->trip, 0, p->node_len * sizeof(e->trip[0]));
+  e->computed = 0;
+  e->status = EVAL_OK;
+  NodeId ctrl = START_NODE;
+  while (e->status == EVAL_OK) {
+    Node node = p->node_arr[ctrl];
+    NodeId next;
+    if (!(*fuel)--) return EVAL_OUT_OF_FUEL;
+    switch (node.tag) {
+      case NODE_RETURN:
+        *result = node.value.ret.value ? Eval_node(e, p, node.value.ret.value) : 0;
+        return e->status;
+      case NODE_IF:
+        next = Eval_proj(p, ctrl, Eval_node(e, p, node.value.if_.cond) ? 0 : 1);
+        break;
+      case NODE_CALL:
+        next = 0;
+        for (LinkId link = node.outputs; link; link = p->link_arr[link].next) {
+          NodeId user = p->link_arr[link].node;
+          if (p->node_arr[user].tag == NODE_CALL_END) next = user;
+        }
+        assert(next);
+        EvalStatus status = Eval_call(e, p, ctrl, fuel, depth, next);
+        if (status != EVAL_OK) return status;
+        break;
+      case NODE_CALL_END:
+        next = Eval_proj(p, ctrl, 0);
+        break;
+      default:
+        next = Eval_next(p, ctrl);
+    }
+    if (!next) return EVAL_NO_RETURN;
+    Node succ = p->node_arr[next];
+    if (succ.tag == NODE_REGION || succ.tag == NODE_LOOP) Eval_enter_region(e, p, next, ctrl);
+    ctrl = next;
+  }
+  return e->status;
+}
+
+EvalStatus Parser_eval(const Parser *p, Eval *e, uint64_t fuel, int64_t arg, int64_t *result) {
+  Profile_push(PHASE_EVAL);
+  e->arg_arr = &arg;
+  EvalStatus status = Eval_run(p, e, &fuel, 0, result);
+  e->arg_arr = NULL;
+  Profile_pop();
+  return status;
+}
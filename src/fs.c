@@ -1,5 +1,7 @@
 #include "common.h"
+#include <errno.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/mman.h>
@@ -8,17 +10,100 @@
 #include <unistd.h>
 #include <stdarg.h>
 
-// Returns NULL on failure
-const char *map_file_readonly(const char *filename) {
+// Bigger files get their pages faulted in up front
+#define POPULATE_THRESHOLD (256 * 1024)
+#define READ_CHUNK_SIZE (64 * 1024)
+
+// Address space for a source read from a pipe, the most
+// a source can be. Only what gets written is ever committed
+#define READ_RESERVE_SIZE ((uint32_t)UINT32_MAX / READ_CHUNK_SIZE * READ_CHUNK_SIZE)
+
+// Pipes, ttys and the like can't be mapped. They're read once
+// into an arena reserved for the biggest source, pages made
+// writable as it fills, so the bytes are never copied. What's
+// left over is given back, the source unloads like a mapping
+bool read_whole_fd(int fd, SourceFile *file) {
+  char *buf = mmap(NULL, READ_RESERVE_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (buf == MAP_FAILED) return false;
+  uint32_t cap = 0, len = 0;
+  int saved_errno;
+  while (1) {
+    if (len == cap) {
+      if (cap == READ_RESERVE_SIZE) {
+        errno = EFBIG;
+        goto fail;
+      }
+      uint32_t new_cap = cap ? MIN((uint64_t)cap * 2, READ_RESERVE_SIZE) : READ_CHUNK_SIZE;
+      if (mprotect(&buf[cap], new_cap - cap, PROT_READ | PROT_WRITE) < 0) goto fail;
+      cap = new_cap;
+    }
+    ssize_t res = read(fd, &buf[len], cap - len);
+    if (res < 0) {
+      if (errno == EINTR) continue;
+      goto fail;
+    }
+    if (res == 0) break;
+    len += res;
+  }
+  // Can't keep zero bytes mapped
+  uint32_t used = len ? (len + READ_CHUNK_SIZE - 1) / READ_CHUNK_SIZE * READ_CHUNK_SIZE : 0;
+  munmap(&buf[used], READ_RESERVE_SIZE - used);
+  *file = len ? (SourceFile){ buf, len, SOURCE_MAPPED } : (SourceFile){ "", 0, SOURCE_STATIC };
+  return true;
+fail:
+  saved_errno = errno;
+  munmap(buf, READ_RESERVE_SIZE);
+  errno = saved_errno;
+  return false;
+}
+
+// Returns false on failure with errno set, "-" reads stdin
+bool load_source(const char *filename, SourceFile *file) {
+  if (filename[0] == '-' && filename[1] == 0) return read_whole_fd(STDIN_FILENO, file);
+
   int fd = open(filename, O_RDONLY);
-  if (fd < 0) return NULL;
+  if (fd < 0) return false;
 
+  int saved_errno;
   struct stat st;
-  if (fstat(fd, &st) < 0) return NULL;
+  if (fstat(fd, &st) < 0) goto fail;
+  if (!S_ISREG(st.st_mode)) {
+    bool ok = read_whole_fd(fd, file);
+    close(fd);
+    return ok;
+  }
+  if ((uint64_t)st.st_size > UINT32_MAX) {
+    errno = EFBIG;
+    goto fail;
+  }
+  // Can't map zero bytes
+  if (st.st_size == 0) {
+    close(fd);
+    *file = (SourceFile){ "", 0, SOURCE_STATIC };
+    return true;
+  }
 
-  const char *file = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
-  if (file == MAP_FAILED) return NULL;
+  int flags = MAP_PRIVATE;
+  bool large = st.st_size >= POPULATE_THRESHOLD;
+  if (large) flags |= MAP_POPULATE;
+  const char *ptr = mmap(0, st.st_size, PROT_READ, flags, fd, 0);
+  if (ptr == MAP_FAILED) goto fail;
+  if (large) madvise((void *)ptr, st.st_size, MADV_SEQUENTIAL);
+  close(fd);
 
+  *file = (SourceFile){ ptr, st.st_size, SOURCE_MAPPED };
+  return true;
+fail:
+  saved_errno = errno;
   close(fd);
-  return file;
+  errno = saved_errno;
+  return false;
+}
+
+void unload_source(SourceFile *file) {
+  switch (file->storage) {
+    case SOURCE_MAPPED: munmap((void *)file->ptr, file->len); break;
+    case SOURCE_STATIC: break;
+  }
+  *file = (SourceFile){0};
 }
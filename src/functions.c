@@ -0,0 +1,110 @@
+#include "parser.h"
+
+// Threads the function graphs are optimized on
+uint32_t OPTIMIZE_THREADS = 1;
+
+// The graph is a parser of its own, sharing the source,
+// tokens and diagnostics of the program
+Parser *Parser_define_function(Parser *p, Token name, uint16_t param_count) {
+  assert(!p->owner);
+  if (p->function_len == p->function_cap) {
+    assert(p->function_cap < MAX_FUNCTIONS);
+    uint16_t cap = p->function_cap ? p->function_cap * 2 : 8;
+    Function *function_arr = realloc(p->function_arr, cap * sizeof(Function));
+    assert(function_arr);
+    memset(&function_arr[p->function_cap], 0, (cap - p->function_cap) * sizeof(Function));
+    p->function_arr = function_arr;
+    p->function_cap = cap;
+  }
+  // Graphs of an earlier compile are taken again
+  Parser *graph = p->function_arr[p->function_len].graph;
+  if (!graph) graph = calloc(1, sizeof(Parser));
+  assert(graph);
+  Parser_init(graph, p->source, p->token_arr, p->diag);
+  graph->out = p->out;
+  graph->graph_filename = p->graph_filename;
+  graph->owner = p;
+  if (p->trace) graph->trace = Trace_new(p->trace->fp, p->function_len + 1);
+  p->function_arr[p->function_len++] = (Function){ name, param_count, graph, false };
+  return graph;
+}
+
+const Function *Parser_find_function(const Parser *p, uint32_t start, uint16_t len) {
+  for (uint16_t i = 0; i < p->function_len; ++i) {
+    Token name = p->function_arr[i].name;
+    if (name.len == len && !strncmp(&p->source[name.start], &p->source[start], len)) {
+      return &p->function_arr[i];
+    }
+  }
+  return NULL;
+}
+
+// Calls in functions go through the program
+const Function *Parser_function(const Parser *p, uint16_t index) {
+  const Parser *program = p->owner ? p->owner : p;
+  assert(index < program->function_len);
+  return &program->function_arr[index];
+}
+
+// Drops the functions after the first `len`, their
+// graphs are reset and kept for the next ones defined
+void Parser_truncate_functions(Parser *p, uint16_t len) {
+  assert(len <= p->function_len);
+  for (uint16_t i = len; i < p->function_len; ++i) Parser_reset(p->function_arr[i].graph);
+  p->function_len = len;
+}
+
+// Passes that need the whole graph, folding already
+// happened while it was built
+void Parser_optimize(Parser *p) {
+  Profile_push(PHASE_OPTIMIZE);
+  // Scopes the parser left behind would pass for users
+  p->dead = Parser_eliminate_dead(p);
+  if (NARROW_RANGES) p->ranges = Parser_narrow_ranges(p);
+  if (THREAD_JUMPS) p->threaded = Parser_thread_jumps(p);
+  p->selects = Parser_convert_ifs(p);
+  DeadStats dead = Parser_eliminate_dead(p);
+  p->dead.node_count += dead.node_count;
+  p->dead.link_count += dead.link_count;
+  // Last, the passes before know multiplication and division
+  if (REDUCE_STRENGTH) p->reduced = Parser_reduce_strength(p);
+  if (HOIST_INVARIANTS) Parser_hoist_invariants(p);
+  Profile_pop();
+}
+
+typedef struct {
+  Parser *program;
+  // First function not optimized yet
+  uint16_t first;
+} OptimizeJobs;
+
+void Parser_optimize_job(void *ctx, uint32_t job, uint32_t worker) {
+  (void)worker;
+  OptimizeJobs *jobs = ctx;
+  Parser *p = jobs->program;
+  Parser_optimize(job ? p->function_arr[jobs->first + job - 1].graph : p);
+}
+
+// Functions kept from an earlier parse are done already. The
+// inliner reads the graphs of the callees so it runs first,
+// in definition order since only earlier ones can be called.
+// After that the graphs share nothing, each one is a job
+void Parser_optimize_all(Parser *p) {
+  OptimizeJobs jobs = { p, p->function_len };
+  while (jobs.first && !p->function_arr[jobs.first - 1].optimized) jobs.first--;
+  for (uint16_t i = jobs.first; i < p->function_len; ++i) {
+    Parser *graph = p->function_arr[i].graph;
+    graph->inlined = Parser_inline_calls(graph);
+  }
+  p->inlined = Parser_inline_calls(p);
+  Pool_run(p->function_len - jobs.first + 1, OPTIMIZE_THREADS, Parser_optimize_job, &jobs);
+  for (uint16_t i = jobs.first; i < p->function_len; ++i) p->function_arr[i].optimized = true;
+}
+
+void print_functions(const Parser *p) {
+  for (uint16_t i = 0; i < p->function_len; ++i) {
+    const Function *f = &p->function_arr[i];
+    fprintf(p->out, "%.*s:\n", f->name.len, &p->source[f->name.start]);
+    print_nodes(f->graph);
+  }
+}
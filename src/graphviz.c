@@ -1,73 +1,279 @@
 #include <assert.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
+#include <unistd.h>
 #include "parser.h"
 
 const char *GRAPHVIZ_PREAMBLE =
   "digraph G {\n"
   "  bgcolor=\"#181818\";\n"
-  "  node [fontoclor=\"#e6e6e6\", style=filled, color=\"#e6e6e6\", fillcolor=\"#333333\"];\n"
+  "  node [fontcolor=\"#e6e6e6\", style=filled, color=\"#e6e6e6\", fillcolor=\"#333333\"];\n"
   "  edge [color=\"#e6e6e6\", fontcolor=\"#e6e6e6\"]\n";
 
-void output_graphviz_file(const char *filename, const Parser *p) {
-  FILE *fp = fopen(filename, "w");
-  if (fp == NULL) {
-    print_error_message("Failed to open '%s' for writing", filename);
-    return;
+GraphOptions GRAPH_OPTIONS = {0};
+
+// NOTE: one buffer per thread, a thread only has a single
+// dump in flight at a time (see graphviz_wait)
+typedef struct {
+#define GRAPH_BUFFER_SIZE (64 * 1024)
+  char buf[GRAPH_BUFFER_SIZE];
+  uint32_t len;
+  int fd;
+} GraphWriter;
+
+__thread GraphWriter GRAPH_WRITER;
+
+void GraphWriter_flush(GraphWriter *w) {
+  uint32_t written = 0;
+  while (written < w->len) {
+    ssize_t res = write(w->fd, &w->buf[written], w->len - written);
+    if (res <= 0) break;
+    written += res;
+  }
+  w->len = 0;
+}
+
+void GraphWriter_push(GraphWriter *w, const char *str, uint32_t len) {
+  // Every piece is way smaller than the buffer
+  assert(len <= GRAPH_BUFFER_SIZE);
+  if (w->len + len > GRAPH_BUFFER_SIZE) GraphWriter_flush(w);
+  memcpy(&w->buf[w->len], str, len);
+  w->len += len;
+}
+
+#define GraphWriter_push_lit(w, str) GraphWriter_push(w, str, CSTR_LEN(str))
+
+void GraphWriter_push_int(GraphWriter *w, int64_t value) {
+  // sign and up to 19 digits
+  char digits[20];
+  uint32_t len = 0;
+  uint64_t abs = value < 0 ? -(uint64_t)value : (uint64_t)value;
+  do {
+    digits[sizeof(digits) - ++len] = '0' + abs % 10;
+    abs /= 10;
+  } while (abs);
+  if (value < 0) digits[sizeof(digits) - ++len] = '-';
+  GraphWriter_push(w, &digits[sizeof(digits) - len], len);
+}
+
+bool graphviz_tag_visible(NodeTag tag, GraphFilter filter) {
+  switch (filter) {
+    case GRAPH_FILTER_ALL: return true;
+    case GRAPH_FILTER_CTRL: return tag >= NODE_START && tag < DATA_NODES_START;
+    case GRAPH_FILTER_DATA: return tag >= DATA_NODES_START;
   }
-  fprintf(fp, "%s", GRAPHVIZ_PREAMBLE);
+  return true;
+}
 
+// Marks the nodes that make it into the file. With a center,
+// we walk the def-use edges in both directions, one ring per pass
+void graphviz_select_nodes(const Parser *p, const GraphOptions *opt, bool visible[MAX_NODES]) {
   for (int i = 0; i < p->node_len; ++i) {
     Node node = p->node_arr[i];
-    if (!node.tag) continue;
-    // if (!node.outputs) continue;
+    visible[i] = node.tag && graphviz_tag_visible(node.tag, opt->filter);
+  }
+  if (!opt->center || opt->center >= p->node_len) return;
+
+  uint16_t depth[MAX_NODES];
+  const uint16_t unreached = UINT16_MAX;
+  for (int i = 0; i < p->node_len; ++i) depth[i] = unreached;
+  depth[opt->center] = 0;
+
+  for (uint16_t ring = 0; ring < opt->radius; ++ring) {
+    bool grew = false;
+    for (int i = 0; i < p->node_len; ++i) {
+      if (!visible[i]) continue;
+      for (LinkId id = p->node_arr[i].outputs; id; id = p->link_arr[id].next) {
+        NodeId user = p->link_arr[id].node;
+        if (!visible[user]) continue;
+        if (depth[i] == ring && depth[user] == unreached) {
+          depth[user] = ring + 1;
+          grew = true;
+        } else if (depth[user] == ring && depth[i] == unreached) {
+          depth[i] = ring + 1;
+          grew = true;
+        }
+      }
+    }
+    if (!grew) break;
+  }
+  for (int i = 0; i < p->node_len; ++i) visible[i] = visible[i] && depth[i] != unreached;
+}
+
+void graphviz_write(GraphWriter *w, const Parser *p, const GraphOptions *opt) {
+  bool visible[MAX_NODES];
+  graphviz_select_nodes(p, opt, visible);
+
+  GraphWriter_push(w, GRAPHVIZ_PREAMBLE, strlen(GRAPHVIZ_PREAMBLE));
+  for (int i = 0; i < p->node_len; ++i) {
+    if (!visible[i]) continue;
+    Node node = p->node_arr[i];
     switch (node.tag) {
       case NODE_SCOPE:
-        fprintf(fp, "  %d [shape=none,label=<\n", i, node.value.i64);
-        fprintf(fp, "<TABLE BORDER=\"0\" CELLSPACING=\"0\" CELLBORDER=\"1\">\n");
-        fprintf(fp, "  <TR><TD>scope</TD></TR>\n");
+        GraphWriter_push_lit(w, "  ");
+        GraphWriter_push_int(w, i);
+        GraphWriter_push_lit(w, " [shape=none,label=<\n"
+          "<TABLE BORDER=\"0\" CELLSPACING=\"0\" CELLBORDER=\"1\">\n"
+          "  <TR><TD>scope</TD></TR>\n");
         // TODO: print scope's ctrl
         for (int j = 0; j < node.value.scope.var_count; ++j) {
-          VarId id = p->var_offset + node.value.scope.var_start + j;
-          Var var = p->var_arr[id];
-          fprintf(fp, "  <TR><TD PORT=\"%d\">%.*s</TD></TR>\n", j, var.len, &p->source[var.start]);
+          Var var = p->var_arr[node.value.scope.var_start + j];
+          GraphWriter_push_lit(w, "  <TR><TD PORT=\"");
+          GraphWriter_push_int(w, j);
+          GraphWriter_push_lit(w, "\">");
+          GraphWriter_push(w, &p->source[var.start], var.len);
+          GraphWriter_push_lit(w, "</TD></TR>\n");
         }
-        fprintf(fp, "</TABLE>>];\n");
+        GraphWriter_push_lit(w, "</TABLE>>];\n");
         for (int j = 0; j < node.value.scope.var_count; ++j) {
-          VarId id = p->var_offset + node.value.scope.var_start + j;
-          Var var = p->var_arr[id];
-          fprintf(fp, "  %d -> %d:%d", var.node, i, j);
+          Var var = p->var_arr[node.value.scope.var_start + j];
+          if (!visible[var.node]) continue;
+          GraphWriter_push_lit(w, "  ");
+          GraphWriter_push_int(w, var.node);
+          GraphWriter_push_lit(w, " -> ");
+          GraphWriter_push_int(w, i);
+          GraphWriter_push_lit(w, ":");
+          GraphWriter_push_int(w, j);
+          GraphWriter_push_lit(w, ";\n");
         }
         break;
       case NODE_IF:
-        fprintf(fp, "  %d [shape=none,label=<\n"
+        GraphWriter_push_lit(w, "  ");
+        GraphWriter_push_int(w, i);
+        GraphWriter_push_lit(w, " [shape=none,label=<\n"
           "<TABLE BORDER=\"0\" CELLSPACING=\"0\" CELLBORDER=\"1\">\n"
           "  <TR><TD COLSPAN=\"3\">if</TD></TR>\n"
           "  <TR><TD PORT=\"0\">then</TD><TD PORT=\"1\">else</TD></TR>\n"
-          "</TABLE>>];\n", i);
+          "</TABLE>>];\n");
+        break;
+      case NODE_CALL_END:
+        GraphWriter_push_lit(w, "  ");
+        GraphWriter_push_int(w, i);
+        GraphWriter_push_lit(w, " [shape=none,label=<\n"
+          "<TABLE BORDER=\"0\" CELLSPACING=\"0\" CELLBORDER=\"1\">\n"
+          "  <TR><TD COLSPAN=\"2\">call_end</TD></TR>\n"
+          "  <TR><TD PORT=\"0\">ctrl</TD><TD PORT=\"1\">result</TD></TR>\n"
+          "</TABLE>>];\n");
         break;
       case NODE_CONSTANT:
-        fprintf(fp, "  %d [shape=oval,label=\"#%d\"];\n", i, node.value.i64);
+        GraphWriter_push_lit(w, "  ");
+        GraphWriter_push_int(w, i);
+        GraphWriter_push_lit(w, " [shape=oval,label=\"#");
+        GraphWriter_push_int(w, node.value.i64);
+        GraphWriter_push_lit(w, "\"];\n");
         break;
       case NODE_PROJ:
         break;
       default:
-        const char *shape = node.tag >= DATA_NODES_START ? "oval" : "box";
-        fprintf(fp, "  %d [shape=%s,label=\"%s\"];\n", i, shape, NODE_NAME[node.tag]);
+        GraphWriter_push_lit(w, "  ");
+        GraphWriter_push_int(w, i);
+        if (node.tag >= DATA_NODES_START) GraphWriter_push_lit(w, " [shape=oval,label=\"");
+        else GraphWriter_push_lit(w, " [shape=box,label=\"");
+        GraphWriter_push(w, NODE_NAME[node.tag], strlen(NODE_NAME[node.tag]));
+        GraphWriter_push_lit(w, "\"];\n");
+    }
 
+    if (node.tag == NODE_PROJ && !visible[node.value.proj.ctrl]) continue;
+    GraphWriter_push_lit(w, "  ");
+    if (node.tag != NODE_PROJ) {
+      GraphWriter_push_int(w, i);
+    } else {
+      GraphWriter_push_int(w, node.value.proj.ctrl);
+      GraphWriter_push_lit(w, ":");
+      GraphWriter_push_int(w, node.value.proj.select);
     }
-    if (node.tag != NODE_PROJ) fprintf(fp, "  %d -> {", i);
-    else fprintf(fp, "  %d:%d -> {", node.value.proj.ctrl, node.value.proj.select);
-    LinkId id = node.outputs;
-    while (id) {
+    GraphWriter_push_lit(w, " -> {");
+    for (LinkId id = node.outputs; id; id = p->link_arr[id].next) {
       NodeId nid = p->link_arr[id].node;
-      if (p->node_arr[nid].tag != NODE_SCOPE
-          && p->node_arr[nid].tag != NODE_PROJ) fprintf(fp, "%d", p->link_arr[id].node);
-      if (!p->link_arr[id].next) break;
-      fprintf(fp, " ");
-      id = p->link_arr[id].next;
+      if (!visible[nid]) continue;
+      if (p->node_arr[nid].tag == NODE_SCOPE || p->node_arr[nid].tag == NODE_PROJ) continue;
+      GraphWriter_push_int(w, nid);
+      GraphWriter_push_lit(w, " ");
     }
-    fprintf(fp, "};\n");
+    GraphWriter_push_lit(w, "};\n");
+  }
+  GraphWriter_push_lit(w, "}\n");
+}
+
+void graphviz_write_file(const char *filename, const Parser *p, const GraphOptions *opt) {
+  int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    print_error_message("Failed to open '%s' for writing", filename);
+    return;
+  }
+  Profile_push(PHASE_GRAPHVIZ);
+  GRAPH_WRITER.fd = fd;
+  GRAPH_WRITER.len = 0;
+  graphviz_write(&GRAPH_WRITER, p, opt);
+  GraphWriter_flush(&GRAPH_WRITER);
+  close(fd);
+  Profile_pop();
+}
+
+typedef struct {
+  Parser snapshot;
+  GraphOptions options;
+  char filename[256];
+} GraphJob;
+
+__thread pthread_t GRAPHVIZ_THREAD;
+__thread bool GRAPHVIZ_THREAD_ACTIVE = false;
+
+void *graphviz_thread(void *arg) {
+  GraphJob *job = arg;
+  graphviz_write_file(job->filename, &job->snapshot, &job->options);
+  free(job);
+  return NULL;
+}
+
+// Blocks until the background dump started by
+// this thread, if any, is on disk
+void graphviz_wait(void) {
+  if (!GRAPHVIZ_THREAD_ACTIVE) return;
+  pthread_join(GRAPHVIZ_THREAD, NULL);
+  GRAPHVIZ_THREAD_ACTIVE = false;
+}
+
+void output_graphviz_file(const char *filename, const Parser *p, const GraphOptions *opt) {
+  // Dumps go to the same file, so keep them in order
+  graphviz_wait();
+  if (!opt->async) {
+    graphviz_write_file(filename, p, opt);
+    return;
+  }
+
+  // Copy only the live part of the arenas, the rest
+  // of the snapshot is never read
+  GraphJob *job = malloc(sizeof(*job));
+  if (job == NULL) {
+    graphviz_write_file(filename, p, opt);
+    return;
+  }
+  job->options = *opt;
+  snprintf(job->filename, sizeof(job->filename), "%s", filename);
+  Parser *s = &job->snapshot;
+  s->source = p->source;
+  s->node_len = p->node_len;
+  s->link_len = p->link_len;
+  // Scopes of finished blocks can still point past var_len
+  uint16_t var_end = p->var_len;
+  for (int i = 0; i < p->node_len; ++i) {
+    Node node = p->node_arr[i];
+    if (node.tag != NODE_SCOPE) continue;
+    var_end = MAX(var_end, node.value.scope.var_start + node.value.scope.var_count);
+  }
+  s->var_len = p->var_len;
+  memcpy(s->node_arr, p->node_arr, p->node_len * sizeof(Node));
+  memcpy(s->link_arr, p->link_arr, p->link_len * sizeof(Link));
+  memcpy(s->var_arr, p->var_arr, var_end * sizeof(Var));
+
+  if (pthread_create(&GRAPHVIZ_THREAD, NULL, graphviz_thread, job)) {
+    graphviz_thread(job);
+    return;
   }
-  fprintf(fp, "}");
+  GRAPHVIZ_THREAD_ACTIVE = true;
 }
@@ -0,0 +1,52 @@
+#ifndef INCLUDE_ARENA
+#define INCLUDE_ARENA
+
+#include "nodes.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+// Bump allocator for memory that only lives during one
+// pass. A pass takes a mark first and releases it when
+// done, which frees everything it allocated at once
+typedef struct {
+  uint8_t *base;
+  uint32_t cap;
+  uint32_t len;
+  // Most that was ever in use, to size the buffer
+  uint32_t high_water;
+} Arena;
+
+typedef uint32_t ArenaMark;
+
+void Arena_init(Arena *a, void *buf, uint32_t cap);
+void *Arena_alloc(Arena *a, uint32_t size);
+void *Arena_alloc_zero(Arena *a, uint32_t size);
+ArenaMark Arena_mark(const Arena *a);
+void Arena_release(Arena *a, ArenaMark mark);
+
+// One bit per node id
+typedef struct {
+  uint64_t *word_arr;
+  uint16_t len;
+} Bitset;
+
+Bitset Bitset_new(Arena *a, uint16_t len);
+bool Bitset_get(const Bitset *b, NodeId id);
+void Bitset_set(Bitset *b, NodeId id);
+void Bitset_clear(Bitset *b, NodeId id);
+// Returns whether the bit was set already
+bool Bitset_test_and_set(Bitset *b, NodeId id);
+
+// Stack of node ids, every node is on it at most once
+typedef struct {
+  NodeId *node_arr;
+  Bitset on;
+  uint16_t len;
+  uint16_t cap;
+} Worklist;
+
+Worklist Worklist_new(Arena *a, uint16_t node_len);
+void Worklist_push(Worklist *w, NodeId id);
+NodeId Worklist_pop(Worklist *w);
+
+#endif
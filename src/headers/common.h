@@ -2,6 +2,9 @@
 #define INCLUDE_COMMON
 
 #include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stdio.h>
 
 typedef struct {
   const char *ptr;
@@ -39,17 +42,69 @@ typedef struct {
 
 
 // error_reporting.c
-void print_source_span(const char *source, uint32_t start, uint16_t len);
-void print_note(const char *source, uint32_t start, uint16_t len, const char *fmt, ...);
+typedef struct {
+  const char *source;
+  uint32_t source_len;
+  // Offset of the first byte of every line
+  uint32_t *line_arr;
+  uint32_t line_count;
+} LineIndex;
+
+typedef enum {
+  DIAG_ERROR,
+  DIAG_NOTE,
+} DiagKind;
+
+typedef struct {
+  DiagKind kind;
+  bool has_span;
+  uint16_t len;
+  uint32_t start;
+  uint32_t msg_start;
+  uint16_t msg_len;
+} Diagnostic;
+
+// Errors are collected here and printed once the whole
+// file went through the compiler
+typedef struct {
+#define MAX_DIAGNOSTICS 128
+  Diagnostic diag_arr[MAX_DIAGNOSTICS];
+#define DIAG_TEXT_SIZE (8 * 1024)
+  char text[DIAG_TEXT_SIZE];
+  uint32_t text_len;
+  uint16_t diag_len;
+  uint16_t error_count;
+  uint16_t dropped_count;
+} Diagnostics;
+
+void LineIndex_build(LineIndex *lines, const char *source, uint32_t len);
+void LineIndex_free(LineIndex *lines);
+uint32_t LineIndex_find_line(const LineIndex *lines, uint32_t offset);
+void print_source_span(FILE *out, const LineIndex *lines, uint32_t start, uint16_t len);
 void print_error_message(const char *fmt, ...);
-void print_error(const char *source, uint32_t start, uint16_t len, const char *fmt, ...);
+void Diagnostics_reset(Diagnostics *d);
+void Diagnostics_vpush(Diagnostics *d, DiagKind kind,
+    uint32_t start, uint16_t len, bool has_span, const char *fmt, va_list args);
+void Diagnostics_error(Diagnostics *d, uint32_t start, uint16_t len, const char *fmt, ...);
+void Diagnostics_error_message(Diagnostics *d, const char *fmt, ...);
+void Diagnostics_note(Diagnostics *d, uint32_t start, uint16_t len, const char *fmt, ...);
+void Diagnostics_print(FILE *out, const Diagnostics *d, const LineIndex *lines);
 
 // fs.c
-const char *map_file_readonly(const char *filename);
+typedef enum {
+  SOURCE_STATIC,
+  SOURCE_MAPPED,
+} SourceStorage;
+
+// NOTE: not NUL terminated, always go by len
+typedef struct {
+  const char *ptr;
+  uint32_t len;
+  SourceStorage storage;
+} SourceFile;
 
-// graphviz.c
-#include "parser.h"
-void output_graphviz_file(const char *filename, const Parser *p);
+bool load_source(const char *filename, SourceFile *file);
+void unload_source(SourceFile *file);
 
 #endif
 
@@ -40,18 +40,28 @@ typedef enum {
   NODE_STOP,
   NODE_RETURN, // in: cnode predecessor, dnode value
   NODE_REGION,
+  NODE_LOOP, // region, left is the entry and right the back edge
   NODE_IF,
   NODE_PROJ,
+  NODE_CALL, // in: cnode predecessor, dnode arguments
+  NODE_CALL_END, // in: call, proj 0 is the control after it and 1 the result
 
 #define DATA_NODES_START NODE_PHI
   // Data nodes
   NODE_PHI,
   NODE_CONSTANT, // in: start node
+  NODE_SELECT, // in: cond, the value when it holds and when it doesn't
 #define NODE_BINARY_START NODE_ADD
   NODE_ADD,
   NODE_SUB,
   NODE_MUL,
   NODE_DIV,
+  // Made by strength reduction only. Shift counts are
+  // taken mod 64, MULHI is the high half of the product
+  NODE_SHL,
+  NODE_SAR,
+  NODE_SHR,
+  NODE_MULHI,
   NODE_MINUS,
   NODE_NOT,
   NODE_EQ,
@@ -64,31 +74,7 @@ typedef enum {
   NODE_COUNT
 } NodeTag;
 
-const char *NODE_NAME[] = {
-  [NODE_NONE] = "none",
-  [NODE_SCOPE] = "scope",
-  [NODE_START] = "start",
-  [NODE_RETURN] = "return",
-  [NODE_CONSTANT] = "const",
-  [NODE_ADD] = "add",
-  [NODE_SUB] = "sub",
-  [NODE_MUL] = "mul",
-  [NODE_DIV] = "div",
-  [NODE_MINUS] = "minus",
-  [NODE_NOT] = "not",
-  [NODE_REGION] = "region",
-  [NODE_IF] = "if",
-  [NODE_PHI] = "phi",
-  [NODE_PROJ] = "proj",
-  [NODE_EQ] = "eq",
-  [NODE_NE] = "ne",
-  [NODE_GT] = "gt",
-  [NODE_GE] = "ge",
-  [NODE_LT] = "lt",
-  [NODE_LE] = "le",
-  [NODE_NOT] = "not",
-  [NODE_STOP] = "stop",
-};
+extern const char *const NODE_NAME[NODE_COUNT];
 
 typedef union {
   int64_t i64;
@@ -123,11 +109,26 @@ typedef union {
     NodeId left_block;
     NodeId right_block;
   } region;
+  // The arguments are Parser.arg_arr[arg_start..]
+  struct NodeCall {
+    NodeId ctrl;
+    uint16_t function;
+    uint16_t arg_start;
+    uint16_t arg_count;
+  } call;
+  struct NodeCallEnd {
+    NodeId call;
+  } call_end;
   struct NodePhi {
     NodeId ctrl;
     NodeId left;
     NodeId right;
   } phi;
+  struct NodeSelect {
+    NodeId cond;
+    NodeId left;
+    NodeId right;
+  } select;
 } NodeValue;
 
 typedef struct {
@@ -135,6 +136,9 @@ typedef struct {
   NodeValue value;
   LinkId outputs;
   TypeTag type;
+  // Innermost loop the node was created in, where
+  // it runs when nothing moves it out
+  NodeId loop;
 } Node;
 
 #endif
@@ -3,8 +3,14 @@
 
 #include "tokenizer.h"
 #include "nodes.h"
+#include "arena.h"
+#include "pool.h"
+#include "trace.h"
+#include "profile.h"
 #include <stdint.h>
 #include <stdbool.h>
+#include <setjmp.h>
+#include <stdio.h>
 
 typedef struct {
   uint32_t start;
@@ -17,10 +23,141 @@ typedef struct {
   uint16_t elem_start;
 } Type;
 
+// What a failed statement rolls back to
 typedef struct {
+  uint16_t statement_start;
+  NodeId scope;
+  uint16_t var_count;
+  uint16_t var_len;
+  uint16_t var_offset;
+  NodeId ctrl;
+} Recovery;
+
+typedef enum {
+  FRAME_BLOCK,
+  FRAME_THEN,
+  FRAME_ELSE,
+  FRAME_LOOP,
+} FrameKind;
+
+// What the last dead code pass reclaimed
+typedef struct {
+  uint16_t node_count;
+  uint16_t link_count;
+} DeadStats;
+
+// What the last range pass decided
+typedef struct {
+  uint16_t folded_count;
+  // Divisions by a range that includes zero
+  uint16_t div_count;
+} RangeStats;
+
+// A slot of the graph as it was before an edit, see undo.c
+typedef enum {
+  UNDO_NODE,
+  UNDO_LINK,
+  UNDO_ARG,
+  UNDO_VAR,
+} UndoKind;
+
+typedef struct {
+  UndoKind kind;
+  uint16_t id;
+  union {
+    Node node;
+    Link link;
+    NodeId arg;
+    Var var;
+  } old;
+} UndoEntry;
+
+typedef struct {
+  UndoEntry *entry_arr;
+  uint32_t len;
+  uint32_t cap;
+  // Link slots at or past this weren't in use at any
+  // open checkpoint, nothing to restore in them
+  uint16_t link_floor;
+  // Open checkpoints
+  uint16_t depth;
+} UndoLog;
+
+// What a rollback returns to
+typedef struct {
+  uint32_t undo_len;
+  uint16_t node_len;
+  uint16_t link_len;
+  uint16_t arg_len;
+  uint16_t link_floor;
+} UndoMark;
+
+typedef struct Parser Parser;
+
+// Defined at the top level, with a graph of its own
+typedef struct {
+  Token name;
+  uint16_t param_count;
+  Parser *graph;
+  // Inlined into and optimized, kept that way
+  // by incremental parses that don't touch it
+  bool optimized;
+} Function;
+
+// A statement waiting for a nested one to finish
+typedef struct {
+  FrameKind kind;
+  union {
+    struct {
+      Token start;
+      // Value of the last statement
+      NodeId node;
+      // Set before each statement of the block
+      Recovery recovery;
+    } block;
+    struct {
+      NodeId node;
+      NodeId then_block;
+      NodeId else_block;
+      NodeId new_scope;
+      NodeId prev_scope;
+      uint16_t right_start;
+      uint16_t left_start;
+    } branch;
+    // Vars of the scope chain around a loop hold the loop
+    // node until the body touches them, a phi is made then
+    struct {
+      NodeId node;
+      NodeId exit;
+      // Copy of the chain with the values at the entry,
+      // and the phis once they're made
+      NodeId head;
+      NodeId scope;
+      NodeId prev_loop;
+      uint16_t depth;
+      uint16_t head_start;
+    } loop;
+  } value;
+} Frame;
+
+// Pending operator, prefix operators, `(` and calls
+// wait here for their operand to be finished
+typedef struct {
+  NodeTag op; // NODE_NONE for `(`, NODE_CALL for a call
+  uint8_t prec; // Binary operators only
+  bool prefix;
+  // The arguments so far are on the operand stack
+  uint16_t function;
+  uint16_t arg_start;
+} PendingOp;
+
+struct Parser {
 #define NULL_NODE ((NodeId)0)
 #define START_NODE ((NodeId)1)
 #define STOP_NODE ((NodeId)2)
+// Projection of START that `arg` reads in the program,
+// function parameters start there too
+#define PROGRAM_ARG 1
 #define MAX_NODES 256
   Node node_arr[MAX_NODES];
 #define NULL_LINK ((LinkId)0)
@@ -30,10 +167,26 @@ typedef struct {
   Var var_arr[MAX_VAR_DEPTH];
 #define MAX_TYPES 256
   Type type_arr[MAX_TYPES];
+  // Arguments of the calls
+#define MAX_ARGS 256
+  NodeId arg_arr[MAX_ARGS];
+  // Backs the scratch arena, passes take what they need from
+  // there and give it back before they return
+#define SCRATCH_SIZE (16 * 1024)
+  uint64_t scratch_buf[SCRATCH_SIZE / sizeof(uint64_t)];
+  Arena scratch;
   char filename_buffer[256];
 
   const char *source;
   const Token *token_arr;
+  Diagnostics *diag;
+  // Where the debug builtins write to
+  FILE *out;
+  // Where graph() dumps to, NULL when it doesn't
+  const char *graph_filename;
+  // Where to continue after a syntax error,
+  // set at every statement boundary
+  jmp_buf *recover;
   uint16_t node_len;
   uint16_t link_len;
   uint16_t var_len;
@@ -41,18 +194,73 @@ typedef struct {
   uint16_t scope_len;
   uint16_t type_len;
   uint16_t pos;
+  uint16_t arg_len;
+  // Statements waiting for a nested one, and what the
+  // expression being parsed has pending. Grown as deep as
+  // the input nests, every level takes a token at least.
+  // Kept across compiles, Parser_free gives them back
+  Frame *frame_arr;
+  uint16_t frame_len;
+  uint16_t frame_cap;
+  NodeId *operand_arr;
+  PendingOp *op_arr;
+  uint16_t expression_cap;
   NodeId scope;
-} Parser;
+  // Innermost loop being parsed
+  NodeId loop;
+  DeadStats dead;
+  RangeStats ranges;
+  // Ifs the last jump threading skipped for a side
+  uint16_t threaded;
+  // Ifs the last if-conversion turned into selects
+  uint16_t selects;
+  // Multiplications and divisions the last strength
+  // reduction turned into shifts
+  uint16_t reduced;
+  // Calls the last inlining pass replaced
+  uint16_t inlined;
+  // Nodes the rules of rewrite.rules replaced while parsing
+  uint16_t rewritten;
+  // Graphs of the functions, grown as they're defined
+#define MAX_FUNCTIONS 1024
+#define MAX_PARAMS 64
+#define MAX_INPUTS (MAX_PARAMS + 1)
+  // Slots past the length keep their graphs for the next
+  // functions defined, the ones never used have none
+  Function *function_arr;
+  uint16_t function_len;
+  uint16_t function_cap;
+  // The program a function belongs to,
+  // NULL when parsing the program itself
+  Parser *owner;
+  // Where the edits of the graph are recorded, NULL when
+  // they aren't. Each function graph has its own
+  Trace *trace;
+  // What the edits since the first open checkpoint
+  // overwrote, NULL when there's none
+  UndoLog *undo;
+};
 
 // parser.c
-NodeId parse(const char *source, const Token *tokens, Parser *p);
+extern const char *const GRAPH_FILENAME;
+void Parser_init(Parser *p, const char *source, const Token *tokens, Diagnostics *diag);
+void Parser_reset(Parser *p);
+void Parser_free(Parser *p);
+NodeId parse(const char *source, const Token *tokens, Diagnostics *diag, Parser *p);
 void print_nodes(const Parser *p);
+NORETURN void Parser_error(Parser *p, uint32_t start, uint16_t len, const char *fmt, ...);
 Token Parser_expect_token(Parser *p, TokenTag tag);
 
 // parser_nodes.c
+void Parser_trace(Parser *p, TraceKind kind, NodeId a, NodeId b);
+uint16_t Parser_input_slots(Parser *p, NodeId id, NodeId *slot_arr[MAX_INPUTS]);
+uint16_t Parser_node_inputs(const Parser *p, NodeId id, NodeId input_arr[MAX_INPUTS]);
+void Parser_reserve_links(Parser *p, uint16_t count);
 void Parser_add_node_output(Parser *p, NodeId user, NodeId used);
+LinkId Parser_unlink_output(Parser *p, NodeId user, NodeId used);
 void Parser_remove_node(Parser *p, NodeId id);
 void Parser_remove_output_node(Parser *p, NodeId user, NodeId used);
+void Parser_replace_node(Parser *p, NodeId old, NodeId new);
 NodeId Parser_create_node(Parser *p, Node node);
 NodeId Parser_create_constant(Parser *p, int64_t value);
 NodeId Parser_create_unary_node(Parser *p, NodeTag op, NodeId inner);
@@ -62,23 +270,142 @@ NodeId Parser_create_if_node(Parser *p, NodeId cond);
 NodeId Parser_create_region_node(Parser *p, NodeId left, NodeId right);
 NodeId Parser_create_return_node(Parser *p, NodeId value);
 NodeId Parser_create_phi_node(Parser *p, NodeId region, NodeId left, NodeId right);
+NodeId Parser_create_loop_node(Parser *p, NodeId entry);
+NodeId Parser_create_loop_phi(Parser *p, NodeId loop, NodeId entry);
+NodeId Parser_create_call(Parser *p, uint16_t function, const NodeId *arg_arr, uint16_t arg_count);
 
 // parser_vars.c
+void Parser_check_var_slots(Parser *p, uint16_t count);
 VarId Parser_resolve_var(Parser *p, uint32_t start, uint16_t len);
 VarId Parser_push_var(Parser *p, uint32_t start, uint16_t len, NodeId node);
 NodeId Parser_duplicate_scopes(Parser *p, uint16_t offset);
-void Parser_create_phi_nodes(Parser *p, uint16_t copy_start, NodeId ctrl, NodeId new_scope);
+void Parser_create_phi_nodes(Parser *p, uint16_t offset, NodeId ctrl, NodeId new_scope);
+void Parser_take_branch(Parser *p, uint16_t offset);
 void Parser_update_var(Parser *p, uint32_t start, uint16_t len, NodeId new_value);
+void Parser_set_var(Parser *p, NodeId scope, uint16_t index, NodeId node);
 void Parser_pop_scope(Parser *p);
 void Parser_push_scope(Parser *p);
 NodeId Parser_resolve_ctrl(Parser *p);
 void Parser_update_ctrl(Parser *p, NodeId new_ctrl);
+NodeId Parser_resolve_lazy(Parser *p, NodeId scope, uint16_t index);
+void Parser_open_loop(Parser *p, Frame *f, NodeId loop);
+void Parser_close_loop(Parser *p, Frame *f);
+void Parser_abandon_loop(Parser *p, Frame *f);
 
 // parser_expressions.c
+int64_t Parser_mulhi(int64_t l, int64_t r);
+int64_t Parser_sar(int64_t l, int64_t r);
+bool Parser_fold_value(NodeTag op, int64_t l, int64_t r, int64_t *out);
+int64_t Parser_fold_unary_value(NodeTag op, int64_t value);
+extern bool APPLY_REWRITES;
+bool Parser_cannot_trap(Parser *p, NodeId id);
 NodeId Parser_parse_expression(Parser *p);
 
+// rewrite.c, generated from rewrite.rules
+NodeId Parser_rewrite(Parser *p, NodeTag op, NodeId left, NodeId right);
+
 // parser_statements.c
-NodeId Parser_parse_statement(Parser *p);
+NodeId Parser_parse_statement(Parser *p, uint16_t base, bool resume);
+NodeId Parser_parse_statement_or_recover(Parser *p);
+void Parser_open_top_level(Parser *p);
+void Parser_close_top_level(Parser *p);
 NodeId Parser_parse_top_level(Parser *p);
 
+// functions.c
+extern uint32_t OPTIMIZE_THREADS;
+Parser *Parser_define_function(Parser *p, Token name, uint16_t param_count);
+const Function *Parser_find_function(const Parser *p, uint32_t start, uint16_t len);
+const Function *Parser_function(const Parser *p, uint16_t index);
+void Parser_truncate_functions(Parser *p, uint16_t len);
+void Parser_optimize(Parser *p);
+void Parser_optimize_all(Parser *p);
+void print_functions(const Parser *p);
+
+// undo.c
+void UndoLog_free(UndoLog *u);
+void Parser_save_node(Parser *p, NodeId id);
+void Parser_save_link(Parser *p, LinkId id);
+void Parser_save_arg(Parser *p, uint16_t index);
+void Parser_save_var(Parser *p, VarId id);
+UndoMark Parser_checkpoint(Parser *p);
+void Parser_commit(Parser *p, UndoMark mark);
+void Parser_rollback(Parser *p, UndoMark mark);
+
+// dce.c
+Bitset Parser_live_nodes(const Parser *p, Arena *a);
+DeadStats Parser_eliminate_dead(Parser *p);
+
+// inline.c
+extern uint32_t INLINE_BUDGET;
+void Parser_kill_node(Parser *p, NodeId id);
+bool Parser_inline_call(Parser *p, NodeId call);
+uint16_t Parser_inline_calls(Parser *p);
+
+// licm.c
+extern bool HOIST_INVARIANTS;
+void Parser_hoist_invariants(Parser *p);
+
+// ranges.c
+extern bool NARROW_RANGES;
+bool Parser_fold_if(Parser *p, NodeId id, bool holds);
+RangeStats Parser_narrow_ranges(Parser *p);
+
+// jumps.c
+extern bool THREAD_JUMPS;
+uint16_t Parser_thread_jumps(Parser *p);
+
+// select.c
+extern uint32_t SELECT_BUDGET;
+uint16_t Parser_convert_ifs(Parser *p);
+
+// strength.c
+extern bool REDUCE_STRENGTH;
+bool Parser_reduce_node(Parser *p, NodeId id);
+uint16_t Parser_reduce_strength(Parser *p);
+
+// eval.c
+typedef enum {
+  EVAL_OK,
+  EVAL_DIV_BY_ZERO,
+  EVAL_OUT_OF_FUEL,
+  EVAL_NO_RETURN,
+  EVAL_TOO_DEEP,
+} EvalStatus;
+
+typedef struct {
+  int64_t value[MAX_NODES];
+  uint32_t stamp[MAX_NODES];
+  // Per loop node, bumped every time its header is entered
+  uint32_t trip[MAX_NODES];
+  // Data nodes computed, cache hits not counted
+  uint64_t computed;
+  EvalStatus status;
+  // Values of the parameters, or of the program's `arg`
+  const int64_t *arg_arr;
+} Eval;
+
+#define MAX_CALL_DEPTH 256
+EvalStatus Parser_eval(const Parser *p, Eval *e, uint64_t fuel, int64_t arg, int64_t *result);
+
+// graphviz.c
+typedef enum {
+  GRAPH_FILTER_ALL,
+  GRAPH_FILTER_CTRL, // control skeleton only
+  GRAPH_FILTER_DATA, // data nodes only
+} GraphFilter;
+
+typedef struct {
+  GraphFilter filter;
+  // Only nodes at most `radius` edges away from `center`,
+  // whole graph when center is the null node
+  NodeId center;
+  uint16_t radius;
+  // Snapshot the graph and write it on a background thread
+  bool async;
+} GraphOptions;
+
+extern GraphOptions GRAPH_OPTIONS;
+void output_graphviz_file(const char *filename, const Parser *p, const GraphOptions *opt);
+void graphviz_wait(void);
+
 #endif // !INCLUDE_NODES
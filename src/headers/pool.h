@@ -0,0 +1,21 @@
+#ifndef INCLUDE_POOL
+#define INCLUDE_POOL
+
+#include <stdint.h>
+
+// Runs job number `job` on thread number `worker`,
+// every worker index is only ever used by one thread
+typedef void (*PoolJob)(void *ctx, uint32_t job, uint32_t worker);
+
+typedef struct Pool Pool;
+
+// Threads Pool_start would use for `job_count` jobs
+uint32_t Pool_worker_count(uint32_t job_count, uint32_t thread_count);
+// Starts the jobs [0, job_count) on background threads
+Pool *Pool_start(uint32_t job_count, uint32_t thread_count, PoolJob fn, void *ctx);
+// Waits for every job and frees the pool
+void Pool_join(Pool *pool);
+// Start and join, on the calling thread alone when one is enough
+void Pool_run(uint32_t job_count, uint32_t thread_count, PoolJob fn, void *ctx);
+
+#endif
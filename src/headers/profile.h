@@ -0,0 +1,58 @@
+#ifndef INCLUDE_PROFILE
+#define INCLUDE_PROFILE
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// What the compiler is doing, as a stack of phases every thread
+// keeps whether or not a profile is taken: a push is a store and
+// an add. With a profile, SIGPROF samples the stack of the thread
+// it lands on and counts every distinct stack
+typedef enum {
+  PHASE_TOKENIZE,
+  PHASE_PARSE,
+  PHASE_FUNCTION,
+  PHASE_STATEMENT,
+  PHASE_EXPRESSION,
+  PHASE_RESOLVE_VAR,
+  PHASE_FOLD,
+  PHASE_SCOPES,
+  PHASE_INLINE,
+  PHASE_OPTIMIZE,
+  PHASE_DCE,
+  PHASE_RANGES,
+  PHASE_JUMPS,
+  PHASE_SELECT,
+  PHASE_STRENGTH,
+  PHASE_LICM,
+  PHASE_GRAPHVIZ,
+  PHASE_EVAL,
+  PHASE_COUNT
+} ProfilePhase;
+
+extern const char *const PHASE_NAME[PHASE_COUNT];
+
+// Deeper phases are counted, not kept
+#define PROFILE_DEPTH 32
+
+typedef struct {
+  uint8_t phase_arr[PROFILE_DEPTH];
+  uint32_t depth;
+} PhaseStack;
+
+extern __thread PhaseStack PHASE_STACK;
+
+void Profile_push(ProfilePhase phase);
+void Profile_pop(void);
+// For code a longjmp can skip the pops of
+uint32_t Profile_depth(void);
+void Profile_unwind(uint32_t depth);
+
+// Arms the timer, false when it can't be
+bool Profile_start(void);
+// Disarms it and writes the stacks folded, a line of
+// `son;phase;phase count` each, as flamegraph scripts
+// take them. False when the file can't be written
+bool Profile_write(const char *filename, uint32_t *sample_count);
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef INCLUDE_SERVER
+#define INCLUDE_SERVER
+
+#include <stdint.h>
+
+// Wire format of the compile server. Native byte order,
+// the socket is local. A client can send any number of
+// requests without waiting, responses come back in order
+
+typedef enum {
+  SERVE_NODES,       // print_nodes text, diagnostics on error
+  SERVE_DIAGNOSTICS, // diagnostics only
+  SERVE_IR,          // ServeIrHeader, node_arr, link_arr
+} ServeKind;
+
+typedef struct {
+  uint32_t len; // source bytes that follow
+  uint32_t kind;
+} ServeRequest;
+
+typedef struct {
+  uint32_t len; // payload bytes that follow
+  uint32_t error_count;
+  // Time waiting for a worker and inside the compiler
+  uint64_t queue_ns;
+  uint64_t compile_ns;
+} ServeResponse;
+
+typedef struct {
+  uint16_t node_len;
+  uint16_t link_len;
+} ServeIrHeader;
+
+#define SERVE_MAX_REQUEST (1 << 20)
+
+// server.c
+void serve(const char *path, uint32_t thread_count);
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef INCLUDE_SON
+#define INCLUDE_SON
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Everything one compile needs, allocated once
+// and reused by every son_compile call
+typedef struct SonContext SonContext;
+// What a compile made, the program and its functions.
+// Owned by the context or document it came from
+typedef struct SonGraph SonGraph;
+
+// Returns NULL when out of memory
+SonContext *son_context_new(void);
+void son_context_free(SonContext *ctx);
+// Cost is proportional to what the last compile used
+void son_context_reset(SonContext *ctx);
+// The source has to outlive the results. Returns the
+// number of errors, 0 when the program compiled
+uint32_t son_compile(SonContext *ctx, const char *src, uint32_t len);
+// Where `nodes()` and friends print, stdout by default
+void son_context_set_output(SonContext *ctx, FILE *out);
+// Where `graph()` dumps to, out/graph.dot by default.
+// NULL turns the dumps off
+void son_context_set_graph_file(SonContext *ctx, const char *filename);
+void son_print_diagnostics(const SonContext *ctx, FILE *out);
+// Graph of the last compile, valid until the next one
+const SonGraph *son_graph(const SonContext *ctx);
+
+// An edited source, compiled once by son_document_set and
+// then reparsed from a checkpoint by son_document_edit. Only
+// the tokens the edit touches are lexed again, parsing resumes
+// at the last checkpoint before them and goes on to the end,
+// then the whole program is optimized again. Nothing after the
+// edit is reused, later statements see the values of earlier
+// ones. An edit costs the parse of the rest of the file from
+// that checkpoint plus a full optimize, not the size of the
+// edit. Edits near the end are the cheap ones
+typedef struct SonDocument SonDocument;
+
+// Returns NULL when out of memory
+SonDocument *son_document_new(void);
+void son_document_free(SonDocument *doc);
+void son_document_set_output(SonDocument *doc, FILE *out);
+// The source is copied into the document
+void son_document_set(SonDocument *doc, const char *src, uint32_t len);
+// Replaces `removed` bytes at `offset` with `inserted`,
+// returns the number of errors of the edited source
+uint32_t son_document_edit(SonDocument *doc, uint32_t offset, uint32_t removed,
+    const char *inserted, uint32_t inserted_len);
+uint32_t son_document_error_count(const SonDocument *doc);
+void son_document_print_diagnostics(const SonDocument *doc, FILE *out);
+const char *son_document_source(const SonDocument *doc, uint32_t *len);
+const SonGraph *son_document_graph(const SonDocument *doc);
+
+// Live nodes, those of the functions included
+uint32_t son_graph_node_count(const SonGraph *graph);
+uint16_t son_graph_function_count(const SonGraph *graph);
+// The nodes of the program, then of each function, to the
+// output of the context or document, as `nodes()` prints them
+void son_graph_print(const SonGraph *graph);
+
+#endif
@@ -17,6 +17,7 @@ typedef enum {
   TOK_GE,
   TOK_LE,
   TOK_SEMICOLON,
+  TOK_COMMA,
   TOK_LBRACE,
   TOK_RBRACE,
   TOK_LPAREN,
@@ -36,6 +37,8 @@ typedef enum {
   TOK_FALSE,
   TOK_IF,
   TOK_ELSE,
+  TOK_WHILE,
+  TOK_ARG,
   // Debug keywords
   // TODO: maybe add special flag for them
 #define KEYWORDS_COUNT (TOK_COUNT - TOK_RETURN)
@@ -43,36 +46,7 @@ typedef enum {
   TOK_COUNT,
 } TokenTag;
 
-// NOTE: using array intilizers, to not update them
-// when we change the order
-const char *TOK_NAMES[TOK_COUNT] = {
-  [TOK_NONE] = "<none>",
-  [TOK_IDENT] = "<identfier>",
-  [TOK_RETURN] = "return",
-  [TOK_DECIMAL] = "<decimal>",
-  [TOK_SEMICOLON] = ";",
-  [TOK_PLUS] = "+",
-  [TOK_MINUS] = "-",
-  [TOK_STAR] = "*",
-  [TOK_SLASH] = "/",
-  [TOK_LBRACE] = "{",
-  [TOK_RBRACE] = "}",
-  [TOK_INT] = "int",
-  [TOK_EQ] = "=",
-  [TOK_LPAREN] = "(",
-  [TOK_RPAREN] = ")",
-  [TOK_BANG] = "!",
-  [TOK_LT] = "<",
-  [TOK_GT] = ">",
-  [TOK_DEQ] = "==",
-  [TOK_NE] = "!=",
-  [TOK_GE] = ">=",
-  [TOK_LE] = "<=",
-  [TOK_TRUE] = "true",
-  [TOK_FALSE] = "false",
-  [TOK_IF] = "if",
-  [TOK_ELSE] = "else",
-};
+extern const char *const TOK_NAMES[TOK_COUNT];
 
 typedef struct {
   TokenTag tag;
@@ -80,9 +54,10 @@ typedef struct {
   uint32_t start;
 } Token;
 
-#define MAX_TOKENS 256
+#define MAX_TOKENS (1 << 13)
 
-void tokenize(const char *source, Token token_arr[MAX_TOKENS]);
+bool lex_token(const char *source, uint32_t len, uint32_t *offset, Token *tok, Diagnostics *diag);
+void tokenize(const char *source, uint32_t len, Token token_arr[MAX_TOKENS], Diagnostics *diag);
 void print_tokens(const Token *token_arr);
 
 #endif
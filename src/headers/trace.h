@@ -0,0 +1,65 @@
+#ifndef INCLUDE_TRACE
+#define INCLUDE_TRACE
+
+#include "nodes.h"
+#include <stdint.h>
+#include <stdio.h>
+
+// Edits of one graph, in the order they happened. Events
+// fill a fixed buffer that is written out whenever it wraps
+// around, so recording costs a store and a compare. The file
+// starts with TRACE_MAGIC, the version and the event size,
+// then chunks of a TraceChunk and its events. Chunks of
+// different graphs interleave, those of one are in order
+typedef enum {
+  // a: the node, tag and value what it is from now on.
+  // Also for nodes changed in place
+  TRACE_CREATE_NODE,
+  // a: user, b: used
+  TRACE_ADD_OUTPUT,
+  TRACE_REMOVE_OUTPUT,
+  // a: the node, taken out along with its edges
+  TRACE_REMOVE_NODE,
+  // The graph is back to what it was at the
+  // checkpoint the rollback closes
+  TRACE_CHECKPOINT,
+  TRACE_COMMIT,
+  TRACE_ROLLBACK,
+  TRACE_KIND_COUNT
+} TraceKind;
+
+typedef struct {
+  uint8_t kind;
+  uint8_t tag;
+  NodeId a;
+  NodeId b;
+  NodeValue value;
+} TraceEvent;
+
+typedef struct {
+  // 0 for the program, function i is i + 1
+  uint16_t graph;
+  uint16_t reserved;
+  uint32_t len;
+} TraceChunk;
+
+#define TRACE_MAGIC "SONTRACE"
+#define TRACE_VERSION 2
+#define TRACE_EVENTS 4096
+
+typedef struct {
+  FILE *fp;
+  uint16_t graph;
+  uint32_t len;
+  TraceEvent event_arr[TRACE_EVENTS];
+} Trace;
+
+// Writes the file header, NULL when it can't be opened
+FILE *Trace_open(const char *filename);
+Trace *Trace_new(FILE *fp, uint16_t graph);
+void Trace_push(Trace *t, TraceEvent event);
+void Trace_flush(Trace *t);
+// Flushes first, NULL is fine
+void Trace_free(Trace *t);
+
+#endif
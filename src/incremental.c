@@ -0,0 +1,291 @@
+#include "parser.h"
+#include "son.h"
+
+// Reparse from checkpoint: an edit rolls the parser back to
+// the last checkpoint before it and parses on to the end.
+// Nothing after the edit is spliced back in, the graph holds
+// at most MAX_NODES nodes so the rest is never long.
+//
+// Parser state between two top level statements. Only the
+// used prefixes of the node and link arenas are copied, the
+// vars are copied whole since scopes left behind by a syntax
+// error can still point past var_len
+typedef struct {
+  uint16_t pos;
+  uint16_t node_len;
+  uint16_t link_len;
+  uint16_t var_len;
+  uint16_t var_offset;
+  uint16_t arg_len;
+  NodeId scope;
+  // Functions defined before, their graphs are done
+  uint16_t function_len;
+  uint32_t text_len;
+  uint16_t diag_len;
+  uint16_t error_count;
+  uint16_t dropped_count;
+  Node node_arr[MAX_NODES];
+  Link link_arr[MAX_LINKS];
+  Var var_arr[MAX_VAR_DEPTH];
+  NodeId arg_arr[MAX_ARGS];
+} Checkpoint;
+
+struct SonDocument {
+  Parser parser;
+  Token token_arr[MAX_TOKENS];
+  // Tokens after the edit while the damaged range is re-lexed
+  Token old_token_arr[MAX_TOKENS];
+  uint16_t token_len;
+  Diagnostics lex_diag;
+  Diagnostics diag;
+  char *source;
+  uint32_t source_len;
+  uint32_t source_cap;
+  FILE *out;
+  // At top level statement boundaries, the first at the start
+  // and then one every CHECKPOINT_STRIDE (128) tokens or more,
+  // plus one at the end
+#define MAX_CHECKPOINTS 64
+#define CHECKPOINT_STRIDE (MAX_TOKENS / MAX_CHECKPOINTS)
+  Checkpoint checkpoint_arr[MAX_CHECKPOINTS];
+  uint16_t checkpoint_len;
+  bool used;
+};
+
+SonDocument *son_document_new(void) {
+  SonDocument *doc = calloc(1, sizeof(SonDocument));
+  if (doc) doc->out = stdout;
+  return doc;
+}
+
+void son_document_free(SonDocument *doc) {
+  if (!doc) return;
+  Parser_free(&doc->parser);
+  free(doc->source);
+  free(doc);
+}
+
+void son_document_set_output(SonDocument *doc, FILE *out) {
+  doc->out = out;
+  doc->parser.out = out;
+}
+
+void SonDocument_save(SonDocument *doc, Checkpoint *cp) {
+  Parser *p = &doc->parser;
+  cp->pos = p->pos;
+  cp->node_len = p->node_len;
+  cp->link_len = p->link_len;
+  cp->var_len = p->var_len;
+  cp->var_offset = p->var_offset;
+  cp->arg_len = p->arg_len;
+  cp->scope = p->scope;
+  cp->function_len = p->function_len;
+  cp->text_len = doc->diag.text_len;
+  cp->diag_len = doc->diag.diag_len;
+  cp->error_count = doc->diag.error_count;
+  cp->dropped_count = doc->diag.dropped_count;
+  memcpy(cp->node_arr, p->node_arr, p->node_len * sizeof(Node));
+  memcpy(cp->link_arr, p->link_arr, p->link_len * sizeof(Link));
+  memcpy(cp->var_arr, p->var_arr, sizeof(p->var_arr));
+  memcpy(cp->arg_arr, p->arg_arr, p->arg_len * sizeof(NodeId));
+}
+
+// Later checkpoints are dropped, the statements
+// after this one are going to be parsed again
+void SonDocument_restore(SonDocument *doc, uint16_t index) {
+  assert(index < doc->checkpoint_len);
+  Checkpoint *cp = &doc->checkpoint_arr[index];
+  Parser *p = &doc->parser;
+  p->pos = cp->pos;
+  p->node_len = cp->node_len;
+  p->link_len = cp->link_len;
+  p->var_len = cp->var_len;
+  p->var_offset = cp->var_offset;
+  p->arg_len = cp->arg_len;
+  p->scope = cp->scope;
+  p->recover = NULL;
+  Parser_truncate_functions(p, cp->function_len);
+  memcpy(p->node_arr, cp->node_arr, cp->node_len * sizeof(Node));
+  memcpy(p->link_arr, cp->link_arr, cp->link_len * sizeof(Link));
+  memcpy(p->var_arr, cp->var_arr, sizeof(p->var_arr));
+  // Inlining rewires arguments of the calls before
+  memcpy(p->arg_arr, cp->arg_arr, cp->arg_len * sizeof(NodeId));
+  doc->diag.text_len = cp->text_len;
+  doc->diag.diag_len = cp->diag_len;
+  doc->diag.error_count = cp->error_count;
+  doc->diag.dropped_count = cp->dropped_count;
+  doc->checkpoint_len = index + 1;
+}
+
+// Parses from the current position to the end, leaving a
+// checkpoint every CHECKPOINT_STRIDE tokens. It doesn't stop
+// where the tokens line up with the old ones again: the scope
+// there holds values of the edited statements, so what comes
+// after can't be kept
+void SonDocument_parse_rest(SonDocument *doc) {
+  Parser *p = &doc->parser;
+  assert(doc->checkpoint_len);
+  while (p->token_arr[p->pos].tag != TOK_NONE) {
+    Checkpoint *last = &doc->checkpoint_arr[doc->checkpoint_len - 1];
+    if (doc->checkpoint_len < MAX_CHECKPOINTS && p->pos - last->pos >= CHECKPOINT_STRIDE) {
+      SonDocument_save(doc, &doc->checkpoint_arr[doc->checkpoint_len++]);
+    }
+    Parser_parse_statement_or_recover(p);
+  }
+  // Typing at the end of the file is the common case
+  Checkpoint *last = &doc->checkpoint_arr[doc->checkpoint_len - 1];
+  if (last->pos != p->pos) {
+    if (doc->checkpoint_len < MAX_CHECKPOINTS) doc->checkpoint_len++;
+    SonDocument_save(doc, &doc->checkpoint_arr[doc->checkpoint_len - 1]);
+  }
+  Parser_close_top_level(p);
+  Parser_optimize_all(p);
+  graphviz_wait();
+}
+
+void SonDocument_tokenize(SonDocument *doc) {
+  Diagnostics_reset(&doc->lex_diag);
+  tokenize(doc->source, doc->source_len, doc->token_arr, &doc->lex_diag);
+  uint16_t len = 0;
+  while (doc->token_arr[len].tag) len++;
+  doc->token_len = len;
+}
+
+// Re-lexes from the first token the edit touches until the new
+// tokens line up with the old ones again, the rest only gets
+// shifted. Returns the index of the first token that may differ
+uint16_t SonDocument_relex(SonDocument *doc, uint32_t offset, uint32_t removed, uint32_t inserted_len) {
+  uint16_t old_len = doc->token_len;
+  uint16_t first = 0;
+  while (first < old_len && doc->token_arr[first].start + doc->token_arr[first].len < offset) first++;
+  // Positions of lexer errors would have to be shifted too
+  if (doc->lex_diag.error_count) {
+    SonDocument_tokenize(doc);
+    return first;
+  }
+
+  // Tokens end where the next one can start, so
+  // the gap before the edit is lexed again
+  uint32_t pos = first ? doc->token_arr[first - 1].start + doc->token_arr[first - 1].len : 0;
+  // Including EOF
+  uint16_t old_count = old_len - first + 1;
+  memcpy(doc->old_token_arr, &doc->token_arr[first], old_count * sizeof(Token));
+  int64_t delta = (int64_t)inserted_len - removed;
+  uint32_t new_edit_end = offset + inserted_len;
+  uint32_t old_edit_end = offset + removed;
+
+  uint16_t len = first, old = 0;
+  bool synced = false, overflow = false;
+  Token tok;
+  while (lex_token(doc->source, doc->source_len, &pos, &tok, &doc->lex_diag)) {
+    if (tok.start >= new_edit_end) {
+      while (old < old_count - 1 && (doc->old_token_arr[old].start < old_edit_end ||
+          doc->old_token_arr[old].start + delta < tok.start)) old++;
+      Token prev = doc->old_token_arr[old];
+      if (old < old_count - 1 && prev.start + delta == tok.start &&
+          prev.tag == tok.tag && prev.len == tok.len) {
+        synced = true;
+        break;
+      }
+    }
+    if (len == MAX_TOKENS - 1) {
+      overflow = true;
+      break;
+    }
+    doc->token_arr[len++] = tok;
+  }
+  if (doc->lex_diag.error_count || overflow ||
+      (synced && len + old_count - old > MAX_TOKENS)) {
+    SonDocument_tokenize(doc);
+    return first;
+  }
+
+  if (synced) {
+    for (; old < old_count; ++old) {
+      Token shifted = doc->old_token_arr[old];
+      shifted.start += delta;
+      doc->token_arr[len++] = shifted;
+    }
+    len--;
+  } else {
+    doc->token_arr[len] = (Token){ .start = pos };
+  }
+  doc->token_len = len;
+  return first;
+}
+
+void son_document_set(SonDocument *doc, const char *src, uint32_t len) {
+  if (len > doc->source_cap) {
+    char *source = realloc(doc->source, len);
+    assert(source);
+    doc->source = source;
+    doc->source_cap = len;
+  }
+  if (len) memcpy(doc->source, src, len);
+  doc->source_len = len;
+
+  if (doc->used) Parser_reset(&doc->parser);
+  doc->used = true;
+  Diagnostics_reset(&doc->diag);
+  SonDocument_tokenize(doc);
+  Parser *p = &doc->parser;
+  Parser_init(p, doc->source, doc->token_arr, &doc->diag);
+  p->out = doc->out;
+  Parser_open_top_level(p);
+  doc->checkpoint_len = 1;
+  SonDocument_save(doc, &doc->checkpoint_arr[0]);
+  SonDocument_parse_rest(doc);
+}
+
+uint32_t son_document_edit(SonDocument *doc, uint32_t offset, uint32_t removed,
+    const char *inserted, uint32_t inserted_len) {
+  assert(doc->used);
+  assert(offset <= doc->source_len && removed <= doc->source_len - offset);
+  uint32_t new_len = doc->source_len - removed + inserted_len;
+  if (new_len > doc->source_cap) {
+    uint32_t cap = MAX(new_len, doc->source_cap * 2);
+    char *source = realloc(doc->source, cap);
+    assert(source);
+    doc->source = source;
+    doc->source_cap = cap;
+  }
+  char *tail = &doc->source[offset + removed];
+  memmove(&doc->source[offset + inserted_len], tail, doc->source_len - offset - removed);
+  if (inserted_len) memcpy(&doc->source[offset], inserted, inserted_len);
+  doc->source_len = new_len;
+  doc->parser.source = doc->source;
+  for (uint16_t i = 0; i < doc->parser.function_len; ++i) {
+    doc->parser.function_arr[i].graph->source = doc->source;
+  }
+
+  uint16_t damaged = SonDocument_relex(doc, offset, removed, inserted_len);
+  // A statement peeks one token past its end, the
+  // checkpoint has to be strictly before the damage
+  uint16_t index = doc->checkpoint_len - 1;
+  while (index && doc->checkpoint_arr[index].pos >= damaged) index--;
+  SonDocument_restore(doc, index);
+  SonDocument_parse_rest(doc);
+  return doc->lex_diag.error_count + doc->diag.error_count;
+}
+
+uint32_t son_document_error_count(const SonDocument *doc) {
+  return doc->lex_diag.error_count + doc->diag.error_count;
+}
+
+void son_document_print_diagnostics(const SonDocument *doc, FILE *out) {
+  if (!doc->lex_diag.diag_len && !doc->diag.diag_len) return;
+  LineIndex lines;
+  LineIndex_build(&lines, doc->source, doc->source_len);
+  Diagnostics_print(out, &doc->lex_diag, &lines);
+  Diagnostics_print(out, &doc->diag, &lines);
+  LineIndex_free(&lines);
+}
+
+const char *son_document_source(const SonDocument *doc, uint32_t *len) {
+  *len = doc->source_len;
+  return doc->source;
+}
+
+const SonGraph *son_document_graph(const SonDocument *doc) {
+  return (const SonGraph *)&doc->parser;
+}
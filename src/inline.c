@@ -0,0 +1,216 @@
+#include "parser.h"
+
+// Copies the graph of a small enough callee in place of the
+// call. The parameters become the arguments, the returns are
+// merged with a region and a phi for the result. Calls copied
+// along aren't inlined again, recursion stops after one level
+uint32_t INLINE_BUDGET = 32;
+
+// What copying `callee` in would take, false if it can't be
+typedef struct {
+  uint16_t node_count;
+  uint16_t link_count;
+  uint16_t arg_count;
+  uint16_t return_count;
+} InlineCost;
+
+bool Parser_inline_cost(const Parser *callee, const Bitset *live, InlineCost *cost) {
+  *cost = (InlineCost){0};
+  for (NodeId i = START_NODE; i < callee->node_len; ++i) {
+    if (!Bitset_get(live, i)) continue;
+    const Node *node = &callee->node_arr[i];
+    NodeId input_arr[MAX_INPUTS];
+    switch (node->tag) {
+      case NODE_START:
+      case NODE_STOP:
+        continue;
+      case NODE_PROJ:
+        if (node->value.proj.ctrl == START_NODE) continue;
+        break;
+      case NODE_RETURN:
+        // Control carrying on after a return
+        // would need a path that never runs
+        for (LinkId link = node->outputs; link; link = callee->link_arr[link].next) {
+          if (callee->link_arr[link].node != STOP_NODE) return false;
+        }
+        cost->return_count++;
+        continue;
+      case NODE_CALL:
+        cost->arg_count += node->value.call.arg_count;
+        break;
+      default: break;
+    }
+    cost->node_count++;
+    cost->link_count += Parser_node_inputs(callee, i, input_arr);
+  }
+  // One that never returns keeps its call
+  if (!cost->return_count) return false;
+  return cost->node_count <= INLINE_BUDGET;
+}
+
+// The call's end and its projections
+void Parser_call_projs(const Parser *p, NodeId call, NodeId *end, NodeId *ctrl, NodeId *result) {
+  *end = *ctrl = *result = 0;
+  for (LinkId link = p->node_arr[call].outputs; link; link = p->link_arr[link].next) {
+    NodeId user = p->link_arr[link].node;
+    if (p->node_arr[user].tag == NODE_CALL_END) *end = user;
+  }
+  assert(*end);
+  for (LinkId link = p->node_arr[*end].outputs; link; link = p->link_arr[link].next) {
+    NodeId user = p->link_arr[link].node;
+    if (p->node_arr[user].tag != NODE_PROJ) continue;
+    if (p->node_arr[user].value.proj.select) *result = user;
+    else *ctrl = user;
+  }
+}
+
+// Unlinks the node from its inputs and takes it
+// out, whatever still uses it has to be rewired first
+void Parser_kill_node(Parser *p, NodeId id) {
+  NodeId input_arr[MAX_INPUTS];
+  uint16_t input_len = Parser_node_inputs(p, id, input_arr);
+  for (uint16_t i = 0; i < input_len; ++i) Parser_unlink_output(p, id, input_arr[i]);
+  if (p->trace) Parser_trace(p, TRACE_REMOVE_NODE, id, 0);
+  if (p->undo) Parser_save_node(p, id);
+  p->node_arr[id].tag = NODE_NONE;
+  p->node_arr[id].outputs = 0;
+}
+
+// Returns whether the call was replaced
+bool Parser_inline_call(Parser *p, NodeId call) {
+  struct NodeCall site = p->node_arr[call].value.call;
+  const Parser *callee = Parser_function(p, site.function)->graph;
+  if (callee == p) return false;
+  NodeId end, ctrl_proj, result_proj;
+  Parser_call_projs(p, call, &end, &ctrl_proj, &result_proj);
+
+  ArenaMark mark = Arena_mark(&p->scratch);
+  Bitset live = Parser_live_nodes(callee, &p->scratch);
+  InlineCost cost;
+  bool fits = Parser_inline_cost(callee, &live, &cost);
+  // The merge takes a region and a phi per extra
+  // return, and a bare return a constant
+  uint16_t merge_count = cost.return_count - 1;
+  uint32_t link_count = cost.link_count + 5 * merge_count;
+  if (!fits || p->node_len + cost.node_count + 2 * merge_count + cost.return_count > MAX_NODES ||
+      p->link_len + link_count > MAX_LINKS || p->arg_len + cost.arg_count > MAX_ARGS) {
+    Arena_release(&p->scratch, mark);
+    return false;
+  }
+
+  // Callee node to caller node
+  NodeId *map = Arena_alloc_zero(&p->scratch, callee->node_len * sizeof(NodeId));
+  NodeId loop = p->node_arr[call].loop;
+  map[START_NODE] = site.ctrl;
+  NodeId first = p->node_len;
+  for (NodeId i = START_NODE + 1; i < callee->node_len; ++i) {
+    if (!Bitset_get(&live, i)) continue;
+    Node node = callee->node_arr[i];
+    switch (node.tag) {
+      case NODE_STOP:
+      case NODE_RETURN:
+        continue;
+      case NODE_PROJ:
+        if (node.value.proj.ctrl != START_NODE) break;
+        map[i] = p->arg_arr[site.arg_start + node.value.proj.select - 1];
+        continue;
+      case NODE_CALL:
+        memcpy(&p->arg_arr[p->arg_len], &callee->arg_arr[node.value.call.arg_start],
+          node.value.call.arg_count * sizeof(NodeId));
+        node.value.call.arg_start = p->arg_len;
+        p->arg_len += node.value.call.arg_count;
+        break;
+      default: break;
+    }
+    node.outputs = 0;
+    // Loops of the callee are nested in the one of the call
+    node.loop = node.loop ? map[node.loop] : loop;
+    map[i] = p->node_len++;
+    if (p->undo) Parser_save_node(p, map[i]);
+    p->node_arr[map[i]] = node;
+  }
+  // Inputs can be phi back edges, made after their users
+  for (NodeId id = first; id < p->node_len; ++id) {
+    NodeId *slot_arr[MAX_INPUTS];
+    uint16_t slot_len = Parser_input_slots(p, id, slot_arr);
+    for (uint16_t i = 0; i < slot_len; ++i) {
+      if (!*slot_arr[i]) continue;
+      *slot_arr[i] = map[*slot_arr[i]];
+      Parser_add_node_output(p, id, *slot_arr[i]);
+    }
+    // Once its inputs are the caller's
+    if (p->trace) Parser_trace(p, TRACE_CREATE_NODE, id, 0);
+  }
+
+  // Returns merge pairwise, a bare `return;` gives zero
+  NodeId ctrl = 0, value = 0;
+  NodeId prev_loop = p->loop;
+  p->loop = loop;
+  for (NodeId i = START_NODE; i < callee->node_len; ++i) {
+    if (!Bitset_get(&live, i) || callee->node_arr[i].tag != NODE_RETURN) continue;
+    struct NodeReturn ret = callee->node_arr[i].value.ret;
+    NodeId ret_ctrl = map[ret.predecessor];
+    NodeId ret_value = ret.value ? map[ret.value] : Parser_create_constant(p, 0);
+    if (!ctrl) {
+      ctrl = ret_ctrl;
+      value = ret_value;
+      continue;
+    }
+    ctrl = Parser_create_region_node(p, ctrl, ret_ctrl);
+    value = Parser_create_phi_node(p, ctrl, value, ret_value);
+  }
+  p->loop = prev_loop;
+
+  if (result_proj) Parser_replace_node(p, result_proj, value);
+  Parser_replace_node(p, ctrl_proj, ctrl);
+  if (result_proj) Parser_kill_node(p, result_proj);
+  Parser_kill_node(p, ctrl_proj);
+  Parser_kill_node(p, end);
+  Parser_kill_node(p, call);
+  Arena_release(&p->scratch, mark);
+  return true;
+}
+
+// Arithmetic on the constants the arguments brought in,
+// repeated until nothing changes. Stops early when the
+// graph is out of nodes, what's left is still correct
+void Parser_fold_constants(Parser *p) {
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (NodeId id = START_NODE; id < p->node_len; ++id) {
+      Node node = p->node_arr[id];
+      int64_t value;
+      if (node.tag >= NODE_BINARY_START && node.tag != NODE_MINUS && node.tag != NODE_NOT) {
+        Node left = p->node_arr[node.value.binary.left];
+        Node right = p->node_arr[node.value.binary.right];
+        if (left.tag != NODE_CONSTANT || right.tag != NODE_CONSTANT ||
+            !Parser_fold_value(node.tag, left.value.i64, right.value.i64, &value)) continue;
+      } else if (node.tag == NODE_MINUS || node.tag == NODE_NOT) {
+        Node inner = p->node_arr[node.value.unary.node];
+        if (inner.tag != NODE_CONSTANT) continue;
+        value = node.tag == NODE_NOT ? !inner.value.i64 : (int64_t)(0 - (uint64_t)inner.value.i64);
+      } else {
+        continue;
+      }
+      if (p->node_len == MAX_NODES) return;
+      Parser_replace_node(p, id, Parser_create_constant(p, value));
+      changed = true;
+    }
+  }
+}
+
+// Calls that were there before, in the order they were made.
+// Returns how many got inlined
+uint16_t Parser_inline_calls(Parser *p) {
+  if (!INLINE_BUDGET) return 0;
+  Profile_push(PHASE_INLINE);
+  uint16_t count = 0;
+  NodeId node_len = p->node_len;
+  for (NodeId id = START_NODE; id < node_len; ++id) {
+    if (p->node_arr[id].tag == NODE_CALL && Parser_inline_call(p, id)) count++;
+  }
+  if (count) Parser_fold_constants(p);
+  Profile_pop();
+  return count;
+}
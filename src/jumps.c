@@ -0,0 +1,332 @@
+#include "parser.h"
+
+// An if right after a region, on a condition the phis of that
+// region decide for one of its sides, is skipped by that side:
+// it goes straight to the projection it would take. A flag set
+// in one if and tested by the next is the usual case. Values of
+// the phis still used past the if are split by where the use
+// sits: behind the projection a side was sent to it's what that
+// side brings, behind the merge of both projections a new phi
+bool THREAD_JUMPS = true;
+
+// Nodes computed from the phis
+#define THREAD_BUDGET 8
+// Levels of the condition computed for a side
+#define THREAD_DEPTH 4
+
+// Where control is, relative to the if being threaded
+typedef enum {
+  THREAD_UNSEEN,
+  // Behind the projection the left side, or the known one, takes
+  THREAD_TAKEN,
+  // Behind the other projection, or at the if
+  THREAD_OTHER,
+  // Behind the merge of both projections
+  THREAD_MERGE,
+  // Not behind the if, nothing there reads the phis
+  THREAD_BEFORE,
+  THREAD_FAIL,
+} ThreadPlace;
+
+#define THREAD_PLACES 3
+
+// A use of the phis that sits in control
+typedef struct {
+  NodeId user;
+  uint16_t slot;
+  ThreadPlace place;
+} ThreadUse;
+
+typedef struct {
+  NodeId region, id, taken, other;
+  // Region both projections come together in, if any,
+  // and where its sides are, as they were before threading
+  NodeId merge;
+  ThreadPlace merge_left, merge_right;
+  // Region of the known side and the taken projection,
+  // not made when both sides go to their own projection
+  NodeId join;
+  // The side of the region that goes to `taken`
+  bool left;
+  uint8_t *place_arr;
+  // Phis of the region and what's computed from them
+  Bitset cone;
+  NodeId *value_arr[THREAD_PLACES];
+} Thread;
+
+// Value of `id` when control comes into `region`
+// from the `left` side, false when it isn't known
+bool Parser_side_value(const Parser *p, NodeId id, NodeId region, bool left, uint8_t depth, int64_t *value) {
+  Node node = p->node_arr[id];
+  int64_t l, r;
+  switch (node.tag) {
+    case NODE_CONSTANT:
+      *value = node.value.i64;
+      return true;
+    case NODE_PHI:
+      if (node.value.phi.ctrl != region || !depth) return false;
+      return Parser_side_value(p, left ? node.value.phi.left : node.value.phi.right, region, left, depth - 1, value);
+    case NODE_MINUS:
+    case NODE_NOT:
+      if (!depth || !Parser_side_value(p, node.value.unary.node, region, left, depth - 1, &l)) return false;
+      *value = node.tag == NODE_NOT ? !l : (int64_t)(0 - (uint64_t)l);
+      return true;
+    default:
+      if (node.tag < NODE_BINARY_START || !depth) return false;
+      return Parser_side_value(p, node.value.binary.left, region, left, depth - 1, &l) &&
+        Parser_side_value(p, node.value.binary.right, region, left, depth - 1, &r) &&
+        Parser_fold_value(node.tag, l, r, value);
+  }
+}
+
+// The projection of the if taken when its condition is `holds`
+NodeId Parser_if_proj(const Parser *p, NodeId id, bool holds) {
+  for (LinkId link = p->node_arr[id].outputs; link; link = p->link_arr[link].next) {
+    NodeId user = p->link_arr[link].node;
+    if (p->node_arr[user].tag == NODE_PROJ && (p->node_arr[user].value.proj.select == 0) == holds) return user;
+  }
+  return 0;
+}
+
+// Where `ctrl` is, walking up to the if. Only one region
+// can merge the projections, a second one fails
+ThreadPlace Thread_place(Thread *t, const Parser *p, NodeId ctrl) {
+  if (ctrl == t->taken) return THREAD_TAKEN;
+  if (ctrl == t->other || ctrl == t->id) return THREAD_OTHER;
+  if (ctrl == t->region) return THREAD_FAIL;
+  if (t->place_arr[ctrl]) return t->place_arr[ctrl];
+  Node node = p->node_arr[ctrl];
+  ThreadPlace place = THREAD_FAIL;
+  switch (node.tag) {
+    case NODE_START: place = THREAD_BEFORE; break;
+    case NODE_RETURN: place = Thread_place(t, p, node.value.binary.left); break;
+    case NODE_IF: place = Thread_place(t, p, node.value.if_.ctrl); break;
+    case NODE_PROJ: place = Thread_place(t, p, node.value.proj.ctrl); break;
+    case NODE_CALL: place = Thread_place(t, p, node.value.call.ctrl); break;
+    case NODE_CALL_END: place = Thread_place(t, p, node.value.call_end.call); break;
+    // The back edge comes from inside the loop
+    case NODE_LOOP: place = Thread_place(t, p, node.value.region.left_block); break;
+    case NODE_REGION: {
+      ThreadPlace l = Thread_place(t, p, node.value.region.left_block);
+      ThreadPlace r = Thread_place(t, p, node.value.region.right_block);
+      if (l == THREAD_FAIL || r == THREAD_FAIL) place = THREAD_FAIL;
+      else if (l == r) place = l;
+      else if (l == THREAD_BEFORE || r == THREAD_BEFORE) place = THREAD_BEFORE;
+      else if (((l == THREAD_TAKEN && r == THREAD_OTHER) || (l == THREAD_OTHER && r == THREAD_TAKEN)) && !t->merge) {
+        t->merge = ctrl;
+        place = THREAD_MERGE;
+      }
+      break;
+    }
+    default: break;
+  }
+  t->place_arr[ctrl] = place;
+  return place;
+}
+
+// Where the use in `slot` of `user` sits, fails for
+// users that aren't computed from the phis nor in control
+ThreadPlace Thread_use_place(Thread *t, const Parser *p, NodeId user, uint16_t slot) {
+  Node node = p->node_arr[user];
+  switch (node.tag) {
+    case NODE_PHI:
+      if (node.value.phi.ctrl == t->region) return THREAD_FAIL;
+      struct NodeRegion merge = p->node_arr[node.value.phi.ctrl].value.region;
+      return Thread_place(t, p, slot == 1 ? merge.left_block : merge.right_block);
+    case NODE_RETURN:
+    case NODE_IF:
+    case NODE_CALL:
+      return Thread_place(t, p, user);
+    default:
+      return THREAD_FAIL;
+  }
+}
+
+// Finds the nodes computed from the phis of the region and the
+// uses of them in control, returns how many of those there are
+// or -1 when some use can't be placed or there are too many
+int32_t Thread_collect(Thread *t, Parser *p, ThreadUse *use_arr, bool both) {
+  Worklist work = Worklist_new(&p->scratch, p->node_len);
+  for (LinkId link = p->node_arr[t->region].outputs; link; link = p->link_arr[link].next) {
+    NodeId user = p->link_arr[link].node;
+    if (user == t->id) continue;
+    if (p->node_arr[user].tag != NODE_PHI) return -1;
+    Bitset_set(&t->cone, user);
+    Worklist_push(&work, user);
+  }
+  int32_t use_len = 0;
+  uint16_t count = 0;
+  while (work.len) {
+    NodeId node = Worklist_pop(&work);
+    for (LinkId link = p->node_arr[node].outputs; link; link = p->link_arr[link].next) {
+      NodeId user = p->link_arr[link].node;
+      // A user reading it twice is on the list twice
+      bool seen = false;
+      for (LinkId prev = p->node_arr[node].outputs; prev != link && !seen; prev = p->link_arr[prev].next) {
+        seen = p->link_arr[prev].node == user;
+      }
+      if (seen || Bitset_get(&t->cone, user)) continue;
+      NodeTag tag = p->node_arr[user].tag;
+      if (tag > NODE_CONSTANT) {
+        if (++count > THREAD_BUDGET) return -1;
+        Bitset_set(&t->cone, user);
+        Worklist_push(&work, user);
+        continue;
+      }
+      // The if goes with the region when both sides are known
+      if (user == t->id && both) continue;
+      NodeId *slot_arr[MAX_INPUTS];
+      uint16_t slot_len = Parser_input_slots(p, user, slot_arr);
+      for (uint16_t i = 0; i < slot_len; ++i) {
+        if (*slot_arr[i] != node) continue;
+        ThreadPlace place = Thread_use_place(t, p, user, i);
+        if (place < THREAD_TAKEN || place > THREAD_MERGE) return -1;
+        use_arr[use_len++] = (ThreadUse){ user, i, place };
+      }
+    }
+  }
+  return use_len;
+}
+
+// What `id` is behind `place`, made on the first ask
+NodeId Thread_value(Thread *t, Parser *p, NodeId id, ThreadPlace place) {
+  if (!Bitset_get(&t->cone, id)) return id;
+  NodeId *value = &t->value_arr[place - THREAD_TAKEN][id];
+  if (*value) return *value;
+  Node node = p->node_arr[id];
+  if (node.tag == NODE_PHI && node.value.phi.ctrl == t->region) {
+    NodeId taken = t->left ? node.value.phi.left : node.value.phi.right;
+    NodeId other = t->left ? node.value.phi.right : node.value.phi.left;
+    if (place == THREAD_OTHER) return *value = other;
+    if (place == THREAD_TAKEN && !t->join) return *value = taken;
+    NodeId ctrl = t->join;
+    if (place == THREAD_TAKEN) {
+      // The join has the known side on the left
+      *value = Parser_create_phi_node(p, t->join, taken, other);
+    } else {
+      ctrl = t->merge;
+      NodeId l = Thread_value(t, p, id, t->merge_left);
+      NodeId r = Thread_value(t, p, id, t->merge_right);
+      *value = Parser_create_phi_node(p, t->merge, l, r);
+    }
+    p->node_arr[*value].type = node.type;
+    p->node_arr[*value].loop = p->node_arr[ctrl].loop;
+    return *value;
+  }
+  node.outputs = 0;
+  NodeId clone = Parser_create_node(p, node);
+  p->node_arr[clone].loop = node.loop;
+  NodeId *slot_arr[MAX_INPUTS];
+  uint16_t slot_len = Parser_input_slots(p, clone, slot_arr);
+  for (uint16_t i = 0; i < slot_len; ++i) {
+    *slot_arr[i] = Thread_value(t, p, *slot_arr[i], place);
+    Parser_add_node_output(p, clone, *slot_arr[i]);
+  }
+  return *value = clone;
+}
+
+// Returns whether the if after `region` was threaded
+bool Parser_thread_jump(Parser *p, NodeId region) {
+  NodeId id = 0;
+  for (LinkId link = p->node_arr[region].outputs; link; link = p->link_arr[link].next) {
+    NodeId user = p->link_arr[link].node;
+    if (p->node_arr[user].tag == NODE_IF) id = user;
+  }
+  if (!id) return false;
+  struct NodeIf node = p->node_arr[id].value.if_;
+  int64_t left_value, right_value;
+  bool left = Parser_side_value(p, node.cond, region, true, THREAD_DEPTH, &left_value);
+  bool right = Parser_side_value(p, node.cond, region, false, THREAD_DEPTH, &right_value);
+  if (!left && !right) return false;
+  if (left && right && !left_value == !right_value) return Parser_fold_if(p, id, left_value);
+  NodeId then_proj = Parser_if_proj(p, id, true), else_proj = Parser_if_proj(p, id, false);
+  if (!then_proj || !else_proj) return false;
+
+  // With both known the left side takes its projection and the
+  // right one the other, else the known side takes its own
+  bool both = left && right;
+  bool value = left ? left_value : right_value;
+  Thread t = {
+    .region = region,
+    .id = id,
+    .taken = value ? then_proj : else_proj,
+    .other = value ? else_proj : then_proj,
+    .left = left,
+  };
+  ArenaMark mark = Arena_mark(&p->scratch);
+  t.place_arr = Arena_alloc_zero(&p->scratch, p->node_len);
+  t.cone = Bitset_new(&p->scratch, p->node_len);
+  for (uint16_t i = 0; i < THREAD_PLACES; ++i) {
+    t.value_arr[i] = Arena_alloc_zero(&p->scratch, p->node_len * sizeof(NodeId));
+  }
+  ThreadUse *use_arr = Arena_alloc(&p->scratch, MAX_LINKS * sizeof(ThreadUse));
+  int32_t use_len = Thread_collect(&t, p, use_arr, both);
+  // Each phi makes at most two new ones, anything else
+  // is made for each place, with three inputs at most
+  uint16_t cone_len = 0, phi_len = 0;
+  for (NodeId i = 0; i < p->node_len; ++i) {
+    if (!Bitset_get(&t.cone, i)) continue;
+    if (p->node_arr[i].tag == NODE_PHI) phi_len++;
+    else cone_len++;
+  }
+  uint32_t node_count = 1 + 2 * phi_len + THREAD_PLACES * cone_len;
+  if (use_len < 0 || p->node_len + node_count > MAX_NODES ||
+      p->link_len + 2 + 3 * node_count + use_len > MAX_LINKS) {
+    Arena_release(&p->scratch, mark);
+    return false;
+  }
+
+  if (t.merge) {
+    struct NodeRegion sides = p->node_arr[t.merge].value.region;
+    t.merge_left = Thread_place(&t, p, sides.left_block);
+    t.merge_right = Thread_place(&t, p, sides.right_block);
+  }
+  struct NodeRegion merge = p->node_arr[region].value.region;
+  NodeId known = left ? merge.left_block : merge.right_block;
+  NodeId other = left ? merge.right_block : merge.left_block;
+  if (!both) {
+    // The known side joins the projection it takes in a new
+    // region, the if is left with the other side
+    t.join = Parser_create_node(p, (Node){ .tag = NODE_REGION });
+    p->node_arr[t.join].loop = p->node_arr[region].loop;
+    Parser_replace_node(p, t.taken, t.join);
+    p->node_arr[t.join].value.region = (struct NodeRegion){ known, t.taken };
+    Parser_add_node_output(p, t.join, known);
+    Parser_add_node_output(p, t.join, t.taken);
+  }
+  for (int32_t i = 0; i < use_len; ++i) {
+    ThreadUse use = use_arr[i];
+    NodeId *slot_arr[MAX_INPUTS];
+    Parser_input_slots(p, use.user, slot_arr);
+    Parser_replace_slot(p, use.user, use.slot, Thread_value(&t, p, *slot_arr[use.slot], use.place));
+  }
+  if (both) {
+    // Each side to its own projection, the region and the if go
+    Parser_replace_node(p, t.taken, known);
+    Parser_replace_node(p, t.other, other);
+    Parser_kill_node(p, then_proj);
+    Parser_kill_node(p, else_proj);
+    Parser_kill_node(p, id);
+  }
+  // Nothing past the if reads the old nodes anymore
+  for (NodeId i = 0; i < t.cone.len; ++i) {
+    if (Bitset_get(&t.cone, i) && p->node_arr[i].tag != NODE_NONE) Parser_remove_node(p, i);
+  }
+  Arena_release(&p->scratch, mark);
+  if (!both) Parser_replace_node(p, region, other);
+  Parser_kill_node(p, region);
+  return true;
+}
+
+// Regions made on the way have no phis, they're
+// never threaded. Returns how many ifs were
+uint16_t Parser_thread_jumps(Parser *p) {
+  Profile_push(PHASE_JUMPS);
+  uint16_t count = 0;
+  NodeId node_len = p->node_len;
+  for (NodeId id = START_NODE; id < node_len; ++id) {
+    if (p->node_arr[id].tag == NODE_REGION && Parser_thread_jump(p, id)) count++;
+  }
+  Profile_pop();
+  return count;
+}
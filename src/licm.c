@@ -0,0 +1,89 @@
+#include "parser.h"
+
+// Moves every node out of the loop it was created in, to the
+// innermost loop around it that one of its inputs changes in
+bool HOIST_INVARIANTS = true;
+
+// Innermost loop around both, loops form a tree
+// through the loop each one was created in
+NodeId Parser_common_loop(const Parser *p, const uint16_t *depth, NodeId a, NodeId b) {
+  while (depth[a] > depth[b]) a = p->node_arr[a].loop;
+  while (depth[b] > depth[a]) b = p->node_arr[b].loop;
+  while (a != b) {
+    a = p->node_arr[a].loop;
+    b = p->node_arr[b].loop;
+  }
+  return a;
+}
+
+// `at` is the loop of the user, the input may come out of
+// a loop that is over by then, only the loops around the
+// user can make it change
+NodeId Parser_input_loop(const Parser *p, const uint16_t *depth, NodeId at, NodeId input) {
+  return Parser_common_loop(p, depth, at, p->node_arr[input].loop);
+}
+
+void Parser_hoist_invariants(Parser *p) {
+  Profile_push(PHASE_LICM);
+  ArenaMark mark = Arena_mark(&p->scratch);
+  // Loop nesting depth by node id, zero for the rest.
+  // Loops come after the ones around them
+  uint16_t *depth = Arena_alloc_zero(&p->scratch, p->node_len * sizeof(uint16_t));
+  for (NodeId i = START_NODE; i < p->node_len; ++i) {
+    if (p->node_arr[i].tag == NODE_LOOP) depth[i] = depth[p->node_arr[i].loop] + 1;
+  }
+  // Inputs come before their users, so one pass does it.
+  // Inlined code breaks that, the users of a call come
+  // before the copy of the callee, those take another
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (NodeId i = START_NODE; i < p->node_len; ++i) {
+      Node *node = &p->node_arr[i];
+      NodeId loop = node->loop, hoisted = loop, left, right;
+      switch (node->tag) {
+        case NODE_CONSTANT:
+          hoisted = 0;
+          break;
+        case NODE_MINUS:
+        case NODE_NOT:
+          hoisted = Parser_input_loop(p, depth, node->loop, node->value.unary.node);
+          break;
+        case NODE_ADD:
+        case NODE_SUB:
+        case NODE_MUL:
+        case NODE_DIV:
+        case NODE_SHL:
+        case NODE_SAR:
+        case NODE_SHR:
+        case NODE_MULHI:
+        case NODE_EQ:
+        case NODE_NE:
+        case NODE_LT:
+        case NODE_LE:
+        case NODE_GT:
+        case NODE_GE:
+          left = Parser_input_loop(p, depth, node->loop, node->value.binary.left);
+          right = Parser_input_loop(p, depth, node->loop, node->value.binary.right);
+          // Both are around the user
+          hoisted = depth[left] > depth[right] ? left : right;
+          break;
+        case NODE_SELECT:
+          left = Parser_input_loop(p, depth, node->loop, node->value.select.left);
+          right = Parser_input_loop(p, depth, node->loop, node->value.select.right);
+          left = depth[left] > depth[right] ? left : right;
+          right = Parser_input_loop(p, depth, node->loop, node->value.select.cond);
+          hoisted = depth[left] > depth[right] ? left : right;
+          break;
+        // Phis run with their region, control stays put
+        default: break;
+      }
+      if (hoisted == loop) continue;
+      if (p->undo) Parser_save_node(p, i);
+      node->loop = hoisted;
+      changed = true;
+    }
+  }
+  Arena_release(&p->scratch, mark);
+  Profile_pop();
+}
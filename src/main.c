@@ -5,39 +5,186 @@
 #include <stdlib.h>
 #include <string.h>
 
-#include "error_reporting.c"
-#include "graphviz.c"
-#include "fs.c"
-
-#include "parser_nodes.c"
-#include "parser_expressions.c"
-#include "parser_statements.c"
-#include "parser_vars.c"
-#include "parser.h"
-#include "tokenizer.c"
-#include "parser.c"
+#include "son.c"
+#include "batch.c"
+#include "server.c"
+
+// Zero picks one thread per online cpu
+uint32_t THREAD_COUNT = 0;
+const char *SERVE_PATH = NULL;
+// Run the program after compiling it
+bool RUN = false;
+// What `arg` reads when it runs
+int64_t RUN_ARG = 0;
+// Where the edits of the graphs go, see replay.c
+const char *TRACE_FILENAME = NULL;
+// Where the samples of --profile go, written at exit
+const char *PROFILE_FILENAME = NULL;
+#define RUN_FUEL 100000000
+
+// Returns false for unknown options
+bool parse_option(const char *arg) {
+  if (!strcmp(arg, "--graph-ctrl")) GRAPH_OPTIONS.filter = GRAPH_FILTER_CTRL;
+  else if (!strcmp(arg, "--graph-data")) GRAPH_OPTIONS.filter = GRAPH_FILTER_DATA;
+  else if (!strcmp(arg, "--graph-async")) GRAPH_OPTIONS.async = true;
+  else if (!strncmp(arg, "--graph-center=", CSTR_LEN("--graph-center=")))
+    GRAPH_OPTIONS.center = atoi(&arg[CSTR_LEN("--graph-center=")]);
+  else if (!strncmp(arg, "--graph-radius=", CSTR_LEN("--graph-radius=")))
+    GRAPH_OPTIONS.radius = atoi(&arg[CSTR_LEN("--graph-radius=")]);
+  else if (!strncmp(arg, "--jobs=", CSTR_LEN("--jobs=")))
+    THREAD_COUNT = atoi(&arg[CSTR_LEN("--jobs=")]);
+  else if (!strncmp(arg, "--opt-jobs=", CSTR_LEN("--opt-jobs=")))
+    OPTIMIZE_THREADS = atoi(&arg[CSTR_LEN("--opt-jobs=")]);
+  else if (!strcmp(arg, "--no-licm")) HOIST_INVARIANTS = false;
+  else if (!strcmp(arg, "--no-ranges")) NARROW_RANGES = false;
+  else if (!strcmp(arg, "--no-jump-threading")) THREAD_JUMPS = false;
+  else if (!strcmp(arg, "--no-strength-reduction")) REDUCE_STRENGTH = false;
+  else if (!strcmp(arg, "--no-rewrites")) APPLY_REWRITES = false;
+  else if (!strncmp(arg, "--inline-budget=", CSTR_LEN("--inline-budget=")))
+    INLINE_BUDGET = atoi(&arg[CSTR_LEN("--inline-budget=")]);
+  else if (!strncmp(arg, "--select-budget=", CSTR_LEN("--select-budget=")))
+    SELECT_BUDGET = atoi(&arg[CSTR_LEN("--select-budget=")]);
+  else if (!strcmp(arg, "--run")) RUN = true;
+  else if (!strncmp(arg, "--arg=", CSTR_LEN("--arg=")))
+    RUN_ARG = strtoll(&arg[CSTR_LEN("--arg=")], NULL, 10);
+  else if (!strncmp(arg, "--trace=", CSTR_LEN("--trace=")))
+    TRACE_FILENAME = &arg[CSTR_LEN("--trace=")];
+  else if (!strcmp(arg, "--profile")) PROFILE_FILENAME = "out/profile.folded";
+  else if (!strncmp(arg, "--profile=", CSTR_LEN("--profile=")))
+    PROFILE_FILENAME = &arg[CSTR_LEN("--profile=")];
+  else if (!strncmp(arg, "--serve=", CSTR_LEN("--serve=")))
+    SERVE_PATH = &arg[CSTR_LEN("--serve=")];
+  else return false;
+  return true;
+}
+
+// Errors exit too, those compiles are profiled as well
+void write_profile(void) {
+  uint32_t sample_count = 0;
+  if (!Profile_write(PROFILE_FILENAME, &sample_count)) {
+    print_error_message("Failed to write profile " ANSI_BLUE "%s" ANSI_RESET ": %s", PROFILE_FILENAME, strerror(errno));
+    return;
+  }
+  fprintf(stderr, "Wrote %u samples to %s\n", sample_count, PROFILE_FILENAME);
+}
 
 int main(int argc, char *argv[]) {
-  assert(argc == 2);
-  const char *filename = argv[1];
+  const char **filename_arr = malloc(sizeof(*filename_arr) * argc);
+  uint32_t file_count = 0;
+  for (int i = 1; i < argc; ++i) {
+    if (strncmp(argv[i], "--", 2)) {
+      filename_arr[file_count++] = argv[i];
+      continue;
+    }
+    if (!parse_option(argv[i])) {
+      print_error_message("Unknown option " ANSI_BLUE "%s" ANSI_RESET, argv[i]);
+      exit(1);
+    }
+  }
+  if (PROFILE_FILENAME) {
+    // A server never gets to write it
+    if (SERVE_PATH) {
+      print_error_message("--serve can't be profiled");
+      exit(1);
+    }
+    if (!Profile_start()) {
+      print_error_message("Failed to start the profiler: %s", strerror(errno));
+      exit(1);
+    }
+    atexit(write_profile);
+  }
+  if (SERVE_PATH) {
+    if (!THREAD_COUNT) THREAD_COUNT = MAX(sysconf(_SC_NPROCESSORS_ONLN), 1);
+    serve(SERVE_PATH, THREAD_COUNT);
+  }
+  if (!file_count) {
+    print_error_message("No input files");
+    exit(1);
+  }
+
+  // Many files, compile them quietly on a thread pool
+  if (file_count > 1 || THREAD_COUNT) {
+    if (TRACE_FILENAME) {
+      print_error_message("Only a single file compiled without --jobs can be traced");
+      exit(1);
+    }
+    if (!THREAD_COUNT) THREAD_COUNT = MAX(sysconf(_SC_NPROCESSORS_ONLN), 1);
+    uint32_t failed = compile_batch(filename_arr, file_count, THREAD_COUNT);
+    return failed ? 1 : 0;
+  }
+  const char *filename = filename_arr[0];
 
   printf("Reading file '%s'\n", filename);
-  const char *file = map_file_readonly(filename);
-  if (file == NULL) {
+  SourceFile file;
+  if (!load_source(filename, &file)) {
     print_error_message("Failed to read input file "
         ANSI_BLUE "%s" ANSI_RESET ": %s\n", filename, strerror(errno));
     exit(1);
   }
 
   printf("\nTokenizing:\n");
+  Diagnostics *diag = calloc(1, sizeof(*diag));
   Token *tokens = malloc(sizeof(*tokens) * MAX_TOKENS);
-  tokenize(file, tokens);
+  tokenize(file.ptr, file.len, tokens, diag);
   print_tokens(tokens);
 
   printf("\nCodegen:\n");
-  Parser *p = malloc(sizeof(*p));
-  parse(file, tokens, p);
-  print_nodes(p);
+  Parser *p = calloc(1, sizeof(*p));
+  Parser_init(p, file.ptr, tokens, diag);
+  FILE *trace = NULL;
+  if (TRACE_FILENAME) {
+    trace = Trace_open(TRACE_FILENAME);
+    if (!trace) {
+      print_error_message("Failed to open trace file "
+          ANSI_BLUE "%s" ANSI_RESET ": %s\n", TRACE_FILENAME, strerror(errno));
+      exit(1);
+    }
+    p->trace = Trace_new(trace, 0);
+  }
+  Parser_parse_top_level(p);
+  graphviz_wait();
+  if (trace) {
+    // Nothing edits the graphs past here, and errors exit
+    Trace_flush(p->trace);
+    for (uint16_t i = 0; i < p->function_len; ++i) Trace_flush(p->function_arr[i].graph->trace);
+    fclose(trace);
+  }
 
+  if (diag->error_count) {
+    LineIndex lines;
+    LineIndex_build(&lines, file.ptr, file.len);
+    Diagnostics_print(stderr, diag, &lines);
+    fprintf(stderr, "\n%d errors\n", diag->error_count);
+    exit(1);
+  }
+  if (p->inlined) printf("Inlined %d calls\n", p->inlined);
+  if (p->ranges.folded_count) printf("Folded %d comparisons and branches by range\n", p->ranges.folded_count);
+  if (p->threaded) printf("Threaded %d ifs\n", p->threaded);
+  if (p->selects) printf("Converted %d ifs to selects\n", p->selects);
+  if (p->rewritten) printf("Rewrote %d nodes by rules\n", p->rewritten);
+  if (p->reduced) printf("Reduced %d multiplications and divisions\n", p->reduced);
+  if (p->ranges.div_count) printf("%d divisions by a range that includes zero\n", p->ranges.div_count);
+  for (uint16_t i = 0; i < p->function_len; ++i) {
+    const Function *f = &p->function_arr[i];
+    if (!f->graph->ranges.div_count) continue;
+    printf("%d divisions by a range that includes zero in %.*s\n",
+      f->graph->ranges.div_count, f->name.len, &file.ptr[f->name.start]);
+  }
+  printf("Reclaimed %d dead nodes and %d links\n", p->dead.node_count, p->dead.link_count);
+  print_nodes(p);
+  print_functions(p);
+  if (RUN) {
+    Eval *e = malloc(sizeof(*e));
+    int64_t result = 0;
+    switch (Parser_eval(p, e, RUN_FUEL, RUN_ARG, &result)) {
+      case EVAL_OK: printf("Result: %lld\n", (long long)result); break;
+      case EVAL_DIV_BY_ZERO: print_error_message("Division by zero"); exit(1);
+      case EVAL_OUT_OF_FUEL: print_error_message("Still running after %d steps", RUN_FUEL); exit(1);
+      case EVAL_NO_RETURN: print_error_message("Program ended without a return"); exit(1);
+      case EVAL_TOO_DEEP: print_error_message("Calls nested deeper than %d", MAX_CALL_DEPTH); exit(1);
+    }
+    free(e);
+  }
+  unload_source(&file);
   return 0;
 }
@@ -4,59 +4,147 @@
 #include <assert.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
 #include <string.h>
 
+// Records the error and unwinds to the statement being parsed
+void Parser_error(Parser *p, uint32_t start, uint16_t len, const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  Diagnostics_vpush(p->diag, DIAG_ERROR, start, len, true, fmt, args);
+  va_end(args);
+  assert(p->recover);
+  longjmp(*p->recover, 1);
+}
+
 Token Parser_expect_token(Parser *p, TokenTag tag) {
-  Token tok = p->token_arr[p->pos++];
-  if (tok.tag == tag) return tok;
-  print_error(p->source, tok.start, tok.len,
+  Token tok = p->token_arr[p->pos];
+  if (tok.tag != tag) Parser_error(p, tok.start, tok.len,
     "Expected `%s`, got `%s`", TOK_NAMES[tag], TOK_NAMES[tok.tag]);
-  exit(1);
+  p->pos++;
+  return tok;
 }
 
-NodeId parse(const char *source, const Token *tokens, Parser *p) {
-  *p = (Parser){
-    .source = source,
-    .token_arr = tokens,
-    .node_len = 3, // null node, start node, stop node
-    .link_len = 1, // space for null link
-  };
-  p->node_arr[START_NODE] = (Node){ .tag = NODE_START };
+// NOTE: the arenas are left as they are, every slot below
+// the lengths is written before it's read. Zeroing the whole
+// struct would cost more than most compiles. The stacks and
+// function graphs are kept, so the parser has to be zeroed
+// before its first init
+void Parser_init(Parser *p, const char *source, const Token *tokens, Diagnostics *diag) {
+  p->source = source;
+  p->token_arr = tokens;
+  p->diag = diag;
+  p->out = stdout;
+  p->graph_filename = GRAPH_FILENAME;
+  p->recover = NULL;
+  p->node_len = 3; // null node, start node, stop node
+  p->link_len = 1; // space for null link
+  p->var_len = 0;
+  p->var_offset = 0;
+  p->scope_len = 0;
+  p->type_len = 0;
+  p->pos = 0;
+  p->arg_len = 0;
+  p->frame_len = 0;
+  p->scope = NULL_NODE;
+  p->loop = NULL_NODE;
+  p->dead = (DeadStats){0};
+  p->ranges = (RangeStats){0};
+  p->threaded = 0;
+  p->selects = 0;
+  p->reduced = 0;
+  p->rewritten = 0;
+  p->inlined = 0;
+  Parser_truncate_functions(p, 0);
+  p->owner = NULL;
+  p->trace = NULL;
+  p->undo = NULL;
+  p->filename_buffer[0] = 0;
+  Arena_init(&p->scratch, p->scratch_buf, sizeof(p->scratch_buf));
+  p->node_arr[NULL_NODE] = (Node){0};
+  p->node_arr[START_NODE] = (Node){ .tag = NODE_START, .type = TYPE_TUPLE };
   p->node_arr[STOP_NODE] = (Node){ .tag = NODE_STOP };
+  p->link_arr[NULL_LINK] = (Link){0};
+}
 
-  Parser_parse_top_level(p);
+// Clears only what the previous compile used,
+// so stale nodes can't leak into the next graph.
+// Also frees the traces and the undo log of a
+// checkpoint left open. The stacks and the function
+// graphs stay for the next compile
+void Parser_reset(Parser *p) {
+  Trace_free(p->trace);
+  p->trace = NULL;
+  UndoLog_free(p->undo);
+  p->undo = NULL;
+  memset(p->node_arr, 0, p->node_len * sizeof(Node));
+  memset(p->link_arr, 0, p->link_len * sizeof(Link));
+  p->node_len = 0;
+  p->link_len = 0;
+  p->var_len = 0;
+  Parser_truncate_functions(p, 0);
+}
+
+// Everything reset keeps, the parser is
+// left as zeroed for the next init
+void Parser_free(Parser *p) {
+  Parser_reset(p);
+  for (uint16_t i = 0; i < p->function_cap; ++i) {
+    if (!p->function_arr[i].graph) continue;
+    Parser_free(p->function_arr[i].graph);
+    free(p->function_arr[i].graph);
+  }
+  free(p->function_arr);
+  free(p->frame_arr);
+  free(p->operand_arr);
+  free(p->op_arr);
+  p->function_arr = NULL;
+  p->frame_arr = NULL;
+  p->operand_arr = NULL;
+  p->op_arr = NULL;
+  p->function_cap = p->frame_cap = p->expression_cap = 0;
+}
+
+NodeId parse(const char *source, const Token *tokens, Diagnostics *diag, Parser *p) {
+  Parser_init(p, source, tokens, diag);
+  return Parser_parse_top_level(p);
 }
 
 void print_nodes(const Parser *p) {
   for (int i = 0; i < p->node_len; ++i) {
     Node node = p->node_arr[i];
     if (!node.tag) continue;
-    printf("% 2d %s", i, NODE_NAME[node.tag]);
+    fprintf(p->out, "% 2d %s", i, NODE_NAME[node.tag]);
     switch (node.tag) {
       case NODE_PROJ:
-        printf(" %d", node.value.proj.select);
+        fprintf(p->out, " %d", node.value.proj.select);
         break;
       case NODE_CONSTANT:
-        printf(" %d", node.value.i64);
+        fprintf(p->out, " %lld", (long long)node.value.i64);
+        break;
+      case NODE_CALL:
+        Token name = Parser_function(p, node.value.call.function)->name;
+        fprintf(p->out, " %.*s", name.len, &p->source[name.start]);
         break;
       default:
     }
-    printf(" [");
+    fprintf(p->out, " [");
     LinkId id = node.outputs;
     while (id) {
-      printf("%d", p->link_arr[id].node);
+      fprintf(p->out, "%d", p->link_arr[id].node);
       if (!p->link_arr[id].next) break;
-      putchar(' ');
+      fputc(' ', p->out);
       id = p->link_arr[id].next;
     }
-    printf("]\n");
+    fprintf(p->out, "]\n");
     if (node.tag == NODE_SCOPE) {
       for (int i = 0; i < node.value.scope.var_count; ++i) {
         VarId id = node.value.scope.var_start + i;
         Var var = p->var_arr[id];
-        printf("  %.*s: %d\n", var.len, &p->source[var.start], var.node);
+        fprintf(p->out, "  %.*s: %d\n", var.len, &p->source[var.start], var.node);
       }
     }
   }
-  printf("\n");
+  fprintf(p->out, "\n");
 }
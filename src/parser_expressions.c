@@ -1,6 +1,6 @@
 #include "parser.h"
 
-uint8_t PRECEDENCE[NODE_BINARY_COUNT] = {
+const uint8_t PRECEDENCE[NODE_BINARY_COUNT] = {
   [NODE_MUL - NODE_BINARY_START] = 10,
   [NODE_DIV - NODE_BINARY_START] = 10,
   [NODE_ADD - NODE_BINARY_START] = 9,
@@ -13,6 +13,35 @@ uint8_t PRECEDENCE[NODE_BINARY_COUNT] = {
   [NODE_GE - NODE_BINARY_START] = 7,
 };
 
+// The function `name` calls, from the program or any of its functions
+uint16_t Parser_resolve_function(Parser *p, Token name) {
+  const Parser *program = p->owner ? p->owner : p;
+  const Function *f = Parser_find_function(program, name.start, name.len);
+  if (!f) Parser_error(p, name.start, name.len, "Unknown function `%.*s`",
+    name.len, &p->source[name.start]);
+  return f - program->function_arr;
+}
+
+void Parser_check_arg_count(Parser *p, Token at, uint16_t function, uint16_t arg_count) {
+  const Function *f = Parser_function(p, function);
+  if (arg_count == f->param_count) return;
+  Parser_error(p, at.start, at.len, "`%.*s` takes %d arguments, got %d",
+    f->name.len, &p->source[f->name.start], f->param_count, arg_count);
+}
+
+// The program's input, one node however often it's read
+NodeId Parser_resolve_arg(Parser *p, Token tok) {
+  if (p->owner) Parser_error(p, tok.start, tok.len,
+    "`arg` is the program's input, functions take parameters");
+  for (LinkId link = p->node_arr[START_NODE].outputs; link; link = p->link_arr[link].next) {
+    NodeId user = p->link_arr[link].node;
+    if (p->node_arr[user].tag == NODE_PROJ && p->node_arr[user].value.proj.select == PROGRAM_ARG) return user;
+  }
+  return Parser_create_proj_node(p, START_NODE, PROGRAM_ARG);
+}
+
+// Parentheses, prefix operators and calls with arguments are
+// handled by Parser_parse_expression, never nested here
 NodeId Parser_parse_atom(Parser *p) {
   Token tok = p->token_arr[p->pos++];
   NodeId node;
@@ -21,14 +50,19 @@ NodeId Parser_parse_atom(Parser *p) {
       return Parser_create_constant(p, true);
     case TOK_FALSE:
       return Parser_create_constant(p, false);
+    case TOK_ARG:
+      return Parser_resolve_arg(p, tok);
     case TOK_IDENT:
+      if (p->token_arr[p->pos].tag == TOK_LPAREN) {
+        uint16_t function = Parser_resolve_function(p, tok);
+        p->pos++;
+        Token end = Parser_expect_token(p, TOK_RPAREN);
+        Parser_check_arg_count(p, end, function, 0);
+        return Parser_create_call(p, function, NULL, 0);
+      }
       VarId var = Parser_resolve_var(p, tok.start, tok.len);
       node = p->var_arr[var].node;
       break;
-    case TOK_LPAREN:
-      node = Parser_parse_expression(p);
-      Parser_expect_token(p, TOK_RPAREN);
-      break;
     case TOK_DECIMAL:
       int64_t number = 0;
       for (int i = 0; i < tok.len; ++i) {
@@ -37,89 +71,257 @@ NodeId Parser_parse_atom(Parser *p) {
       }
       return Parser_create_constant(p, number); 
     default:
-      print_error(p->source, tok.start, tok.len,
+      p->pos--;
+      Parser_error(p, tok.start, tok.len,
         "Unexpected token while parsing atom: `%s`", TOK_NAMES[tok.tag]);
-      exit(1);
   }
   return node;
 }
 
-NodeId Parser_parse_unary(Parser *p) {
-  Token tok = p->token_arr[p->pos];
-  NodeTag op;
-  switch (tok.tag) {
-    case TOK_MINUS: op = NODE_MINUS; break;
-    case TOK_BANG: op = NODE_NOT; break;
-    default: return Parser_parse_atom(p);
+int64_t Parser_fold_unary_value(NodeTag op, int64_t value) {
+  switch (op) {
+    case NODE_MINUS: return (int64_t)(0 - (uint64_t)value);
+    case NODE_NOT: return !value;
+    default: assert(0);
+  }
+  return 0;
+}
+
+// Rewrites by the rules of rewrite.rules
+bool APPLY_REWRITES = true;
+
+// Whether computing the node can't divide by zero, for rewrites
+// that leave it out. Phis and projections are computed where
+// their control is, whatever reads them
+bool Parser_cannot_trap(Parser *p, NodeId id) {
+  ArenaMark mark = Arena_mark(&p->scratch);
+  Bitset seen = Bitset_new(&p->scratch, p->node_len);
+  Worklist work = Worklist_new(&p->scratch, p->node_len);
+  Worklist_push(&work, id);
+  Bitset_set(&seen, id);
+  bool safe = true;
+  while (work.len && safe) {
+    id = Worklist_pop(&work);
+    Node node = p->node_arr[id];
+    if (node.tag <= NODE_CONSTANT) continue;
+    if (node.tag == NODE_DIV) {
+      Node divisor = p->node_arr[node.value.binary.right];
+      safe = divisor.tag == NODE_CONSTANT && divisor.value.i64;
+    }
+    NodeId input_arr[MAX_INPUTS];
+    uint16_t input_len = Parser_node_inputs(p, id, input_arr);
+    for (uint16_t i = 0; i < input_len; ++i) {
+      if (!Bitset_test_and_set(&seen, input_arr[i])) Worklist_push(&work, input_arr[i]);
+    }
+  }
+  Arena_release(&p->scratch, mark);
+  return safe;
+}
+
+// The node, or what a rule rewrites it to. Operands the rule
+// dropped are taken out too. When it gave back a node of theirs
+// that could go with them, only constants are, DCE gets the rest
+NodeId Parser_rewrite_node(Parser *p, NodeTag op, NodeId left, NodeId right) {
+  NodeId first = p->node_len;
+  NodeId node = APPLY_REWRITES ? Parser_rewrite(p, op, left, right) : NULL_NODE;
+  if (!node) return right ? Parser_create_binary_node(p, op, left, right) : Parser_create_unary_node(p, op, left);
+  p->rewritten++;
+  bool fresh = node >= first;
+  if (left != node && (fresh || p->node_arr[left].tag == NODE_CONSTANT)) Parser_remove_node(p, left);
+  if (right && right != node && right != left && (fresh || p->node_arr[right].tag == NODE_CONSTANT)) {
+    Parser_remove_node(p, right);
   }
-  p->pos++;
-  NodeId inner = Parser_parse_unary(p);
+  return node;
+}
+
+NodeId Parser_fold_unary(Parser *p, NodeTag op, NodeId inner) {
   if (p->node_arr[inner].tag != NODE_CONSTANT) {
-    return Parser_create_unary_node(p, op, inner);
+    return Parser_rewrite_node(p, op, inner, NULL_NODE);
   }
-  int64_t value = p->node_arr[inner].value.i64;
+  Profile_push(PHASE_FOLD);
+  int64_t value = Parser_fold_unary_value(op, p->node_arr[inner].value.i64);
   Parser_remove_node(p, inner);
+  NodeId node = Parser_create_constant(p, value);
+  Profile_pop();
+  return node;
+}
+
+// High half of the 128 bit product, from 32 bit pieces
+int64_t Parser_mulhi(int64_t l, int64_t r) {
+  uint64_t a = l, b = r;
+  uint64_t lo_lo = (a & 0xffffffff) * (b & 0xffffffff);
+  uint64_t hi_lo = (a >> 32) * (b & 0xffffffff);
+  uint64_t lo_hi = (a & 0xffffffff) * (b >> 32);
+  uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xffffffff) + lo_hi;
+  uint64_t hi = (a >> 32) * (b >> 32) + (hi_lo >> 32) + (cross >> 32);
+  // That was unsigned, a negative factor counts 2^64 too much
+  if (l < 0) hi -= b;
+  if (r < 0) hi -= a;
+  return (int64_t)hi;
+}
+
+// Shifting in copies of the sign bit, whatever C does
+int64_t Parser_sar(int64_t l, int64_t r) {
+  r &= 63;
+  return l < 0 ? ~(~l >> r) : l >> r;
+}
+
+// Wrapping like the machine, false for a
+// division by zero, that one is left to fail
+bool Parser_fold_value(NodeTag op, int64_t l, int64_t r, int64_t *out) {
   switch (op) {
-    case NODE_MINUS: value = -value; break;
-    case NODE_NOT: value = !value; break;
+    case NODE_ADD: *out = (int64_t)((uint64_t)l + (uint64_t)r); break;
+    case NODE_SUB: *out = (int64_t)((uint64_t)l - (uint64_t)r); break;
+    case NODE_MUL: *out = (int64_t)((uint64_t)l * (uint64_t)r); break;
+    case NODE_DIV:
+      if (!r) return false;
+      *out = r == -1 ? (int64_t)(0 - (uint64_t)l) : l / r;
+      break;
+    case NODE_SHL: *out = (int64_t)((uint64_t)l << (r & 63)); break;
+    case NODE_SAR: *out = Parser_sar(l, r); break;
+    case NODE_SHR: *out = (int64_t)((uint64_t)l >> (r & 63)); break;
+    case NODE_MULHI: *out = Parser_mulhi(l, r); break;
+    case NODE_EQ: *out = l == r; break;
+    case NODE_NE: *out = l != r; break;
+    case NODE_GE: *out = l >= r; break;
+    case NODE_GT: *out = l > r; break;
+    case NODE_LE: *out = l <= r; break;
+    case NODE_LT: *out = l < r; break;
     default: assert(0);
   }
-  return Parser_create_constant(p, value);
+  return true;
+}
+
+NodeId Parser_fold_binary(Parser *p, NodeTag op, NodeId left, NodeId right) {
+  int64_t value;
+  if (p->node_arr[left].tag != NODE_CONSTANT
+      || p->node_arr[right].tag != NODE_CONSTANT
+      || !Parser_fold_value(op, p->node_arr[left].value.i64, p->node_arr[right].value.i64, &value)) {
+    return Parser_rewrite_node(p, op, left, right);
+  }
+  Profile_push(PHASE_FOLD);
+  Parser_remove_node(p, right);
+  Parser_remove_node(p, left);
+  NodeId node = Parser_create_constant(p, value);
+  Profile_pop();
+  return node;
 }
 
-NodeId Parser_parse_binary(Parser *p, uint8_t prec) {
-  NodeId left = Parser_parse_unary(p);
-  Token tok;
-  NodeTag op;
-  uint8_t new_prec;
+NodeTag Parser_binary_op(TokenTag tag) {
+  switch (tag) {
+    case TOK_PLUS: return NODE_ADD;
+    case TOK_MINUS: return NODE_SUB;
+    case TOK_STAR: return NODE_MUL;
+    case TOK_SLASH: return NODE_DIV;
+    case TOK_DEQ: return NODE_EQ;
+    case TOK_NE: return NODE_NE;
+    case TOK_LT: return NODE_LT;
+    case TOK_LE: return NODE_LE;
+    case TOK_GT: return NODE_GT;
+    case TOK_GE: return NODE_GE;
+    default: return NODE_NONE;
+  }
+}
+
+// Room for one more operand and operator. NOTE: moves
+// both stacks, pointers into them don't hold anymore
+void Parser_reserve_expression(Parser *p, uint16_t len) {
+  if (len < p->expression_cap) return;
+  // Every entry takes a token
+  assert(p->expression_cap < MAX_TOKENS);
+  uint16_t cap = p->expression_cap ? p->expression_cap * 2 : 32;
+  NodeId *operand_arr = realloc(p->operand_arr, cap * sizeof(NodeId));
+  PendingOp *op_arr = realloc(p->op_arr, cap * sizeof(PendingOp));
+  assert(operand_arr && op_arr);
+  p->operand_arr = operand_arr;
+  p->op_arr = op_arr;
+  p->expression_cap = cap;
+}
+
+// Operator precedence parsing with explicit stacks, so nesting
+// depth costs no C stack. Operators of equal precedence group
+// to the left, `a - b - c` is `(a - b) - c`
+NodeId Parser_parse_expression(Parser *p) {
+  uint16_t operand_len = 0, op_len = 0;
+  NodeId node;
+  Profile_push(PHASE_EXPRESSION);
+
   while (1) {
-    tok = p->token_arr[p->pos];
+    // Prefix operators, parentheses and calls
+    Token tok = p->token_arr[p->pos];
+    Parser_reserve_expression(p, op_len);
     switch (tok.tag) {
-      case TOK_PLUS: op = NODE_ADD; break;
-      case TOK_MINUS: op = NODE_SUB; break;
-      case TOK_STAR: op = NODE_MUL; break;
-      case TOK_SLASH: op = NODE_DIV; break;
-      case TOK_DEQ: op = NODE_EQ; break;
-      case TOK_NE: op = NODE_NE; break;
-      case TOK_LT: op = NODE_LT; break;
-      case TOK_LE: op = NODE_LE; break;
-      case TOK_GT: op = NODE_GT; break;
-      case TOK_GE: op = NODE_GE; break;
-      default: return left;
-    }
-    new_prec = PRECEDENCE[op - NODE_BINARY_START];
-    if (new_prec < prec) break;
-    p->pos++;
-    NodeId right = Parser_parse_binary(p, new_prec);
-    if (p->node_arr[left].tag != NODE_CONSTANT
-        || p->node_arr[right].tag != NODE_CONSTANT) {
-      left = Parser_create_binary_node(p, op, left, right);
-      continue;
+      case TOK_MINUS:
+        p->op_arr[op_len++] = (PendingOp){ .op = NODE_MINUS, .prefix = true };
+        p->pos++;
+        continue;
+      case TOK_BANG:
+        p->op_arr[op_len++] = (PendingOp){ .op = NODE_NOT, .prefix = true };
+        p->pos++;
+        continue;
+      case TOK_LPAREN:
+        p->op_arr[op_len++] = (PendingOp){ .op = NODE_NONE };
+        p->pos++;
+        continue;
+      case TOK_IDENT:
+        // Calls without arguments are atoms
+        if (p->token_arr[p->pos + 1].tag != TOK_LPAREN ||
+            p->token_arr[p->pos + 2].tag == TOK_RPAREN) break;
+        uint16_t function = Parser_resolve_function(p, tok);
+        p->op_arr[op_len++] = (PendingOp){
+          .op = NODE_CALL, .function = function, .arg_start = operand_len };
+        p->pos += 2;
+        continue;
+      default: break;
     }
-    int64_t l = p->node_arr[left].value.i64;
-    int64_t r = p->node_arr[right].value.i64;
-    Parser_remove_node(p, right);
-    Parser_remove_node(p, left);
-    switch (op) {
-      case NODE_ADD: l += r; break;
-      case NODE_SUB: l -= r; break;
-      case NODE_MUL: l *= r; break;
-      case NODE_DIV: l /= r; break;
-      case NODE_EQ: l = l == r; break;
-      case NODE_NE: l = l != r; break;
-      case NODE_GE: l = l >= r; break;
-      case NODE_GT: l = l > r; break;
-      case NODE_LE: l = l <= r; break;
-      case NODE_LT: l = l < r; break;
-      default: assert(0);
+    node = Parser_parse_atom(p);
+
+    while (1) {
+      while (op_len && p->op_arr[op_len - 1].prefix) {
+        node = Parser_fold_unary(p, p->op_arr[--op_len].op, node);
+      }
+      NodeTag op = Parser_binary_op(p->token_arr[p->pos].tag);
+      uint8_t prec = op ? PRECEDENCE[op - NODE_BINARY_START] : 0;
+      while (op_len && p->op_arr[op_len - 1].prec && (!op || p->op_arr[op_len - 1].prec >= prec)) {
+        node = Parser_fold_binary(p, p->op_arr[--op_len].op, p->operand_arr[--operand_len], node);
+      }
+      if (op) {
+        Parser_reserve_expression(p, operand_len);
+        p->operand_arr[operand_len++] = node;
+        p->op_arr[op_len++] = (PendingOp){ .op = op, .prec = prec };
+        p->pos++;
+        break;
+      }
+      if (!op_len) {
+        Profile_pop();
+        return node;
+      }
+      // Only `(` or a call is left on top
+      PendingOp top = p->op_arr[op_len - 1];
+      if (top.op == NODE_CALL) {
+        Token tok = p->token_arr[p->pos];
+        uint16_t arg_count = operand_len - top.arg_start + 1;
+        if (tok.tag == TOK_COMMA) {
+          // One too many already, whatever follows
+          if (arg_count == Parser_function(p, top.function)->param_count) {
+            Parser_check_arg_count(p, tok, top.function, arg_count + 1);
+          }
+          Parser_reserve_expression(p, operand_len);
+          p->operand_arr[operand_len++] = node;
+          p->pos++;
+          break;
+        }
+        Parser_expect_token(p, TOK_RPAREN);
+        Parser_check_arg_count(p, tok, top.function, arg_count);
+        Parser_reserve_expression(p, operand_len);
+        p->operand_arr[operand_len++] = node;
+        operand_len = top.arg_start;
+        node = Parser_create_call(p, top.function, &p->operand_arr[top.arg_start], arg_count);
+        op_len--;
+        continue;
+      }
+      Parser_expect_token(p, TOK_RPAREN);
+      op_len--;
     }
-    left = Parser_create_constant(p, l);
   }
-  return left;
 }
-
-NodeId Parser_parse_expression(Parser *p) {
-  NodeId value = Parser_parse_binary(p, 0);
-  return value;
-}
-
@@ -2,16 +2,145 @@
 #include <stdint.h>
 #include <assert.h>
 
+const char *const NODE_NAME[NODE_COUNT] = {
+  [NODE_NONE] = "none",
+  [NODE_SCOPE] = "scope",
+  [NODE_START] = "start",
+  [NODE_RETURN] = "return",
+  [NODE_CONSTANT] = "const",
+  [NODE_ADD] = "add",
+  [NODE_SUB] = "sub",
+  [NODE_MUL] = "mul",
+  [NODE_DIV] = "div",
+  [NODE_SHL] = "shl",
+  [NODE_SAR] = "sar",
+  [NODE_SHR] = "shr",
+  [NODE_MULHI] = "mulhi",
+  [NODE_MINUS] = "minus",
+  [NODE_NOT] = "not",
+  [NODE_REGION] = "region",
+  [NODE_LOOP] = "loop",
+  [NODE_IF] = "if",
+  [NODE_PHI] = "phi",
+  [NODE_SELECT] = "select",
+  [NODE_PROJ] = "proj",
+  [NODE_CALL] = "call",
+  [NODE_CALL_END] = "call_end",
+  [NODE_EQ] = "eq",
+  [NODE_NE] = "ne",
+  [NODE_GT] = "gt",
+  [NODE_GE] = "ge",
+  [NODE_LT] = "lt",
+  [NODE_LE] = "le",
+  [NODE_STOP] = "stop",
+};
+
+// Records an edit of `a`, tag and value as they are now. Callers
+// check for a trace, untraced edits pay a load and a branch
+void Parser_trace(Parser *p, TraceKind kind, NodeId a, NodeId b) {
+  Node node = p->node_arr[a];
+  Trace_push(p->trace, (TraceEvent){ kind, node.tag, a, b, node.value });
+}
+
+// Errors out before an update taking `count` links
+// starts, so it isn't left half done
+void Parser_reserve_links(Parser *p, uint16_t count) {
+  if (p->link_len + count <= MAX_LINKS || !p->recover) return;
+  Token tok = p->token_arr[p->pos];
+  Parser_error(p, tok.start, tok.len, "Program too big, out of links");
+}
+
 void Parser_add_node_output(Parser *p, NodeId user, NodeId used) {
+  Parser_reserve_links(p, 1);
   assert(p->link_len < MAX_LINKS);
   LinkId id = p->link_len++;
+  if (p->undo) {
+    Parser_save_link(p, id);
+    Parser_save_node(p, used);
+  }
   LinkId prev = p->node_arr[used].outputs;
   p->link_arr[id] = (Link){ prev, user };
   p->node_arr[used].outputs = id;
+  if (p->trace) Parser_trace(p, TRACE_ADD_OUTPUT, user, used);
 }
 
-void Parser_remove_output_node(Parser *p, NodeId user, NodeId used) {
-  if (!user || !used) return;
+// Where the inputs of a node are kept, the vars of a scope
+// aside. Unset inputs are included, returns how many there are
+uint16_t Parser_input_slots(Parser *p, NodeId id, NodeId *slot_arr[MAX_INPUTS]) {
+  Node *node = &p->node_arr[id];
+  uint16_t len = 0;
+  switch (node->tag) {
+    case NODE_IF:
+      slot_arr[len++] = &node->value.if_.ctrl;
+      slot_arr[len++] = &node->value.if_.cond;
+      break;
+    case NODE_PROJ:
+      slot_arr[len++] = &node->value.proj.ctrl;
+      break;
+    case NODE_CALL:
+      slot_arr[len++] = &node->value.call.ctrl;
+      for (uint16_t i = 0; i < node->value.call.arg_count; ++i) {
+        slot_arr[len++] = &p->arg_arr[node->value.call.arg_start + i];
+      }
+      break;
+    case NODE_CALL_END:
+      slot_arr[len++] = &node->value.call_end.call;
+      break;
+    case NODE_REGION:
+    case NODE_LOOP:
+      slot_arr[len++] = &node->value.region.left_block;
+      slot_arr[len++] = &node->value.region.right_block;
+      break;
+    case NODE_PHI:
+      slot_arr[len++] = &node->value.phi.ctrl;
+      slot_arr[len++] = &node->value.phi.left;
+      slot_arr[len++] = &node->value.phi.right;
+      break;
+    case NODE_SELECT:
+      slot_arr[len++] = &node->value.select.cond;
+      slot_arr[len++] = &node->value.select.left;
+      slot_arr[len++] = &node->value.select.right;
+      break;
+    case NODE_MINUS:
+    case NODE_NOT:
+      slot_arr[len++] = &node->value.unary.node;
+      break;
+    case NODE_RETURN:
+    case NODE_ADD:
+    case NODE_SUB:
+    case NODE_MUL:
+    case NODE_DIV:
+    case NODE_SHL:
+    case NODE_SAR:
+    case NODE_SHR:
+    case NODE_MULHI:
+    case NODE_EQ:
+    case NODE_NE:
+    case NODE_LT:
+    case NODE_LE:
+    case NODE_GT:
+    case NODE_GE:
+      slot_arr[len++] = &node->value.binary.left;
+      slot_arr[len++] = &node->value.binary.right;
+      break;
+    default: break;
+  }
+  return len;
+}
+
+// Nodes this one uses, returns how many went into `input_arr`
+uint16_t Parser_node_inputs(const Parser *p, NodeId id, NodeId input_arr[MAX_INPUTS]) {
+  NodeId *slot_arr[MAX_INPUTS];
+  uint16_t slot_len = Parser_input_slots((Parser *)p, id, slot_arr);
+  // An unfinished loop has no back edge yet
+  uint16_t len = 0;
+  for (uint16_t i = 0; i < slot_len; ++i) if (*slot_arr[i]) input_arr[len++] = *slot_arr[i];
+  return len;
+}
+
+// Takes `user` off the outputs of `used`, returns the
+// link it was on or the null link if it wasn't there
+LinkId Parser_unlink_output(Parser *p, NodeId user, NodeId used) {
   LinkId prev = 0;
   LinkId link = p->node_arr[used].outputs;
   while (link) {
@@ -21,64 +150,91 @@ void Parser_remove_output_node(Parser *p, NodeId user, NodeId used) {
       continue;
     }
     // TODO: reuse the link
+    if (p->undo) {
+      if (!prev) Parser_save_node(p, used);
+      else Parser_save_link(p, prev);
+    }
     if (!prev) p->node_arr[used].outputs = p->link_arr[link].next;
     else p->link_arr[prev].next = p->link_arr[link].next;
-    if (!p->node_arr[used].outputs) Parser_remove_node(p, used);
-    return;
+    if (p->trace) Parser_trace(p, TRACE_REMOVE_OUTPUT, user, used);
+    return link;
   }
-  assert(0);
-  printf("bad %d\n", used);
+  return NULL_LINK;
 }
 
-// Removes node only if it's unused
-void Parser_remove_node(Parser *p, NodeId id) {
-  if (p->node_arr[id].outputs) return;
-  if (id == p->node_len - 1) p->node_len--;
-  // TODO: else add to free list
-  Node node = p->node_arr[id];
-  switch (node.tag) {
+void Parser_remove_output_node(Parser *p, NodeId user, NodeId used) {
+  if (!user || !used) return;
+  bool found = Parser_unlink_output(p, user, used);
+  assert(found);
+  if (!p->node_arr[used].outputs) Parser_remove_node(p, used);
+}
+
+// Control nodes are kept alive by the control flow,
+// which isn't tracked through output links
+bool Parser_is_pinned(NodeTag tag) {
+  switch (tag) {
     case NODE_START:
-      break;
-    case NODE_CONSTANT:
-      // Parser_remove_output_node(p, START_NODE, id);
-      break;
-    case NODE_MINUS:
-      Parser_remove_output_node(p, node.value.unary.node, id);
-      break;
-    case NODE_RETURN:
-    case NODE_ADD:
-    case NODE_SUB:
-    case NODE_MUL:
-    case NODE_DIV:
-      Parser_remove_output_node(p, node.value.binary.left, id);
-      Parser_remove_output_node(p, node.value.binary.right, id);
-      break;
-    case NODE_PHI:
-      Parser_remove_output_node(p, node.value.phi.ctrl, id);
-      Parser_remove_output_node(p, node.value.phi.left, id);
-      Parser_remove_output_node(p, node.value.phi.right, id);
-      break;
-    case NODE_SCOPE:
-      // NOTE: you can only remove top most scope
-      uint16_t var_start = node.value.scope.var_start;
-      uint16_t var_count = node.value.scope.var_count;
-      for (int i = 0; i < var_count; i++) {
-        Var entry = p->var_arr[var_start + i];
-        Parser_remove_output_node(p, id, entry.node);
-      }
-      break;
+    case NODE_STOP:
+    case NODE_REGION:
+    case NODE_LOOP:
+    case NODE_IF:
+    case NODE_PROJ:
+    case NODE_CALL:
+    case NODE_CALL_END:
+      return true;
     default:
-      printf("Trying to remove bad node type: `%s`\n", NODE_NAME[node.tag]);
-      assert(0);
+      return false;
   }
-  p->node_arr[id].tag = NODE_NONE;
 }
 
+// Removes node only if it's unused, then the inputs only it
+// used. A worklist instead of recursion, chains can be long
+void Parser_remove_node(Parser *p, NodeId id) {
+  if (p->node_arr[id].outputs || Parser_is_pinned(p->node_arr[id].tag)) return;
+  ArenaMark mark = Arena_mark(&p->scratch);
+  Worklist work = Worklist_new(&p->scratch, p->node_len);
+  Worklist_push(&work, id);
+  while (work.len) {
+    id = Worklist_pop(&work);
+    Node node = p->node_arr[id];
+    if (node.outputs || Parser_is_pinned(node.tag)) continue;
+    if (id == p->node_len - 1) p->node_len--;
+    // TODO: else add to free list
+    NodeId input_arr[MAX_INPUTS];
+    uint16_t input_len = Parser_node_inputs(p, id, input_arr);
+    for (uint16_t i = 0; i < input_len; ++i) {
+      bool found = Parser_unlink_output(p, id, input_arr[i]);
+      assert(found);
+      if (!p->node_arr[input_arr[i]].outputs) Worklist_push(&work, input_arr[i]);
+    }
+    if (node.tag == NODE_SCOPE) {
+      // NOTE: you can only remove top most scope
+      for (uint16_t i = 0; i < node.value.scope.var_count; ++i) {
+        NodeId var = p->var_arr[node.value.scope.var_start + i].node;
+        if (!var) continue;
+        bool found = Parser_unlink_output(p, id, var);
+        assert(found);
+        if (!p->node_arr[var].outputs) Worklist_push(&work, var);
+      }
+    }
+    if (p->trace) Parser_trace(p, TRACE_REMOVE_NODE, id, 0);
+    if (p->undo) Parser_save_node(p, id);
+    p->node_arr[id].tag = NODE_NONE;
+  }
+  Arena_release(&p->scratch, mark);
+}
 
 NodeId Parser_create_node(Parser *p, Node node) {
+  if (p->node_len >= MAX_NODES && p->recover) {
+    Token tok = p->token_arr[p->pos];
+    Parser_error(p, tok.start, tok.len, "Program too big, out of nodes");
+  }
   assert(p->node_len < MAX_NODES);
   NodeId id = p->node_len++;
+  node.loop = p->loop;
+  if (p->undo) Parser_save_node(p, id);
   p->node_arr[id] = node;
+  if (p->trace) Parser_trace(p, TRACE_CREATE_NODE, id, 0);
   return id;
 }
 
@@ -114,9 +270,12 @@ NodeId Parser_create_binary_node(Parser *p, NodeTag op, NodeId left, NodeId righ
   return node;
 }
 
+// Inputs of the graph, parameters or the program's `arg`,
+// are projections of its START and can be any int
 NodeId Parser_create_proj_node(Parser *p, NodeId ctrl, uint16_t select) {
   NodeId node = Parser_create_node(p, (Node){
     .tag = NODE_PROJ,
+    .type = ctrl == START_NODE ? TYPE_INT_BOT : TYPE_BOT,
     .value.proj.ctrl = ctrl,
     .value.proj.select = select,
   });
@@ -176,3 +335,129 @@ NodeId Parser_create_phi_node(Parser *p, NodeId region, NodeId left, NodeId righ
   Parser_add_node_output(p, node, right);
   return node;
 }
+
+// The back edge is set once the body is parsed
+NodeId Parser_create_loop_node(Parser *p, NodeId entry) {
+  NodeId node = Parser_create_node(p, (Node){
+    .tag = NODE_LOOP,
+    .value.region.left_block = entry,
+  });
+  Parser_add_node_output(p, node, entry);
+  return node;
+}
+
+// Made lazily, possibly while parsing a nested loop
+NodeId Parser_create_loop_phi(Parser *p, NodeId loop, NodeId entry) {
+  NodeId node = Parser_create_node(p, (Node){
+    .tag = NODE_PHI,
+    .value.phi.ctrl = loop,
+    .value.phi.left = entry,
+  });
+  p->node_arr[node].loop = loop;
+  Parser_add_node_output(p, node, loop);
+  Parser_add_node_output(p, node, entry);
+  return node;
+}
+
+// `function` of the program with the values in `arg_arr`, at
+// the current control. Returns the result, the control carries
+// on from the call's end
+NodeId Parser_create_call(Parser *p, uint16_t function, const NodeId *arg_arr, uint16_t arg_count) {
+  Token tok = p->token_arr[p->pos - 1];
+  if (p->arg_len + arg_count > MAX_ARGS) {
+    Parser_error(p, tok.start, tok.len, "Program too big, out of argument slots");
+  }
+  // A call without its end would be a dead end for the control
+  if (p->node_len + 4 > MAX_NODES) Parser_error(p, tok.start, tok.len, "Program too big, out of nodes");
+  Parser_reserve_links(p, arg_count + 4);
+  NodeId ctrl = Parser_resolve_ctrl(p);
+  uint16_t arg_start = p->arg_len;
+  NodeId call = Parser_create_node(p, (Node){
+    .tag = NODE_CALL,
+    .value.call = { ctrl, function, arg_start, arg_count },
+  });
+  if (arg_count) memcpy(&p->arg_arr[arg_start], arg_arr, arg_count * sizeof(NodeId));
+  p->arg_len += arg_count;
+  Parser_add_node_output(p, call, ctrl);
+  for (uint16_t i = 0; i < arg_count; ++i) Parser_add_node_output(p, call, arg_arr[i]);
+  NodeId end = Parser_create_node(p, (Node){
+    .tag = NODE_CALL_END,
+    .value.call_end.call = call,
+  });
+  Parser_add_node_output(p, end, call);
+  Parser_update_ctrl(p, Parser_create_proj_node(p, end, 0));
+  NodeId result = Parser_create_proj_node(p, end, 1);
+  p->node_arr[result].type = TYPE_INT;
+  return result;
+}
+
+void Parser_set_slot(Parser *p, NodeId user, NodeId *slot, NodeId new) {
+  if (p->undo) {
+    // The arguments of a call are kept aside
+    bool arg = slot >= p->arg_arr && slot < &p->arg_arr[MAX_ARGS];
+    if (arg) Parser_save_arg(p, slot - p->arg_arr);
+    else Parser_save_node(p, user);
+  }
+  *slot = new;
+}
+
+// One use of `old` in `user` is made a use of `new`
+void Parser_replace_input(Parser *p, NodeId user, NodeId old, NodeId new) {
+  Node *node = &p->node_arr[user];
+  if (node->tag == NODE_SCOPE) {
+    for (uint16_t i = 0; i < node->value.scope.var_count; ++i) {
+      Var *var = &p->var_arr[node->value.scope.var_start + i];
+      if (var->node != old) continue;
+      if (p->undo) Parser_save_var(p, node->value.scope.var_start + i);
+      var->node = new;
+      return;
+    }
+    return;
+  }
+  NodeId *slot_arr[MAX_INPUTS];
+  uint16_t slot_len = Parser_input_slots(p, user, slot_arr);
+  for (uint16_t i = 0; i < slot_len; ++i) {
+    if (*slot_arr[i] != old) continue;
+    Parser_set_slot(p, user, slot_arr[i], new);
+    return;
+  }
+}
+
+// The input in `slot` of `user` is made `new`, links
+// included. What it was is left even when unused
+void Parser_replace_slot(Parser *p, NodeId user, uint16_t slot, NodeId new) {
+  NodeId *slot_arr[MAX_INPUTS];
+  uint16_t slot_len = Parser_input_slots(p, user, slot_arr);
+  assert(slot < slot_len);
+  NodeId old = *slot_arr[slot];
+  Parser_set_slot(p, user, slot_arr[slot], new);
+  bool found = Parser_unlink_output(p, user, old);
+  assert(found);
+  Parser_add_node_output(p, user, new);
+}
+
+// Every user of `old` uses `new` instead, `old` goes away.
+// The links move over, so this can't run out of them
+void Parser_replace_node(Parser *p, NodeId old, NodeId new) {
+  LinkId link = p->node_arr[old].outputs;
+  while (link) {
+    LinkId next = p->link_arr[link].next;
+    NodeId user = p->link_arr[link].node;
+    Parser_replace_input(p, user, old, new);
+    if (p->undo) {
+      Parser_save_link(p, link);
+      Parser_save_node(p, new);
+    }
+    p->link_arr[link].next = p->node_arr[new].outputs;
+    p->node_arr[new].outputs = link;
+    if (p->trace) {
+      Parser_trace(p, TRACE_REMOVE_OUTPUT, user, old);
+      Parser_trace(p, TRACE_ADD_OUTPUT, user, new);
+      Parser_trace(p, TRACE_CREATE_NODE, user, 0);
+    }
+    link = next;
+  }
+  if (p->undo) Parser_save_node(p, old);
+  p->node_arr[old].outputs = 0;
+  Parser_remove_node(p, old);
+}
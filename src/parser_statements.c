@@ -1,85 +1,232 @@
 #include "parser.h"
 #include "tokenizer.h"
 
-const char *GRAPH_FILENAME = "out/graph.dot";
+const char *const GRAPH_FILENAME = "out/graph.dot";
 const Str GRAPH_BUILTIN_NAME = STR("graph");
 const Str PRINT_AST_BUILTIN_NAME = STR("nodes");
 
-NodeId Parser_parse_statement(Parser *p);
+// Skips to the next place a statement can start: past a `;`
+// or a whole `{}` block, or before a statement keyword or the
+// `}` closing the current block
+void Parser_synchronize(Parser *p, uint16_t statement_start) {
+  // Always make progress, the first token is the culprit
+  if (p->pos == statement_start && p->token_arr[p->pos].tag) p->pos++;
+  uint16_t depth = 0;
+  while (1) {
+    Token tok = p->token_arr[p->pos];
+    switch (tok.tag) {
+      case TOK_NONE:
+        return;
+      case TOK_SEMICOLON:
+        p->pos++;
+        if (!depth) return;
+        break;
+      case TOK_LBRACE:
+        p->pos++;
+        depth++;
+        break;
+      case TOK_RBRACE:
+        if (!depth) return;
+        p->pos++;
+        if (!--depth) return;
+        break;
+      case TOK_INT:
+      case TOK_IF:
+      case TOK_WHILE:
+      case TOK_RETURN:
+        if (!depth) return;
+        p->pos++;
+        break;
+      default:
+        p->pos++;
+    }
+  }
+}
 
-NodeId Parser_parse_block(Parser *p) {
-  Parser_push_scope(p);
-  assert(p->pos);
-  Token start = p->token_arr[p->pos - 1];
+void Parser_save_recovery(Parser *p, Recovery *r) {
+  r->statement_start = p->pos;
+  r->scope = p->scope;
+  r->var_count = p->node_arr[p->scope].value.scope.var_count;
+  r->var_len = p->var_len;
+  r->var_offset = p->var_offset;
+  r->ctrl = Parser_resolve_ctrl(p);
+}
+
+void Parser_recover(Parser *p, const Recovery *r) {
+  p->scope = r->scope;
+  p->node_arr[r->scope].value.scope.var_count = r->var_count;
+  p->var_len = r->var_len;
+  p->var_offset = r->var_offset;
+  Parser_update_ctrl(p, r->ctrl);
+  Parser_synchronize(p, r->statement_start);
+}
+
+// NOTE: moves the frames, pointers to them from
+// before don't hold anymore
+Frame *Parser_push_frame(Parser *p, FrameKind kind) {
+  if (p->frame_len == p->frame_cap) {
+    // Every frame starts at a token
+    assert(p->frame_cap < MAX_TOKENS);
+    uint16_t cap = p->frame_cap ? p->frame_cap * 2 : 16;
+    Frame *frame_arr = realloc(p->frame_arr, cap * sizeof(Frame));
+    assert(frame_arr);
+    p->frame_arr = frame_arr;
+    p->frame_cap = cap;
+  }
+  Frame *f = &p->frame_arr[p->frame_len++];
+  f->kind = kind;
+  return f;
+}
+
+// Statement boundary, errors inside the statement land
+// here. An error in a nested block only skips the failed
+// statement of that block, the block itself carries on
+NodeId Parser_parse_statement_or_recover(Parser *p) {
+  jmp_buf recover;
+  jmp_buf *prev_recover = p->recover;
+  uint16_t base = p->frame_len;
+  Recovery outer;
+  Parser_save_recovery(p, &outer);
+  ArenaMark scratch = Arena_mark(&p->scratch);
+  Profile_push(PHASE_STATEMENT);
+  uint32_t depth = Profile_depth();
+  // NOTE: volatile, or the longjmp can clobber it
+  volatile bool resume = false;
   NodeId node = 0;
-  while (p->token_arr[p->pos].tag != TOK_RBRACE) {
-    Token tok = p->token_arr[p->pos];
-    if (!tok.tag) {
-      print_error(p->source, start.start, start.len, "No matching `}` found before EOF");
-      exit(1);
+
+  if (setjmp(recover)) {
+    // Whatever was using it got unwound
+    Arena_release(&p->scratch, scratch);
+    Profile_unwind(depth);
+    uint16_t i = p->frame_len;
+    while (i > base && p->frame_arr[i - 1].kind != FRAME_BLOCK) {
+      // Popped first, so an error while abandoning can't repeat it
+      p->frame_len = --i;
+      if (p->frame_arr[i].kind == FRAME_LOOP) Parser_abandon_loop(p, &p->frame_arr[i]);
     }
-    NodeId elem = Parser_parse_statement(p);
-    if (elem) node = elem;
+    p->frame_len = i;
+    if (i == base) {
+      Parser_recover(p, &outer);
+      p->recover = prev_recover;
+      Profile_pop();
+      return 0;
+    }
+    Parser_recover(p, &p->frame_arr[i - 1].value.block.recovery);
+    resume = true;
   }
-  p->pos++;
-  Parser_pop_scope(p);
+  p->recover = &recover;
+  node = Parser_parse_statement(p, base, resume);
+  p->recover = prev_recover;
+  Profile_pop();
   return node;
 }
 
-NodeId Parser_parse_statement(Parser *p) {
+// `int name(int a, int b) { ... }` at the top level, the body
+// goes into a graph of its own. Parameters are projections of
+// its START, the control is START itself
+void Parser_parse_function(Parser *p, Token name) {
+  if (p->owner || p->frame_len) {
+    Parser_error(p, name.start, name.len, "Functions can only be defined at the top level");
+  }
+  if (Parser_find_function(p, name.start, name.len)) {
+    Parser_error(p, name.start, name.len, "Function `%.*s` is already defined",
+      name.len, &p->source[name.start]);
+  }
+  Parser_expect_token(p, TOK_LPAREN);
+  uint16_t param_start = p->pos;
+  uint16_t param_count = 0;
+  while (p->token_arr[p->pos].tag != TOK_RPAREN) {
+    if (param_count) Parser_expect_token(p, TOK_COMMA);
+    Parser_expect_token(p, TOK_INT);
+    Token param = Parser_expect_token(p, TOK_IDENT);
+    if (++param_count > MAX_PARAMS) Parser_error(p, param.start, param.len,
+      "Functions take at most %d parameters", MAX_PARAMS);
+  }
+  p->pos++;
+  Token body = p->token_arr[p->pos];
+  if (body.tag != TOK_LBRACE) Parser_error(p, body.start, body.len,
+    "Expected `{` before the body of `%.*s`, got `%s`",
+    name.len, &p->source[name.start], TOK_NAMES[body.tag]);
+
+  Profile_push(PHASE_FUNCTION);
+  Parser *fp = Parser_define_function(p, name, param_count);
+  Parser_open_top_level(fp);
+  for (uint16_t i = 0; i < param_count; ++i) {
+    // `int name` and a `,` before every but the first
+    Token param = p->token_arr[param_start + i * 3 + 1];
+    NodeId proj = Parser_create_proj_node(fp, START_NODE, i + 1);
+    Parser_push_var(fp, param.start, param.len, proj);
+  }
+  // Errors in the body are recovered from in there
+  fp->pos = p->pos;
+  Parser_parse_statement_or_recover(fp);
+  Parser_close_top_level(fp);
+  p->pos = fp->pos;
+  Profile_pop();
+}
+
+// One statement and everything nested in it. Blocks and
+// branches wait on p->frame_arr instead of the C stack, frames
+// below `base` belong to the caller. With `resume` the block on
+// top carries on after a statement that failed
+NodeId Parser_parse_statement(Parser *p, uint16_t base, bool resume) {
   NodeId node = 0, value = 0;
-  Token tok = p->token_arr[p->pos++];
+  Frame *f;
+  Token tok;
+  if (resume) goto block_next;
+
+statement:
+  node = 0;
+  tok = p->token_arr[p->pos++];
   switch (tok.tag) {
     case TOK_IF:
       // duplicate the scope
       Parser_expect_token(p, TOK_LPAREN);
       NodeId cond = Parser_parse_expression(p);
       Parser_expect_token(p, TOK_RPAREN);
-      node = Parser_create_if_node(p, cond);
-      NodeId then_block = Parser_create_proj_node(p, node, 0);
-      NodeId else_block = Parser_create_proj_node(p, node, 1);
+      f = Parser_push_frame(p, FRAME_THEN);
+      f->value.branch.node = Parser_create_if_node(p, cond);
+      f->value.branch.then_block = Parser_create_proj_node(p, f->value.branch.node, 0);
+      f->value.branch.else_block = Parser_create_proj_node(p, f->value.branch.node, 1);
 
       // TODO: We don't need a copy of start and len, only node
       uint16_t right_start = p->var_len;
       uint16_t left_start = p->var_offset;
       uint16_t var_len = right_start - left_start;
-      assert((p->var_len += var_len) < MAX_VAR_DEPTH);
+      Parser_check_var_slots(p, var_len);
+      p->var_len += var_len;
       memcpy(&p->var_arr[right_start], &p->var_arr[left_start], var_len * sizeof(Var));
-      NodeId new_scope = Parser_duplicate_scopes(p, right_start);
-      NodeId prev_scope = p->scope;
+      f->value.branch.new_scope = Parser_duplicate_scopes(p, var_len);
+      f->value.branch.prev_scope = p->scope;
+      f->value.branch.right_start = right_start;
+      f->value.branch.left_start = left_start;
 
       // Then block
-      p->scope = new_scope;
+      p->scope = f->value.branch.new_scope;
       p->var_offset = right_start;
       Parser_push_scope(p);
-      Parser_update_ctrl(p, then_block);
-      Parser_parse_statement(p);
-      then_block = Parser_resolve_ctrl(p);
-      Parser_pop_scope(p);
-      p->scope = prev_scope;
-      p->var_offset = left_start;
-
-      // Else block
-      if (p->token_arr[p->pos].tag == TOK_ELSE) {
-        p->pos++;
-        Parser_push_scope(p);
-        Parser_update_ctrl(p, else_block);
-        Parser_parse_statement(p);
-        else_block = Parser_resolve_ctrl(p);
-        Parser_pop_scope(p);
-      }
-      NodeId region = Parser_create_region_node(p, then_block, else_block);
-
-      p->node_arr[p->scope].value.scope.ctrl = region;
-      Parser_create_phi_nodes(p, right_start, region, new_scope);
-      p->var_len = right_start;
-      Parser_update_ctrl(p, region);
-      break;
+      Parser_update_ctrl(p, f->value.branch.then_block);
+      goto statement;
+    case TOK_WHILE:
+      Parser_expect_token(p, TOK_LPAREN);
+      f = Parser_push_frame(p, FRAME_LOOP);
+      f->value.loop.node = 0;
+      NodeId loop = Parser_create_loop_node(p, Parser_resolve_ctrl(p));
+      Parser_update_ctrl(p, loop);
+      Parser_open_loop(p, f, loop);
+      cond = Parser_parse_expression(p);
+      Parser_expect_token(p, TOK_RPAREN);
+      NodeId test = Parser_create_if_node(p, cond);
+      NodeId body = Parser_create_proj_node(p, test, 0);
+      f->value.loop.exit = Parser_create_proj_node(p, test, 1);
+      Parser_push_scope(p);
+      Parser_update_ctrl(p, body);
+      goto statement;
     case TOK_IDENT:
       // TODO: add debug flag
       if (tok.len == GRAPH_BUILTIN_NAME.len &&
           !strncmp(GRAPH_BUILTIN_NAME.ptr, &p->source[tok.start], tok.len)) {
-        output_graphviz_file(GRAPH_FILENAME, p);
+        if (p->graph_filename) output_graphviz_file(p->graph_filename, p, &GRAPH_OPTIONS);
         Parser_expect_token(p, TOK_LPAREN);
         Parser_expect_token(p, TOK_RPAREN);
         Parser_expect_token(p, TOK_SEMICOLON);
@@ -93,45 +240,155 @@ NodeId Parser_parse_statement(Parser *p) {
         Parser_expect_token(p, TOK_SEMICOLON);
         break;
       }
+      // A call for what it does, the result is dropped
+      if (p->token_arr[p->pos].tag == TOK_LPAREN) {
+        p->pos--;
+        Parser_parse_expression(p);
+        Parser_expect_token(p, TOK_SEMICOLON);
+        break;
+      }
       Parser_expect_token(p, TOK_EQ);
       value = Parser_parse_expression(p);
+      Parser_expect_token(p, TOK_SEMICOLON);
       Parser_update_var(p, tok.start, tok.len, value);
       break;
     case TOK_INT:
       tok = Parser_expect_token(p, TOK_IDENT);
+      if (p->token_arr[p->pos].tag == TOK_LPAREN) {
+        Parser_parse_function(p, tok);
+        break;
+      }
       Parser_expect_token(p, TOK_EQ);
       value = Parser_parse_expression(p);
+      Parser_expect_token(p, TOK_SEMICOLON);
       Parser_push_var(p, tok.start, tok.len, value);
       break;
     case TOK_SEMICOLON:
       break;
     case TOK_LBRACE:
-      node = Parser_parse_block(p);
-      break;
+      Parser_push_scope(p);
+      f = Parser_push_frame(p, FRAME_BLOCK);
+      f->value.block.start = tok;
+      f->value.block.node = 0;
+      goto block_next;
     case TOK_RETURN:
       if (p->token_arr[p->pos].tag != TOK_SEMICOLON) {
         value = Parser_parse_expression(p);
         Parser_expect_token(p, TOK_SEMICOLON);
       } else p->pos++;
-      return Parser_create_return_node(p, value);
+      node = Parser_create_return_node(p, value);
       break;
     default: 
-      print_error(p->source, tok.start, tok.len,
+      p->pos--;
+      Parser_error(p, tok.start, tok.len,
         "Expected statement, got `%s`", TOK_NAMES[tok.tag]);
-      exit(1);
   }
-  return node;
+
+statement_done:
+  // Hand the finished statement to the one waiting for it
+  if (p->frame_len == base) return node;
+  f = &p->frame_arr[p->frame_len - 1];
+  switch (f->kind) {
+    case FRAME_BLOCK:
+      if (node) f->value.block.node = node;
+      goto block_next;
+    case FRAME_THEN:
+      f->value.branch.then_block = Parser_resolve_ctrl(p);
+      Parser_pop_scope(p);
+      p->scope = f->value.branch.prev_scope;
+      p->var_offset = f->value.branch.left_start;
+
+      // Else block
+      if (p->token_arr[p->pos].tag == TOK_ELSE) {
+        p->pos++;
+        Parser_push_scope(p);
+        Parser_update_ctrl(p, f->value.branch.else_block);
+        f->kind = FRAME_ELSE;
+        goto statement;
+      }
+      break;
+    case FRAME_ELSE:
+      f->value.branch.else_block = Parser_resolve_ctrl(p);
+      Parser_pop_scope(p);
+      break;
+    case FRAME_LOOP:
+      Parser_close_loop(p, f);
+      Parser_update_ctrl(p, f->value.loop.exit);
+      node = f->value.loop.node;
+      p->frame_len--;
+      goto statement_done;
+  }
+  // A branch that returned never gets to the merge, the
+  // other one carries on alone. Callees stay inlinable
+  NodeId then_block = f->value.branch.then_block;
+  NodeId else_block = f->value.branch.else_block;
+  uint16_t offset = f->value.branch.right_start - f->value.branch.left_start;
+  bool then_returned = p->node_arr[then_block].tag == NODE_RETURN;
+  bool else_returned = p->node_arr[else_block].tag == NODE_RETURN;
+  NodeId ctrl = then_returned ? else_block : then_block;
+  if (then_returned == else_returned) {
+    ctrl = Parser_create_region_node(p, then_block, else_block);
+    Parser_create_phi_nodes(p, offset, ctrl, f->value.branch.new_scope);
+  } else if (else_returned) {
+    Parser_take_branch(p, offset);
+  }
+  p->var_len = f->value.branch.right_start;
+  Parser_update_ctrl(p, ctrl);
+  node = f->value.branch.node;
+  p->frame_len--;
+  goto statement_done;
+
+block_next:
+  f = &p->frame_arr[p->frame_len - 1];
+  assert(f->kind == FRAME_BLOCK);
+  tok = p->token_arr[p->pos];
+  if (tok.tag == TOK_RBRACE) {
+    p->pos++;
+    Parser_pop_scope(p);
+    node = f->value.block.node;
+    p->frame_len--;
+    goto statement_done;
+  }
+  if (!tok.tag) {
+    // Reported to the statement around the block
+    Token start = f->value.block.start;
+    p->frame_len--;
+    Parser_error(p, start.start, start.len, "No matching `}` found before EOF");
+  }
+  Parser_save_recovery(p, &f->value.block.recovery);
+  goto statement;
 }
 
-NodeId Parser_parse_top_level(Parser *p) {
+// The top level scope, split out so an incremental
+// reparse can resume between statements
+void Parser_open_top_level(Parser *p) {
   Parser_push_scope(p);
   p->node_arr[p->scope].value.scope.ctrl = START_NODE;
+}
+
+void Parser_close_top_level(Parser *p) {
+  // Running off the end stops the program too
+  NodeId end = Parser_resolve_ctrl(p);
+  if (p->node_arr[end].tag != NODE_RETURN && p->link_len < MAX_LINKS) {
+    Parser_add_node_output(p, STOP_NODE, end);
+  } else if (p->node_arr[end].tag != NODE_RETURN) {
+    // Past the last statement, nothing to recover in
+    Token tok = p->token_arr[p->pos ? p->pos - 1 : 0];
+    Diagnostics_error(p->diag, tok.start, tok.len, "Program too big, out of links");
+  }
+  Parser_pop_scope(p);
+}
+
+NodeId Parser_parse_top_level(Parser *p) {
+  Profile_push(PHASE_PARSE);
+  Parser_open_top_level(p);
   NodeId node = 0;
   while (p->token_arr[p->pos].tag != TOK_NONE) {
-    NodeId elem = Parser_parse_statement(p);
+    NodeId elem = Parser_parse_statement_or_recover(p);
     if (elem) node = elem;
   }
-  Parser_pop_scope(p);
+  Parser_close_top_level(p);
+  Profile_pop();
+  Parser_optimize_all(p);
   return node;
 }
-
@@ -43,27 +43,37 @@ NodeId Parser_resolve_ctrl(Parser *p) {
   return 0;
 }
 
+// Branches and loops copy the whole chain, deep
+// nesting runs out of slots before anything else
+void Parser_check_var_slots(Parser *p, uint16_t count) {
+  if (p->var_len + count < MAX_VAR_DEPTH) return;
+  Token tok = p->token_arr[p->pos ? p->pos - 1 : 0];
+  Parser_error(p, tok.start, tok.len, "Program too big, out of variable slots");
+}
+
 VarId Parser_push_var(Parser *p, uint32_t start, uint16_t len, NodeId node) {
-  assert(p->var_len < MAX_VAR_DEPTH);
+  Parser_check_var_slots(p, 1);
   uint16_t var_count = p->node_arr[p->scope].value.scope.var_count;
   uint16_t var_start = p->node_arr[p->scope].value.scope.var_start;
   for (int i = 0; i < var_count; i++) {
     Var entry = p->var_arr[var_start + i];
     if (entry.len != len) continue;
     if (strncmp(&p->source[entry.start], &p->source[start], len)) continue;
-    print_error_message("Redefintion of `%.*s`", len, &p->source[start]);
-    print_note(p->source, entry.start, entry.len, "Variable first defined here");
-    print_note(p->source, start, len, "Redefinition here");
-    exit(1);
+    // Not a syntax error, keep the first definition and carry on
+    Diagnostics_error(p->diag, start, len, "Redefinition of `%.*s`", len, &p->source[start]);
+    Diagnostics_note(p->diag, entry.start, entry.len, "Variable first defined here");
+    return var_start + i;
   }
+  // Linked first, running out of links leaves no var behind
+  Parser_add_node_output(p, p->scope, node);
   VarId id = p->var_len++;
   p->var_arr[id] = (Var){ start, len, node };
   p->node_arr[p->scope].value.scope.var_count++;
-  Parser_add_node_output(p, p->scope, node);
   return id;
 }
 
 VarId Parser_resolve_var(Parser *p, uint32_t start, uint16_t len) {
+  Profile_push(PHASE_RESOLVE_VAR);
   NodeId scope = p->scope;
   while (scope) {
     uint16_t var_count = p->node_arr[scope].value.scope.var_count;
@@ -72,12 +82,14 @@ VarId Parser_resolve_var(Parser *p, uint32_t start, uint16_t len) {
     for (int i = var_end - 1; i >= var_start; --i) {
       Var var = p->var_arr[i];
       if (var.len != len) continue;
-      if (!strncmp(&p->source[var.start], &p->source[start], len)) return i;
+      if (strncmp(&p->source[var.start], &p->source[start], len)) continue;
+      Parser_resolve_lazy(p, scope, i - var_start);
+      Profile_pop();
+      return i;
     }
     scope = p->node_arr[scope].value.scope.prev_scope;
   }
-  print_error(p->source, start, len, "Variable `%.*s` not found", len, &p->source[start]);
-  exit(1);
+  Parser_error(p, start, len, "Variable `%.*s` not found", len, &p->source[start]);
 }
 
 void Parser_update_var(Parser *p, uint32_t start, uint16_t len, NodeId new_value) {
@@ -96,24 +108,32 @@ void Parser_update_var(Parser *p, uint32_t start, uint16_t len, NodeId new_value
     }
     scope = p->node_arr[scope].value.scope.prev_scope;
   }
-  print_error(p->source, start, len, "Variable `%.*s` not found", len, &p->source[start]);
-  exit(1);
+  Parser_error(p, start, len, "Variable `%.*s` not found", len, &p->source[start]);
 var_found:
-  Parser_remove_output_node(p, scope, p->var_arr[id].node);
+  // The value after the loop depends on the write too
+  Parser_resolve_lazy(p, scope, id - p->node_arr[scope].value.scope.var_start);
+  // Add first, `a = a` would free the node otherwise
   Parser_add_node_output(p, scope, new_value);
+  Parser_remove_output_node(p, scope, p->var_arr[id].node);
   p->var_arr[id].node = new_value;
 }
 
+// Copies the whole scope chain for the vars copied `offset`
+// slots up, the copies link to each other
 NodeId Parser_duplicate_scopes(Parser *p, uint16_t offset) {
+  Profile_push(PHASE_SCOPES);
   NodeId scope = p->scope;
-  NodeId ret = 0;
+  NodeId ret = 0, prev_copy = 0;
   while (scope) {
     Node node = p->node_arr[scope];
     uint16_t new_start = node.value.scope.var_start + offset;
     uint16_t var_count = node.value.scope.var_count;
     node.value.scope.var_start += offset;
+    node.value.scope.prev_scope = 0;
     NodeId new_scope = Parser_create_node(p, node);
     if (!ret) ret = new_scope;
+    if (prev_copy) p->node_arr[prev_copy].value.scope.prev_scope = new_scope;
+    prev_copy = new_scope;
 
     uint16_t var_end = new_start + var_count; 
     for (int i = var_end - 1; i >= new_start; --i) {
@@ -122,10 +142,12 @@ NodeId Parser_duplicate_scopes(Parser *p, uint16_t offset) {
     }
     scope = p->node_arr[scope].value.scope.prev_scope;
   }
+  Profile_pop();
   return ret;
 }
 
-void Parser_create_phi_nodes(Parser *p, uint16_t copy_start, NodeId ctrl, NodeId new_scope) {
+void Parser_create_phi_nodes(Parser *p, uint16_t offset, NodeId ctrl, NodeId new_scope) {
+  Profile_push(PHASE_SCOPES);
   NodeId scope = p->scope;
   while (scope) {
     assert(new_scope);
@@ -134,22 +156,209 @@ void Parser_create_phi_nodes(Parser *p, uint16_t copy_start, NodeId ctrl, NodeId
     uint16_t var_end = var_start + var_count;
     for (int i = var_end - 1; i >= var_start; --i) {
       NodeId lnode = p->var_arr[i].node;
-      NodeId rnode = p->var_arr[i + copy_start].node;
+      NodeId rnode = p->var_arr[i + offset].node;
       if (lnode == rnode) continue;
-      NodeId phi = Parser_create_phi_node(p, ctrl, lnode, rnode);
-
-      printf("left: %d\n", p->node_arr[lnode].value.i64);
-      printf("right: %d\n", p->node_arr[rnode].value.i64);
-      LinkId link = p->node_arr[lnode].outputs;
-
+      lnode = Parser_resolve_lazy(p, scope, i - var_start);
+      rnode = Parser_resolve_lazy(p, new_scope, i - var_start);
+      if (lnode == rnode) continue;
+      // The then branch ran on the copies, it is the left of the region
+      NodeId phi = Parser_create_phi_node(p, ctrl, rnode, lnode);
       // TOOD: why it's not an input of scope?
-      Parser_remove_output_node(p, scope, lnode);
       Parser_remove_output_node(p, new_scope, rnode);
-      Parser_add_node_output(p, scope, phi);
-      p->var_arr[i].node = phi;
+      Parser_set_var(p, scope, i - var_start, phi);
     }
     scope = p->node_arr[scope].value.scope.prev_scope;
     // Parser_remove_node(p, new_scope);
     new_scope = p->node_arr[new_scope].value.scope.prev_scope;
   }
+  Profile_pop();
+}
+
+// Only the then branch gets past the if, the
+// values it left in the copies become the vars
+void Parser_take_branch(Parser *p, uint16_t offset) {
+  for (NodeId scope = p->scope; scope; scope = p->node_arr[scope].value.scope.prev_scope) {
+    uint16_t var_start = p->node_arr[scope].value.scope.var_start;
+    for (uint16_t i = 0; i < p->node_arr[scope].value.scope.var_count; ++i) {
+      NodeId node = p->var_arr[var_start + i + offset].node;
+      if (node != p->var_arr[var_start + i].node) Parser_set_var(p, scope, i, node);
+    }
+  }
+}
+
+// The scope's link moves over to the new value, so this
+// can't run out of links. Abandoning a loop counts on that
+void Parser_set_var(Parser *p, NodeId scope, uint16_t index, NodeId node) {
+  Var *var = &p->var_arr[p->node_arr[scope].value.scope.var_start + index];
+  NodeId old = var->node;
+  LinkId link = old ? Parser_unlink_output(p, scope, old) : NULL_LINK;
+  var->node = node;
+  if (!link) {
+    Parser_add_node_output(p, scope, node);
+    return;
+  }
+  p->link_arr[link].next = p->node_arr[node].outputs;
+  p->node_arr[node].outputs = link;
+  if (p->trace) Parser_trace(p, TRACE_ADD_OUTPUT, scope, node);
+  if (!p->node_arr[old].outputs) Parser_remove_node(p, old);
+}
+
+uint16_t Parser_scope_depth(Parser *p, NodeId scope) {
+  uint16_t depth = 0;
+  for (; scope; scope = p->node_arr[scope].value.scope.prev_scope) depth++;
+  return depth;
+}
+
+// Scope of the loop's head chain that mirrors `scope`. Branch
+// copies keep the depth and var order of the chain they copy
+NodeId Parser_loop_head(Parser *p, NodeId loop, NodeId scope) {
+  uint16_t i = p->frame_len;
+  while (i && (p->frame_arr[i - 1].kind != FRAME_LOOP ||
+      p->frame_arr[i - 1].value.loop.node != loop)) i--;
+  assert(i);
+  Frame *f = &p->frame_arr[i - 1];
+  NodeId head = f->value.loop.head;
+  uint16_t depth = Parser_scope_depth(p, scope);
+  assert(depth <= f->value.loop.depth);
+  for (uint16_t j = depth; j < f->value.loop.depth; ++j) {
+    head = p->node_arr[head].value.scope.prev_scope;
+  }
+  return head;
+}
+
+// Value of var `index` of `scope`. A var still holding a loop
+// node gets that loop's phi, made the first time it's asked
+// for. The entry value can be lazy for an outer loop too
+NodeId Parser_resolve_lazy(Parser *p, NodeId scope, uint16_t index) {
+  VarId start = p->node_arr[scope].value.scope.var_start;
+  NodeId node = p->var_arr[start + index].node;
+  if (p->node_arr[node].tag != NODE_LOOP) return node;
+  // One entry per loop being parsed at most
+  ArenaMark mark = Arena_mark(&p->scratch);
+  NodeId *path = Arena_alloc(&p->scratch, p->frame_len * sizeof(NodeId));
+  uint16_t path_len = 0;
+  // Walk out to the first loop that already has a value
+  NodeId s = scope;
+  while (p->node_arr[node].tag == NODE_LOOP) {
+    assert(path_len < p->frame_len);
+    path[path_len++] = s;
+    s = Parser_loop_head(p, node, s);
+    node = p->var_arr[p->node_arr[s].value.scope.var_start + index].node;
+  }
+  // And make the phis on the way back in
+  while (path_len--) {
+    s = path[path_len];
+    NodeId loop = p->var_arr[p->node_arr[s].value.scope.var_start + index].node;
+    NodeId head = Parser_loop_head(p, loop, s);
+    node = p->var_arr[p->node_arr[head].value.scope.var_start + index].node;
+    if (p->node_arr[node].tag != NODE_PHI || p->node_arr[node].value.phi.ctrl != loop) {
+      node = Parser_create_loop_phi(p, loop, node);
+      Parser_set_var(p, head, index, node);
+    }
+    Parser_set_var(p, s, index, node);
+  }
+  Arena_release(&p->scratch, mark);
+  return node;
+}
+
+// Copies the chain into the loop's head and
+// leaves the loop node in every var of the chain
+void Parser_open_loop(Parser *p, Frame *f, NodeId loop) {
+  uint16_t head_start = p->var_len;
+  uint16_t var_len = head_start - p->var_offset;
+  Parser_check_var_slots(p, var_len);
+  p->var_len += var_len;
+  memcpy(&p->var_arr[head_start], &p->var_arr[p->var_offset], var_len * sizeof(Var));
+  // Can run out of nodes, the frame isn't open before it's done
+  f->value.loop.head = Parser_duplicate_scopes(p, var_len);
+  f->value.loop.node = loop;
+  f->value.loop.scope = p->scope;
+  f->value.loop.prev_loop = p->loop;
+  f->value.loop.depth = Parser_scope_depth(p, p->scope);
+  f->value.loop.head_start = head_start;
+  for (NodeId scope = p->scope; scope; scope = p->node_arr[scope].value.scope.prev_scope) {
+    for (uint16_t i = 0; i < p->node_arr[scope].value.scope.var_count; ++i) {
+      Parser_set_var(p, scope, i, loop);
+    }
+  }
+  p->loop = loop;
+}
+
+// Vars that got a phi leave the loop with it, the
+// rest with their entry value. With a back edge the
+// phis take the values at the end of the body
+void Parser_finish_loop(Parser *p, Frame *f, NodeId back) {
+  NodeId loop = f->value.loop.node;
+  NodeId scope = f->value.loop.scope;
+  NodeId head = f->value.loop.head;
+  while (scope) {
+    for (uint16_t i = 0; i < p->node_arr[scope].value.scope.var_count; ++i) {
+      VarId id = p->node_arr[scope].value.scope.var_start + i;
+      NodeId entry = p->var_arr[p->node_arr[head].value.scope.var_start + i].node;
+      NodeId last = p->var_arr[id].node;
+      bool phi = p->node_arr[entry].tag == NODE_PHI && p->node_arr[entry].value.phi.ctrl == loop;
+      if (phi && back) {
+        // Only asked for in a branch a syntax error threw away
+        if (last == loop) last = entry;
+        p->node_arr[entry].value.phi.right = last;
+        Parser_add_node_output(p, entry, last);
+      }
+      if (phi || last == loop) Parser_set_var(p, scope, i, entry);
+    }
+    scope = p->node_arr[scope].value.scope.prev_scope;
+    head = p->node_arr[head].value.scope.prev_scope;
+  }
+  // Read in the body but never changed, the phi is the entry
+  // value and hides it from code motion. Removing one can
+  // make another one copy the entry value
+  bool changed = back;
+  while (changed) {
+    changed = false;
+    for (head = f->value.loop.head; head; head = p->node_arr[head].value.scope.prev_scope) {
+      for (uint16_t i = 0; i < p->node_arr[head].value.scope.var_count; ++i) {
+        NodeId phi = p->var_arr[p->node_arr[head].value.scope.var_start + i].node;
+        Node node = p->node_arr[phi];
+        if (node.tag != NODE_PHI || node.value.phi.ctrl != loop) continue;
+        if (node.value.phi.right != phi && node.value.phi.right != node.value.phi.left) continue;
+        Parser_remove_output_node(p, phi, node.value.phi.right);
+        p->node_arr[phi].value.phi.right = 0;
+        Parser_replace_node(p, phi, node.value.phi.left);
+        changed = true;
+      }
+    }
+  }
+  for (head = f->value.loop.head; head;) {
+    NodeId prev = p->node_arr[head].value.scope.prev_scope;
+    Parser_remove_node(p, head);
+    head = prev;
+  }
+  p->var_len = f->value.loop.head_start;
+  p->loop = f->value.loop.prev_loop;
+}
+
+// Pops the body scope too, after the check so
+// an error leaves the loop as it was
+void Parser_close_loop(Parser *p, Frame *f) {
+  NodeId loop = f->value.loop.node;
+  NodeId back = Parser_resolve_ctrl(p);
+  // The back edge and one per phi, a phi left without its
+  // link would break the abandon that follows the error
+  uint16_t link_count = 1;
+  for (NodeId head = f->value.loop.head; head; head = p->node_arr[head].value.scope.prev_scope) {
+    for (uint16_t i = 0; i < p->node_arr[head].value.scope.var_count; ++i) {
+      NodeId node = p->var_arr[p->node_arr[head].value.scope.var_start + i].node;
+      link_count += p->node_arr[node].tag == NODE_PHI && p->node_arr[node].value.phi.ctrl == loop;
+    }
+  }
+  Parser_reserve_links(p, link_count);
+  Parser_pop_scope(p);
+  p->node_arr[loop].value.region.right_block = back;
+  Parser_add_node_output(p, loop, back);
+  Parser_finish_loop(p, f, back);
+}
+
+// A syntax error inside the loop, its phis are left
+// without a back edge but no var may keep the loop node
+void Parser_abandon_loop(Parser *p, Frame *f) {
+  if (f->value.loop.node) Parser_finish_loop(p, f, 0);
 }
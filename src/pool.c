@@ -0,0 +1,102 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include "pool.h"
+#include "common.h"
+
+// Every worker starts with a contiguous slice of the jobs.
+// The owner takes from the front, idle workers steal from the back
+typedef struct {
+  pthread_mutex_t lock;
+  uint32_t head;
+  uint32_t tail;
+  Pool *pool;
+  uint32_t index;
+  pthread_t thread;
+} PoolWorker;
+
+struct Pool {
+  PoolJob fn;
+  void *ctx;
+  PoolWorker *worker_arr;
+  uint32_t worker_len;
+};
+
+uint32_t Pool_worker_count(uint32_t job_count, uint32_t thread_count) {
+  if (thread_count > job_count) thread_count = job_count;
+  return thread_count ? thread_count : 1;
+}
+
+// Returns false when there's nothing left anywhere
+bool PoolWorker_next_job(PoolWorker *w, uint32_t *job) {
+  bool found = false;
+  pthread_mutex_lock(&w->lock);
+  if (w->head < w->tail) {
+    *job = w->head++;
+    found = true;
+  }
+  pthread_mutex_unlock(&w->lock);
+  if (found) return true;
+
+  Pool *pool = w->pool;
+  for (uint32_t i = 1; i < pool->worker_len && !found; ++i) {
+    PoolWorker *victim = &pool->worker_arr[(w->index + i) % pool->worker_len];
+    pthread_mutex_lock(&victim->lock);
+    if (victim->head < victim->tail) {
+      *job = --victim->tail;
+      found = true;
+    }
+    pthread_mutex_unlock(&victim->lock);
+  }
+  return found;
+}
+
+void *PoolWorker_run(void *arg) {
+  PoolWorker *w = arg;
+  uint32_t job;
+  while (PoolWorker_next_job(w, &job)) w->pool->fn(w->pool->ctx, job, w->index);
+  return NULL;
+}
+
+Pool *Pool_start(uint32_t job_count, uint32_t thread_count, PoolJob fn, void *ctx) {
+  Pool *pool = malloc(sizeof(Pool));
+  assert(pool);
+  pool->fn = fn;
+  pool->ctx = ctx;
+  pool->worker_len = Pool_worker_count(job_count, thread_count);
+  pool->worker_arr = calloc(pool->worker_len, sizeof(PoolWorker));
+  assert(pool->worker_arr);
+  for (uint32_t i = 0; i < pool->worker_len; ++i) {
+    PoolWorker *w = &pool->worker_arr[i];
+    pthread_mutex_init(&w->lock, NULL);
+    w->head = (uint64_t)job_count * i / pool->worker_len;
+    w->tail = (uint64_t)job_count * (i + 1) / pool->worker_len;
+    w->pool = pool;
+    w->index = i;
+  }
+  for (uint32_t i = 0; i < pool->worker_len; ++i) {
+    PoolWorker *w = &pool->worker_arr[i];
+    if (pthread_create(&w->thread, NULL, PoolWorker_run, w)) {
+      print_error_message("Failed to start worker thread");
+      exit(1);
+    }
+  }
+  return pool;
+}
+
+void Pool_join(Pool *pool) {
+  // Others may still try to steal from a finished worker
+  for (uint32_t i = 0; i < pool->worker_len; ++i) pthread_join(pool->worker_arr[i].thread, NULL);
+  for (uint32_t i = 0; i < pool->worker_len; ++i) pthread_mutex_destroy(&pool->worker_arr[i].lock);
+  free(pool->worker_arr);
+  free(pool);
+}
+
+void Pool_run(uint32_t job_count, uint32_t thread_count, PoolJob fn, void *ctx) {
+  if (Pool_worker_count(job_count, thread_count) == 1) {
+    for (uint32_t i = 0; i < job_count; ++i) fn(ctx, i, 0);
+    return;
+  }
+  Pool_join(Pool_start(job_count, thread_count, fn, ctx));
+}
@@ -0,0 +1,127 @@
+#include "profile.h"
+#include "common.h"
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+// CPU time between samples, the kernel delivers
+// them at most once per tick anyway
+#define PROFILE_INTERVAL_US 1000
+#define PROFILE_STACKS 1024
+
+const char *const PHASE_NAME[PHASE_COUNT] = {
+  [PHASE_TOKENIZE] = "tokenize",
+  [PHASE_PARSE] = "parse",
+  [PHASE_FUNCTION] = "function",
+  [PHASE_STATEMENT] = "statement",
+  [PHASE_EXPRESSION] = "expression",
+  [PHASE_RESOLVE_VAR] = "resolve_var",
+  [PHASE_FOLD] = "fold",
+  [PHASE_SCOPES] = "scopes",
+  [PHASE_INLINE] = "inline",
+  [PHASE_OPTIMIZE] = "optimize",
+  [PHASE_DCE] = "dce",
+  [PHASE_RANGES] = "ranges",
+  [PHASE_JUMPS] = "jumps",
+  [PHASE_SELECT] = "select",
+  [PHASE_STRENGTH] = "strength",
+  [PHASE_LICM] = "licm",
+  [PHASE_GRAPHVIZ] = "graphviz",
+  [PHASE_EVAL] = "eval",
+};
+
+__thread PhaseStack PHASE_STACK;
+
+// The handler can't allocate, stacks go into a fixed table
+// with open addressing. A count of zero is a free slot
+typedef struct {
+  uint8_t phase_arr[PROFILE_DEPTH];
+  uint32_t depth;
+  uint32_t count;
+} ProfileStack;
+
+typedef struct {
+  ProfileStack stack_arr[PROFILE_STACKS];
+  uint32_t sample_count;
+  // Samples that found the table full, or another thread in it
+  uint32_t dropped_count;
+  bool busy;
+} Profile;
+
+Profile PROFILE;
+
+void Profile_push(ProfilePhase phase) {
+  PhaseStack *s = &PHASE_STACK;
+  if (s->depth < PROFILE_DEPTH) s->phase_arr[s->depth] = phase;
+  // A sample can land between any two instructions
+  // of this thread, the phase goes in first
+  __atomic_signal_fence(__ATOMIC_SEQ_CST);
+  s->depth++;
+}
+
+void Profile_pop(void) {
+  PHASE_STACK.depth--;
+}
+
+uint32_t Profile_depth(void) {
+  return PHASE_STACK.depth;
+}
+
+void Profile_unwind(uint32_t depth) {
+  PHASE_STACK.depth = depth;
+}
+
+void Profile_sample(int signal) {
+  (void)signal;
+  const PhaseStack *s = &PHASE_STACK;
+  uint32_t depth = MIN(s->depth, PROFILE_DEPTH);
+  if (__atomic_test_and_set(&PROFILE.busy, __ATOMIC_ACQUIRE)) {
+    __atomic_add_fetch(&PROFILE.dropped_count, 1, __ATOMIC_RELAXED);
+    return;
+  }
+  uint32_t hash = 2166136261u ^ depth;
+  for (uint32_t i = 0; i < depth; ++i) hash = (hash ^ s->phase_arr[i]) * 16777619u;
+  bool counted = false;
+  for (uint32_t i = 0; i < PROFILE_STACKS && !counted; ++i) {
+    ProfileStack *stack = &PROFILE.stack_arr[(hash + i) % PROFILE_STACKS];
+    if (!stack->count) {
+      memcpy(stack->phase_arr, s->phase_arr, depth);
+      stack->depth = depth;
+    } else if (stack->depth != depth || memcmp(stack->phase_arr, s->phase_arr, depth)) {
+      continue;
+    }
+    stack->count++;
+    counted = true;
+  }
+  if (counted) PROFILE.sample_count++;
+  else PROFILE.dropped_count++;
+  __atomic_clear(&PROFILE.busy, __ATOMIC_RELEASE);
+}
+
+bool Profile_start(void) {
+  struct sigaction action = { .sa_handler = Profile_sample, .sa_flags = SA_RESTART };
+  sigemptyset(&action.sa_mask);
+  struct itimerval timer = {
+    .it_interval = { 0, PROFILE_INTERVAL_US },
+    .it_value = { 0, PROFILE_INTERVAL_US },
+  };
+  return !sigaction(SIGPROF, &action, NULL) && !setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+bool Profile_write(const char *filename, uint32_t *sample_count) {
+  struct itimerval off = {0};
+  setitimer(ITIMER_PROF, &off, NULL);
+  FILE *fp = fopen(filename, "w");
+  if (!fp) return false;
+  for (uint32_t i = 0; i < PROFILE_STACKS; ++i) {
+    const ProfileStack *stack = &PROFILE.stack_arr[i];
+    if (!stack->count) continue;
+    fprintf(fp, "son");
+    for (uint32_t j = 0; j < stack->depth; ++j) fprintf(fp, ";%s", PHASE_NAME[stack->phase_arr[j]]);
+    fprintf(fp, " %u\n", stack->count);
+  }
+  if (PROFILE.dropped_count) fprintf(fp, "son;dropped %u\n", PROFILE.dropped_count);
+  *sample_count = PROFILE.sample_count + PROFILE.dropped_count;
+  return !fclose(fp);
+}
@@ -0,0 +1,586 @@
+#include "parser.h"
+
+// Interval of the values every node can take, empty while
+// nothing reaches it. Phis widen after growing a few times
+// and narrow again once it settles. The arms of an if narrow
+// the operands of its condition, comparisons and ifs decided
+// by the intervals are folded, the dead arm is cut off
+bool NARROW_RANGES = true;
+
+typedef struct {
+  int64_t lo;
+  int64_t hi;
+} Range;
+
+#define RANGE_FULL ((Range){ INT64_MIN, INT64_MAX })
+#define RANGE_EMPTY ((Range){ 1, 0 })
+// Times a phi grows before its moving bounds jump to the limits
+#define WIDEN_AFTER 3
+#define NARROW_SWEEPS 2
+// Levels of an expression computed again from
+// what the branches around it know of the inputs
+#define REFINE_DEPTH 2
+// Folding can decide more, extra rounds are only a bonus
+#define MAX_RANGE_ROUNDS 8
+
+bool Range_empty(Range r) {
+  return r.lo > r.hi;
+}
+
+bool Range_same(Range a, Range b) {
+  return (Range_empty(a) && Range_empty(b)) || (a.lo == b.lo && a.hi == b.hi);
+}
+
+bool Range_has(Range r, int64_t value) {
+  return r.lo <= value && value <= r.hi;
+}
+
+Range Range_hull(Range a, Range b) {
+  if (Range_empty(a)) return b;
+  if (Range_empty(b)) return a;
+  return (Range){ MIN(a.lo, b.lo), MAX(a.hi, b.hi) };
+}
+
+Range Range_meet(Range a, Range b) {
+  return (Range){ MAX(a.lo, b.lo), MIN(a.hi, b.hi) };
+}
+
+// Only shrinks when `value` is at an end
+Range Range_exclude(Range r, int64_t value) {
+  if (r.lo == value && r.lo != INT64_MAX) r.lo++;
+  else if (r.hi == value && r.hi != INT64_MIN) r.hi--;
+  return r;
+}
+
+Range Range_bool(bool can_be_false, bool can_be_true) {
+  return (Range){ !can_be_false, can_be_true };
+}
+
+Range Range_unary(NodeTag op, Range r) {
+  if (Range_empty(r)) return r;
+  if (op == NODE_NOT) return Range_bool(r.lo || r.hi, Range_has(r, 0));
+  if (r.lo == INT64_MIN) return RANGE_FULL;
+  return (Range){ -r.hi, -r.lo };
+}
+
+// Smallest and largest of l / d over the ends of `l` and
+// the divisors closest to zero, a zero divisor traps
+Range Range_divide(Range l, Range r) {
+  int64_t divisor_arr[4];
+  uint8_t divisor_len = 0;
+  if (r.lo) divisor_arr[divisor_len++] = r.lo;
+  if (r.hi) divisor_arr[divisor_len++] = r.hi;
+  if (r.lo < -1 && r.hi >= -1) divisor_arr[divisor_len++] = -1;
+  if (r.lo <= 1 && r.hi > 1) divisor_arr[divisor_len++] = 1;
+  if (!divisor_len) return RANGE_FULL;
+  Range out = RANGE_EMPTY;
+  for (uint8_t i = 0; i < divisor_len; ++i) {
+    int64_t d = divisor_arr[i];
+    if (l.lo == INT64_MIN && d == -1) return RANGE_FULL;
+    out = Range_hull(out, (Range){ l.lo / d, l.lo / d });
+    out = Range_hull(out, (Range){ l.hi / d, l.hi / d });
+  }
+  return out;
+}
+
+// Anything that could wrap around may be anything
+Range Range_binary(NodeTag op, Range l, Range r) {
+  if (Range_empty(l) || Range_empty(r)) return RANGE_EMPTY;
+  int64_t lo, hi, corner_arr[4];
+  switch (op) {
+    case NODE_ADD:
+      if (__builtin_add_overflow(l.lo, r.lo, &lo) || __builtin_add_overflow(l.hi, r.hi, &hi)) return RANGE_FULL;
+      return (Range){ lo, hi };
+    case NODE_SUB:
+      if (__builtin_sub_overflow(l.lo, r.hi, &lo) || __builtin_sub_overflow(l.hi, r.lo, &hi)) return RANGE_FULL;
+      return (Range){ lo, hi };
+    case NODE_MUL:
+      if (__builtin_mul_overflow(l.lo, r.lo, &corner_arr[0]) ||
+          __builtin_mul_overflow(l.lo, r.hi, &corner_arr[1]) ||
+          __builtin_mul_overflow(l.hi, r.lo, &corner_arr[2]) ||
+          __builtin_mul_overflow(l.hi, r.hi, &corner_arr[3])) return RANGE_FULL;
+      lo = hi = corner_arr[0];
+      for (int i = 1; i < 4; ++i) {
+        lo = MIN(lo, corner_arr[i]);
+        hi = MAX(hi, corner_arr[i]);
+      }
+      return (Range){ lo, hi };
+    case NODE_DIV: return Range_divide(l, r);
+    // Keeps the order, by a known count
+    case NODE_SAR:
+      if (r.lo != r.hi) return RANGE_FULL;
+      return (Range){ Parser_sar(l.lo, r.lo), Parser_sar(l.hi, r.lo) };
+    // A multiplication by a power of two, rules make
+    // those from multiplications while parsing
+    case NODE_SHL:
+      if (r.lo != r.hi || r.lo < 0 || r.lo > 62 ||
+          __builtin_mul_overflow(l.lo, (int64_t)1 << r.lo, &lo) ||
+          __builtin_mul_overflow(l.hi, (int64_t)1 << r.lo, &hi)) return RANGE_FULL;
+      return (Range){ lo, hi };
+    case NODE_SHR:
+    case NODE_MULHI:
+      return RANGE_FULL;
+    case NODE_EQ: return Range_bool(l.lo != l.hi || r.lo != r.hi || l.lo != r.lo, l.lo <= r.hi && r.lo <= l.hi);
+    case NODE_NE: return Range_bool(l.lo <= r.hi && r.lo <= l.hi, l.lo != l.hi || r.lo != r.hi || l.lo != r.lo);
+    case NODE_LT: return Range_bool(l.hi >= r.lo, l.lo < r.hi);
+    case NODE_LE: return Range_bool(l.hi > r.lo, l.lo <= r.hi);
+    case NODE_GT: return Range_bool(l.lo <= r.hi, l.hi > r.lo);
+    case NODE_GE: return Range_bool(l.lo < r.hi, l.hi >= r.lo);
+    default: assert(0);
+  }
+  return RANGE_FULL;
+}
+
+bool Parser_is_comparison(NodeTag tag) {
+  return tag >= NODE_EQ && tag <= NODE_GE;
+}
+
+// `a op b` is `b mirror a`
+NodeTag Range_mirror(NodeTag op) {
+  switch (op) {
+    case NODE_LT: return NODE_GT;
+    case NODE_LE: return NODE_GE;
+    case NODE_GT: return NODE_LT;
+    case NODE_GE: return NODE_LE;
+    default: return op;
+  }
+}
+
+NodeTag Range_negate(NodeTag op) {
+  switch (op) {
+    case NODE_EQ: return NODE_NE;
+    case NODE_NE: return NODE_EQ;
+    case NODE_LT: return NODE_GE;
+    case NODE_LE: return NODE_GT;
+    case NODE_GT: return NODE_LE;
+    case NODE_GE: return NODE_LT;
+    default: assert(0);
+  }
+  return op;
+}
+
+// Narrows `r`, the range of x, where `x op other` holds
+Range Range_implied(NodeTag op, Range other, Range r) {
+  if (Range_empty(other)) return r;
+  switch (op) {
+    case NODE_EQ: return Range_meet(r, other);
+    case NODE_NE: return other.lo == other.hi ? Range_exclude(r, other.lo) : r;
+    case NODE_LT: return other.hi == INT64_MIN ? RANGE_EMPTY : Range_meet(r, (Range){ INT64_MIN, other.hi - 1 });
+    case NODE_LE: return Range_meet(r, (Range){ INT64_MIN, other.hi });
+    case NODE_GT: return other.lo == INT64_MAX ? RANGE_EMPTY : Range_meet(r, (Range){ other.lo + 1, INT64_MAX });
+    case NODE_GE: return Range_meet(r, (Range){ other.lo, INT64_MAX });
+    default: assert(0);
+  }
+  return r;
+}
+
+typedef struct {
+  Parser *p;
+  Range *range;
+  uint8_t *grown;
+  // Immediate dominator of the control nodes, zero depth
+  // for the ones no path from START is known to
+  NodeId *idom;
+  uint16_t *dom_depth;
+} RangeState;
+
+// Inputs before users except where inlining put the merge
+// of a callee after the code that follows the call, so
+// it goes around until nothing new gets a dominator
+void Ranges_dominators(RangeState *s) {
+  const Parser *p = s->p;
+  s->dom_depth[START_NODE] = 1;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (NodeId id = START_NODE + 1; id < p->node_len; ++id) {
+      if (s->dom_depth[id]) continue;
+      Node node = p->node_arr[id];
+      NodeId idom = 0;
+      switch (node.tag) {
+        case NODE_PROJ: idom = node.value.proj.ctrl; break;
+        case NODE_IF: idom = node.value.if_.ctrl; break;
+        case NODE_CALL: idom = node.value.call.ctrl; break;
+        case NODE_CALL_END: idom = node.value.call_end.call; break;
+        case NODE_RETURN: idom = node.value.ret.predecessor; break;
+        // The back edge can't come first
+        case NODE_LOOP: idom = node.value.region.left_block; break;
+        case NODE_REGION:
+          idom = node.value.region.left_block;
+          NodeId other = node.value.region.right_block;
+          if (!idom || !other || !s->dom_depth[idom] || !s->dom_depth[other]) continue;
+          while (idom != other) {
+            if (s->dom_depth[idom] >= s->dom_depth[other]) idom = s->idom[idom];
+            else other = s->idom[other];
+          }
+          break;
+        default: continue;
+      }
+      if (!idom || !s->dom_depth[idom]) continue;
+      s->idom[id] = idom;
+      s->dom_depth[id] = s->dom_depth[idom] + 1;
+      changed = true;
+    }
+  }
+}
+
+// What the arm taking `holds` of an if on `cond` tells of x
+Range Ranges_branch(RangeState *s, NodeId cond, bool holds, NodeId x, Range r) {
+  const Parser *p = s->p;
+  Node node = p->node_arr[cond];
+  while (node.tag == NODE_NOT && cond != x) {
+    holds = !holds;
+    cond = node.value.unary.node;
+    node = p->node_arr[cond];
+  }
+  if (cond == x) return holds ? Range_exclude(r, 0) : Range_meet(r, (Range){ 0, 0 });
+  if (!Parser_is_comparison(node.tag)) return r;
+  NodeTag op = holds ? node.tag : Range_negate(node.tag);
+  if (node.value.binary.left == x) r = Range_implied(op, s->range[node.value.binary.right], r);
+  if (node.value.binary.right == x) r = Range_implied(Range_mirror(op), s->range[node.value.binary.left], r);
+  return r;
+}
+
+// Range of x where control is at `ctrl`, narrowed by
+// every if arm on the way from START
+Range Ranges_at(RangeState *s, NodeId x, NodeId ctrl, uint8_t depth) {
+  const Parser *p = s->p;
+  Node node = p->node_arr[x];
+  Range r = s->range[x];
+  if (depth && !Range_empty(r)) {
+    if (node.tag == NODE_MINUS || node.tag == NODE_NOT) {
+      r = Range_meet(r, Range_unary(node.tag, Ranges_at(s, node.value.unary.node, ctrl, depth - 1)));
+    } else if (node.tag >= NODE_BINARY_START) {
+      r = Range_meet(r, Range_binary(node.tag,
+        Ranges_at(s, node.value.binary.left, ctrl, depth - 1),
+        Ranges_at(s, node.value.binary.right, ctrl, depth - 1)));
+    }
+  }
+  for (NodeId c = ctrl; c && !Range_empty(r); c = s->idom[c]) {
+    Node arm = p->node_arr[c];
+    if (arm.tag != NODE_PROJ || p->node_arr[arm.value.proj.ctrl].tag != NODE_IF) continue;
+    NodeId cond = p->node_arr[arm.value.proj.ctrl].value.if_.cond;
+    r = Ranges_branch(s, cond, arm.value.proj.select == 0, x, r);
+  }
+  return r;
+}
+
+Range Ranges_compute(RangeState *s, NodeId id) {
+  const Parser *p = s->p;
+  Node node = p->node_arr[id];
+  switch (node.tag) {
+    case NODE_CONSTANT:
+      return (Range){ node.value.i64, node.value.i64 };
+    // Parameters and results of calls
+    case NODE_PROJ:
+      return RANGE_FULL;
+    case NODE_PHI: {
+      Node region = p->node_arr[node.value.phi.ctrl];
+      Range r = RANGE_EMPTY;
+      if (node.value.phi.left) {
+        r = Range_hull(r, Ranges_at(s, node.value.phi.left, region.value.region.left_block, REFINE_DEPTH));
+      }
+      if (node.value.phi.right) {
+        r = Range_hull(r, Ranges_at(s, node.value.phi.right, region.value.region.right_block, REFINE_DEPTH));
+      }
+      return r;
+    }
+    case NODE_SELECT: {
+      Range cond = s->range[node.value.select.cond];
+      Range r = RANGE_EMPTY;
+      if (cond.lo || cond.hi) r = Range_hull(r, s->range[node.value.select.left]);
+      if (Range_has(cond, 0)) r = Range_hull(r, s->range[node.value.select.right]);
+      return Range_empty(cond) ? RANGE_EMPTY : r;
+    }
+    case NODE_MINUS:
+    case NODE_NOT:
+      return Range_unary(node.tag, s->range[node.value.unary.node]);
+    default:
+      if (node.tag < NODE_BINARY_START) return RANGE_EMPTY;
+      return Range_binary(node.tag, s->range[node.value.binary.left], s->range[node.value.binary.right]);
+  }
+}
+
+void Ranges_analyze(RangeState *s) {
+  const Parser *p = s->p;
+  for (NodeId id = 0; id < p->node_len; ++id) s->range[id] = RANGE_EMPTY;
+  memset(s->grown, 0, p->node_len);
+  memset(s->idom, 0, p->node_len * sizeof(NodeId));
+  memset(s->dom_depth, 0, p->node_len * sizeof(uint16_t));
+  Ranges_dominators(s);
+
+  // Everything only grows, phis a bounded number of times
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (NodeId id = START_NODE; id < p->node_len; ++id) {
+      Range old = s->range[id];
+      Range r = Ranges_compute(s, id);
+      if (p->node_arr[id].tag == NODE_PHI) {
+        r = Range_hull(old, r);
+        if (!Range_same(r, old) && !Range_empty(old) && ++s->grown[id] > WIDEN_AFTER) {
+          if (r.lo < old.lo) r.lo = INT64_MIN;
+          if (r.hi > old.hi) r.hi = INT64_MAX;
+        }
+      }
+      if (Range_same(r, old)) continue;
+      s->range[id] = r;
+      changed = true;
+    }
+  }
+  // Going down from a fixed point stays correct
+  for (int i = 0; i < NARROW_SWEEPS; ++i) {
+    for (NodeId id = START_NODE; id < p->node_len; ++id) s->range[id] = Ranges_compute(s, id);
+  }
+}
+
+// Control that only runs through `from`
+Bitset Parser_dead_ctrl(const Parser *p, NodeId from, Arena *a) {
+  Bitset dead = Bitset_new(a, p->node_len);
+  ArenaMark mark = Arena_mark(a);
+  Worklist work = Worklist_new(a, p->node_len);
+  Bitset_set(&dead, from);
+  Worklist_push(&work, from);
+  while (work.len) {
+    NodeId id = Worklist_pop(&work);
+    for (LinkId link = p->node_arr[id].outputs; link; link = p->link_arr[link].next) {
+      NodeId user = p->link_arr[link].node;
+      Node node = p->node_arr[user];
+      bool is_dead = false;
+      switch (node.tag) {
+        case NODE_REGION:
+          is_dead = Bitset_get(&dead, node.value.region.left_block) &&
+            Bitset_get(&dead, node.value.region.right_block);
+          break;
+        case NODE_LOOP: is_dead = node.value.region.left_block == id; break;
+        case NODE_IF: is_dead = node.value.if_.ctrl == id; break;
+        case NODE_PROJ: is_dead = node.value.proj.ctrl == id; break;
+        case NODE_CALL: is_dead = node.value.call.ctrl == id; break;
+        case NODE_CALL_END: is_dead = true; break;
+        case NODE_RETURN: is_dead = node.value.ret.predecessor == id; break;
+        default: break;
+      }
+      if (is_dead && !Bitset_test_and_set(&dead, user)) Worklist_push(&work, user);
+    }
+  }
+  Arena_release(a, mark);
+  return dead;
+}
+
+// Control STOP reaches backwards, around the `dead` nodes
+Bitset Parser_ctrl_to_stop(const Parser *p, const Bitset *dead, Arena *a) {
+  Bitset reach = Bitset_new(a, p->node_len);
+  ArenaMark mark = Arena_mark(a);
+  Worklist work = Worklist_new(a, p->node_len);
+  for (NodeId i = START_NODE; i < p->node_len; ++i) {
+    if (Bitset_get(dead, i)) continue;
+    for (LinkId link = p->node_arr[i].outputs; link; link = p->link_arr[link].next) {
+      if (p->link_arr[link].node != STOP_NODE) continue;
+      Bitset_set(&reach, i);
+      Worklist_push(&work, i);
+      break;
+    }
+  }
+  while (work.len) {
+    Node node = p->node_arr[Worklist_pop(&work)];
+    NodeId pred_arr[2] = {0};
+    switch (node.tag) {
+      case NODE_RETURN: pred_arr[0] = node.value.ret.predecessor; break;
+      case NODE_PROJ: pred_arr[0] = node.value.proj.ctrl; break;
+      case NODE_IF: pred_arr[0] = node.value.if_.ctrl; break;
+      case NODE_CALL: pred_arr[0] = node.value.call.ctrl; break;
+      case NODE_CALL_END: pred_arr[0] = node.value.call_end.call; break;
+      case NODE_REGION:
+      case NODE_LOOP:
+        pred_arr[0] = node.value.region.left_block;
+        pred_arr[1] = node.value.region.right_block;
+        break;
+      default: break;
+    }
+    for (int i = 0; i < 2; ++i) {
+      NodeId pred = pred_arr[i];
+      if (!pred || Bitset_get(dead, pred) || Bitset_test_and_set(&reach, pred)) continue;
+      Worklist_push(&work, pred);
+    }
+  }
+  Arena_release(a, mark);
+  return reach;
+}
+
+// The phis of a region, they change while being taken out
+uint16_t Parser_region_phis(const Parser *p, NodeId region, NodeId *phi_arr) {
+  uint16_t len = 0;
+  for (LinkId link = p->node_arr[region].outputs; link; link = p->link_arr[link].next) {
+    NodeId user = p->link_arr[link].node;
+    if (p->node_arr[user].tag == NODE_PHI && p->node_arr[user].value.phi.ctrl == region) {
+      phi_arr[len++] = user;
+    }
+  }
+  return len;
+}
+
+// A merge left with one live side becomes that side
+void Parser_collapse_region(Parser *p, NodeId region, const Bitset *dead) {
+  NodeId phi_arr[MAX_NODES];
+  uint16_t phi_len = Parser_region_phis(p, region, phi_arr);
+  bool left = !Bitset_get(dead, p->node_arr[region].value.region.left_block);
+  for (uint16_t i = 0; i < phi_len; ++i) {
+    struct NodePhi phi = p->node_arr[phi_arr[i]].value.phi;
+    Parser_replace_node(p, phi_arr[i], left ? phi.left : phi.right);
+  }
+  struct NodeRegion node = p->node_arr[region].value.region;
+  Parser_replace_node(p, region, left ? node.left_block : node.right_block);
+  Parser_kill_node(p, region);
+}
+
+// Returns false when the arm that never runs holds the
+// only way out of a loop, an endless loop has to stay
+bool Parser_fold_if(Parser *p, NodeId id, bool holds) {
+  NodeId taken = 0, skipped = 0;
+  for (LinkId link = p->node_arr[id].outputs; link; link = p->link_arr[link].next) {
+    NodeId user = p->link_arr[link].node;
+    if (p->node_arr[user].tag != NODE_PROJ) continue;
+    if ((p->node_arr[user].value.proj.select == 0) == holds) taken = user;
+    else skipped = user;
+  }
+  if (!taken || !skipped) return false;
+
+  ArenaMark mark = Arena_mark(&p->scratch);
+  Bitset dead = Parser_dead_ctrl(p, skipped, &p->scratch);
+  Bitset none = Bitset_new(&p->scratch, p->node_len);
+  Bitset before = Parser_ctrl_to_stop(p, &none, &p->scratch);
+  Bitset after = Parser_ctrl_to_stop(p, &dead, &p->scratch);
+  for (NodeId i = START_NODE; i < p->node_len; ++i) {
+    if (p->node_arr[i].tag == NODE_LOOP && Bitset_get(&before, i) &&
+        !Bitset_get(&dead, i) && !Bitset_get(&after, i)) {
+      Arena_release(&p->scratch, mark);
+      return false;
+    }
+  }
+
+  // Merges the dead arm flows into
+  NodeId *merge_arr = Arena_alloc(&p->scratch, p->node_len * sizeof(NodeId));
+  uint16_t merge_len = 0;
+  Bitset seen = Bitset_new(&p->scratch, p->node_len);
+  for (NodeId i = START_NODE; i < p->node_len; ++i) {
+    if (!Bitset_get(&dead, i)) continue;
+    for (LinkId link = p->node_arr[i].outputs; link; link = p->link_arr[link].next) {
+      NodeId user = p->link_arr[link].node;
+      NodeTag tag = p->node_arr[user].tag;
+      if ((tag != NODE_REGION && tag != NODE_LOOP) || Bitset_get(&dead, user)) continue;
+      if (!Bitset_test_and_set(&seen, user)) merge_arr[merge_len++] = user;
+    }
+  }
+  for (uint16_t i = 0; i < merge_len; ++i) Parser_collapse_region(p, merge_arr[i], &dead);
+
+  Parser_replace_node(p, taken, p->node_arr[id].value.if_.ctrl);
+  Parser_kill_node(p, taken);
+  // The phis of dead merges and whatever reads them or the
+  // dead control goes too, only STOP outlives them
+  Worklist work = Worklist_new(&p->scratch, p->node_len);
+  for (NodeId i = START_NODE; i < p->node_len; ++i) {
+    if (!Bitset_get(&dead, i)) continue;
+    Worklist_push(&work, i);
+    NodeTag tag = p->node_arr[i].tag;
+    if (tag != NODE_REGION && tag != NODE_LOOP) continue;
+    NodeId phi_arr[MAX_NODES];
+    uint16_t phi_len = Parser_region_phis(p, i, phi_arr);
+    for (uint16_t j = 0; j < phi_len; ++j) {
+      if (!Bitset_test_and_set(&dead, phi_arr[j])) Worklist_push(&work, phi_arr[j]);
+    }
+  }
+  while (work.len) {
+    NodeId i = Worklist_pop(&work);
+    for (LinkId link = p->node_arr[i].outputs; link; link = p->link_arr[link].next) {
+      NodeId user = p->link_arr[link].node;
+      if (user != STOP_NODE && !Bitset_test_and_set(&dead, user)) Worklist_push(&work, user);
+    }
+  }
+  Bitset_set(&dead, id);
+  // Then the live inputs they were the last users of
+  NodeId *input_arr = Arena_alloc(&p->scratch, MAX_LINKS * sizeof(NodeId));
+  uint16_t input_len = 0;
+  for (NodeId i = START_NODE; i < p->node_len; ++i) {
+    if (!Bitset_get(&dead, i)) continue;
+    NodeId arr[MAX_INPUTS];
+    uint16_t len = Parser_node_inputs(p, i, arr);
+    for (uint16_t j = 0; j < len; ++j) {
+      if (arr[j] && !Bitset_get(&dead, arr[j])) input_arr[input_len++] = arr[j];
+    }
+    Parser_kill_node(p, i);
+  }
+  for (uint16_t i = 0; i < input_len; ++i) {
+    if (p->node_arr[input_arr[i]].tag != NODE_NONE) Parser_remove_node(p, input_arr[i]);
+  }
+  Arena_release(&p->scratch, mark);
+  return true;
+}
+
+// Turns a decided comparison into the constant, in place
+void Parser_fold_comparison(Parser *p, NodeId id, int64_t value) {
+  NodeId input_arr[MAX_INPUTS];
+  uint16_t input_len = Parser_node_inputs(p, id, input_arr);
+  for (uint16_t i = 0; i < input_len; ++i) Parser_unlink_output(p, id, input_arr[i]);
+  if (p->undo) Parser_save_node(p, id);
+  p->node_arr[id].tag = NODE_CONSTANT;
+  p->node_arr[id].type = TYPE_INT;
+  p->node_arr[id].value.i64 = value;
+  if (p->trace) Parser_trace(p, TRACE_CREATE_NODE, id, 0);
+  // One input can take another along, or be both sides
+  for (uint16_t i = 0; i < input_len; ++i) {
+    if (p->node_arr[input_arr[i]].tag != NODE_NONE) Parser_remove_node(p, input_arr[i]);
+  }
+}
+
+RangeStats Parser_narrow_ranges(Parser *p) {
+  Profile_push(PHASE_RANGES);
+  ArenaMark mark = Arena_mark(&p->scratch);
+  RangeState s = {
+    .p = p,
+    .range = Arena_alloc(&p->scratch, p->node_len * sizeof(Range)),
+    .grown = Arena_alloc(&p->scratch, p->node_len),
+    .idom = Arena_alloc(&p->scratch, p->node_len * sizeof(NodeId)),
+    .dom_depth = Arena_alloc(&p->scratch, p->node_len * sizeof(uint16_t)),
+  };
+  RangeStats stats = {0};
+  bool folded = true;
+  for (int round = 0; round < MAX_RANGE_ROUNDS && folded; ++round) {
+    folded = false;
+    Ranges_analyze(&s);
+    // Nodes only go away, node_len doesn't grow
+    for (NodeId id = START_NODE; id < p->node_len; ++id) {
+      Node node = p->node_arr[id];
+      Range r = s.range[id];
+      if (Parser_is_comparison(node.tag) && r.lo == r.hi) {
+        Parser_fold_comparison(p, id, r.lo);
+        stats.folded_count++;
+        folded = true;
+      } else if (node.tag == NODE_IF && s.dom_depth[id]) {
+        r = Ranges_at(&s, node.value.if_.cond, node.value.if_.ctrl, REFINE_DEPTH);
+        if (r.lo != r.hi || !Parser_fold_if(p, id, r.lo)) continue;
+        stats.folded_count++;
+        folded = true;
+      }
+    }
+  }
+
+  // Reported, not an error, most such divisions never divide by zero
+  Bitset live = Parser_live_nodes(p, &p->scratch);
+  for (NodeId id = START_NODE; id < p->node_len; ++id) {
+    Node node = p->node_arr[id];
+    if (node.tag != NODE_DIV || !Bitset_get(&live, id)) continue;
+    if (Range_has(s.range[node.value.binary.right], 0)) stats.div_count++;
+  }
+  // Loops cut off or left with one trip are gone,
+  // their nodes run in the loop around them
+  for (NodeId id = START_NODE; id < p->node_len; ++id) {
+    NodeId loop = p->node_arr[id].loop;
+    while (loop && p->node_arr[loop].tag != NODE_LOOP) loop = p->node_arr[loop].loop;
+    if (loop == p->node_arr[id].loop) continue;
+    if (p->undo) Parser_save_node(p, id);
+    p->node_arr[id].loop = loop;
+  }
+  Arena_release(&p->scratch, mark);
+  Profile_pop();
+  return stats;
+}
@@ -0,0 +1,225 @@
+// Reads a trace written with --trace and rebuilds one graph from
+// it, as it was after the first `at` of its events, or at the end.
+// Prints how many events of each kind every graph has and the
+// nodes of the one rebuilt, and writes it as dot. Scopes come out
+// without their vars, those aren't traced.
+//
+// usage: replay TRACE [--graph=N] [--at=K] [--dot=FILE]
+//   N: 0 is the program, function i is i + 1
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "son.c"
+
+const char *const TRACE_KIND_NAME[TRACE_KIND_COUNT] = {
+  [TRACE_CREATE_NODE] = "create_node",
+  [TRACE_ADD_OUTPUT] = "add_output",
+  [TRACE_REMOVE_OUTPUT] = "remove_output",
+  [TRACE_REMOVE_NODE] = "remove_node",
+  [TRACE_CHECKPOINT] = "checkpoint",
+  [TRACE_COMMIT] = "commit",
+  [TRACE_ROLLBACK] = "rollback",
+};
+
+// Checkpoints the events opened, the rebuilt
+// graph takes and rolls back its own
+#define MAX_REPLAY_MARKS 64
+UndoMark mark_arr[MAX_REPLAY_MARKS];
+uint16_t mark_len;
+
+// Events of one graph, in order
+typedef struct {
+  TraceEvent *event_arr;
+  uint32_t len;
+  uint32_t cap;
+  uint32_t kind_count[TRACE_KIND_COUNT];
+} GraphEvents;
+
+// Links of removed edges aren't reused, live ones get
+// packed to the front when there's no room for another
+void replay_compact_links(Parser *p) {
+  Link old[MAX_LINKS];
+  memcpy(old, p->link_arr, p->link_len * sizeof(Link));
+  uint16_t link_len = 1;
+  for (NodeId i = 0; i < p->node_len; ++i) {
+    LinkId head = 0, prev = 0;
+    for (LinkId link = p->node_arr[i].outputs; link; link = old[link].next) {
+      LinkId id = link_len++;
+      if (p->undo) Parser_save_link(p, id);
+      p->link_arr[id] = (Link){ 0, old[link].node };
+      if (prev) p->link_arr[prev].next = id;
+      else head = id;
+      prev = id;
+    }
+    if (p->undo) Parser_save_node(p, i);
+    p->node_arr[i].outputs = head;
+  }
+  p->link_len = link_len;
+}
+
+void replay_event(Parser *p, TraceEvent event) {
+  if (event.a >= MAX_NODES || event.b >= MAX_NODES) {
+    print_error_message("Event on node %d or %d, past the last one", event.a, event.b);
+    exit(1);
+  }
+  Node *node = &p->node_arr[event.a];
+  // Users can be linked before they're made, inlined nodes are
+  if (event.a >= p->node_len) p->node_len = event.a + 1;
+  switch ((TraceKind)event.kind) {
+    case TRACE_CREATE_NODE:
+      if (p->undo) Parser_save_node(p, event.a);
+      node->tag = event.tag;
+      node->value = event.value;
+      if (node->tag == NODE_SCOPE) node->value.scope.var_count = 0;
+      break;
+    case TRACE_ADD_OUTPUT:
+      if (event.b >= p->node_len) p->node_len = event.b + 1;
+      if (p->link_len == MAX_LINKS) replay_compact_links(p);
+      Parser_add_node_output(p, event.a, event.b);
+      break;
+    case TRACE_REMOVE_OUTPUT:
+      Parser_unlink_output(p, event.a, event.b);
+      break;
+    case TRACE_REMOVE_NODE:
+      // Along with whatever edges it still has
+      if (p->undo) Parser_save_node(p, event.a);
+      node->tag = NODE_NONE;
+      node->outputs = 0;
+      for (NodeId i = 0; i < p->node_len; ++i) {
+        while (Parser_unlink_output(p, event.a, i));
+      }
+      while (p->node_len > STOP_NODE + 1 && !p->node_arr[p->node_len - 1].tag) p->node_len--;
+      break;
+    case TRACE_CHECKPOINT:
+      if (mark_len == MAX_REPLAY_MARKS) {
+        print_error_message("Checkpoints nest deeper than %d", MAX_REPLAY_MARKS);
+        exit(1);
+      }
+      mark_arr[mark_len++] = Parser_checkpoint(p);
+      break;
+    case TRACE_COMMIT:
+    case TRACE_ROLLBACK:
+      if (!mark_len) {
+        print_error_message("A %s without a checkpoint", TRACE_KIND_NAME[event.kind]);
+        exit(1);
+      }
+      mark_len--;
+      if (event.kind == TRACE_COMMIT) Parser_commit(p, mark_arr[mark_len]);
+      else Parser_rollback(p, mark_arr[mark_len]);
+      break;
+    default:
+      print_error_message("Unknown event kind %d", event.kind);
+      exit(1);
+  }
+}
+
+// As print_nodes, which needs the source for calls and vars
+void replay_print(const Parser *p) {
+  for (NodeId i = 0; i < p->node_len; ++i) {
+    Node node = p->node_arr[i];
+    if (!node.tag) continue;
+    printf("% 2d %s", i, NODE_NAME[node.tag]);
+    if (node.tag == NODE_PROJ) printf(" %d", node.value.proj.select);
+    if (node.tag == NODE_CONSTANT) printf(" %lld", (long long)node.value.i64);
+    printf(" [");
+    for (LinkId id = node.outputs; id; id = p->link_arr[id].next) {
+      printf("%d%s", p->link_arr[id].node, p->link_arr[id].next ? " " : "");
+    }
+    printf("]\n");
+  }
+}
+
+int main(int argc, char *argv[]) {
+  const char *filename = NULL;
+  const char *dot_filename = "out/replay.dot";
+  uint32_t graph = 0;
+  uint32_t at = UINT32_MAX;
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    if (!strncmp(arg, "--graph=", CSTR_LEN("--graph="))) graph = atoi(&arg[CSTR_LEN("--graph=")]);
+    else if (!strncmp(arg, "--at=", CSTR_LEN("--at="))) at = strtoul(&arg[CSTR_LEN("--at=")], NULL, 10);
+    else if (!strncmp(arg, "--dot=", CSTR_LEN("--dot="))) dot_filename = &arg[CSTR_LEN("--dot=")];
+    else if (strncmp(arg, "--", 2)) filename = arg;
+    else {
+      print_error_message("Unknown option " ANSI_BLUE "%s" ANSI_RESET, arg);
+      exit(1);
+    }
+  }
+  if (!filename) {
+    print_error_message("usage: replay TRACE [--graph=N] [--at=K] [--dot=FILE]");
+    exit(1);
+  }
+
+  FILE *fp = fopen(filename, "rb");
+  if (!fp) {
+    print_error_message("Failed to open trace " ANSI_BLUE "%s" ANSI_RESET, filename);
+    exit(1);
+  }
+  char magic[CSTR_LEN(TRACE_MAGIC)];
+  uint32_t header[2];
+  if (fread(magic, sizeof(magic), 1, fp) != 1 || memcmp(magic, TRACE_MAGIC, sizeof(magic)) ||
+      fread(header, sizeof(header), 1, fp) != 1 || header[0] != TRACE_VERSION || header[1] != sizeof(TraceEvent)) {
+    print_error_message("%s is not a trace of this version", filename);
+    exit(1);
+  }
+
+  GraphEvents *graph_arr = calloc(MAX_FUNCTIONS + 1, sizeof(GraphEvents));
+  assert(graph_arr);
+  uint32_t graph_len = 0;
+  TraceChunk chunk;
+  while (fread(&chunk, sizeof(chunk), 1, fp) == 1) {
+    if (chunk.graph > MAX_FUNCTIONS || chunk.len > TRACE_EVENTS) {
+      print_error_message("Broken chunk of %u events for graph %d", chunk.len, chunk.graph);
+      exit(1);
+    }
+    GraphEvents *g = &graph_arr[chunk.graph];
+    if (g->len + chunk.len > g->cap) {
+      g->cap = MAX(g->cap * 2, g->len + chunk.len);
+      g->event_arr = realloc(g->event_arr, g->cap * sizeof(TraceEvent));
+      assert(g->event_arr);
+    }
+    if (fread(&g->event_arr[g->len], sizeof(TraceEvent), chunk.len, fp) != chunk.len) {
+      print_error_message("Trace ends inside a chunk");
+      exit(1);
+    }
+    for (uint32_t i = g->len; i < g->len + chunk.len; ++i) {
+      if (g->event_arr[i].kind < TRACE_KIND_COUNT) g->kind_count[g->event_arr[i].kind]++;
+    }
+    g->len += chunk.len;
+    graph_len = MAX(graph_len, chunk.graph + 1u);
+  }
+  fclose(fp);
+
+  printf("%-6s %10s", "graph", "events");
+  for (int k = 0; k < TRACE_KIND_COUNT; ++k) printf(" %14s", TRACE_KIND_NAME[k]);
+  printf("\n");
+  for (uint32_t i = 0; i < graph_len; ++i) {
+    GraphEvents *g = &graph_arr[i];
+    if (!g->len) continue;
+    printf("%-6u %10u", i, g->len);
+    for (int k = 0; k < TRACE_KIND_COUNT; ++k) printf(" %14u", g->kind_count[k]);
+    printf("\n");
+  }
+
+  if (graph >= graph_len || !graph_arr[graph].len) {
+    print_error_message("No events for graph %u", graph);
+    exit(1);
+  }
+  GraphEvents *g = &graph_arr[graph];
+  at = MIN(at, g->len);
+  // Made nodes keep the outputs they have, those start empty
+  Parser *p = calloc(1, sizeof(*p));
+  assert(p);
+  Parser_init(p, "", NULL, NULL);
+  for (uint32_t i = 0; i < at; ++i) replay_event(p, g->event_arr[i]);
+  printf("\nGraph %u after %u of %u events:\n", graph, at, g->len);
+  replay_print(p);
+  graphviz_write_file(dot_filename, p, &GRAPH_OPTIONS);
+
+  for (uint32_t i = 0; i < graph_len; ++i) free(graph_arr[i].event_arr);
+  free(graph_arr);
+  free(p);
+  return 0;
+}
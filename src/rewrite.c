@@ -0,0 +1,985 @@
+// Generated by rulegen from rewrite.rules, don't edit,
+// change the rules and run `make rules`
+#include "parser.h"
+
+bool Rewrite_is_power(int64_t value) {
+  return value && !((uint64_t)value & ((uint64_t)value - 1));
+}
+
+// `left op right`, or `op left`, as the first rule that matches
+// rewrites it, the null node when none does. Nothing is made
+// unless a rule matches
+NodeId Parser_rewrite(Parser *p, NodeTag op, NodeId left, NodeId right) {
+  (void)right;
+  switch (op) {
+    case NODE_ADD:
+      switch (p->node_arr[left].tag) {
+        case NODE_CONSTANT:
+          switch (p->node_arr[right].tag) {
+            case NODE_CONSTANT:
+              // (add x (const 0)) -> x, line 19
+              {
+                NodeId n_x = left;
+                if (p->node_arr[right].value.i64 == 0) {
+                  return n_x;
+                }
+              }
+              // (add (const 0) x) -> x, line 19 swapped
+              {
+                if (p->node_arr[left].value.i64 == 0) {
+                  NodeId n_x = right;
+                  return n_x;
+                }
+              }
+              return NULL_NODE;
+            case NODE_MINUS:
+              // (add (const 0) x) -> x, line 19 swapped
+              {
+                if (p->node_arr[left].value.i64 == 0) {
+                  NodeId n_x = right;
+                  return n_x;
+                }
+              }
+              // (add x (minus y)) -> (sub x y), line 31
+              {
+                NodeId n_x = left;
+                NodeId n_y = p->node_arr[right].value.unary.node;
+                NodeId b0 = Parser_create_binary_node(p, NODE_SUB, n_x, n_y);
+                return b0;
+              }
+            case NODE_SUB:
+              // (add (const 0) x) -> x, line 19 swapped
+              {
+                if (p->node_arr[left].value.i64 == 0) {
+                  NodeId n_x = right;
+                  return n_x;
+                }
+              }
+              // (add y (sub x y)) -> x, line 36 swapped
+              {
+                NodeId n_y = left;
+                NodeId n_x = p->node_arr[right].value.binary.left;
+                if (p->node_arr[right].value.binary.right == n_y && Parser_cannot_trap(p, n_y)) {
+                  return n_x;
+                }
+              }
+              // (add (const b) (sub x (const a))) -> (add x (const (sub b a))), line 44 swapped
+              {
+                int64_t c_b = p->node_arr[left].value.i64;
+                NodeId n_x = p->node_arr[right].value.binary.left;
+                NodeId n0 = p->node_arr[right].value.binary.right;
+                if (p->node_arr[n0].tag == NODE_CONSTANT) {
+                  int64_t c_a = p->node_arr[n0].value.i64;
+                  int64_t v1;
+                  if (Parser_fold_value(NODE_SUB, c_b, c_a, &v1)) {
+                    NodeId b2 = Parser_create_constant(p, v1);
+                    NodeId b3 = Parser_create_binary_node(p, NODE_ADD, n_x, b2);
+                    return b3;
+                  }
+                }
+              }
+              return NULL_NODE;
+            case NODE_ADD:
+              // (add (const 0) x) -> x, line 19 swapped
+              {
+                if (p->node_arr[left].value.i64 == 0) {
+                  NodeId n_x = right;
+                  return n_x;
+                }
+              }
+              // (add (const b) (add x (const a))) -> (add x (const (add a b))), line 41 swapped
+              {
+                int64_t c_b = p->node_arr[left].value.i64;
+                NodeId n_x = p->node_arr[right].value.binary.left;
+                NodeId n0 = p->node_arr[right].value.binary.right;
+                if (p->node_arr[n0].tag == NODE_CONSTANT) {
+                  int64_t c_a = p->node_arr[n0].value.i64;
+                  int64_t v1;
+                  if (Parser_fold_value(NODE_ADD, c_a, c_b, &v1)) {
+                    NodeId b2 = Parser_create_constant(p, v1);
+                    NodeId b3 = Parser_create_binary_node(p, NODE_ADD, n_x, b2);
+                    return b3;
+                  }
+                }
+              }
+              // (add (const b) (add (const a) x)) -> (add x (const (add a b))), line 42 swapped
+              {
+                int64_t c_b = p->node_arr[left].value.i64;
+                NodeId n0 = p->node_arr[right].value.binary.left;
+                if (p->node_arr[n0].tag == NODE_CONSTANT) {
+                  int64_t c_a = p->node_arr[n0].value.i64;
+                  NodeId n_x = p->node_arr[right].value.binary.right;
+                  int64_t v1;
+                  if (Parser_fold_value(NODE_ADD, c_a, c_b, &v1)) {
+                    NodeId b2 = Parser_create_constant(p, v1);
+                    NodeId b3 = Parser_create_binary_node(p, NODE_ADD, n_x, b2);
+                    return b3;
+                  }
+                }
+              }
+              return NULL_NODE;
+            default:
+              // (add (const 0) x) -> x, line 19 swapped
+              {
+                if (p->node_arr[left].value.i64 == 0) {
+                  NodeId n_x = right;
+                  return n_x;
+                }
+              }
+              return NULL_NODE;
+          }
+        case NODE_MINUS:
+          switch (p->node_arr[right].tag) {
+            case NODE_CONSTANT:
+              // (add x (const 0)) -> x, line 19
+              {
+                NodeId n_x = left;
+                if (p->node_arr[right].value.i64 == 0) {
+                  return n_x;
+                }
+              }
+              // (add (minus y) x) -> (sub x y), line 31 swapped
+              {
+                NodeId n_y = p->node_arr[left].value.unary.node;
+                NodeId n_x = right;
+                NodeId b0 = Parser_create_binary_node(p, NODE_SUB, n_x, n_y);
+                return b0;
+              }
+            case NODE_MINUS:
+              // (add x (minus y)) -> (sub x y), line 31
+              {
+                NodeId n_x = left;
+                NodeId n_y = p->node_arr[right].value.unary.node;
+                NodeId b0 = Parser_create_binary_node(p, NODE_SUB, n_x, n_y);
+                return b0;
+              }
+            case NODE_SUB:
+              // (add (minus y) x) -> (sub x y), line 31 swapped
+              {
+                NodeId n_y = p->node_arr[left].value.unary.node;
+                NodeId n_x = right;
+                NodeId b0 = Parser_create_binary_node(p, NODE_SUB, n_x, n_y);
+                return b0;
+              }
+            default:
+              // (add (minus y) x) -> (sub x y), line 31 swapped
+              {
+                NodeId n_y = p->node_arr[left].value.unary.node;
+                NodeId n_x = right;
+                NodeId b0 = Parser_create_binary_node(p, NODE_SUB, n_x, n_y);
+                return b0;
+              }
+          }
+        case NODE_SUB:
+          switch (p->node_arr[right].tag) {
+            case NODE_CONSTANT:
+              // (add x (const 0)) -> x, line 19
+              {
+                NodeId n_x = left;
+                if (p->node_arr[right].value.i64 == 0) {
+                  return n_x;
+                }
+              }
+              // (add (sub x y) y) -> x, line 36
+              {
+                NodeId n_x = p->node_arr[left].value.binary.left;
+                NodeId n_y = p->node_arr[left].value.binary.right;
+                if (right == n_y && Parser_cannot_trap(p, n_y)) {
+                  return n_x;
+                }
+              }
+              // (add (sub x (const a)) (const b)) -> (add x (const (sub b a))), line 44
+              {
+                NodeId n_x = p->node_arr[left].value.binary.left;
+                NodeId n0 = p->node_arr[left].value.binary.right;
+                if (p->node_arr[n0].tag == NODE_CONSTANT) {
+                  int64_t c_a = p->node_arr[n0].value.i64;
+                  int64_t c_b = p->node_arr[right].value.i64;
+                  int64_t v1;
+                  if (Parser_fold_value(NODE_SUB, c_b, c_a, &v1)) {
+                    NodeId b2 = Parser_create_constant(p, v1);
+                    NodeId b3 = Parser_create_binary_node(p, NODE_ADD, n_x, b2);
+                    return b3;
+                  }
+                }
+              }
+              return NULL_NODE;
+            case NODE_MINUS:
+              // (add x (minus y)) -> (sub x y), line 31
+              {
+                NodeId n_x = left;
+                NodeId n_y = p->node_arr[right].value.unary.node;
+                NodeId b0 = Parser_create_binary_node(p, NODE_SUB, n_x, n_y);
+                return b0;
+              }
+            case NODE_SUB:
+              // (add (sub x y) y) -> x, line 36
+              {
+                NodeId n_x = p->node_arr[left].value.binary.left;
+                NodeId n_y = p->node_arr[left].value.binary.right;
+                if (right == n_y && Parser_cannot_trap(p, n_y)) {
+                  return n_x;
+                }
+              }
+              // (add y (sub x y)) -> x, line 36 swapped
+              {
+                NodeId n_y = left;
+                NodeId n_x = p->node_arr[right].value.binary.left;
+                if (p->node_arr[right].value.binary.right == n_y && Parser_cannot_trap(p, n_y)) {
+                  return n_x;
+                }
+              }
+              return NULL_NODE;
+            default:
+              // (add (sub x y) y) -> x, line 36
+              {
+                NodeId n_x = p->node_arr[left].value.binary.left;
+                NodeId n_y = p->node_arr[left].value.binary.right;
+                if (right == n_y && Parser_cannot_trap(p, n_y)) {
+                  return n_x;
+                }
+              }
+              return NULL_NODE;
+          }
+        case NODE_ADD:
+          switch (p->node_arr[right].tag) {
+            case NODE_CONSTANT:
+              // (add x (const 0)) -> x, line 19
+              {
+                NodeId n_x = left;
+                if (p->node_arr[right].value.i64 == 0) {
+                  return n_x;
+                }
+              }
+              // (add (add x (const a)) (const b)) -> (add x (const (add a b))), line 41
+              {
+                NodeId n_x = p->node_arr[left].value.binary.left;
+                NodeId n0 = p->node_arr[left].value.binary.right;
+                if (p->node_arr[n0].tag == NODE_CONSTANT) {
+                  int64_t c_a = p->node_arr[n0].value.i64;
+                  int64_t c_b = p->node_arr[right].value.i64;
+                  int64_t v1;
+                  if (Parser_fold_value(NODE_ADD, c_a, c_b, &v1)) {
+                    NodeId b2 = Parser_create_constant(p, v1);
+                    NodeId b3 = Parser_create_binary_node(p, NODE_ADD, n_x, b2);
+                    return b3;
+                  }
+                }
+              }
+              // (add (add (const a) x) (const b)) -> (add x (const (add a b))), line 42
+              {
+                NodeId n0 = p->node_arr[left].value.binary.left;
+                if (p->node_arr[n0].tag == NODE_CONSTANT) {
+                  int64_t c_a = p->node_arr[n0].value.i64;
+                  NodeId n_x = p->node_arr[left].value.binary.right;
+                  int64_t c_b = p->node_arr[right].value.i64;
+                  int64_t v1;
+                  if (Parser_fold_value(NODE_ADD, c_a, c_b, &v1)) {
+                    NodeId b2 = Parser_create_constant(p, v1);
+                    NodeId b3 = Parser_create_binary_node(p, NODE_ADD, n_x, b2);
+                    return b3;
+                  }
+                }
+              }
+              return NULL_NODE;
+            case NODE_MINUS:
+              // (add x (minus y)) -> (sub x y), line 31
+              {
+                NodeId n_x = left;
+                NodeId n_y = p->node_arr[right].value.unary.node;
+                NodeId b0 = Parser_create_binary_node(p, NODE_SUB, n_x, n_y);
+                return b0;
+              }
+            case NODE_SUB:
+              // (add y (sub x y)) -> x, line 36 swapped
+              {
+                NodeId n_y = left;
+                NodeId n_x = p->node_arr[right].value.binary.left;
+                if (p->node_arr[right].value.binary.right == n_y && Parser_cannot_trap(p, n_y)) {
+                  return n_x;
+                }
+              }
+              return NULL_NODE;
+            default:
+              return NULL_NODE;
+          }
+        default:
+          switch (p->node_arr[right].tag) {
+            case NODE_CONSTANT:
+              // (add x (const 0)) -> x, line 19
+              {
+                NodeId n_x = left;
+                if (p->node_arr[right].value.i64 == 0) {
+                  return n_x;
+                }
+              }
+              return NULL_NODE;
+            case NODE_MINUS:
+              // (add x (minus y)) -> (sub x y), line 31
+              {
+                NodeId n_x = left;
+                NodeId n_y = p->node_arr[right].value.unary.node;
+                NodeId b0 = Parser_create_binary_node(p, NODE_SUB, n_x, n_y);
+                return b0;
+              }
+            case NODE_SUB:
+              // (add y (sub x y)) -> x, line 36 swapped
+              {
+                NodeId n_y = left;
+                NodeId n_x = p->node_arr[right].value.binary.left;
+                if (p->node_arr[right].value.binary.right == n_y && Parser_cannot_trap(p, n_y)) {
+                  return n_x;
+                }
+              }
+              return NULL_NODE;
+            default:
+              return NULL_NODE;
+          }
+      }
+    case NODE_SUB:
+      switch (p->node_arr[left].tag) {
+        case NODE_CONSTANT:
+          switch (p->node_arr[right].tag) {
+            case NODE_CONSTANT:
+              // (sub x (const 0)) -> x, line 20
+              {
+                NodeId n_x = left;
+                if (p->node_arr[right].value.i64 == 0) {
+                  return n_x;
+                }
+              }
+              // (sub (const 0) x) -> (minus x), line 26
+              {
+                if (p->node_arr[left].value.i64 == 0) {
+                  NodeId n_x = right;
+                  NodeId b0 = Parser_create_unary_node(p, NODE_MINUS, n_x);
+                  return b0;
+                }
+              }
+              // (sub x x) -> (const 0), line 35
+              {
+                NodeId n_x = left;
+                if (right == n_x && Parser_cannot_trap(p, n_x)) {
+                  NodeId b0 = Parser_create_constant(p, 0);
+                  return b0;
+                }
+              }
+              return NULL_NODE;
+            case NODE_MINUS:
+              // (sub (const 0) x) -> (minus x), line 26
+              {
+                if (p->node_arr[left].value.i64 == 0) {
+                  NodeId n_x = right;
+                  NodeId b0 = Parser_create_unary_node(p, NODE_MINUS, n_x);
+                  return b0;
+                }
+              }
+              // (sub x (minus y)) -> (add x y), line 32
+              {
+                NodeId n_x = left;
+                NodeId n_y = p->node_arr[right].value.unary.node;
+                NodeId b0 = Parser_create_binary_node(p, NODE_ADD, n_x, n_y);
+                return b0;
+              }
+            default:
+              // (sub (const 0) x) -> (minus x), line 26
+              {
+                if (p->node_arr[left].value.i64 == 0) {
+                  NodeId n_x = right;
+                  NodeId b0 = Parser_create_unary_node(p, NODE_MINUS, n_x);
+                  return b0;
+                }
+              }
+              // (sub x x) -> (const 0), line 35
+              {
+                NodeId n_x = left;
+                if (right == n_x && Parser_cannot_trap(p, n_x)) {
+                  NodeId b0 = Parser_create_constant(p, 0);
+                  return b0;
+                }
+              }
+              return NULL_NODE;
+          }
+        case NODE_ADD:
+          switch (p->node_arr[right].tag) {
+            case NODE_CONSTANT:
+              // (sub x (const 0)) -> x, line 20
+              {
+                NodeId n_x = left;
+                if (p->node_arr[right].value.i64 == 0) {
+                  return n_x;
+                }
+              }
+              // (sub x x) -> (const 0), line 35
+              {
+                NodeId n_x = left;
+                if (right == n_x && Parser_cannot_trap(p, n_x)) {
+                  NodeId b0 = Parser_create_constant(p, 0);
+                  return b0;
+                }
+              }
+              // (sub (add x y) y) -> x, line 37
+              {
+                NodeId n_x = p->node_arr[left].value.binary.left;
+                NodeId n_y = p->node_arr[left].value.binary.right;
+                if (right == n_y && Parser_cannot_trap(p, n_y)) {
+                  return n_x;
+                }
+              }
+              // (sub (add y x) y) -> x, line 38
+              {
+                NodeId n_y = p->node_arr[left].value.binary.left;
+                NodeId n_x = p->node_arr[left].value.binary.right;
+                if (right == n_y && Parser_cannot_trap(p, n_y)) {
+                  return n_x;
+                }
+              }
+              // (sub (add x (const a)) (const b)) -> (add x (const (sub a b))), line 43
+              {
+                NodeId n_x = p->node_arr[left].value.binary.left;
+                NodeId n0 = p->node_arr[left].value.binary.right;
+                if (p->node_arr[n0].tag == NODE_CONSTANT) {
+                  int64_t c_a = p->node_arr[n0].value.i64;
+                  int64_t c_b = p->node_arr[right].value.i64;
+                  int64_t v1;
+                  if (Parser_fold_value(NODE_SUB, c_a, c_b, &v1)) {
+                    NodeId b2 = Parser_create_constant(p, v1);
+                    NodeId b3 = Parser_create_binary_node(p, NODE_ADD, n_x, b2);
+                    return b3;
+                  }
+                }
+              }
+              return NULL_NODE;
+            case NODE_MINUS:
+              // (sub x (minus y)) -> (add x y), line 32
+              {
+                NodeId n_x = left;
+                NodeId n_y = p->node_arr[right].value.unary.node;
+                NodeId b0 = Parser_create_binary_node(p, NODE_ADD, n_x, n_y);
+                return b0;
+              }
+            default:
+              // (sub x x) -> (const 0), line 35
+              {
+                NodeId n_x = left;
+                if (right == n_x && Parser_cannot_trap(p, n_x)) {
+                  NodeId b0 = Parser_create_constant(p, 0);
+                  return b0;
+                }
+              }
+              // (sub (add x y) y) -> x, line 37
+              {
+                NodeId n_x = p->node_arr[left].value.binary.left;
+                NodeId n_y = p->node_arr[left].value.binary.right;
+                if (right == n_y && Parser_cannot_trap(p, n_y)) {
+                  return n_x;
+                }
+              }
+              // (sub (add y x) y) -> x, line 38
+              {
+                NodeId n_y = p->node_arr[left].value.binary.left;
+                NodeId n_x = p->node_arr[left].value.binary.right;
+                if (right == n_y && Parser_cannot_trap(p, n_y)) {
+                  return n_x;
+                }
+              }
+              return NULL_NODE;
+          }
+        default:
+          switch (p->node_arr[right].tag) {
+            case NODE_CONSTANT:
+              // (sub x (const 0)) -> x, line 20
+              {
+                NodeId n_x = left;
+                if (p->node_arr[right].value.i64 == 0) {
+                  return n_x;
+                }
+              }
+              // (sub x x) -> (const 0), line 35
+              {
+                NodeId n_x = left;
+                if (right == n_x && Parser_cannot_trap(p, n_x)) {
+                  NodeId b0 = Parser_create_constant(p, 0);
+                  return b0;
+                }
+              }
+              return NULL_NODE;
+            case NODE_MINUS:
+              // (sub x (minus y)) -> (add x y), line 32
+              {
+                NodeId n_x = left;
+                NodeId n_y = p->node_arr[right].value.unary.node;
+                NodeId b0 = Parser_create_binary_node(p, NODE_ADD, n_x, n_y);
+                return b0;
+              }
+            default:
+              // (sub x x) -> (const 0), line 35
+              {
+                NodeId n_x = left;
+                if (right == n_x && Parser_cannot_trap(p, n_x)) {
+                  NodeId b0 = Parser_create_constant(p, 0);
+                  return b0;
+                }
+              }
+              return NULL_NODE;
+          }
+      }
+    case NODE_MUL:
+      switch (p->node_arr[left].tag) {
+        case NODE_CONSTANT:
+          switch (p->node_arr[right].tag) {
+            case NODE_CONSTANT:
+              // (mul x (const 1)) -> x, line 21
+              {
+                NodeId n_x = left;
+                if (p->node_arr[right].value.i64 == 1) {
+                  return n_x;
+                }
+              }
+              // (mul (const 1) x) -> x, line 21 swapped
+              {
+                if (p->node_arr[left].value.i64 == 1) {
+                  NodeId n_x = right;
+                  return n_x;
+                }
+              }
+              // (mul x (const 0)) -> (const 0), line 23
+              {
+                NodeId n_x = left;
+                if (p->node_arr[right].value.i64 == 0 && Parser_cannot_trap(p, n_x)) {
+                  NodeId b0 = Parser_create_constant(p, 0);
+                  return b0;
+                }
+              }
+              // (mul (const 0) x) -> (const 0), line 23 swapped
+              {
+                if (p->node_arr[left].value.i64 == 0) {
+                  NodeId n_x = right;
+                  if (Parser_cannot_trap(p, n_x)) {
+                    NodeId b0 = Parser_create_constant(p, 0);
+                    return b0;
+                  }
+                }
+              }
+              // (mul x (const -1)) -> (minus x), line 27
+              {
+                NodeId n_x = left;
+                if (p->node_arr[right].value.i64 == -1) {
+                  NodeId b0 = Parser_create_unary_node(p, NODE_MINUS, n_x);
+                  return b0;
+                }
+              }
+              // (mul (const -1) x) -> (minus x), line 27 swapped
+              {
+                if (p->node_arr[left].value.i64 == -1) {
+                  NodeId n_x = right;
+                  NodeId b0 = Parser_create_unary_node(p, NODE_MINUS, n_x);
+                  return b0;
+                }
+              }
+              // (mul x (const 2^k)) -> (shl x (const k)), line 49
+              {
+                NodeId n_x = left;
+                if (Rewrite_is_power(p->node_arr[right].value.i64)) {
+                  int64_t c_k = __builtin_ctzll(p->node_arr[right].value.i64);
+                  NodeId b0 = Parser_create_constant(p, c_k);
+                  NodeId b1 = Parser_create_binary_node(p, NODE_SHL, n_x, b0);
+                  return b1;
+                }
+              }
+              // (mul (const 2^k) x) -> (shl x (const k)), line 49 swapped
+              {
+                if (Rewrite_is_power(p->node_arr[left].value.i64)) {
+                  int64_t c_k = __builtin_ctzll(p->node_arr[left].value.i64);
+                  NodeId n_x = right;
+                  NodeId b0 = Parser_create_constant(p, c_k);
+                  NodeId b1 = Parser_create_binary_node(p, NODE_SHL, n_x, b0);
+                  return b1;
+                }
+              }
+              return NULL_NODE;
+            case NODE_MUL:
+              // (mul (const 1) x) -> x, line 21 swapped
+              {
+                if (p->node_arr[left].value.i64 == 1) {
+                  NodeId n_x = right;
+                  return n_x;
+                }
+              }
+              // (mul (const 0) x) -> (const 0), line 23 swapped
+              {
+                if (p->node_arr[left].value.i64 == 0) {
+                  NodeId n_x = right;
+                  if (Parser_cannot_trap(p, n_x)) {
+                    NodeId b0 = Parser_create_constant(p, 0);
+                    return b0;
+                  }
+                }
+              }
+              // (mul (const -1) x) -> (minus x), line 27 swapped
+              {
+                if (p->node_arr[left].value.i64 == -1) {
+                  NodeId n_x = right;
+                  NodeId b0 = Parser_create_unary_node(p, NODE_MINUS, n_x);
+                  return b0;
+                }
+              }
+              // (mul (const b) (mul x (const a))) -> (mul x (const (mul a b))), line 45 swapped
+              {
+                int64_t c_b = p->node_arr[left].value.i64;
+                NodeId n_x = p->node_arr[right].value.binary.left;
+                NodeId n0 = p->node_arr[right].value.binary.right;
+                if (p->node_arr[n0].tag == NODE_CONSTANT) {
+                  int64_t c_a = p->node_arr[n0].value.i64;
+                  int64_t v1;
+                  if (Parser_fold_value(NODE_MUL, c_a, c_b, &v1)) {
+                    NodeId b2 = Parser_create_constant(p, v1);
+                    NodeId b3 = Parser_create_binary_node(p, NODE_MUL, n_x, b2);
+                    return b3;
+                  }
+                }
+              }
+              // (mul (const b) (mul (const a) x)) -> (mul x (const (mul a b))), line 46 swapped
+              {
+                int64_t c_b = p->node_arr[left].value.i64;
+                NodeId n0 = p->node_arr[right].value.binary.left;
+                if (p->node_arr[n0].tag == NODE_CONSTANT) {
+                  int64_t c_a = p->node_arr[n0].value.i64;
+                  NodeId n_x = p->node_arr[right].value.binary.right;
+                  int64_t v1;
+                  if (Parser_fold_value(NODE_MUL, c_a, c_b, &v1)) {
+                    NodeId b2 = Parser_create_constant(p, v1);
+                    NodeId b3 = Parser_create_binary_node(p, NODE_MUL, n_x, b2);
+                    return b3;
+                  }
+                }
+              }
+              // (mul (const 2^k) x) -> (shl x (const k)), line 49 swapped
+              {
+                if (Rewrite_is_power(p->node_arr[left].value.i64)) {
+                  int64_t c_k = __builtin_ctzll(p->node_arr[left].value.i64);
+                  NodeId n_x = right;
+                  NodeId b0 = Parser_create_constant(p, c_k);
+                  NodeId b1 = Parser_create_binary_node(p, NODE_SHL, n_x, b0);
+                  return b1;
+                }
+              }
+              return NULL_NODE;
+            default:
+              // (mul (const 1) x) -> x, line 21 swapped
+              {
+                if (p->node_arr[left].value.i64 == 1) {
+                  NodeId n_x = right;
+                  return n_x;
+                }
+              }
+              // (mul (const 0) x) -> (const 0), line 23 swapped
+              {
+                if (p->node_arr[left].value.i64 == 0) {
+                  NodeId n_x = right;
+                  if (Parser_cannot_trap(p, n_x)) {
+                    NodeId b0 = Parser_create_constant(p, 0);
+                    return b0;
+                  }
+                }
+              }
+              // (mul (const -1) x) -> (minus x), line 27 swapped
+              {
+                if (p->node_arr[left].value.i64 == -1) {
+                  NodeId n_x = right;
+                  NodeId b0 = Parser_create_unary_node(p, NODE_MINUS, n_x);
+                  return b0;
+                }
+              }
+              // (mul (const 2^k) x) -> (shl x (const k)), line 49 swapped
+              {
+                if (Rewrite_is_power(p->node_arr[left].value.i64)) {
+                  int64_t c_k = __builtin_ctzll(p->node_arr[left].value.i64);
+                  NodeId n_x = right;
+                  NodeId b0 = Parser_create_constant(p, c_k);
+                  NodeId b1 = Parser_create_binary_node(p, NODE_SHL, n_x, b0);
+                  return b1;
+                }
+              }
+              return NULL_NODE;
+          }
+        case NODE_MUL:
+          switch (p->node_arr[right].tag) {
+            case NODE_CONSTANT:
+              // (mul x (const 1)) -> x, line 21
+              {
+                NodeId n_x = left;
+                if (p->node_arr[right].value.i64 == 1) {
+                  return n_x;
+                }
+              }
+              // (mul x (const 0)) -> (const 0), line 23
+              {
+                NodeId n_x = left;
+                if (p->node_arr[right].value.i64 == 0 && Parser_cannot_trap(p, n_x)) {
+                  NodeId b0 = Parser_create_constant(p, 0);
+                  return b0;
+                }
+              }
+              // (mul x (const -1)) -> (minus x), line 27
+              {
+                NodeId n_x = left;
+                if (p->node_arr[right].value.i64 == -1) {
+                  NodeId b0 = Parser_create_unary_node(p, NODE_MINUS, n_x);
+                  return b0;
+                }
+              }
+              // (mul (mul x (const a)) (const b)) -> (mul x (const (mul a b))), line 45
+              {
+                NodeId n_x = p->node_arr[left].value.binary.left;
+                NodeId n0 = p->node_arr[left].value.binary.right;
+                if (p->node_arr[n0].tag == NODE_CONSTANT) {
+                  int64_t c_a = p->node_arr[n0].value.i64;
+                  int64_t c_b = p->node_arr[right].value.i64;
+                  int64_t v1;
+                  if (Parser_fold_value(NODE_MUL, c_a, c_b, &v1)) {
+                    NodeId b2 = Parser_create_constant(p, v1);
+                    NodeId b3 = Parser_create_binary_node(p, NODE_MUL, n_x, b2);
+                    return b3;
+                  }
+                }
+              }
+              // (mul (mul (const a) x) (const b)) -> (mul x (const (mul a b))), line 46
+              {
+                NodeId n0 = p->node_arr[left].value.binary.left;
+                if (p->node_arr[n0].tag == NODE_CONSTANT) {
+                  int64_t c_a = p->node_arr[n0].value.i64;
+                  NodeId n_x = p->node_arr[left].value.binary.right;
+                  int64_t c_b = p->node_arr[right].value.i64;
+                  int64_t v1;
+                  if (Parser_fold_value(NODE_MUL, c_a, c_b, &v1)) {
+                    NodeId b2 = Parser_create_constant(p, v1);
+                    NodeId b3 = Parser_create_binary_node(p, NODE_MUL, n_x, b2);
+                    return b3;
+                  }
+                }
+              }
+              // (mul x (const 2^k)) -> (shl x (const k)), line 49
+              {
+                NodeId n_x = left;
+                if (Rewrite_is_power(p->node_arr[right].value.i64)) {
+                  int64_t c_k = __builtin_ctzll(p->node_arr[right].value.i64);
+                  NodeId b0 = Parser_create_constant(p, c_k);
+                  NodeId b1 = Parser_create_binary_node(p, NODE_SHL, n_x, b0);
+                  return b1;
+                }
+              }
+              return NULL_NODE;
+            default:
+              return NULL_NODE;
+          }
+        default:
+          switch (p->node_arr[right].tag) {
+            case NODE_CONSTANT:
+              // (mul x (const 1)) -> x, line 21
+              {
+                NodeId n_x = left;
+                if (p->node_arr[right].value.i64 == 1) {
+                  return n_x;
+                }
+              }
+              // (mul x (const 0)) -> (const 0), line 23
+              {
+                NodeId n_x = left;
+                if (p->node_arr[right].value.i64 == 0 && Parser_cannot_trap(p, n_x)) {
+                  NodeId b0 = Parser_create_constant(p, 0);
+                  return b0;
+                }
+              }
+              // (mul x (const -1)) -> (minus x), line 27
+              {
+                NodeId n_x = left;
+                if (p->node_arr[right].value.i64 == -1) {
+                  NodeId b0 = Parser_create_unary_node(p, NODE_MINUS, n_x);
+                  return b0;
+                }
+              }
+              // (mul x (const 2^k)) -> (shl x (const k)), line 49
+              {
+                NodeId n_x = left;
+                if (Rewrite_is_power(p->node_arr[right].value.i64)) {
+                  int64_t c_k = __builtin_ctzll(p->node_arr[right].value.i64);
+                  NodeId b0 = Parser_create_constant(p, c_k);
+                  NodeId b1 = Parser_create_binary_node(p, NODE_SHL, n_x, b0);
+                  return b1;
+                }
+              }
+              return NULL_NODE;
+            default:
+              return NULL_NODE;
+          }
+      }
+    case NODE_DIV:
+      switch (p->node_arr[right].tag) {
+        case NODE_CONSTANT:
+          // (div x (const 1)) -> x, line 22
+          {
+            NodeId n_x = left;
+            if (p->node_arr[right].value.i64 == 1) {
+              return n_x;
+            }
+          }
+          // (div x (const -1)) -> (minus x), line 28
+          {
+            NodeId n_x = left;
+            if (p->node_arr[right].value.i64 == -1) {
+              NodeId b0 = Parser_create_unary_node(p, NODE_MINUS, n_x);
+              return b0;
+            }
+          }
+          return NULL_NODE;
+        default:
+          return NULL_NODE;
+      }
+    case NODE_MINUS:
+      switch (p->node_arr[left].tag) {
+        case NODE_MINUS:
+          // (minus (minus x)) -> x, line 29
+          {
+            NodeId n_x = p->node_arr[left].value.unary.node;
+            return n_x;
+          }
+        case NODE_SUB:
+          // (minus (sub x y)) -> (sub y x), line 30
+          {
+            NodeId n_x = p->node_arr[left].value.binary.left;
+            NodeId n_y = p->node_arr[left].value.binary.right;
+            NodeId b0 = Parser_create_binary_node(p, NODE_SUB, n_y, n_x);
+            return b0;
+          }
+        default:
+          return NULL_NODE;
+      }
+    case NODE_NOT:
+      switch (p->node_arr[left].tag) {
+        case NODE_EQ:
+          // (not (eq x y)) -> (ne x y), line 60
+          {
+            NodeId n_x = p->node_arr[left].value.binary.left;
+            NodeId n_y = p->node_arr[left].value.binary.right;
+            NodeId b0 = Parser_create_binary_node(p, NODE_NE, n_x, n_y);
+            return b0;
+          }
+        case NODE_NE:
+          // (not (ne x y)) -> (eq x y), line 61
+          {
+            NodeId n_x = p->node_arr[left].value.binary.left;
+            NodeId n_y = p->node_arr[left].value.binary.right;
+            NodeId b0 = Parser_create_binary_node(p, NODE_EQ, n_x, n_y);
+            return b0;
+          }
+        case NODE_LT:
+          // (not (lt x y)) -> (ge x y), line 62
+          {
+            NodeId n_x = p->node_arr[left].value.binary.left;
+            NodeId n_y = p->node_arr[left].value.binary.right;
+            NodeId b0 = Parser_create_binary_node(p, NODE_GE, n_x, n_y);
+            return b0;
+          }
+        case NODE_LE:
+          // (not (le x y)) -> (gt x y), line 63
+          {
+            NodeId n_x = p->node_arr[left].value.binary.left;
+            NodeId n_y = p->node_arr[left].value.binary.right;
+            NodeId b0 = Parser_create_binary_node(p, NODE_GT, n_x, n_y);
+            return b0;
+          }
+        case NODE_GT:
+          // (not (gt x y)) -> (le x y), line 64
+          {
+            NodeId n_x = p->node_arr[left].value.binary.left;
+            NodeId n_y = p->node_arr[left].value.binary.right;
+            NodeId b0 = Parser_create_binary_node(p, NODE_LE, n_x, n_y);
+            return b0;
+          }
+        case NODE_GE:
+          // (not (ge x y)) -> (lt x y), line 65
+          {
+            NodeId n_x = p->node_arr[left].value.binary.left;
+            NodeId n_y = p->node_arr[left].value.binary.right;
+            NodeId b0 = Parser_create_binary_node(p, NODE_LT, n_x, n_y);
+            return b0;
+          }
+        case NODE_NOT:
+          // (not (not (not x))) -> (not x), line 66
+          {
+            NodeId n0 = p->node_arr[left].value.unary.node;
+            if (p->node_arr[n0].tag == NODE_NOT) {
+              NodeId n_x = p->node_arr[n0].value.unary.node;
+              NodeId b1 = Parser_create_unary_node(p, NODE_NOT, n_x);
+              return b1;
+            }
+          }
+          return NULL_NODE;
+        default:
+          return NULL_NODE;
+      }
+    case NODE_EQ:
+      // (eq x x) -> (const 1), line 52
+      {
+        NodeId n_x = left;
+        if (right == n_x && Parser_cannot_trap(p, n_x)) {
+          NodeId b0 = Parser_create_constant(p, 1);
+          return b0;
+        }
+      }
+      return NULL_NODE;
+    case NODE_NE:
+      // (ne x x) -> (const 0), line 53
+      {
+        NodeId n_x = left;
+        if (right == n_x && Parser_cannot_trap(p, n_x)) {
+          NodeId b0 = Parser_create_constant(p, 0);
+          return b0;
+        }
+      }
+      return NULL_NODE;
+    case NODE_LT:
+      // (lt x x) -> (const 0), line 54
+      {
+        NodeId n_x = left;
+        if (right == n_x && Parser_cannot_trap(p, n_x)) {
+          NodeId b0 = Parser_create_constant(p, 0);
+          return b0;
+        }
+      }
+      return NULL_NODE;
+    case NODE_LE:
+      // (le x x) -> (const 1), line 55
+      {
+        NodeId n_x = left;
+        if (right == n_x && Parser_cannot_trap(p, n_x)) {
+          NodeId b0 = Parser_create_constant(p, 1);
+          return b0;
+        }
+      }
+      return NULL_NODE;
+    case NODE_GT:
+      // (gt x x) -> (const 0), line 56
+      {
+        NodeId n_x = left;
+        if (right == n_x && Parser_cannot_trap(p, n_x)) {
+          NodeId b0 = Parser_create_constant(p, 0);
+          return b0;
+        }
+      }
+      return NULL_NODE;
+    case NODE_GE:
+      // (ge x x) -> (const 1), line 57
+      {
+        NodeId n_x = left;
+        if (right == n_x && Parser_cannot_trap(p, n_x)) {
+          NodeId b0 = Parser_create_constant(p, 1);
+          return b0;
+        }
+      }
+      return NULL_NODE;
+    default:
+      return NULL_NODE;
+  }
+}
@@ -0,0 +1,733 @@
+// Compiles the rewrite rules into the matcher the parser calls for
+// every unary and binary node it makes, see rewrite.rules for how
+// they're written. Every rule is first run on random values, both
+// sides folded like the evaluator would, and has to agree. Nodes
+// are taken to be values, a rewrite that leaves one out checks
+// it can't divide by zero when it's matched instead. Then
+// the rules become one function: a switch on the op, one on the
+// tag of the left operand and one on the right, and in the case
+// they land in, checks for only the rules of that shape in order.
+// Matching a node is those lookups, however many rules there are.
+//
+// usage: rulegen RULES OUT [samples]
+#include <assert.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "son.c"
+
+#define DEFAULT_SAMPLES 10000
+#define MAX_RULES 256
+#define MAX_TERMS 32
+#define MAX_NAMES 8
+#define MAX_NAME_LEN 16
+#define MAX_LINE 256
+// Deep enough for the checks of a rule
+#define MAX_ITEMS 64
+#define MAX_ITEM_LEN 192
+
+typedef enum {
+  TERM_OP, // a node of `op`, inside a value the op folded
+  TERM_NAME, // a node, inside a value what it's bound to
+  TERM_CONST, // a constant node of the value `arg_arr[0]`
+  TERM_VALUE, // a literal value
+  TERM_POWER, // a power of two, its exponent bound to `name`
+} TermKind;
+
+typedef struct {
+  TermKind kind;
+  NodeTag op;
+  uint8_t arg_arr[2];
+  uint8_t name;
+  int64_t value;
+} Term;
+
+typedef struct {
+  char text[MAX_NAME_LEN];
+  // A value of a constant, or else a node
+  bool is_value;
+  bool is_power;
+  // Occurrences in the pattern and in the rewrite
+  uint8_t match_count;
+  uint8_t build_count;
+} Name;
+
+typedef struct {
+  uint32_t line;
+  Term term_arr[MAX_TERMS];
+  uint8_t term_len;
+  uint8_t match;
+  uint8_t build;
+  Name name_arr[MAX_NAMES];
+  uint8_t name_len;
+  // The operands of a commutative op the other way around
+  bool swapped;
+} Rule;
+
+typedef enum {
+  CONTEXT_MATCH,
+  CONTEXT_MATCH_VALUE,
+  CONTEXT_BUILD,
+  CONTEXT_BUILD_VALUE,
+} Context;
+
+typedef struct {
+  const char *filename;
+  uint32_t line;
+  const char *pos;
+  Rule *rule;
+} Reader;
+
+Rule rule_arr[MAX_RULES];
+uint16_t rule_len;
+
+#define ENUM(tag) [tag] = #tag
+const char *const NODE_ENUM[NODE_COUNT] = {
+  ENUM(NODE_CONSTANT),
+  ENUM(NODE_ADD), ENUM(NODE_SUB), ENUM(NODE_MUL), ENUM(NODE_DIV),
+  ENUM(NODE_SHL), ENUM(NODE_SAR), ENUM(NODE_SHR), ENUM(NODE_MULHI),
+  ENUM(NODE_MINUS), ENUM(NODE_NOT),
+  ENUM(NODE_EQ), ENUM(NODE_NE), ENUM(NODE_LT), ENUM(NODE_LE), ENUM(NODE_GT), ENUM(NODE_GE),
+};
+
+void Reader_fail(const Reader *r, const char *fmt, ...) {
+  char message[256];
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(message, sizeof(message), fmt, args);
+  va_end(args);
+  print_error_message("%s:%u: %s", r->filename, r->line, message);
+  exit(1);
+}
+
+void Reader_skip_space(Reader *r) {
+  while (*r->pos == ' ' || *r->pos == '\t') r->pos++;
+}
+
+bool is_name_char(char ch) {
+  return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9') || ch == '_';
+}
+
+uint16_t Reader_word(Reader *r, char *out) {
+  uint16_t len = 0;
+  while (is_name_char(r->pos[len])) {
+    if (len == MAX_NAME_LEN - 1) Reader_fail(r, "Name longer than %d", MAX_NAME_LEN - 1);
+    out[len] = r->pos[len];
+    len++;
+  }
+  out[len] = 0;
+  r->pos += len;
+  return len;
+}
+
+// Operands of the ops rules can have, 0 for other tags
+uint8_t op_arity(NodeTag op) {
+  if (op == NODE_MINUS || op == NODE_NOT) return 1;
+  return op >= NODE_BINARY_START && op < NODE_COUNT ? 2 : 0;
+}
+
+NodeTag find_op(const char *word) {
+  for (NodeTag op = NODE_BINARY_START; op < NODE_COUNT; ++op) {
+    if (!strcmp(NODE_NAME[op], word)) return op;
+  }
+  return NODE_NONE;
+}
+
+bool is_commutative(NodeTag op) {
+  return op == NODE_ADD || op == NODE_MUL || op == NODE_EQ || op == NODE_NE;
+}
+
+uint8_t Rule_term(Reader *r, Term term) {
+  Rule *rule = r->rule;
+  if (rule->term_len == MAX_TERMS) Reader_fail(r, "More than %d terms", MAX_TERMS);
+  rule->term_arr[rule->term_len] = term;
+  return rule->term_len++;
+}
+
+uint8_t Rule_find_name(const Rule *rule, const char *text) {
+  for (uint8_t i = 0; i < rule->name_len; ++i) {
+    if (!strcmp(rule->name_arr[i].text, text)) return i;
+  }
+  return MAX_NAMES;
+}
+
+// A name of the pattern, the first occurrence binds it
+uint8_t Reader_bind(Reader *r, const char *text, bool is_value, bool is_power) {
+  Rule *rule = r->rule;
+  uint8_t i = Rule_find_name(rule, text);
+  if (i == MAX_NAMES) {
+    if (rule->name_len == MAX_NAMES) Reader_fail(r, "More than %d names", MAX_NAMES);
+    i = rule->name_len++;
+    rule->name_arr[i] = (Name){ .is_value = is_value, .is_power = is_power };
+    strcpy(rule->name_arr[i].text, text);
+  } else if (rule->name_arr[i].is_value != is_value) {
+    Reader_fail(r, "`%s` is a node and a value", text);
+  } else if (is_power || rule->name_arr[i].is_power) {
+    Reader_fail(r, "`%s` is a power of two and can't repeat", text);
+  }
+  rule->name_arr[i].match_count++;
+  return i;
+}
+
+uint8_t Reader_term(Reader *r, Context context) {
+  Rule *rule = r->rule;
+  bool in_value = context == CONTEXT_MATCH_VALUE || context == CONTEXT_BUILD_VALUE;
+  char word[MAX_NAME_LEN];
+  Reader_skip_space(r);
+  if (*r->pos == '(') {
+    r->pos++;
+    Reader_skip_space(r);
+    if (!Reader_word(r, word)) Reader_fail(r, "Expected an op after `(`");
+    Term term = {0};
+    if (!strcmp(word, "const")) {
+      if (in_value) Reader_fail(r, "`const` inside a value");
+      term.kind = TERM_CONST;
+      term.arg_arr[0] = Reader_term(r, context == CONTEXT_MATCH ? CONTEXT_MATCH_VALUE : CONTEXT_BUILD_VALUE);
+    } else {
+      term.kind = TERM_OP;
+      term.op = find_op(word);
+      uint8_t arity = op_arity(term.op);
+      if (!arity) Reader_fail(r, "Unknown op `%s`", word);
+      if (context == CONTEXT_MATCH_VALUE) Reader_fail(r, "Ops over the value of a constant don't match");
+      for (uint8_t i = 0; i < arity; ++i) term.arg_arr[i] = Reader_term(r, context);
+    }
+    Reader_skip_space(r);
+    if (*r->pos != ')') Reader_fail(r, "Expected `)`, `(%s` takes %s", word, term.kind == TERM_CONST ? "one value" : "its operands");
+    r->pos++;
+    return Rule_term(r, term);
+  }
+  if (r->pos[0] == '2' && r->pos[1] == '^') {
+    r->pos += 2;
+    if (context != CONTEXT_MATCH_VALUE) Reader_fail(r, "`2^` only matches a constant");
+    if (!Reader_word(r, word)) Reader_fail(r, "Expected a name after `2^`");
+    return Rule_term(r, (Term){ .kind = TERM_POWER, .name = Reader_bind(r, word, true, true) });
+  }
+  if (*r->pos == '-' || (*r->pos >= '0' && *r->pos <= '9')) {
+    if (!in_value) Reader_fail(r, "A number is a value, wrap it in `(const ...)`");
+    char *end;
+    int64_t value = strtoll(r->pos, &end, 10);
+    if (end == r->pos) Reader_fail(r, "Expected a number");
+    r->pos = end;
+    return Rule_term(r, (Term){ .kind = TERM_VALUE, .value = value });
+  }
+  if (!Reader_word(r, word)) Reader_fail(r, "Expected a term, got `%c`", *r->pos ? *r->pos : ' ');
+  if (context == CONTEXT_MATCH || context == CONTEXT_MATCH_VALUE) {
+    return Rule_term(r, (Term){ .kind = TERM_NAME, .name = Reader_bind(r, word, in_value, false) });
+  }
+  uint8_t name = Rule_find_name(rule, word);
+  if (name == MAX_NAMES) Reader_fail(r, "`%s` isn't in the pattern", word);
+  if (in_value && !rule->name_arr[name].is_value) Reader_fail(r, "`%s` is a node, not a value", word);
+  rule->name_arr[name].build_count++;
+  uint8_t term = Rule_term(r, (Term){ .kind = TERM_NAME, .name = name });
+  // A bare value makes a constant
+  if (in_value || !rule->name_arr[name].is_value) return term;
+  return Rule_term(r, (Term){ .kind = TERM_CONST, .arg_arr[0] = term });
+}
+
+void Reader_rule(Reader *r) {
+  Rule *rule = r->rule;
+  *rule = (Rule){ .line = r->line };
+  rule->match = Reader_term(r, CONTEXT_MATCH);
+  if (rule->term_arr[rule->match].kind != TERM_OP) Reader_fail(r, "A pattern starts with an op");
+  Reader_skip_space(r);
+  if (strncmp(r->pos, "->", 2)) Reader_fail(r, "Expected `->`");
+  r->pos += 2;
+  rule->build = Reader_term(r, CONTEXT_BUILD);
+  Reader_skip_space(r);
+  if (*r->pos && *r->pos != '\n' && *r->pos != '#') Reader_fail(r, "Expected the end of the rule");
+}
+
+bool Term_equal(const Rule *rule, uint8_t a, uint8_t b) {
+  Term x = rule->term_arr[a], y = rule->term_arr[b];
+  if (x.kind != y.kind) return false;
+  switch (x.kind) {
+    case TERM_OP:
+      for (uint8_t i = 0; i < op_arity(x.op); ++i) {
+        if (!Term_equal(rule, x.arg_arr[i], y.arg_arr[i])) return false;
+      }
+      return x.op == y.op;
+    case TERM_CONST: return Term_equal(rule, x.arg_arr[0], y.arg_arr[0]);
+    case TERM_VALUE: return x.value == y.value;
+    default: return x.name == y.name;
+  }
+}
+
+void read_rules(const char *filename) {
+  FILE *fp = fopen(filename, "r");
+  if (!fp) {
+    print_error_message("Failed to open " ANSI_BLUE "%s" ANSI_RESET, filename);
+    exit(1);
+  }
+  char line[MAX_LINE];
+  Reader r = { .filename = filename };
+  while (fgets(line, sizeof(line), fp)) {
+    r.line++;
+    r.pos = line;
+    Reader_skip_space(&r);
+    if (*r.pos == '#' || *r.pos == '\n' || !*r.pos) continue;
+    if (rule_len + 2 > MAX_RULES) Reader_fail(&r, "More than %d rules", MAX_RULES);
+    r.rule = &rule_arr[rule_len++];
+    Reader_rule(&r);
+    Rule *rule = r.rule;
+    Term top = rule->term_arr[rule->match];
+    if (!is_commutative(top.op) || Term_equal(rule, top.arg_arr[0], top.arg_arr[1])) continue;
+    Rule *swapped = &rule_arr[rule_len++];
+    *swapped = *rule;
+    swapped->swapped = true;
+    swapped->term_arr[swapped->match].arg_arr[0] = top.arg_arr[1];
+    swapped->term_arr[swapped->match].arg_arr[1] = top.arg_arr[0];
+  }
+  fclose(fp);
+}
+
+// As the rules are written
+void Term_format(const Rule *rule, uint8_t id, char *out, size_t size) {
+  Term term = rule->term_arr[id];
+  size_t len = 0;
+  switch (term.kind) {
+    case TERM_OP:
+    case TERM_CONST:
+      len = snprintf(out, size, "(%s", term.kind == TERM_OP ? NODE_NAME[term.op] : "const");
+      for (uint8_t i = 0; i < (term.kind == TERM_OP ? op_arity(term.op) : 1) && len + 1 < size; ++i) {
+        out[len++] = ' ';
+        Term_format(rule, term.arg_arr[i], &out[len], size - len);
+        len += strlen(&out[len]);
+      }
+      if (len + 1 < size) snprintf(&out[len], size - len, ")");
+      break;
+    case TERM_NAME: snprintf(out, size, "%s", rule->name_arr[term.name].text); break;
+    case TERM_VALUE: snprintf(out, size, "%lld", (long long)term.value); break;
+    case TERM_POWER: snprintf(out, size, "2^%s", rule->name_arr[term.name].text); break;
+  }
+}
+
+typedef enum {
+  SAMPLE_OK,
+  SAMPLE_TRAP, // a division by zero
+  SAMPLE_SKIP, // a value of the rewrite doesn't fold, it doesn't apply
+} SampleStatus;
+
+// Values folded as the evaluator would, nodes
+// trap and values the rewrite needs don't apply
+SampleStatus Term_eval(const Rule *rule, uint8_t id, const int64_t *env, bool in_value, int64_t *out) {
+  Term term = rule->term_arr[id];
+  int64_t arg_arr[2];
+  switch (term.kind) {
+    case TERM_OP:
+      for (uint8_t i = 0; i < op_arity(term.op); ++i) {
+        SampleStatus status = Term_eval(rule, term.arg_arr[i], env, in_value, &arg_arr[i]);
+        if (status != SAMPLE_OK) return status;
+      }
+      if (op_arity(term.op) == 1) {
+        *out = Parser_fold_unary_value(term.op, arg_arr[0]);
+        return SAMPLE_OK;
+      }
+      if (Parser_fold_value(term.op, arg_arr[0], arg_arr[1], out)) return SAMPLE_OK;
+      return in_value ? SAMPLE_SKIP : SAMPLE_TRAP;
+    case TERM_CONST: return Term_eval(rule, term.arg_arr[0], env, true, out);
+    case TERM_NAME: *out = env[term.name]; return SAMPLE_OK;
+    case TERM_VALUE: *out = term.value; return SAMPLE_OK;
+    case TERM_POWER: *out = (int64_t)((uint64_t)1 << env[term.name]); return SAMPLE_OK;
+  }
+  return SAMPLE_OK;
+}
+
+uint64_t random_state = 0x9e3779b97f4a7c15;
+
+uint64_t random_next(void) {
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 7;
+  random_state ^= random_state << 17;
+  return random_state;
+}
+
+// Mostly edges, some small and some anything
+int64_t random_value(void) {
+  static const int64_t EDGE_ARR[] = {
+    0, 1, -1, 2, -2, 3, -3, 7, 63, 64, -64, 1000,
+    INT64_MAX, INT64_MIN, INT64_MAX - 1, INT64_MIN + 1, INT32_MAX, INT32_MIN,
+  };
+  uint64_t pick = random_next();
+  switch (pick % 4) {
+    case 0:
+    case 1: return EDGE_ARR[(pick >> 8) % (sizeof(EDGE_ARR) / sizeof(EDGE_ARR[0]))];
+    case 2: return (int64_t)((pick >> 8) % 201) - 100;
+    default: return (int64_t)random_next();
+  }
+}
+
+void print_env(const Rule *rule, const int64_t *env) {
+  for (uint8_t i = 0; i < rule->name_len; ++i) {
+    fprintf(stderr, "%s%s = %lld", i ? ", " : "  with ", rule->name_arr[i].text, (long long)env[i]);
+  }
+  fprintf(stderr, "\n");
+}
+
+// False, and why on stderr, when a sample tells the sides apart
+// or the rewrite never applies
+bool check_rule(const char *filename, const Rule *rule, uint32_t samples) {
+  char match[MAX_LINE], build[MAX_LINE];
+  Term_format(rule, rule->match, match, sizeof(match));
+  Term_format(rule, rule->build, build, sizeof(build));
+  int64_t env[MAX_NAMES];
+  uint32_t applied = 0;
+  for (uint32_t i = 0; i < samples; ++i) {
+    for (uint8_t n = 0; n < rule->name_len; ++n) {
+      env[n] = rule->name_arr[n].is_power ? (int64_t)(random_next() % 64) : random_value();
+    }
+    int64_t before = 0, after = 0;
+    SampleStatus match_status = Term_eval(rule, rule->match, env, false, &before);
+    SampleStatus build_status = Term_eval(rule, rule->build, env, false, &after);
+    if (build_status == SAMPLE_SKIP) continue;
+    applied++;
+    if (match_status == build_status && (match_status == SAMPLE_TRAP || before == after)) continue;
+    print_error_message("%s:%u: %s -> %s is wrong", filename, rule->line, match, build);
+    if (match_status == SAMPLE_TRAP) fprintf(stderr, "  it takes out a division by zero\n");
+    else if (build_status == SAMPLE_TRAP) fprintf(stderr, "  it divides by zero, before it was %lld\n", (long long)before);
+    else fprintf(stderr, "  %lld before and %lld after\n", (long long)before, (long long)after);
+    print_env(rule, env);
+    return false;
+  }
+  if (applied) return true;
+  print_error_message("%s:%u: %s -> %s never applies, its values don't fold", filename, rule->line, match, build);
+  return false;
+}
+
+typedef enum {
+  ITEM_CHECK,
+  ITEM_LINE,
+} ItemKind;
+
+// What a rule does once its node is of its shape: checks
+// that all have to hold and the lines that bind names
+typedef struct {
+  ItemKind kind;
+  char text[MAX_ITEM_LEN];
+} Item;
+
+typedef struct {
+  const Rule *rule;
+  Item item_arr[MAX_ITEMS];
+  uint8_t item_len;
+  bool bound[MAX_NAMES];
+  uint8_t temp_len;
+} Matcher;
+
+void Matcher_item(Matcher *m, ItemKind kind, const char *fmt, ...) {
+  assert(m->item_len < MAX_ITEMS);
+  Item *item = &m->item_arr[m->item_len++];
+  item->kind = kind;
+  va_list args;
+  va_start(args, fmt);
+  int len = vsnprintf(item->text, sizeof(item->text), fmt, args);
+  va_end(args);
+  assert(len < MAX_ITEM_LEN);
+}
+
+// Values are written so they parse back to themselves
+void format_value(int64_t value, char *out, size_t size) {
+  if (value == INT64_MIN) snprintf(out, size, "INT64_MIN");
+  else snprintf(out, size, "%lld", (long long)value);
+}
+
+// Values that are only matched once don't need binding, nodes
+// do, the rewrite has to check those it leaves out can't trap
+bool Name_used(const Name *name) {
+  return !name->is_value || name->build_count || name->match_count > 1;
+}
+
+// `value` is the C expression of the constant
+void Matcher_value(Matcher *m, uint8_t id, const char *value) {
+  const Rule *rule = m->rule;
+  Term term = rule->term_arr[id];
+  const Name *name = &rule->name_arr[term.name];
+  char literal[32];
+  switch (term.kind) {
+    case TERM_VALUE:
+      format_value(term.value, literal, sizeof(literal));
+      Matcher_item(m, ITEM_CHECK, "%s == %s", value, literal);
+      break;
+    case TERM_NAME:
+      if (m->bound[term.name]) {
+        Matcher_item(m, ITEM_CHECK, "%s == c_%s", value, name->text);
+      } else if (Name_used(name)) {
+        Matcher_item(m, ITEM_LINE, "int64_t c_%s = %s;", name->text, value);
+        m->bound[term.name] = true;
+      }
+      break;
+    case TERM_POWER:
+      Matcher_item(m, ITEM_CHECK, "Rewrite_is_power(%s)", value);
+      if (Name_used(name)) {
+        Matcher_item(m, ITEM_LINE, "int64_t c_%s = __builtin_ctzll(%s);", name->text, value);
+        m->bound[term.name] = true;
+      }
+      break;
+    default: assert(0);
+  }
+}
+
+// `node` is the C expression of the node id, `top` when
+// the switches already checked its tag
+void Matcher_node(Matcher *m, uint8_t id, const char *node, bool top) {
+  const Rule *rule = m->rule;
+  Term term = rule->term_arr[id];
+  char at[32], arg[64];
+  // Checked before the fields are read, those
+  // of another kind of node are anything
+  if (term.kind == TERM_OP || term.kind == TERM_CONST) {
+    if (!top) {
+      snprintf(at, sizeof(at), "n%d", m->temp_len++);
+      Matcher_item(m, ITEM_LINE, "NodeId %s = %s;", at, node);
+      Matcher_item(m, ITEM_CHECK, "p->node_arr[%s].tag == %s", at, term.kind == TERM_OP ? NODE_ENUM[term.op] : "NODE_CONSTANT");
+      node = at;
+    }
+  }
+  switch (term.kind) {
+    case TERM_OP:
+      for (uint8_t i = 0; i < op_arity(term.op); ++i) {
+        if (op_arity(term.op) == 1) snprintf(arg, sizeof(arg), "p->node_arr[%s].value.unary.node", node);
+        else snprintf(arg, sizeof(arg), "p->node_arr[%s].value.binary.%s", node, i ? "right" : "left");
+        Matcher_node(m, term.arg_arr[i], arg, false);
+      }
+      break;
+    case TERM_CONST:
+      snprintf(arg, sizeof(arg), "p->node_arr[%s].value.i64", node);
+      Matcher_value(m, term.arg_arr[0], arg);
+      break;
+    case TERM_NAME: {
+      const Name *name = &rule->name_arr[term.name];
+      if (m->bound[term.name]) {
+        Matcher_item(m, ITEM_CHECK, "%s == n_%s", node, name->text);
+      } else {
+        Matcher_item(m, ITEM_LINE, "NodeId n_%s = %s;", name->text, node);
+        m->bound[term.name] = true;
+      }
+      break;
+    }
+    default: assert(0);
+  }
+}
+
+// Into `out` the C expression of a value of the rewrite,
+// folds that can fail are checked before anything is made
+void Matcher_build_value(Matcher *m, uint8_t id, char *out, size_t size) {
+  const Rule *rule = m->rule;
+  Term term = rule->term_arr[id];
+  char arg_arr[2][32];
+  switch (term.kind) {
+    case TERM_VALUE: format_value(term.value, out, size); return;
+    case TERM_NAME: snprintf(out, size, "c_%s", rule->name_arr[term.name].text); return;
+    case TERM_OP:
+      for (uint8_t i = 0; i < op_arity(term.op); ++i) Matcher_build_value(m, term.arg_arr[i], arg_arr[i], sizeof(arg_arr[i]));
+      snprintf(out, size, "v%d", m->temp_len++);
+      if (op_arity(term.op) == 1) {
+        Matcher_item(m, ITEM_LINE, "int64_t %s = Parser_fold_unary_value(%s, %s);", out, NODE_ENUM[term.op], arg_arr[0]);
+      } else {
+        Matcher_item(m, ITEM_LINE, "int64_t %s;", out);
+        Matcher_item(m, ITEM_CHECK, "Parser_fold_value(%s, %s, %s, &%s)", NODE_ENUM[term.op], arg_arr[0], arg_arr[1], out);
+      }
+      return;
+    default: assert(0);
+  }
+}
+
+// Values first, they can fail
+void Matcher_values(Matcher *m, uint8_t id, char value_arr[][32]) {
+  Term term = m->rule->term_arr[id];
+  if (term.kind == TERM_CONST) Matcher_build_value(m, term.arg_arr[0], value_arr[id], 32);
+  if (term.kind != TERM_OP) return;
+  for (uint8_t i = 0; i < op_arity(term.op); ++i) Matcher_values(m, term.arg_arr[i], value_arr);
+}
+
+// Then the nodes, operands before their users
+void Matcher_build(Matcher *m, uint8_t id, char value_arr[][32], char *out, size_t size) {
+  const Rule *rule = m->rule;
+  Term term = rule->term_arr[id];
+  char arg_arr[2][32];
+  switch (term.kind) {
+    case TERM_NAME:
+      snprintf(out, size, "n_%s", rule->name_arr[term.name].text);
+      return;
+    case TERM_CONST:
+      snprintf(out, size, "b%d", m->temp_len++);
+      Matcher_item(m, ITEM_LINE, "NodeId %s = Parser_create_constant(p, %s);", out, value_arr[id]);
+      return;
+    case TERM_OP:
+      for (uint8_t i = 0; i < op_arity(term.op); ++i) Matcher_build(m, term.arg_arr[i], value_arr, arg_arr[i], sizeof(arg_arr[i]));
+      snprintf(out, size, "b%d", m->temp_len++);
+      if (op_arity(term.op) == 1) {
+        Matcher_item(m, ITEM_LINE, "NodeId %s = Parser_create_unary_node(p, %s, %s);", out, NODE_ENUM[term.op], arg_arr[0]);
+      } else {
+        Matcher_item(m, ITEM_LINE, "NodeId %s = Parser_create_binary_node(p, %s, %s, %s);",
+          out, NODE_ENUM[term.op], arg_arr[0], arg_arr[1]);
+      }
+      return;
+    default: assert(0);
+  }
+}
+
+void emit_indent(FILE *out, int indent) {
+  fprintf(out, "%*s", indent * 2, "");
+}
+
+// A block of the rule, returning what it rewrites to when it
+// matches. True when it always does, the rules after it can't
+bool emit_rule(FILE *out, const Rule *rule, int indent) {
+  Matcher m = { .rule = rule };
+  Term top = rule->term_arr[rule->match];
+  for (uint8_t i = 0; i < op_arity(top.op); ++i) Matcher_node(&m, top.arg_arr[i], i ? "right" : "left", true);
+  // Last, it's the one check that walks the graph
+  for (uint8_t i = 0; i < rule->name_len; ++i) {
+    const Name *name = &rule->name_arr[i];
+    if (!name->is_value && !name->build_count) Matcher_item(&m, ITEM_CHECK, "Parser_cannot_trap(p, n_%s)", name->text);
+  }
+  char value_arr[MAX_TERMS][32];
+  Matcher_values(&m, rule->build, value_arr);
+  char result[32];
+  Matcher_build(&m, rule->build, value_arr, result, sizeof(result));
+
+  char text[MAX_LINE];
+  Term_format(rule, rule->match, text, sizeof(text));
+  emit_indent(out, indent);
+  fprintf(out, "// %s -> ", text);
+  Term_format(rule, rule->build, text, sizeof(text));
+  fprintf(out, "%s, line %u%s\n", text, rule->line, rule->swapped ? " swapped" : "");
+  emit_indent(out, indent);
+  fprintf(out, "{\n");
+  int depth = indent + 1;
+  for (uint8_t i = 0; i < m.item_len;) {
+    if (m.item_arr[i].kind == ITEM_LINE) {
+      emit_indent(out, depth);
+      fprintf(out, "%s\n", m.item_arr[i++].text);
+      continue;
+    }
+    emit_indent(out, depth);
+    fprintf(out, "if (");
+    for (bool first = true; i < m.item_len && m.item_arr[i].kind == ITEM_CHECK; first = false) {
+      fprintf(out, "%s%s", first ? "" : " && ", m.item_arr[i++].text);
+    }
+    fprintf(out, ") {\n");
+    depth++;
+  }
+  emit_indent(out, depth);
+  fprintf(out, "return %s;\n", result);
+  bool always = depth == indent + 1;
+  while (depth > indent) {
+    emit_indent(out, --depth);
+    fprintf(out, "}\n");
+  }
+  return always;
+}
+
+// The switch on the tag of `operand` of the rules in `index_arr`,
+// then on the next operand, then the rules of each shape in order
+void emit_switch(FILE *out, const uint16_t *index_arr, uint16_t len, uint8_t operand, int indent) {
+  const Rule *first = &rule_arr[index_arr[0]];
+  uint8_t arity = op_arity(first->term_arr[first->match].op);
+  if (operand == arity) {
+    for (uint16_t i = 0; i < len; ++i) {
+      if (emit_rule(out, &rule_arr[index_arr[i]], indent)) return;
+    }
+    emit_indent(out, indent);
+    fprintf(out, "return NULL_NODE;\n");
+    return;
+  }
+  // The tag a rule needs the operand to have, none for any
+  NodeTag shape_arr[MAX_RULES];
+  NodeTag tag_arr[MAX_RULES];
+  uint16_t tag_len = 0;
+  for (uint16_t i = 0; i < len; ++i) {
+    const Rule *rule = &rule_arr[index_arr[i]];
+    Term term = rule->term_arr[rule->term_arr[rule->match].arg_arr[operand]];
+    shape_arr[i] = term.kind == TERM_OP ? term.op : term.kind == TERM_CONST ? NODE_CONSTANT : NODE_NONE;
+    bool seen = !shape_arr[i];
+    for (uint16_t t = 0; t < tag_len && !seen; ++t) seen = tag_arr[t] == shape_arr[i];
+    if (!seen) tag_arr[tag_len++] = shape_arr[i];
+  }
+  const char *name = operand ? "right" : "left";
+  if (!tag_len) {
+    emit_switch(out, index_arr, len, operand + 1, indent);
+    return;
+  }
+  emit_indent(out, indent);
+  fprintf(out, "switch (p->node_arr[%s].tag) {\n", name);
+  uint16_t subset_arr[MAX_RULES];
+  // NODE_NONE last, it's the default
+  tag_arr[tag_len++] = NODE_NONE;
+  for (uint16_t t = 0; t < tag_len; ++t) {
+    uint16_t subset_len = 0;
+    for (uint16_t i = 0; i < len; ++i) {
+      if (!shape_arr[i] || shape_arr[i] == tag_arr[t]) subset_arr[subset_len++] = index_arr[i];
+    }
+    emit_indent(out, indent + 1);
+    if (tag_arr[t]) fprintf(out, "case %s:\n", NODE_ENUM[tag_arr[t]]);
+    else fprintf(out, "default:\n");
+    if (subset_len) {
+      emit_switch(out, subset_arr, subset_len, operand + 1, indent + 2);
+    } else {
+      emit_indent(out, indent + 2);
+      fprintf(out, "return NULL_NODE;\n");
+    }
+  }
+  emit_indent(out, indent);
+  fprintf(out, "}\n");
+}
+
+void emit_matcher(FILE *out, const char *rules_filename) {
+  const char *base = strrchr(rules_filename, '/');
+  base = base ? base + 1 : rules_filename;
+  fprintf(out,
+    "// Generated by rulegen from %s, don't edit,\n"
+    "// change the rules and run `make rules`\n"
+    "#include \"parser.h\"\n"
+    "\n"
+    "bool Rewrite_is_power(int64_t value) {\n"
+    "  return value && !((uint64_t)value & ((uint64_t)value - 1));\n"
+    "}\n"
+    "\n"
+    "// `left op right`, or `op left`, as the first rule that matches\n"
+    "// rewrites it, the null node when none does. Nothing is made\n"
+    "// unless a rule matches\n"
+    "NodeId Parser_rewrite(Parser *p, NodeTag op, NodeId left, NodeId right) {\n", base);
+  // Right is unused with only unary rules
+  fprintf(out, "  (void)right;\n");
+  fprintf(out, "  switch (op) {\n");
+  uint16_t index_arr[MAX_RULES];
+  for (NodeTag op = NODE_BINARY_START; op < NODE_COUNT; ++op) {
+    uint16_t len = 0;
+    for (uint16_t i = 0; i < rule_len; ++i) {
+      if (rule_arr[i].term_arr[rule_arr[i].match].op == op) index_arr[len++] = i;
+    }
+    if (!len) continue;
+    fprintf(out, "    case %s:\n", NODE_ENUM[op]);
+    emit_switch(out, index_arr, len, 0, 3);
+  }
+  fprintf(out, "    default:\n");
+  fprintf(out, "      return NULL_NODE;\n");
+  fprintf(out, "  }\n");
+  fprintf(out, "}\n");
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 3) {
+    print_error_message("usage: rulegen RULES OUT [samples]");
+    exit(1);
+  }
+  uint32_t samples = argc > 3 ? strtoul(argv[3], NULL, 10) : DEFAULT_SAMPLES;
+  read_rules(argv[1]);
+  bool ok = true;
+  for (uint16_t i = 0; i < rule_len; ++i) ok &= check_rule(argv[1], &rule_arr[i], samples);
+  // The matcher in the tree stays as it was
+  if (!ok) exit(1);
+  FILE *out = fopen(argv[2], "w");
+  if (!out) {
+    print_error_message("Failed to open " ANSI_BLUE "%s" ANSI_RESET, argv[2]);
+    exit(1);
+  }
+  emit_matcher(out, argv[1]);
+  fclose(out);
+  printf("%u rules checked on %u samples each, wrote %s\n", rule_len, samples, argv[2]);
+  return 0;
+}
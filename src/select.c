@@ -0,0 +1,129 @@
+#include "parser.h"
+
+// An if whose arms hold no control, only values for the phis
+// of the region after it, becomes a select per phi. Both arms
+// are then computed up front, so only cheap ones are taken:
+// what the phis alone need has to stay within the budget and
+// can't divide, a division the branch guarded could trap
+uint32_t SELECT_BUDGET = 4;
+
+// The if of a region its two projections flow straight into
+NodeId Parser_diamond_if(const Parser *p, NodeId region) {
+  struct NodeRegion node = p->node_arr[region].value.region;
+  Node left = p->node_arr[node.left_block];
+  Node right = p->node_arr[node.right_block];
+  if (left.tag != NODE_PROJ || right.tag != NODE_PROJ || left.value.proj.ctrl != right.value.proj.ctrl) return 0;
+  NodeId id = left.value.proj.ctrl;
+  if (p->node_arr[id].tag != NODE_IF || node.left_block == node.right_block) return 0;
+  // Nothing else hangs off the arms
+  for (int i = 0; i < 2; ++i) {
+    NodeId proj = i ? node.right_block : node.left_block;
+    for (LinkId link = p->node_arr[proj].outputs; link; link = p->link_arr[link].next) {
+      if (p->link_arr[link].node != region) return 0;
+    }
+  }
+  return id;
+}
+
+// Data nodes only the phis need, counted against the budget.
+// Returns false when they can't all be computed up front
+bool Parser_select_cost(Parser *p, const NodeId *phi_arr, uint16_t phi_len) {
+  ArenaMark mark = Arena_mark(&p->scratch);
+  Bitset only = Bitset_new(&p->scratch, p->node_len);
+  NodeId *arm_arr = Arena_alloc(&p->scratch, p->node_len * sizeof(NodeId));
+  uint16_t arm_len = 0;
+  for (uint16_t i = 0; i < phi_len; ++i) Bitset_set(&only, phi_arr[i]);
+  // Everything the phis are computed from, up to the
+  // constants, parameters and the phis of other merges
+  for (uint16_t i = 0; i < phi_len; ++i) {
+    struct NodePhi phi = p->node_arr[phi_arr[i]].value.phi;
+    NodeId side_arr[2] = { phi.left, phi.right };
+    for (int j = 0; j < 2; ++j) {
+      if (p->node_arr[side_arr[j]].tag <= NODE_CONSTANT || Bitset_test_and_set(&only, side_arr[j])) continue;
+      arm_arr[arm_len++] = side_arr[j];
+    }
+  }
+  for (uint16_t i = 0; i < arm_len; ++i) {
+    NodeId input_arr[MAX_INPUTS];
+    uint16_t input_len = Parser_node_inputs(p, arm_arr[i], input_arr);
+    for (uint16_t j = 0; j < input_len; ++j) {
+      if (p->node_arr[input_arr[j]].tag <= NODE_CONSTANT || Bitset_test_and_set(&only, input_arr[j])) continue;
+      arm_arr[arm_len++] = input_arr[j];
+    }
+  }
+  // Minus what something else reads as well
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (uint16_t i = 0; i < arm_len; ++i) {
+      if (!Bitset_get(&only, arm_arr[i])) continue;
+      for (LinkId link = p->node_arr[arm_arr[i]].outputs; link; link = p->link_arr[link].next) {
+        if (Bitset_get(&only, p->link_arr[link].node)) continue;
+        Bitset_clear(&only, arm_arr[i]);
+        changed = true;
+        break;
+      }
+    }
+  }
+  uint32_t cost = 0;
+  bool divides = false;
+  for (uint16_t i = 0; i < arm_len; ++i) {
+    if (!Bitset_get(&only, arm_arr[i])) continue;
+    cost++;
+    divides |= p->node_arr[arm_arr[i]].tag == NODE_DIV;
+  }
+  Arena_release(&p->scratch, mark);
+  return !divides && cost <= SELECT_BUDGET;
+}
+
+// Returns whether the diamond ending in `region` was replaced
+bool Parser_convert_if(Parser *p, NodeId region) {
+  NodeId id = Parser_diamond_if(p, region);
+  if (!id) return false;
+  NodeId phi_arr[MAX_NODES];
+  uint16_t phi_len = Parser_region_phis(p, region, phi_arr);
+  if (p->node_len + phi_len > MAX_NODES || p->link_len + 3 * phi_len > MAX_LINKS ||
+      !Parser_select_cost(p, phi_arr, phi_len)) return false;
+
+  struct NodeIf node = p->node_arr[id].value.if_;
+  struct NodeRegion merge = p->node_arr[region].value.region;
+  bool then_left = p->node_arr[merge.left_block].value.proj.select == 0;
+  for (uint16_t i = 0; i < phi_len; ++i) {
+    Node phi = p->node_arr[phi_arr[i]];
+    NodeId select = Parser_create_node(p, (Node){
+      .tag = NODE_SELECT,
+      .type = phi.type,
+      .value.select.cond = node.cond,
+      .value.select.left = then_left ? phi.value.phi.left : phi.value.phi.right,
+      .value.select.right = then_left ? phi.value.phi.right : phi.value.phi.left,
+    });
+    // Runs where the phi ran
+    p->node_arr[select].loop = phi.loop;
+    Parser_add_node_output(p, select, node.cond);
+    Parser_add_node_output(p, select, p->node_arr[select].value.select.left);
+    Parser_add_node_output(p, select, p->node_arr[select].value.select.right);
+    Parser_replace_node(p, phi_arr[i], select);
+  }
+  Parser_replace_node(p, region, node.ctrl);
+  Parser_kill_node(p, region);
+  Parser_kill_node(p, merge.left_block);
+  Parser_kill_node(p, merge.right_block);
+  Parser_kill_node(p, id);
+  // The condition of a diamond without phis
+  Parser_remove_node(p, node.cond);
+  return true;
+}
+
+// Inner diamonds come first, an outer one whose
+// arms were just emptied is converted in the same pass.
+// Returns how many ifs became selects
+uint16_t Parser_convert_ifs(Parser *p) {
+  if (!SELECT_BUDGET) return 0;
+  Profile_push(PHASE_SELECT);
+  uint16_t count = 0;
+  for (NodeId id = START_NODE; id < p->node_len; ++id) {
+    if (p->node_arr[id].tag == NODE_REGION && Parser_convert_if(p, id)) count++;
+  }
+  Profile_pop();
+  return count;
+}
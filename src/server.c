@@ -0,0 +1,410 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "server.h"
+#include "son.h"
+
+typedef struct ServeConn ServeConn;
+
+typedef struct ServeJob {
+  struct ServeJob *next;
+  ServeConn *conn;
+  uint32_t seq;
+  ServeKind kind;
+  char *source;
+  uint32_t len;
+  uint64_t queued_at;
+  ServeResponse response;
+  char *payload;
+  size_t payload_len;
+} ServeJob;
+
+// Incoming bytes are cut into requests, finished jobs wait
+// in `done` until every earlier response went out. After the
+// peer shuts down its side, `eof`, the connection stays open
+// until every request it sent got its response
+struct ServeConn {
+  int fd;
+  bool closed;
+  bool eof;
+  // What epoll waits for
+  uint32_t events;
+  uint32_t inflight;
+  uint32_t next_seq;
+  uint32_t next_reply;
+  ServeJob *done;
+  char *in;
+  uint32_t in_len;
+  uint32_t in_cap;
+  char *out;
+  uint32_t out_len;
+  uint32_t out_pos;
+  uint32_t out_cap;
+  ServeConn *next_dead;
+};
+
+typedef struct {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  ServeJob *head;
+  ServeJob *tail;
+} ServeQueue;
+
+ServeQueue SERVE_PENDING = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, NULL };
+ServeQueue SERVE_FINISHED = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, NULL };
+// Wakes the event loop when SERVE_FINISHED gets a job
+int SERVE_WAKE_FD = -1;
+
+// Only compared by address, tell the special fds
+// apart from connections in epoll events
+char SERVE_LISTEN_TAG;
+char SERVE_WAKE_TAG;
+
+// Closed connections nothing refers to anymore. Freed once
+// the current batch of events is handled, later events in
+// the batch can still point at them
+ServeConn *SERVE_DEAD = NULL;
+
+uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void ServeQueue_push(ServeQueue *q, ServeJob *job) {
+  job->next = NULL;
+  pthread_mutex_lock(&q->lock);
+  if (q->tail) q->tail->next = job;
+  else q->head = job;
+  q->tail = job;
+  pthread_cond_signal(&q->cond);
+  pthread_mutex_unlock(&q->lock);
+}
+
+ServeJob *ServeQueue_pop_wait(ServeQueue *q) {
+  pthread_mutex_lock(&q->lock);
+  while (!q->head) pthread_cond_wait(&q->cond, &q->lock);
+  ServeJob *job = q->head;
+  q->head = job->next;
+  if (!q->head) q->tail = NULL;
+  pthread_mutex_unlock(&q->lock);
+  return job;
+}
+
+ServeJob *ServeQueue_take_all(ServeQueue *q) {
+  pthread_mutex_lock(&q->lock);
+  ServeJob *list = q->head;
+  q->head = q->tail = NULL;
+  pthread_mutex_unlock(&q->lock);
+  return list;
+}
+
+void serve_render(SonContext *ctx, ServeJob *job, uint32_t error_count, FILE *out) {
+  const Parser *p = SonGraph_parser(son_graph(ctx));
+  if (error_count || job->kind == SERVE_DIAGNOSTICS) {
+    son_print_diagnostics(ctx, out);
+    return;
+  }
+  switch (job->kind) {
+    case SERVE_NODES:
+      son_graph_print(son_graph(ctx));
+      break;
+    case SERVE_IR:
+      ServeIrHeader header = { p->node_len, p->link_len };
+      fwrite(&header, sizeof(header), 1, out);
+      fwrite(p->node_arr, sizeof(Node), p->node_len, out);
+      fwrite(p->link_arr, sizeof(Link), p->link_len, out);
+      break;
+    default:
+      fprintf(out, "Unknown request kind %d\n", job->kind);
+  }
+}
+
+void *serve_worker(void *arg) {
+  (void)arg;
+  // Warm for the whole life of the server
+  SonContext *ctx = son_context_new();
+  assert(ctx);
+  // Workers compile at the same time, they'd all dump
+  // to the same file. graph() does nothing here
+  son_context_set_graph_file(ctx, NULL);
+  while (1) {
+    ServeJob *job = ServeQueue_pop_wait(&SERVE_PENDING);
+    FILE *out = open_memstream(&job->payload, &job->payload_len);
+    assert(out);
+    son_context_set_output(ctx, out);
+
+    uint64_t start = now_ns();
+    uint32_t error_count = son_compile(ctx, job->source, job->len);
+    uint64_t end = now_ns();
+    serve_render(ctx, job, error_count, out);
+    fclose(out);
+    son_context_set_output(ctx, stdout);
+
+    job->response = (ServeResponse){
+      .len = job->payload_len,
+      .error_count = error_count,
+      .queue_ns = start - job->queued_at,
+      .compile_ns = end - start,
+    };
+    ServeQueue_push(&SERVE_FINISHED, job);
+    uint64_t one = 1;
+    if (write(SERVE_WAKE_FD, &one, sizeof(one)) < 0) assert(errno == EAGAIN);
+  }
+  return NULL;
+}
+
+void ServeJob_free(ServeJob *job) {
+  free(job->source);
+  free(job->payload);
+  free(job);
+}
+
+void ServeConn_bury(ServeConn *c) {
+  c->next_dead = SERVE_DEAD;
+  SERVE_DEAD = c;
+}
+
+void serve_free_dead(void) {
+  while (SERVE_DEAD) {
+    ServeConn *c = SERVE_DEAD;
+    SERVE_DEAD = c->next_dead;
+    free(c->in);
+    free(c->out);
+    free(c);
+  }
+}
+
+void ServeConn_close(ServeConn *c, int epoll_fd) {
+  if (c->closed) return;
+  epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+  close(c->fd);
+  c->closed = true;
+  while (c->done) {
+    ServeJob *job = c->done;
+    c->done = job->next;
+    ServeJob_free(job);
+  }
+  // Workers still hold jobs pointing at us
+  if (!c->inflight) ServeConn_bury(c);
+}
+
+void ServeConn_append(ServeConn *c, const void *data, uint32_t len) {
+  if (c->out_len + len > c->out_cap) {
+    uint32_t cap = MAX(c->out_cap * 2, c->out_len + len);
+    c->out = realloc(c->out, cap);
+    assert(c->out);
+    c->out_cap = cap;
+  }
+  memcpy(&c->out[c->out_len], data, len);
+  c->out_len += len;
+}
+
+// Returns false if the connection broke, or the peer
+// stopped sending and every response went out
+bool ServeConn_flush(ServeConn *c, int epoll_fd) {
+  while (c->out_pos < c->out_len) {
+    ssize_t res = write(c->fd, &c->out[c->out_pos], c->out_len - c->out_pos);
+    if (res < 0 && errno == EINTR) continue;
+    if (res < 0 && errno == EAGAIN) break;
+    if (res <= 0) return false;
+    c->out_pos += res;
+  }
+  if (c->out_pos == c->out_len) c->out_pos = c->out_len = 0;
+  if (c->eof && !c->inflight && !c->out_len) return false;
+
+  // Past the end there's nothing left to read, waiting
+  // for it would wake us up on every epoll_wait
+  uint32_t events = (c->eof ? 0 : EPOLLIN | EPOLLRDHUP) | (c->out_len ? EPOLLOUT : 0);
+  if (events != c->events) {
+    struct epoll_event ev = { .events = events, .data.ptr = c };
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+    c->events = events;
+  }
+  return true;
+}
+
+// Moves finished jobs to the output, keeping the request order
+void ServeConn_reply(ServeConn *c) {
+  bool progress = true;
+  while (progress) {
+    progress = false;
+    ServeJob **link = &c->done;
+    while (*link) {
+      ServeJob *job = *link;
+      if (job->seq != c->next_reply) {
+        link = &job->next;
+        continue;
+      }
+      *link = job->next;
+      ServeConn_append(c, &job->response, sizeof(job->response));
+      ServeConn_append(c, job->payload, job->payload_len);
+      ServeJob_free(job);
+      c->next_reply++;
+      progress = true;
+    }
+  }
+}
+
+// Returns false if the connection should be closed
+bool ServeConn_read(ServeConn *c) {
+  while (1) {
+    if (c->in_cap - c->in_len < 4096) {
+      c->in_cap = MAX(c->in_cap * 2, 64 * 1024);
+      c->in = realloc(c->in, c->in_cap);
+      assert(c->in);
+    }
+    ssize_t res = read(c->fd, &c->in[c->in_len], c->in_cap - c->in_len);
+    if (res < 0 && errno == EINTR) continue;
+    if (res < 0 && errno == EAGAIN) break;
+    if (res < 0) return false;
+    // The peer shut down its side, it still reads the
+    // responses to what it sent before
+    if (!res) {
+      c->eof = true;
+      break;
+    }
+    c->in_len += res;
+  }
+
+  // Every whole request becomes a job
+  uint32_t pos = 0;
+  while (c->in_len - pos >= sizeof(ServeRequest)) {
+    ServeRequest req;
+    memcpy(&req, &c->in[pos], sizeof(req));
+    if (req.len > SERVE_MAX_REQUEST) return false;
+    if (c->in_len - pos - sizeof(req) < req.len) break;
+    pos += sizeof(req);
+
+    ServeJob *job = calloc(1, sizeof(*job));
+    assert(job);
+    job->conn = c;
+    job->seq = c->next_seq++;
+    job->kind = req.kind;
+    job->len = req.len;
+    job->source = malloc(req.len ? req.len : 1);
+    assert(job->source);
+    memcpy(job->source, &c->in[pos], req.len);
+    job->queued_at = now_ns();
+    pos += req.len;
+    c->inflight++;
+    ServeQueue_push(&SERVE_PENDING, job);
+  }
+  memmove(c->in, &c->in[pos], c->in_len - pos);
+  c->in_len -= pos;
+  return true;
+}
+
+void serve_accept(int listen_fd, int epoll_fd) {
+  while (1) {
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0) return;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    ServeConn *c = calloc(1, sizeof(*c));
+    assert(c);
+    c->fd = fd;
+    c->events = EPOLLIN | EPOLLRDHUP;
+    struct epoll_event ev = { .events = c->events, .data.ptr = c };
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+      close(fd);
+      free(c);
+    }
+  }
+}
+
+void serve_finished(int epoll_fd) {
+  uint64_t count;
+  if (read(SERVE_WAKE_FD, &count, sizeof(count)) < 0) assert(errno == EAGAIN);
+  ServeJob *job = ServeQueue_take_all(&SERVE_FINISHED);
+  while (job) {
+    ServeJob *next = job->next;
+    ServeConn *c = job->conn;
+    c->inflight--;
+    if (c->closed) {
+      ServeJob_free(job);
+      if (!c->inflight) ServeConn_bury(c);
+    } else {
+      job->next = c->done;
+      c->done = job;
+      ServeConn_reply(c);
+      if (!ServeConn_flush(c, epoll_fd)) ServeConn_close(c, epoll_fd);
+    }
+    job = next;
+  }
+}
+
+// Never returns
+void serve(const char *path, uint32_t thread_count) {
+  signal(SIGPIPE, SIG_IGN);
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    print_error_message("Socket path too long: " ANSI_BLUE "%s" ANSI_RESET, path);
+    exit(1);
+  }
+  strcpy(addr.sun_path, path);
+
+  int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  unlink(path);
+  if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0
+      || listen(listen_fd, 128) < 0) {
+    print_error_message("Failed to listen on " ANSI_BLUE "%s" ANSI_RESET ": %s",
+      path, strerror(errno));
+    exit(1);
+  }
+  int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  SERVE_WAKE_FD = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  assert(epoll_fd >= 0 && SERVE_WAKE_FD >= 0);
+  struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &SERVE_LISTEN_TAG };
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev);
+  ev.data.ptr = &SERVE_WAKE_TAG;
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, SERVE_WAKE_FD, &ev);
+
+  for (uint32_t i = 0; i < thread_count; ++i) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, serve_worker, NULL)) {
+      print_error_message("Failed to start worker thread");
+      exit(1);
+    }
+    pthread_detach(thread);
+  }
+  fprintf(stderr, "Listening on %s with %u workers\n", path, thread_count);
+
+#define MAX_EVENTS 64
+  struct epoll_event events[MAX_EVENTS];
+  while (1) {
+    int count = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+    if (count < 0 && errno == EINTR) continue;
+    assert(count >= 0);
+    for (int i = 0; i < count; ++i) {
+      void *tag = events[i].data.ptr;
+      if (tag == &SERVE_LISTEN_TAG) {
+        serve_accept(listen_fd, epoll_fd);
+        continue;
+      }
+      if (tag == &SERVE_WAKE_TAG) {
+        serve_finished(epoll_fd);
+        continue;
+      }
+      ServeConn *c = tag;
+      if (c->closed) continue;
+      bool ok = true;
+      if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) ok = ServeConn_read(c);
+      // Closed both ways, no one is left to read responses
+      if (events[i].events & (EPOLLHUP | EPOLLERR)) ok = false;
+      if (ok) ok = ServeConn_flush(c, epoll_fd);
+      if (!ok) ServeConn_close(c, epoll_fd);
+    }
+    serve_free_dead();
+  }
+}
@@ -0,0 +1,129 @@
+// The whole compiler as one translation unit,
+// built into libson.a and included by the driver
+#include <assert.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "error_reporting.c"
+#include "graphviz.c"
+#include "fs.c"
+#include "arena.c"
+#include "pool.c"
+#include "trace.c"
+#include "profile.c"
+
+#include "parser_nodes.c"
+#include "parser_expressions.c"
+#include "rewrite.c"
+#include "parser_statements.c"
+#include "parser_vars.c"
+#include "undo.c"
+#include "dce.c"
+#include "licm.c"
+#include "ranges.c"
+#include "jumps.c"
+#include "select.c"
+#include "strength.c"
+#include "inline.c"
+#include "functions.c"
+#include "eval.c"
+#include "parser.h"
+#include "tokenizer.c"
+#include "parser.c"
+#include "son.h"
+#include "incremental.c"
+
+struct SonContext {
+  Parser parser;
+  Token token_arr[MAX_TOKENS];
+  Diagnostics diag;
+  // Where the debug builtins print to
+  FILE *out;
+  const char *graph_filename;
+  uint32_t source_len;
+  // Set by son_compile, cleared by son_context_reset
+  bool used;
+};
+
+SonContext *son_context_new(void) {
+  SonContext *ctx = calloc(1, sizeof(SonContext));
+  if (!ctx) return NULL;
+  ctx->out = stdout;
+  ctx->graph_filename = GRAPH_FILENAME;
+  return ctx;
+}
+
+void son_context_free(SonContext *ctx) {
+  if (!ctx) return;
+  Parser_free(&ctx->parser);
+  free(ctx);
+}
+
+void son_context_reset(SonContext *ctx) {
+  Parser_reset(&ctx->parser);
+  Diagnostics_reset(&ctx->diag);
+  ctx->used = false;
+}
+
+uint32_t son_compile(SonContext *ctx, const char *src, uint32_t len) {
+  if (ctx->used) son_context_reset(ctx);
+  ctx->used = true;
+  ctx->source_len = len;
+  tokenize(src, len, ctx->token_arr, &ctx->diag);
+  Parser_init(&ctx->parser, src, ctx->token_arr, &ctx->diag);
+  ctx->parser.out = ctx->out;
+  ctx->parser.graph_filename = ctx->graph_filename;
+  Parser_parse_top_level(&ctx->parser);
+  graphviz_wait();
+  return ctx->diag.error_count;
+}
+
+void son_print_diagnostics(const SonContext *ctx, FILE *out) {
+  if (!ctx->diag.diag_len) return;
+  LineIndex lines;
+  LineIndex_build(&lines, ctx->parser.source, ctx->source_len);
+  Diagnostics_print(out, &ctx->diag, &lines);
+  LineIndex_free(&lines);
+}
+
+void son_context_set_output(SonContext *ctx, FILE *out) {
+  ctx->out = out;
+  ctx->parser.out = out;
+}
+
+void son_context_set_graph_file(SonContext *ctx, const char *filename) {
+  ctx->graph_filename = filename;
+}
+
+// The graph is the parser of the program, only hosts
+// of libson don't see it. Tools built with the compiler
+// get at the nodes with this
+const Parser *SonGraph_parser(const SonGraph *graph) {
+  return (const Parser *)graph;
+}
+
+const SonGraph *son_graph(const SonContext *ctx) {
+  return (const SonGraph *)&ctx->parser;
+}
+
+uint32_t son_graph_node_count(const SonGraph *graph) {
+  const Parser *p = SonGraph_parser(graph);
+  uint32_t count = 0;
+  for (NodeId i = START_NODE; i < p->node_len; ++i) count += p->node_arr[i].tag != NODE_NONE;
+  for (uint16_t i = 0; i < p->function_len; ++i) {
+    count += son_graph_node_count((const SonGraph *)p->function_arr[i].graph);
+  }
+  return count;
+}
+
+uint16_t son_graph_function_count(const SonGraph *graph) {
+  return SonGraph_parser(graph)->function_len;
+}
+
+void son_graph_print(const SonGraph *graph) {
+  print_nodes(SonGraph_parser(graph));
+  print_functions(SonGraph_parser(graph));
+}
@@ -0,0 +1,153 @@
+#include "parser.h"
+
+// Multiplications by a constant that's a power of two, or one
+// off from one, become a shift and at most an add. Divisions by
+// a constant become a multiplication by its scaled reciprocal,
+// keeping the high half, and shifts that round toward zero.
+// Constants are on the right of a division, either side of a
+// multiplication, everything wraps like the folder does
+bool REDUCE_STRENGTH = true;
+
+// Most nodes and links a division takes
+#define REDUCE_NODES 10
+#define REDUCE_LINKS 16
+
+typedef struct {
+  int64_t magic;
+  uint8_t shift;
+} Magic;
+
+// The multiplier and shift of Hacker's Delight 10-1,
+// for 2 <= |d| and d not INT64_MIN
+Magic Parser_magic(int64_t d) {
+  const uint64_t two63 = (uint64_t)1 << 63;
+  uint64_t ad = d < 0 ? 0 - (uint64_t)d : (uint64_t)d;
+  uint64_t t = two63 + ((uint64_t)d >> 63);
+  uint64_t anc = t - 1 - t % ad;
+  uint64_t q1 = two63 / anc, r1 = two63 - q1 * anc;
+  uint64_t q2 = two63 / ad, r2 = two63 - q2 * ad;
+  uint64_t delta;
+  int p = 63;
+  do {
+    p++;
+    q1 *= 2;
+    r1 *= 2;
+    if (r1 >= anc) {
+      q1++;
+      r1 -= anc;
+    }
+    q2 *= 2;
+    r2 *= 2;
+    if (r2 >= ad) {
+      q2++;
+      r2 -= ad;
+    }
+    delta = ad - r2;
+  } while (q1 < delta || (q1 == delta && r1 == 0));
+  uint64_t magic = q2 + 1;
+  if (d < 0) magic = 0 - magic;
+  return (Magic){ (int64_t)magic, p - 64 };
+}
+
+// In the loop of the node being replaced, LICM moves it later
+NodeId Parser_reduced_node(Parser *p, NodeTag op, NodeId left, NodeId right, NodeId loop) {
+  NodeId node = Parser_create_binary_node(p, op, left, right);
+  p->node_arr[node].loop = loop;
+  return node;
+}
+
+NodeId Parser_reduced_minus(Parser *p, NodeId inner, NodeId loop) {
+  NodeId node = Parser_create_unary_node(p, NODE_MINUS, inner);
+  p->node_arr[node].loop = loop;
+  return node;
+}
+
+// `x * c` as shifts, 0 when it takes more than a shift and an add.
+// Mod 2^64 the signed and unsigned products are the same
+NodeId Parser_reduce_mul(Parser *p, NodeId x, int64_t c, NodeId loop) {
+  uint64_t uc = (uint64_t)c;
+  if (uc == 0) return Parser_create_constant(p, 0);
+  if (uc == 1) return x;
+  if (c == -1) return Parser_reduced_minus(p, x, loop);
+  uint64_t power;
+  NodeTag op = NODE_NONE;
+  bool negate = false;
+  if (!(uc & (uc - 1))) {
+    power = uc;
+  } else if (!((uc - 1) & (uc - 2))) {
+    power = uc - 1;
+    op = NODE_ADD;
+  } else if (!((uc + 1) & uc)) {
+    power = uc + 1;
+    op = NODE_SUB;
+  } else if (!(-uc & (-uc - 1))) {
+    power = -uc;
+    negate = true;
+  } else {
+    return 0;
+  }
+  int shift = __builtin_ctzll(power);
+  NodeId node = Parser_reduced_node(p, NODE_SHL, x, Parser_create_constant(p, shift), loop);
+  if (op) node = Parser_reduced_node(p, op, node, x, loop);
+  if (negate) node = Parser_reduced_minus(p, node, loop);
+  return node;
+}
+
+// `x / c` truncating toward zero, 0 for a division by zero
+NodeId Parser_reduce_div(Parser *p, NodeId x, int64_t c, NodeId loop) {
+  if (c == 0) return 0;
+  if (c == 1) return x;
+  if (c == -1) return Parser_reduced_minus(p, x, loop);
+  // Nothing else is that big
+  if (c == INT64_MIN) return Parser_reduced_node(p, NODE_EQ, x, Parser_create_constant(p, INT64_MIN), loop);
+  uint64_t ac = c < 0 ? 0 - (uint64_t)c : (uint64_t)c;
+  NodeId q;
+  if (!(ac & (ac - 1))) {
+    // Negative dividends get 2^k - 1 added first,
+    // the shift alone would round down
+    int shift = __builtin_ctzll(ac);
+    NodeId sign = Parser_reduced_node(p, NODE_SAR, x, Parser_create_constant(p, 63), loop);
+    NodeId bias = Parser_reduced_node(p, NODE_SHR, sign, Parser_create_constant(p, 64 - shift), loop);
+    NodeId sum = Parser_reduced_node(p, NODE_ADD, x, bias, loop);
+    q = Parser_reduced_node(p, NODE_SAR, sum, Parser_create_constant(p, shift), loop);
+    return c < 0 ? Parser_reduced_minus(p, q, loop) : q;
+  }
+  Magic m = Parser_magic(c);
+  q = Parser_reduced_node(p, NODE_MULHI, x, Parser_create_constant(p, m.magic), loop);
+  // The multiplier wrapped around to the other sign
+  if (c > 0 && m.magic < 0) q = Parser_reduced_node(p, NODE_ADD, q, x, loop);
+  if (c < 0 && m.magic > 0) q = Parser_reduced_node(p, NODE_SUB, q, x, loop);
+  if (m.shift) q = Parser_reduced_node(p, NODE_SAR, q, Parser_create_constant(p, m.shift), loop);
+  // Rounded down so far, one more for negative quotients
+  NodeId sign = Parser_reduced_node(p, NODE_SHR, q, Parser_create_constant(p, 63), loop);
+  return Parser_reduced_node(p, NODE_ADD, q, sign, loop);
+}
+
+// Returns whether the node was replaced
+bool Parser_reduce_node(Parser *p, NodeId id) {
+  Node node = p->node_arr[id];
+  if (node.tag != NODE_MUL && node.tag != NODE_DIV) return false;
+  if (p->node_len + REDUCE_NODES > MAX_NODES || p->link_len + REDUCE_LINKS > MAX_LINKS) return false;
+  NodeId x = node.value.binary.left, c = node.value.binary.right;
+  if (node.tag == NODE_MUL && p->node_arr[x].tag == NODE_CONSTANT) {
+    x = node.value.binary.right;
+    c = node.value.binary.left;
+  }
+  if (p->node_arr[c].tag != NODE_CONSTANT || p->node_arr[x].tag == NODE_CONSTANT) return false;
+  int64_t value = p->node_arr[c].value.i64;
+  NodeId reduced = node.tag == NODE_MUL ?
+    Parser_reduce_mul(p, x, value, node.loop) : Parser_reduce_div(p, x, value, node.loop);
+  if (!reduced) return false;
+  Parser_replace_node(p, id, reduced);
+  return true;
+}
+
+// Returns how many nodes were replaced
+uint16_t Parser_reduce_strength(Parser *p) {
+  Profile_push(PHASE_STRENGTH);
+  uint16_t count = 0;
+  NodeId node_len = p->node_len;
+  for (NodeId id = START_NODE; id < node_len; ++id) count += Parser_reduce_node(p, id);
+  Profile_pop();
+  return count;
+}
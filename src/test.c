@@ -1,45 +1,542 @@
+// Compiles every case of a directory in one process, on one
+// context whose tokens and parser are reused. A case is a .son
+// file whose leading comments say what it has to do:
+//
+//   // result: 12       what it returns when run
+//   // nodes: 9         most live nodes, all its graphs together
+//   // arg: 5           what `arg` reads when it's run, 0 without
+//   // threaded: 1      fewest ifs jump threading has to thread
+//   // error: Expected  a diagnostic with that text, can repeat.
+//                       Cases with errors aren't run
+//
+// Each case is compiled a number of times and the fastest counts.
+// Given a baseline, which is an earlier output of this, cases that
+// compile much slower than they did there fail as well.
+//
+// Then what strength reduction makes of `x * c` and `x / c` is
+// computed for many x and c, and has to agree with the folder.
+// Then the graphs of every case are optimized inside checkpoints
+// that are rolled back, and have to come out as they went in.
+// Last, every case is edited as an incremental document, at the
+// start, the middle and the end, with a statement and with a
+// syntax error. Each edit has to leave what compiling the edited
+// source from scratch does, the same diagnostics and graphs.
+//
+// usage: test [dir] [runs] [baseline]
 #include <assert.h>
+#include <dirent.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
-#include "common.c"
-#include "parser.h"
-#include "tokenizer.c"
-#include "parser.c"
-#include "tokenizer.h"
+#include "son.c"
+
+#define DEFAULT_DIR "tests"
+#define DEFAULT_RUNS 20
+#define CASE_FUEL 10000000
+#define MAX_CASES 1024
+#define MAX_CASE_ERRORS 8
+// Slower than the baseline by this much and by more than the
+// slack, compiles of small cases are a few microseconds
+#define REGRESSION_RATIO 1.5
+#define REGRESSION_SLACK_US 5.0
+#define STRENGTH_RANDOM 200
+
+typedef struct {
+  uint32_t start;
+  uint16_t len;
+} Span;
+
+typedef struct {
+  char name[64];
+  SourceFile file;
+  bool has_result;
+  int64_t result;
+  int64_t arg;
+  bool has_nodes;
+  uint32_t nodes;
+  uint32_t threaded;
+  // In the source
+  Span error_arr[MAX_CASE_ERRORS];
+  uint16_t error_len;
+} Case;
+
+double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+bool contains(const char *text, uint32_t len, const char *part, uint32_t part_len) {
+  for (uint32_t i = 0; i + part_len <= len; ++i) {
+    if (!memcmp(&text[i], part, part_len)) return true;
+  }
+  return false;
+}
+
+// Expectations of the comments before the first other line
+bool Case_parse(Case *c) {
+  const char *src = c->file.ptr;
+  uint32_t pos = 0, len = c->file.len;
+  while (pos + 2 <= len && src[pos] == '/' && src[pos + 1] == '/') {
+    uint32_t end = pos;
+    while (end < len && src[end] != '\n') end++;
+    pos += 2;
+    while (pos < end && src[pos] == ' ') pos++;
+    const char *line = &src[pos];
+    uint32_t line_len = end - pos;
+    if (line_len > CSTR_LEN("result:") && !strncmp(line, "result:", CSTR_LEN("result:"))) {
+      c->has_result = true;
+      c->result = strtoll(&line[CSTR_LEN("result:")], NULL, 10);
+    } else if (line_len > CSTR_LEN("arg:") && !strncmp(line, "arg:", CSTR_LEN("arg:"))) {
+      c->arg = strtoll(&line[CSTR_LEN("arg:")], NULL, 10);
+    } else if (line_len > CSTR_LEN("nodes:") && !strncmp(line, "nodes:", CSTR_LEN("nodes:"))) {
+      c->has_nodes = true;
+      c->nodes = strtoul(&line[CSTR_LEN("nodes:")], NULL, 10);
+    } else if (line_len > CSTR_LEN("threaded:") && !strncmp(line, "threaded:", CSTR_LEN("threaded:"))) {
+      c->threaded = strtoul(&line[CSTR_LEN("threaded:")], NULL, 10);
+    } else if (line_len > CSTR_LEN("error: ") && !strncmp(line, "error: ", CSTR_LEN("error: "))) {
+      if (c->error_len == MAX_CASE_ERRORS) return false;
+      uint32_t start = pos + CSTR_LEN("error: ");
+      c->error_arr[c->error_len++] = (Span){ start, end - start };
+    }
+    pos = end + 1;
+  }
+  return c->has_result || c->has_nodes || c->error_len;
+}
+
+int compare_case(const void *a, const void *b) {
+  return strcmp(((const Case *)a)->name, ((const Case *)b)->name);
+}
+
+// Sorted by name
+uint32_t load_cases(const char *dir_name, Case *case_arr) {
+  DIR *dir = opendir(dir_name);
+  if (!dir) {
+    print_error_message("Failed to open " ANSI_BLUE "%s" ANSI_RESET ": %s", dir_name, strerror(errno));
+    exit(1);
+  }
+  uint32_t len = 0;
+  char path[512];
+  for (struct dirent *entry; (entry = readdir(dir));) {
+    size_t name_len = strlen(entry->d_name);
+    if (name_len < 5 || strcmp(&entry->d_name[name_len - 4], ".son")) continue;
+    if (len == MAX_CASES || name_len - 4 >= sizeof(case_arr->name)) {
+      print_error_message("Too many cases, or a name too long: %s", entry->d_name);
+      exit(1);
+    }
+    Case *c = &case_arr[len];
+    *c = (Case){0};
+    memcpy(c->name, entry->d_name, name_len - 4);
+    snprintf(path, sizeof(path), "%s/%s", dir_name, entry->d_name);
+    if (!load_source(path, &c->file)) {
+      print_error_message("Failed to read " ANSI_BLUE "%s" ANSI_RESET ": %s", path, strerror(errno));
+      exit(1);
+    }
+    if (!Case_parse(c)) {
+      print_error_message("%s expects nothing, or more than %d errors", path, MAX_CASE_ERRORS);
+      exit(1);
+    }
+    len++;
+  }
+  closedir(dir);
+  qsort(case_arr, len, sizeof(Case), compare_case);
+  return len;
+}
+
+// Rows of an earlier run, the header doesn't parse
+typedef struct {
+  char name[64];
+  double us;
+} BaselineRow;
+
+uint32_t read_baseline(const char *filename, BaselineRow *row_arr, uint32_t cap) {
+  FILE *fp = fopen(filename, "r");
+  if (!fp) {
+    print_error_message("Failed to open baseline %s", filename);
+    exit(1);
+  }
+  char line[256];
+  uint32_t len = 0;
+  while (len < cap && fgets(line, sizeof(line), fp)) {
+    if (sscanf(line, "%63s %lf", row_arr[len].name, &row_arr[len].us) == 2) len++;
+  }
+  fclose(fp);
+  return len;
+}
+
+uint32_t threaded_ifs(const Parser *p) {
+  uint32_t count = p->threaded;
+  for (uint16_t i = 0; i < p->function_len; ++i) count += threaded_ifs(p->function_arr[i].graph);
+  return count;
+}
+
+// What went wrong goes to stderr, returns false if anything did
+bool check_case(SonContext *ctx, Eval *e, const Case *c, uint32_t nodes) {
+  const Diagnostics *diag = &ctx->diag;
+  const char *src = c->file.ptr;
+  bool ok = true;
+  // Pops skipped by an error, or missing
+  if (Profile_depth()) {
+    fprintf(stderr, "%s: %u profiler phases left open\n", c->name, Profile_depth());
+    Profile_unwind(0);
+    ok = false;
+  }
+  for (uint16_t i = 0; i < c->error_len; ++i) {
+    Span want = c->error_arr[i];
+    bool found = false;
+    for (uint16_t j = 0; j < diag->diag_len && !found; ++j) {
+      Diagnostic d = diag->diag_arr[j];
+      found = contains(&diag->text[d.msg_start], d.msg_len, &src[want.start], want.len);
+    }
+    if (found) continue;
+    fprintf(stderr, "%s: no error with `%.*s`\n", c->name, want.len, &src[want.start]);
+    ok = false;
+  }
+  if (!c->error_len && diag->error_count) {
+    Diagnostic d = diag->diag_arr[0];
+    fprintf(stderr, "%s: unexpected error `%.*s`\n", c->name, d.msg_len, &diag->text[d.msg_start]);
+    return false;
+  }
+  if (c->error_len && !diag->error_count) {
+    fprintf(stderr, "%s: compiled without errors\n", c->name);
+    ok = false;
+  }
+  if (c->has_nodes && nodes > c->nodes) {
+    fprintf(stderr, "%s: %u nodes, at most %u expected\n", c->name, nodes, c->nodes);
+    ok = false;
+  } else if (c->has_nodes && nodes < c->nodes) {
+    fprintf(stderr, "%s: down to %u nodes from %u, lower the expectation\n", c->name, nodes, c->nodes);
+  }
+  uint32_t threaded = threaded_ifs(&ctx->parser);
+  if (threaded < c->threaded) {
+    fprintf(stderr, "%s: %u ifs threaded, %u expected\n", c->name, threaded, c->threaded);
+    ok = false;
+  }
+  if (!c->has_result || diag->error_count) return ok;
+  int64_t result = 0;
+  EvalStatus status = Parser_eval(&ctx->parser, e, CASE_FUEL, c->arg, &result);
+  if (status != EVAL_OK) {
+    fprintf(stderr, "%s: failed to run, status %d\n", c->name, status);
+    return false;
+  }
+  if (result != c->result) {
+    fprintf(stderr, "%s: returned %lld, expected %lld\n", c->name, (long long)result, (long long)c->result);
+    return false;
+  }
+  return ok;
+}
+
+uint64_t rng_state = 0x9e3779b97f4a7c15;
+
+int64_t rng(void) {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return (int64_t)rng_state;
+}
+
+// Small ones, powers of two and their neighbours, the
+// ends of the range and random ones, of both signs
+uint32_t interesting_values(int64_t *value_arr) {
+  uint32_t len = 0;
+  for (int64_t i = -130; i <= 130; ++i) value_arr[len++] = i;
+  for (int k = 1; k < 64; ++k) {
+    uint64_t power = (uint64_t)1 << k;
+    value_arr[len++] = (int64_t)power;
+    value_arr[len++] = (int64_t)(power - 1);
+    value_arr[len++] = (int64_t)(power + 1);
+    value_arr[len++] = (int64_t)(0 - power);
+    value_arr[len++] = (int64_t)(1 - power);
+    value_arr[len++] = (int64_t)(0 - power - 1);
+  }
+  value_arr[len++] = INT64_MAX;
+  for (int i = 0; i < STRENGTH_RANDOM; ++i) {
+    value_arr[len++] = rng();
+    // A few digits or so
+    value_arr[len++] = rng() % 100000;
+  }
+  return len;
+}
+
+// Value of the reduced expression with `x` standing for `x_value`
+int64_t fold_reduced(const Parser *p, NodeId id, NodeId x, int64_t x_value) {
+  Node node = p->node_arr[id];
+  if (id == x) return x_value;
+  if (node.tag == NODE_CONSTANT) return node.value.i64;
+  int64_t l = fold_reduced(p, node.value.binary.left, x, x_value);
+  if (node.tag == NODE_MINUS) return (int64_t)(0 - (uint64_t)l);
+  int64_t r = fold_reduced(p, node.value.binary.right, x, x_value), value;
+  bool folded = Parser_fold_value(node.tag, l, r, &value);
+  assert(folded);
+  return value;
+}
+
+// Returns how many results differ
+uint32_t check_strength(Parser *p) {
+  int64_t *value_arr = malloc(2048 * sizeof(int64_t));
+  assert(value_arr);
+  uint32_t value_len = interesting_values(value_arr);
+  uint32_t checked = 0, differ = 0, reduced = 0;
+  const NodeTag OPS[] = { NODE_MUL, NODE_DIV };
+  for (int o = 0; o < 2; ++o) {
+    for (uint32_t i = 0; i < value_len; ++i) {
+      int64_t c = value_arr[i];
+      if (OPS[o] == NODE_DIV && !c) continue;
+      // A parameter is as unknown as it gets, the minus keeps the result alive
+      Parser_init(p, "", NULL, NULL);
+      NodeId x = Parser_create_proj_node(p, START_NODE, 1);
+      NodeId node = Parser_create_binary_node(p, OPS[o], x, Parser_create_constant(p, c));
+      NodeId user = Parser_create_unary_node(p, NODE_MINUS, node);
+      reduced += Parser_reduce_node(p, node);
+      node = p->node_arr[user].value.unary.node;
+      for (uint32_t j = 0; j < value_len; ++j) {
+        int64_t want, got = fold_reduced(p, node, x, value_arr[j]);
+        Parser_fold_value(OPS[o], value_arr[j], c, &want);
+        checked++;
+        if (got == want) continue;
+        if (differ++ < 10) fprintf(stderr, "%lld %s %lld is %lld, reduced %lld\n", (long long)value_arr[j],
+          OPS[o] == NODE_MUL ? "*" : "/", (long long)c, (long long)want, (long long)got);
+      }
+    }
+  }
+  printf("strength reduction: %u of %u constants reduced, %u results, %u differ\n",
+    reduced, 2 * value_len - 1, checked, differ);
+  free(value_arr);
+  return differ;
+}
+
+// The graph a rollback has to leave, slot for slot
+typedef struct {
+  uint16_t node_len;
+  uint16_t link_len;
+  uint16_t arg_len;
+  Node node_arr[MAX_NODES];
+  Link link_arr[MAX_LINKS];
+  NodeId arg_arr[MAX_ARGS];
+} GraphCopy;
+
+void copy_graph(const Parser *p, GraphCopy *g) {
+  g->node_len = p->node_len;
+  g->link_len = p->link_len;
+  g->arg_len = p->arg_len;
+  memcpy(g->node_arr, p->node_arr, p->node_len * sizeof(Node));
+  memcpy(g->link_arr, p->link_arr, p->link_len * sizeof(Link));
+  memcpy(g->arg_arr, p->arg_arr, p->arg_len * sizeof(NodeId));
+}
+
+bool same_graph(const Parser *p, const GraphCopy *g) {
+  if (p->node_len != g->node_len || p->link_len != g->link_len || p->arg_len != g->arg_len) return false;
+  for (NodeId i = 0; i < p->node_len; ++i) {
+    Node a = p->node_arr[i], b = g->node_arr[i];
+    if (a.tag != b.tag || a.outputs != b.outputs || a.type != b.type || a.loop != b.loop ||
+        memcmp(&a.value, &b.value, sizeof(NodeValue))) return false;
+  }
+  return !memcmp(p->link_arr, g->link_arr, p->link_len * sizeof(Link)) &&
+    !memcmp(p->arg_arr, g->arg_arr, p->arg_len * sizeof(NodeId));
+}
+
+// Inlined into and optimized, as Parser_optimize_all does
+void optimize_graph(Parser *graph) {
+  graph->inlined = Parser_inline_calls(graph);
+  Parser_optimize(graph);
+}
+
+// Compiled with no pass but dead code elimination. Every graph is
+// inlined into inside one checkpoint and optimized inside another,
+// both rolled back. Then it's done again and committed, the result
+// has to be the same. Returns false if anything differed
+bool check_undo(SonContext *ctx, Eval *e, const Case *c, GraphCopy *copy_arr) {
+  uint32_t inline_budget = INLINE_BUDGET, select_budget = SELECT_BUDGET;
+  bool hoist = HOIST_INVARIANTS, narrow = NARROW_RANGES, thread = THREAD_JUMPS, reduce = REDUCE_STRENGTH;
+  INLINE_BUDGET = SELECT_BUDGET = 0;
+  HOIST_INVARIANTS = NARROW_RANGES = THREAD_JUMPS = REDUCE_STRENGTH = false;
+  son_compile(ctx, c->file.ptr, c->file.len);
+  INLINE_BUDGET = inline_budget;
+  SELECT_BUDGET = select_budget;
+  HOIST_INVARIANTS = hoist;
+  NARROW_RANGES = narrow;
+  THREAD_JUMPS = thread;
+  REDUCE_STRENGTH = reduce;
+
+  Parser *p = &ctx->parser;
+  for (uint16_t i = 0; i <= p->function_len; ++i) {
+    Parser *graph = i < p->function_len ? p->function_arr[i].graph : p;
+    copy_graph(graph, &copy_arr[0]);
+    UndoMark outer = Parser_checkpoint(graph);
+    graph->inlined = Parser_inline_calls(graph);
+    copy_graph(graph, &copy_arr[1]);
+    UndoMark inner = Parser_checkpoint(graph);
+    Parser_optimize(graph);
+    Parser_rollback(graph, inner);
+    bool same = same_graph(graph, &copy_arr[1]);
+    Parser_rollback(graph, outer);
+    if (same && same_graph(graph, &copy_arr[0]) && !graph->undo) continue;
+    fprintf(stderr, "%s: graph %u isn't the same after a rollback\n", c->name, i);
+    return false;
+  }
+  for (uint16_t i = 0; i <= p->function_len; ++i) {
+    Parser *graph = i < p->function_len ? p->function_arr[i].graph : p;
+    UndoMark mark = Parser_checkpoint(graph);
+    optimize_graph(graph);
+    Parser_commit(graph, mark);
+  }
+  int64_t result = 0;
+  if (!c->has_result || (Parser_eval(p, e, CASE_FUEL, c->arg, &result) == EVAL_OK && result == c->result)) return true;
+  fprintf(stderr, "%s: returned %lld after a commit, expected %lld\n", c->name,
+    (long long)result, (long long)c->result);
+  return false;
+}
+
+// Lexer and parser diagnostics of a document after each other,
+// as one compile has them
+bool same_diagnostics(const Diagnostics *a, const Diagnostics *b_lex, const Diagnostics *b) {
+  if (a->error_count != b_lex->error_count + b->error_count) return false;
+  if (a->diag_len != b_lex->diag_len + b->diag_len) return false;
+  for (uint16_t i = 0; i < a->diag_len; ++i) {
+    const Diagnostics *d = i < b_lex->diag_len ? b_lex : b;
+    Diagnostic x = a->diag_arr[i], y = d->diag_arr[i < b_lex->diag_len ? i : i - b_lex->diag_len];
+    if (x.start != y.start || x.len != y.len || x.msg_len != y.msg_len ||
+        memcmp(&a->text[x.msg_start], &d->text[y.msg_start], x.msg_len)) return false;
+  }
+  return true;
+}
+
+// What an edit leaves has to be what compiling the edited source
+// from scratch gives, graphs slot for slot. `expected` is the
+// edited source, `ctx` gets compiled with it
+bool same_as_compile(SonContext *ctx, SonDocument *doc, const char *expected, uint32_t len, GraphCopy *copy) {
+  uint32_t doc_len;
+  const char *doc_source = son_document_source(doc, &doc_len);
+  if (doc_len != len || memcmp(doc_source, expected, len)) return false;
+  son_compile(ctx, expected, len);
+  if (!same_diagnostics(&ctx->diag, &doc->lex_diag, &doc->diag)) return false;
+  const Parser *p = SonGraph_parser(son_document_graph(doc));
+  if (p->function_len != ctx->parser.function_len) return false;
+  for (uint16_t i = 0; i <= p->function_len; ++i) {
+    copy_graph(i < p->function_len ? ctx->parser.function_arr[i].graph : &ctx->parser, copy);
+    if (!same_graph(i < p->function_len ? p->function_arr[i].graph : p, copy)) return false;
+  }
+  return true;
+}
+
+// A statement, and a syntax error to recover from
+const char *const EDIT_INSERTS[] = { "int edit_q = 7;\n", " = ;" };
+// Statements before the case, so the document has checkpoints
+// on both sides of the edits
+#define EDIT_PADDING 64
+
+// Every case as a document, edited at the start, in the padding,
+// in the middle of the case and at the end: text taken out to get
+// the source, then put in again. Returns false if any edit differs
+// from a fresh compile
+bool check_incremental(SonContext *ctx, const Case *c, GraphCopy *copy) {
+  char *src;
+  size_t len;
+  FILE *fp = open_memstream(&src, &len);
+  assert(fp);
+  for (uint32_t i = 0; i < EDIT_PADDING; ++i) fprintf(fp, "int pad_%u = %u;\n", i, i);
+  uint32_t case_start = ftell(fp);
+  fwrite(c->file.ptr, 1, c->file.len, fp);
+  fclose(fp);
+
+  SonDocument *doc = son_document_new();
+  char *edited = malloc(len + 64);
+  assert(doc && edited);
+  son_document_set_output(doc, ctx->out);
+  bool ok = true;
+  const uint32_t AT[] = { 0, case_start / 2, case_start + c->file.len / 2, len };
+  for (uint32_t i = 0; i < sizeof(AT) / sizeof(*AT) && ok; ++i) {
+    for (uint32_t j = 0; j < sizeof(EDIT_INSERTS) / sizeof(*EDIT_INSERTS) && ok; ++j) {
+      uint32_t at = AT[i], insert_len = strlen(EDIT_INSERTS[j]);
+      memcpy(edited, src, at);
+      memcpy(&edited[at], EDIT_INSERTS[j], insert_len);
+      memcpy(&edited[at + insert_len], &src[at], len - at);
+      son_document_set(doc, edited, len + insert_len);
+      son_document_edit(doc, at, insert_len, NULL, 0);
+      ok = same_as_compile(ctx, doc, src, len, copy);
+      if (!ok) {
+        fprintf(stderr, "%s: taking out `%s` at %u differs from a compile\n", c->name, EDIT_INSERTS[j], at);
+        break;
+      }
+      son_document_edit(doc, at, 0, EDIT_INSERTS[j], insert_len);
+      ok = same_as_compile(ctx, doc, edited, len + insert_len, copy);
+      if (!ok) fprintf(stderr, "%s: putting in `%s` at %u differs from a compile\n", c->name, EDIT_INSERTS[j], at);
+    }
+  }
+  free(edited);
+  free(src);
+  son_document_free(doc);
+  return ok;
+}
 
 int main(int argc, char *argv[]) {
-  const char *source = "return 12;";
-  Token *tokens = malloc(sizeof(*tokens) * MAX_TOKENS);
-  tokenize(source, tokens);
-  Parser *p = malloc(sizeof(*p));
-  NodeId ret = parse(source, tokens, p);
-
-  assert(p->node_arr[ret].tag == NODE_RETURN);
-  assert(p->node_arr[ret].value.ret.predecessor == START_NODE);
-  NodeId value = p->node_arr[ret].value.ret.value;
-  assert(p->node_arr[value].tag = NODE_CONSTANT);
-  assert(p->node_arr[value].value.i64 == 12);
-
-  fprintf(stderr, "Tests finished succesfully\n");
-
-  source = "return 3 + 3 * 3;";
-  tokenize(source, tokens);
-  ret = parse(source, tokens, p);
-
-  assert(p->node_arr[ret].tag == NODE_RETURN);
-  assert(p->node_arr[ret].value.ret.predecessor == START_NODE);
-  value = p->node_arr[ret].value.ret.value;
-  assert(p->node_arr[value].tag = NODE_CONSTANT);
-  assert(p->node_arr[value].value.i64 == 12);
-
-  source = "return 3 * 3 + 3;";
-  tokenize(source, tokens);
-  ret = parse(source, tokens, p);
-
-  assert(p->node_arr[ret].tag == NODE_RETURN);
-  assert(p->node_arr[ret].value.ret.predecessor == START_NODE);
-  value = p->node_arr[ret].value.ret.value;
-  assert(p->node_arr[value].tag = NODE_CONSTANT);
-  assert(p->node_arr[value].value.i64 == 12);
+  const char *dir = argc > 1 ? argv[1] : DEFAULT_DIR;
+  int runs = argc > 2 ? atoi(argv[2]) : DEFAULT_RUNS;
+  const char *baseline = argc > 3 ? argv[3] : NULL;
+  if (runs < 1) runs = 1;
+
+  Case *case_arr = malloc(MAX_CASES * sizeof(Case));
+  BaselineRow *base_arr = malloc(MAX_CASES * sizeof(BaselineRow));
+  SonContext *ctx = son_context_new();
+  Eval *e = malloc(sizeof(*e));
+  // The debug builtins would drown the table
+  FILE *null = fopen("/dev/null", "w");
+  assert(case_arr && base_arr && ctx && e && null);
+  son_context_set_output(ctx, null);
+  uint32_t case_len = load_cases(dir, case_arr);
+  uint32_t base_len = baseline ? read_baseline(baseline, base_arr, MAX_CASES) : 0;
+
+  printf("%-32s %10s %8s", "case", "us", "nodes");
+  if (baseline) printf(" %10s %8s", "baseline", "change");
+  printf("\n");
+  uint32_t failed = 0;
+  for (uint32_t i = 0; i < case_len; ++i) {
+    const Case *c = &case_arr[i];
+    double best = 1e18;
+    for (int j = 0; j < runs; ++j) {
+      double start = now_ns();
+      son_compile(ctx, c->file.ptr, c->file.len);
+      best = MIN(best, now_ns() - start);
+    }
+    double us = best / 1e3;
+    uint32_t nodes = son_graph_node_count(son_graph(ctx));
+    bool ok = check_case(ctx, e, c, nodes);
+    printf("%-32s %10.2f %8u", c->name, us, nodes);
+    for (uint32_t j = 0; j < base_len; ++j) {
+      if (strcmp(base_arr[j].name, c->name)) continue;
+      double base = base_arr[j].us;
+      bool regressed = us > base * REGRESSION_RATIO && us - base > REGRESSION_SLACK_US;
+      printf(" %10.2f %+7.1f%%%s", base, (us / base - 1) * 100, regressed ? " slower" : "");
+      ok &= !regressed;
+      break;
+    }
+    printf("%s\n", ok ? "" : " FAILED");
+    failed += !ok;
+  }
+  printf("%u cases, %u failed\n", case_len, failed);
+  uint32_t differ = check_strength(&ctx->parser);
+  GraphCopy *copy_arr = malloc(2 * sizeof(GraphCopy));
+  assert(copy_arr);
+  uint32_t undone = 0, undo_failed = 0;
+  for (uint32_t i = 0; i < case_len; ++i) {
+    if (case_arr[i].error_len) continue;
+    undone++;
+    undo_failed += !check_undo(ctx, e, &case_arr[i], copy_arr);
+  }
+  printf("undo: %u cases rolled back, %u differ\n", undone, undo_failed);
+  uint32_t edit_failed = 0;
+  for (uint32_t i = 0; i < case_len; ++i) edit_failed += !check_incremental(ctx, &case_arr[i], copy_arr);
+  printf("incremental: %u cases edited, %u differ from a compile\n", case_len, edit_failed);
+  free(copy_arr);
+
+  for (uint32_t i = 0; i < case_len; ++i) unload_source(&case_arr[i].file);
+  free(case_arr);
+  free(base_arr);
+  free(e);
+  son_context_free(ctx);
+  fclose(null);
+  return failed || differ || undo_failed || edit_failed ? 1 : 0;
 }
@@ -1,12 +1,48 @@
 #include "tokenizer.h"
 #include "common.h"
+#include "profile.h"
 #include <assert.h>
 #include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
 
-TokenTag TOK_LOOKUP[256] = {
+// NOTE: using array intilizers, to not update them
+// when we change the order
+const char *const TOK_NAMES[TOK_COUNT] = {
+  [TOK_NONE] = "<none>",
+  [TOK_IDENT] = "<identfier>",
+  [TOK_RETURN] = "return",
+  [TOK_DECIMAL] = "<decimal>",
+  [TOK_SEMICOLON] = ";",
+  [TOK_COMMA] = ",",
+  [TOK_PLUS] = "+",
+  [TOK_MINUS] = "-",
+  [TOK_STAR] = "*",
+  [TOK_SLASH] = "/",
+  [TOK_LBRACE] = "{",
+  [TOK_RBRACE] = "}",
+  [TOK_INT] = "int",
+  [TOK_EQ] = "=",
+  [TOK_LPAREN] = "(",
+  [TOK_RPAREN] = ")",
+  [TOK_BANG] = "!",
+  [TOK_LT] = "<",
+  [TOK_GT] = ">",
+  [TOK_DEQ] = "==",
+  [TOK_NE] = "!=",
+  [TOK_GE] = ">=",
+  [TOK_LE] = "<=",
+  [TOK_TRUE] = "true",
+  [TOK_FALSE] = "false",
+  [TOK_IF] = "if",
+  [TOK_ELSE] = "else",
+  [TOK_WHILE] = "while",
+  [TOK_ARG] = "arg",
+};
+
+const TokenTag TOK_LOOKUP[256] = {
   [';'] = TOK_SEMICOLON,
+  [','] = TOK_COMMA,
   ['+'] = TOK_PLUS,
   ['-'] = TOK_MINUS,
   ['*'] = TOK_STAR,
@@ -26,72 +62,74 @@ typedef struct {
   TokenTag tag;
 } TokenOpt;
 
-TokenOpt TOK_SECOND_CHAR[TOK_TWO_CHAR_COUNT] = {
+const TokenOpt TOK_SECOND_CHAR[TOK_TWO_CHAR_COUNT] = {
   [TOK_EQ] = { '=', TOK_DEQ },
   [TOK_BANG] = { '=', TOK_NE },
   [TOK_LT] = { '=', TOK_LE },
   [TOK_GT] = { '=', TOK_GE },
 };
 
-Str KEYWORDS[KEYWORDS_COUNT] = {
+const Str KEYWORDS[KEYWORDS_COUNT] = {
   [TOK_RETURN - KEYWORDS_START] = STR("return"),
   [TOK_INT - KEYWORDS_START] = STR("int"),
   [TOK_TRUE - KEYWORDS_START] = STR("true"),
   [TOK_FALSE - KEYWORDS_START] = STR("false"),
   [TOK_IF - KEYWORDS_START] = STR("if"),
   [TOK_ELSE - KEYWORDS_START] = STR("else"),
+  [TOK_WHILE - KEYWORDS_START] = STR("while"),
+  [TOK_ARG - KEYWORDS_START] = STR("arg"),
 };
 
 #define IS_NUMERIC(ch) ((ch) >= '0' && (ch) <= '9')
 #define IS_ALPHA(ch) \
     (((ch) >= 'a' && (ch) <= 'z') || ((ch) >= 'A' && (ch) <= 'Z'))
 
-void tokenize(const char *source, Token token_arr[MAX_TOKENS]) {
-  const char *ch = source;
-  int tokens_len = 0;
+// Lexes the next token starting at `*offset`, skipping whitespace,
+// comments and bad bytes. Returns false at the end of the source.
+// The source doesn't have to be NUL terminated, we never look past `len`
+bool lex_token(const char *source, uint32_t len, uint32_t *offset, Token *tok, Diagnostics *diag) {
+  const char *ch = source + *offset;
+  const char *end = source + len;
 
-  // for every token
-  while (*ch) {
+  while (ch < end) {
     // Skip whitespaces
-    while (*ch == ' ' || *ch == '\n' || *ch == '\t') ch++;
-    if (!*ch) break;
+    while (ch < end && (*ch == ' ' || *ch == '\n' || *ch == '\t')) ch++;
+    if (ch == end) break;
 
-    if (*ch == '/' && ch[1] == '/') {
+    if (*ch == '/' && ch + 1 < end && ch[1] == '/') {
       ch += 2;
-      while (*ch != '\n' && *ch != 0) ch++;
+      while (ch < end && *ch != '\n') ch++;
       continue;
     }
 
     TokenTag tt = TOK_LOOKUP[(uint8_t)*ch];
     if (tt && tt < TOK_TWO_CHAR_COUNT) {
       assert(TOK_SECOND_CHAR[tt].tag);
-      if (ch[1] == TOK_SECOND_CHAR[tt].ch) {
-        assert(tokens_len < MAX_TOKENS);
+      if (ch + 1 < end && ch[1] == TOK_SECOND_CHAR[tt].ch) {
         tt = TOK_SECOND_CHAR[tt].tag;
-        token_arr[tokens_len++] = (Token){ tt, 2, ch - source };
-        ch += 2;
-        continue;
+        *tok = (Token){ tt, 2, ch - source };
+        *offset = ch + 2 - source;
+        return true;
       }
     }
 
     if (tt) {
-      assert(tokens_len < MAX_TOKENS);
-      token_arr[tokens_len++] = (Token){ tt, 1, ch - source };
-      ch++;
-      continue;
+      *tok = (Token){ tt, 1, ch - source };
+      *offset = ch + 1 - source;
+      return true;
     }
 
     if (IS_NUMERIC(*ch)) {
       const char *start = ch++;
-      while (IS_NUMERIC(*ch)) ch++;
-      assert(tokens_len < MAX_TOKENS);
-      token_arr[tokens_len++] = (Token){ TOK_DECIMAL, ch - start, start - source };
-      continue;
+      while (ch < end && IS_NUMERIC(*ch)) ch++;
+      *tok = (Token){ TOK_DECIMAL, ch - start, start - source };
+      *offset = ch - source;
+      return true;
     }
 
     if (*ch == '_' || IS_ALPHA(*ch)) {
       const char *start = ch++;
-      while (*ch == '_' || IS_ALPHA(*ch) || IS_NUMERIC(*ch)) ch++;
+      while (ch < end && (*ch == '_' || IS_ALPHA(*ch) || IS_NUMERIC(*ch))) ch++;
 
       uint32_t len = ch - start;
       TokenTag tt = TOK_IDENT;
@@ -101,15 +139,40 @@ void tokenize(const char *source, Token token_arr[MAX_TOKENS]) {
         tt = KEYWORDS_START + i;
         break;
       }
-      assert(tokens_len < MAX_TOKENS);
-      token_arr[tokens_len++] = (Token){ tt, len, start - source };
-      continue;
+      *tok = (Token){ tt, len, start - source };
+      *offset = ch - source;
+      return true;
+    }
+    if (*ch >= ' ' && *ch <= '~') {
+      Diagnostics_error(diag, ch - source, 1, "Unkown character: '%c'", *ch);
+    } else {
+      Diagnostics_error(diag, ch - source, 1, "Unkown byte: 0x%02x", (uint8_t)*ch);
+    }
+    ch++;
+  }
+  *offset = len;
+  return false;
+}
+
+void tokenize(const char *source, uint32_t len, Token token_arr[MAX_TOKENS], Diagnostics *diag) {
+  Profile_push(PHASE_TOKENIZE);
+  uint32_t offset = 0;
+  int tokens_len = 0;
+  Token tok;
+
+  // for every token
+  while (lex_token(source, len, &offset, &tok, diag)) {
+    // Keep the last slot for EOF
+    if (tokens_len == MAX_TOKENS - 1) {
+      Diagnostics_error(diag, tok.start, tok.len, "Too many tokens, at most %d fit", MAX_TOKENS - 1);
+      break;
     }
-    print_error(source, ch - source, 1, "Unkown character: '%c'", *ch);
+    token_arr[tokens_len++] = tok;
   }
   // EOF token
   assert(tokens_len < MAX_TOKENS);
-  token_arr[tokens_len++] = (Token){0};
+  token_arr[tokens_len++] = (Token){ .start = offset };
+  Profile_pop();
 }
 
 void print_tokens(const Token *tokens) {
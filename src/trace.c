@@ -0,0 +1,45 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "trace.h"
+
+FILE *Trace_open(const char *filename) {
+  FILE *fp = fopen(filename, "wb");
+  if (!fp) return NULL;
+  uint32_t header[2] = { TRACE_VERSION, sizeof(TraceEvent) };
+  fwrite(TRACE_MAGIC, 1, CSTR_LEN(TRACE_MAGIC), fp);
+  fwrite(header, sizeof(header), 1, fp);
+  return fp;
+}
+
+Trace *Trace_new(FILE *fp, uint16_t graph) {
+  Trace *t = malloc(sizeof(Trace));
+  assert(t);
+  t->fp = fp;
+  t->graph = graph;
+  t->len = 0;
+  return t;
+}
+
+void Trace_push(Trace *t, TraceEvent event) {
+  t->event_arr[t->len++] = event;
+  if (t->len == TRACE_EVENTS) Trace_flush(t);
+}
+
+// Graphs optimized on other threads write to the same
+// file, the chunk header and its events stay together
+void Trace_flush(Trace *t) {
+  if (!t->len) return;
+  TraceChunk chunk = { .graph = t->graph, .len = t->len };
+  flockfile(t->fp);
+  fwrite(&chunk, sizeof(chunk), 1, t->fp);
+  fwrite(t->event_arr, sizeof(TraceEvent), t->len, t->fp);
+  funlockfile(t->fp);
+  t->len = 0;
+}
+
+void Trace_free(Trace *t) {
+  if (!t) return;
+  Trace_flush(t);
+  free(t);
+}
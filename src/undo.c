@@ -0,0 +1,106 @@
+#include "parser.h"
+#include <assert.h>
+#include <stdlib.h>
+
+// Checkpoints let a pass try a transformation and take it back.
+// While one is open, every slot of the graph an edit overwrites
+// is logged as it was, and a rollback writes the log back in
+// reverse and restores the lengths. That costs what the edits
+// since the checkpoint did, not what the graph is. Nodes are
+// logged whole on each write, links only below the lengths
+// of the open checkpoints, past those they're fresh. Nodes
+// made since don't need it either, but node_len can shrink
+// and the slots get reused, so those are logged too.
+// Checkpoints nest. They're for the passes, what the parser
+// keeps on the side (frames, var_len) isn't restored
+#define UNDO_INITIAL_CAP 64
+
+void UndoLog_free(UndoLog *u) {
+  if (!u) return;
+  free(u->entry_arr);
+  free(u);
+}
+
+UndoEntry *Parser_undo_entry(Parser *p, UndoKind kind, uint16_t id) {
+  UndoLog *u = p->undo;
+  if (u->len == u->cap) {
+    u->cap *= 2;
+    u->entry_arr = realloc(u->entry_arr, u->cap * sizeof(UndoEntry));
+    assert(u->entry_arr);
+  }
+  UndoEntry *e = &u->entry_arr[u->len++];
+  e->kind = kind;
+  e->id = id;
+  return e;
+}
+
+// Callers check for a log, like they do for a trace
+void Parser_save_node(Parser *p, NodeId id) {
+  Parser_undo_entry(p, UNDO_NODE, id)->old.node = p->node_arr[id];
+}
+
+void Parser_save_link(Parser *p, LinkId id) {
+  if (id >= p->undo->link_floor) return;
+  Parser_undo_entry(p, UNDO_LINK, id)->old.link = p->link_arr[id];
+}
+
+void Parser_save_arg(Parser *p, uint16_t index) {
+  Parser_undo_entry(p, UNDO_ARG, index)->old.arg = p->arg_arr[index];
+}
+
+void Parser_save_var(Parser *p, VarId id) {
+  Parser_undo_entry(p, UNDO_VAR, id)->old.var = p->var_arr[id];
+}
+
+UndoMark Parser_checkpoint(Parser *p) {
+  if (!p->undo) {
+    p->undo = malloc(sizeof(UndoLog));
+    assert(p->undo);
+    *p->undo = (UndoLog){ .entry_arr = malloc(UNDO_INITIAL_CAP * sizeof(UndoEntry)), .cap = UNDO_INITIAL_CAP };
+    assert(p->undo->entry_arr);
+  }
+  UndoLog *u = p->undo;
+  UndoMark mark = { u->len, p->node_len, p->link_len, p->arg_len, u->link_floor };
+  u->link_floor = MAX(u->link_floor, p->link_len);
+  u->depth++;
+  if (p->trace) Parser_trace(p, TRACE_CHECKPOINT, 0, 0);
+  return mark;
+}
+
+// Innermost first. The log is kept for the checkpoints
+// around it and freed with the outermost
+void Parser_close_checkpoint(Parser *p, UndoMark mark) {
+  UndoLog *u = p->undo;
+  u->link_floor = mark.link_floor;
+  if (--u->depth) return;
+  UndoLog_free(u);
+  p->undo = NULL;
+}
+
+// Keeps the edits since `mark`
+void Parser_commit(Parser *p, UndoMark mark) {
+  assert(p->undo && p->undo->len >= mark.undo_len);
+  if (p->trace) Parser_trace(p, TRACE_COMMIT, 0, 0);
+  Parser_close_checkpoint(p, mark);
+}
+
+// The graph as it was at `mark`, slot for slot
+void Parser_rollback(Parser *p, UndoMark mark) {
+  UndoLog *u = p->undo;
+  assert(u && u->len >= mark.undo_len);
+  for (uint32_t i = u->len; i > mark.undo_len; --i) {
+    UndoEntry *e = &u->entry_arr[i - 1];
+    switch (e->kind) {
+      case UNDO_NODE: p->node_arr[e->id] = e->old.node; break;
+      case UNDO_LINK: p->link_arr[e->id] = e->old.link; break;
+      case UNDO_ARG: p->arg_arr[e->id] = e->old.arg; break;
+      case UNDO_VAR: p->var_arr[e->id] = e->old.var; break;
+    }
+  }
+  u->len = mark.undo_len;
+  p->node_len = mark.node_len;
+  p->link_len = mark.link_len;
+  p->arg_len = mark.arg_len;
+  if (p->trace) Parser_trace(p, TRACE_ROLLBACK, 0, 0);
+  Parser_close_checkpoint(p, mark);
+}